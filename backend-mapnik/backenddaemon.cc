@@ -0,0 +1,188 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+#include "backenddaemon.h"
+
+#include <ctype.h>
+#include <syslog.h>
+#include <errno.h>
+
+#include "networklistener.h"
+#include "tracer.h"
+
+static const struct
+{
+    const char *name;
+    int facility;
+} facilities[] = {
+    { "daemon", LOG_DAEMON },
+    { "user",   LOG_USER   },
+    { "local0", LOG_LOCAL0 },
+    { "local1", LOG_LOCAL1 },
+    { "local2", LOG_LOCAL2 },
+    { "local3", LOG_LOCAL3 },
+    { "local4", LOG_LOCAL4 },
+    { "local5", LOG_LOCAL5 },
+    { "local6", LOG_LOCAL6 },
+    { "local7", LOG_LOCAL7 },
+    { NULL, 0 }
+};
+
+BackendDaemon::BackendDaemon(int argc, char **argv, const char *ident, const char *statusname) :
+    mArgv(argv),
+    mArgvSize(argc ? argv[argc-1] + strlen(argv[argc-1]) - argv[0] : 0),
+    mStatusName(statusname),
+    mMaxRequests(-1)
+{
+    setStatus("initializing");
+
+    char *tmp = getenv("TIREX_BACKEND_DEBUG");
+    Debuggable::msDebugLogging = tmp ? true : false;
+
+    int fac = LOG_DAEMON;
+    tmp = getenv("TIREX_BACKEND_SYSLOG_FACILITY");
+    if (tmp && *tmp)
+    {
+        int i = 0;
+        while (facilities[i].name && strcmp(facilities[i].name, tmp)) i++;
+        if (!facilities[i].name)
+        {
+            die(2, "Cannot use log facility '%s' - only local0-local7, user, daemon are allowed.", tmp);
+        }
+        fac = facilities[i].facility;
+    }
+    openlog(ident, Debuggable::msDebugLogging ? LOG_PERROR|LOG_PID : LOG_PID, fac);
+    info("Renderer started (name=%s)", getenv("TIREX_BACKEND_NAME"));
+
+    tmp = getenv("TIREX_BACKEND_SOCKET_FILENO");
+    mSocketFd = tmp ? atoi(tmp) : -1;
+
+    tmp = getenv("TIREX_BACKEND_PIPE_FILENO");
+    mParentFd = tmp ? atoi(tmp) : -1;
+
+    tmp = getenv("TIREX_BACKEND_PORT");
+    mPort = tmp ? atoi(tmp) : 9320;
+
+    // memory limits are configured in MB, but checked in kB
+    tmp = getenv("TIREX_BACKEND_CFG_max_rss_mb");
+    mMaxRss = tmp ? atol(tmp) * 1024 : 0;
+    tmp = getenv("TIREX_BACKEND_CFG_max_rss_growth_mb");
+    mMaxGrowth = tmp ? atol(tmp) * 1024 : 0;
+
+    tmp = getenv("TIREX_BACKEND_CFG_trace_file");
+    if (tmp && !Tracer::open(tmp))
+    {
+        warning("cannot open trace file '%s': %s", tmp, strerror(errno));
+    }
+}
+
+BackendDaemon::~BackendDaemon()
+{
+}
+
+/**
+ * Read a map config file and call the handler for every option in it.
+ * Comments, empty lines and lines that can't be parsed are skipped, the
+ * latter and unknown options with a warning. Returns false if the file
+ * can't be opened.
+ */
+bool BackendDaemon::readMapConfig(const char *configfile, OptionHandler handler)
+{
+    FILE *f = fopen(configfile, "r");
+    if (!f)
+    {
+        warning("cannot open '%s'", configfile);
+        return false;
+    }
+
+    char linebuf[255];
+    int lineno = 0;
+
+    while (char *line = fgets(linebuf, sizeof(linebuf), f))
+    {
+        lineno++;
+        while (isspace(*line)) line++;
+        if (*line == '#') continue;
+        if (!*line) continue;
+        char *eq = strchr(line, '=');
+        if (eq)
+        {
+            char *last = eq-1;
+            // trim space before equal sign
+            while (last > line && isspace(*last)) *last-- = 0;
+            *eq++ = 0;
+            // trim space after equal sign
+            while (isspace(*eq)) eq++;
+            // trim space at end of line
+            last = eq + strlen(eq) - 1;
+            while (last > eq && isspace(*last)) *last-- = 0;
+
+            if (!strcmp(line, "minz") || !strcmp(line, "maxz"))
+            {
+                // no error
+            }
+            else if (!handler(line, eq, lineno))
+            {
+                warning("parse error on line %d of config file %s", lineno, configfile);
+            }
+        }
+        else
+        {
+            warning("parse error on line %d of config file %s", lineno, configfile);
+        }
+    }
+    fclose(f);
+
+    return true;
+}
+
+/**
+ * Load the maps from the config files given by the backend manager. Dies
+ * if one of them can't be loaded.
+ */
+void BackendDaemon::loadMapConfigs()
+{
+    char *tmp = getenv("TIREX_BACKEND_MAP_CONFIGS");
+    if (tmp)
+    {
+        char *dup = strdup(tmp);
+        char *tkn = strtok(dup, " ");
+        while (tkn)
+        {
+            if (!loadMapConfig(tkn)) {
+                die(2, "Unable to load map");
+            }
+            tkn = strtok(NULL, " ");
+        }
+        free(dup);
+    }
+
+    if (mHandlerMap.empty())
+        die(2, "Cannot load any maps");
+}
+
+void BackendDaemon::run()
+{
+    NetworkListener listener(mPort, mSocketFd, mParentFd, &mHandlerMap, mMaxRequests, mMaxRss, mMaxGrowth);
+    char *slot = getenv("TIREX_BACKEND_STATUS_SLOT");
+    if (slot) listener.setStatusSlot(atoi(slot), getenv("TIREX_BACKEND_NAME"));
+    setStatus("idle");
+    listener.run();
+}
+
+void BackendDaemon::setStatus(const char *status)
+{
+#ifdef __linux__
+    // the status replaces the command line, it must not write beyond the
+    // arguments into the environment
+    if (!mArgvSize) return;
+    memset(*mArgv, 0, mArgvSize);
+    snprintf(*mArgv, mArgvSize + 1, "%s: %s", mStatusName.c_str(), status);
+#endif
+}
@@ -0,0 +1,69 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+/**
+ * BackendDaemon
+ *
+ * Superclass for the backend daemons (mapnik and synthetic). Reads the
+ * settings the backend manager passes in the environment, opens syslog,
+ * loads the map configs through loadMapConfig() and runs the network
+ * loop. It also shows the status of the daemon in place of its command
+ * line.
+ */
+
+#ifndef backenddaemon_included
+#define backenddaemon_included
+
+#include "requesthandler.h"
+#include "mortal.h"
+#include "debuggable.h"
+#include "statusreceiver.h"
+#include <functional>
+#include <string>
+#include <map>
+
+class BackendDaemon : public Mortal, public Debuggable, public StatusReceiver
+{
+    private:
+
+    char **mArgv;
+    size_t mArgvSize;
+    std::string mStatusName;
+
+    protected:
+
+    /**
+     * Called for every option in a map config file with the name and the
+     * value (trimmed) and the line number. Returns false for unknown
+     * options.
+     */
+    typedef std::function<bool (const char *name, char *value, int lineno)> OptionHandler;
+
+    int mPort;
+    int mSocketFd;
+    int mParentFd;
+    std::map<std::string, RequestHandler *> mHandlerMap;
+    int mMaxRequests;
+    long mMaxRss;
+    long mMaxGrowth;
+
+    BackendDaemon(int argc, char **argv, const char *ident, const char *statusname);
+
+    bool readMapConfig(const char *configfile, OptionHandler handler);
+    void loadMapConfigs();
+    virtual bool loadMapConfig(const char *configfile) = 0;
+    void setStatus(const char *status);
+
+    public:
+
+    virtual ~BackendDaemon();
+    void run();
+};
+
+#endif
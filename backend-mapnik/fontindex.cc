@@ -0,0 +1,264 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+#include "fontindex.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <type_traits>
+#include <utility>
+
+#include <mapnik/version.hpp>
+#include <mapnik/font_engine_freetype.hpp>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+// Mapnik has no interface to add a face without opening the font file, so
+// faces from the index are written into its font mapping directly. That is
+// only done for the versions where the mapping is known to be a plain map
+// that Mapnik reads when creating faces, all others go through
+// freetype_engine::register_font().
+#if MAPNIK_VERSION >= 300000 && MAPNIK_VERSION < 400000
+# define FONTINDEX_REGISTER_FACES 1
+#endif
+
+FontIndex::FontIndex(const std::string &cachefile) :
+    mCacheFile(cachefile),
+    mLibrary(NULL),
+    mChanged(false),
+    mHits(0),
+    mMisses(0),
+    mFaces(0),
+    mSavedTime(0)
+{
+    load();
+}
+
+FontIndex::~FontIndex()
+{
+    if (mLibrary) FT_Done_FreeType(mLibrary);
+}
+
+/**
+ * Read the cache file. The file has one line for each font file:
+ *
+ *   F <size> <mtime> <scan time in us> <path>
+ *
+ * followed by one line for each face in the file:
+ *
+ *   <index> <face name>
+ */
+void FontIndex::load()
+{
+    std::ifstream infile(mCacheFile);
+    if (!infile)
+    {
+        debug("no font index in %s", mCacheFile.c_str());
+        return;
+    }
+
+    std::string line;
+    entry *current = NULL;
+    while (std::getline(infile, line))
+    {
+        unsigned long long size;
+        long long mtime;
+        unsigned long scantime;
+        int index;
+        int pos = 0;
+        if (sscanf(line.c_str(), "F %llu %lld %lu %n", &size, &mtime, &scantime, &pos) == 3 && pos > 0)
+        {
+            entry &e = mEntries[line.substr(pos)];
+            e.size = size;
+            e.mtime = mtime;
+            e.scantime = scantime;
+            e.faces.clear();
+            e.seen = false;
+            current = &e;
+        }
+        else if (current && sscanf(line.c_str(), "%d %n", &index, &pos) == 1 && pos > 0)
+        {
+            current->faces.push_back(face{index, line.substr(pos)});
+        }
+        else
+        {
+            warning("ignoring broken font index %s", mCacheFile.c_str());
+            mEntries.clear();
+            mChanged = true;
+            return;
+        }
+    }
+    debug("read %lu entries from font index %s", mEntries.size(), mCacheFile.c_str());
+}
+
+/**
+ * Write the cache file if anything changed. Entries for files that were
+ * not seen by registerFonts() are dropped.
+ */
+bool FontIndex::save()
+{
+    for (auto itr = mEntries.begin(); itr != mEntries.end(); )
+    {
+        if (itr->second.seen)
+        {
+            ++itr;
+        }
+        else
+        {
+            itr = mEntries.erase(itr);
+            mChanged = true;
+        }
+    }
+
+    if (!mChanged) return true;
+
+    std::string tmpfilename = mCacheFile + "." + std::to_string(getpid()) + ".tmp";
+    std::ofstream outfile(tmpfilename, std::ios::out | std::ios::trunc);
+    for (auto itr = mEntries.begin(); itr != mEntries.end(); ++itr)
+    {
+        outfile << "F " << itr->second.size << " " << static_cast<long long>(itr->second.mtime) << " " << itr->second.scantime << " " << itr->first << "\n";
+        for (auto f = itr->second.faces.begin(); f != itr->second.faces.end(); ++f)
+        {
+            outfile << f->index << " " << f->name << "\n";
+        }
+    }
+    outfile.close();
+
+    if (outfile.fail() || rename(tmpfilename.c_str(), mCacheFile.c_str()))
+    {
+        unlink(tmpfilename.c_str());
+        warning("cannot write font index %s", mCacheFile.c_str());
+        return false;
+    }
+
+    debug("wrote %lu entries to font index %s", mEntries.size(), mCacheFile.c_str());
+    mChanged = false;
+    return true;
+}
+
+/**
+ * Register all fonts in the directory (and its subdirectories if recurse
+ * is set) with Mapnik.
+ */
+bool FontIndex::registerFonts(const boost::filesystem::path &dir, bool recurse)
+{
+    if (!boost::filesystem::exists(dir)) return false;
+    boost::filesystem::directory_iterator end_itr;
+    for (boost::filesystem::directory_iterator itr(dir); itr != end_itr; ++itr)
+    {
+        if (boost::filesystem::is_directory(*itr) && recurse)
+        {
+            if (!registerFonts(*itr, true)) return false;
+        }
+        else
+        {
+#if (BOOST_FILESYSTEM_VERSION == 3)
+            registerFile(itr->path());
+#else // v2
+            registerFile(*itr);
+#endif
+        }
+    }
+    return true;
+}
+
+void FontIndex::registerFile(const boost::filesystem::path &path)
+{
+    std::string filename = path.string();
+
+#ifdef FONTINDEX_REGISTER_FACES
+    if (!mapnik::freetype_engine::is_font_file(filename)) return;
+
+    struct stat st;
+    if (stat(filename.c_str(), &st)) return;
+
+    auto itr = mEntries.find(filename);
+    if (itr != mEntries.end() && itr->second.size == static_cast<uintmax_t>(st.st_size) && itr->second.mtime == st.st_mtime)
+    {
+        mHits++;
+        mSavedTime += itr->second.scantime;
+        itr->second.seen = true;
+        registerFaces(filename, itr->second);
+        return;
+    }
+
+    entry &e = mEntries[filename];
+    e.size = st.st_size;
+    e.mtime = st.st_mtime;
+    e.seen = true;
+    scanFile(filename, e);
+    mChanged = true;
+    mMisses++;
+    if (mapnik::freetype_engine::register_font(filename)) mFaces += e.faces.size();
+#else
+    mMisses++;
+    mapnik::freetype_engine::register_font(filename);
+#endif
+}
+
+/**
+ * Open the font file with FreeType and remember the names of its faces.
+ * They are named the same way Mapnik names them: family and style name
+ * separated by a space, faces without either are skipped.
+ */
+void FontIndex::scanFile(const std::string &filename, entry &e)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    e.faces.clear();
+    if (!mLibrary && FT_Init_FreeType(&mLibrary))
+    {
+        mLibrary = NULL;
+        warning("cannot initialize FreeType");
+        return;
+    }
+
+    FT_Long num_faces = 1;
+    for (FT_Long i = 0; i < num_faces; i++)
+    {
+        FT_Face ftface;
+        if (FT_New_Face(mLibrary, filename.c_str(), i, &ftface))
+        {
+            debug("cannot open font file %s", filename.c_str());
+            break;
+        }
+        num_faces = ftface->num_faces;
+        if (ftface->family_name && ftface->style_name)
+        {
+            e.faces.push_back(face{static_cast<int>(i), std::string(ftface->family_name) + " " + ftface->style_name});
+        }
+        FT_Done_Face(ftface);
+    }
+
+    e.scantime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    debug("scanned font file %s: %lu faces", filename.c_str(), e.faces.size());
+}
+
+void FontIndex::registerFaces(const std::string &filename, const entry &e)
+{
+#ifdef FONTINDEX_REGISTER_FACES
+    static_assert(std::is_same<mapnik::freetype_engine::font_file_mapping_type, std::map<std::string, std::pair<int, std::string>>>::value,
+                  "font mapping of this Mapnik version is not supported by the font index");
+    auto &mapping = const_cast<mapnik::freetype_engine::font_file_mapping_type &>(mapnik::freetype_engine::get_mapping());
+    for (auto f = e.faces.begin(); f != e.faces.end(); ++f)
+    {
+        mapping.emplace(f->name, std::make_pair(f->index, filename));
+        mFaces++;
+    }
+#else
+    (void) filename;
+    (void) e;
+#endif
+}
@@ -0,0 +1,92 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+/**
+ * FontIndex
+ *
+ * Registers the fonts in the font directory with Mapnik. To find out the
+ * names of the faces in a font file Mapnik has to open it, with large font
+ * collections (like the full Noto set) this takes a noticeable time at
+ * every start of a rendering process.
+ *
+ * The font index keeps the face names of every font file together with
+ * the size and modification time of the file in a cache file. Files that
+ * haven't changed are registered from the index without opening them,
+ * new and changed files are scanned and the cache file is rewritten.
+ * Entries for files that are gone are dropped.
+ *
+ * New and changed files are registered through Mapnik. Registering from
+ * the index is only done with Mapnik 3.x, where the font mapping is known
+ * to be a plain map; with other versions all fonts are registered through
+ * Mapnik as before.
+ */
+
+#ifndef fontindex_included
+#define fontindex_included
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <boost/filesystem.hpp>
+
+#include "debuggable.h"
+
+struct FT_LibraryRec_;
+
+class FontIndex : public Debuggable
+{
+    public:
+
+    FontIndex(const std::string &cachefile);
+    ~FontIndex();
+
+    bool registerFonts(const boost::filesystem::path &dir, bool recurse);
+    bool save();
+
+    unsigned long getHits() const { return mHits; }
+    unsigned long getMisses() const { return mMisses; }
+    unsigned long getFaces() const { return mFaces; }
+
+    // time the files found in the index took to scan when they were added (in microseconds)
+    unsigned long getSavedTime() const { return mSavedTime; }
+
+    private:
+
+    struct face {
+        int index;
+        std::string name;
+    };
+
+    struct entry {
+        uintmax_t size;
+        time_t mtime;
+        unsigned long scantime;
+        std::vector<face> faces;
+        bool seen;
+    };
+
+    void load();
+    void registerFile(const boost::filesystem::path &path);
+    void scanFile(const std::string &filename, entry &e);
+    void registerFaces(const std::string &filename, const entry &e);
+
+    std::string mCacheFile;
+    FT_LibraryRec_ *mLibrary;
+    std::map<std::string, entry> mEntries;
+    bool mChanged;
+    unsigned long mHits;
+    unsigned long mMisses;
+    unsigned long mFaces;
+    unsigned long mSavedTime;
+};
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+#include "imagepool.h"
+
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+ImagePool::ImagePool() :
+    mMaxFree(2),
+    mHugePages(false),
+    mHits(0),
+    mAllocations(0)
+{
+}
+
+ImagePool::~ImagePool()
+{
+    for (auto itr = mFree.begin(); itr != mFree.end(); itr++)
+    {
+        for (auto img = itr->second.begin(); img != itr->second.end(); img++)
+        {
+            delete *img;
+        }
+    }
+}
+
+/**
+ * Set the number of free buffers kept per image size and whether
+ * buffers should be backed by transparent huge pages.
+ */
+void ImagePool::configure(unsigned int maxfree, bool hugepages)
+{
+    mMaxFree = maxfree;
+    mHugePages = hugepages;
+}
+
+mapnik::image_32 *ImagePool::acquire(unsigned int width, unsigned int height)
+{
+    std::vector<mapnik::image_32 *>& free = mFree[dimensions(width, height)];
+    if (!free.empty())
+    {
+        mapnik::image_32 *image = free.back();
+        free.pop_back();
+        mHits++;
+        debug("image pool: re-using %ux%u buffer (%lu hits, %lu allocations)", width, height, mHits, mAllocations);
+        return image;
+    }
+
+    mAllocations++;
+    debug("image pool: allocating %ux%u buffer (%lu hits, %lu allocations)", width, height, mHits, mAllocations);
+
+    // no need to have the buffer zeroed, the caller has to clear it anyway
+    // when it comes from the pool.
+    mapnik::image_32 *image = new mapnik::image_32(width, height, false);
+
+#ifdef MADV_HUGEPAGE
+    if (mHugePages)
+    {
+        uintptr_t pagesize = sysconf(_SC_PAGESIZE);
+        uintptr_t begin = reinterpret_cast<uintptr_t>(image->bytes());
+        uintptr_t start = (begin + pagesize - 1) & ~(pagesize - 1);
+        uintptr_t end = (begin + image->size()) & ~(pagesize - 1);
+        if (end > start && madvise(reinterpret_cast<void *>(start), end - start, MADV_HUGEPAGE))
+        {
+            debug("image pool: madvise failed: %s", strerror(errno));
+        }
+    }
+#endif
+
+    return image;
+}
+
+void ImagePool::release(mapnik::image_32 *image)
+{
+    if (!image) return;
+
+    std::vector<mapnik::image_32 *>& free = mFree[dimensions(image->width(), image->height())];
+    if (free.size() < mMaxFree)
+    {
+        image->set_premultiplied(false);
+        free.push_back(image);
+    }
+    else
+    {
+        delete image;
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+/**
+ * ImagePool
+ *
+ * Keeps image buffers that have been used for rendering a metatile so
+ * that they can be re-used for the next request of the same size instead
+ * of allocating (and page-faulting in) a fresh 16 MB buffer every time.
+ *
+ * Buffers handed out by acquire() are not cleared; their content is
+ * whatever the previous user left in them.
+ */
+
+#ifndef imagepool_included
+#define imagepool_included
+
+#include <map>
+#include <vector>
+
+#include <mapnik/version.hpp>
+#if MAPNIK_VERSION >= 300000
+#define image_data_32 image_rgba8
+#define image_32 image_rgba8
+#include <mapnik/image.hpp>
+#include <mapnik/image_view_any.hpp>
+#else
+#include <mapnik/graphics.hpp>
+#endif
+
+#include "debuggable.h"
+
+class ImagePool : public Debuggable
+{
+    public:
+
+    ImagePool();
+    ~ImagePool();
+
+    void configure(unsigned int maxfree, bool hugepages);
+    mapnik::image_32 *acquire(unsigned int width, unsigned int height);
+    void release(mapnik::image_32 *image);
+
+    unsigned long getHits() const { return mHits; }
+    unsigned long getAllocations() const { return mAllocations; }
+
+    private:
+
+    typedef std::pair<unsigned int, unsigned int> dimensions;
+
+    std::map<dimensions, std::vector<mapnik::image_32 *> > mFree;
+    unsigned int mMaxFree;
+    bool mHugePages;
+    unsigned long mHits;
+    unsigned long mAllocations;
+};
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+#include "layerprofiler.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
+
+#include <mapnik/layer.hpp>
+#include <mapnik/feature.hpp>
+#include <mapnik/query.hpp>
+
+LayerProfiler::LayerProfiler()
+{
+}
+
+/**
+ * Wrap the datasources of all layers in the map so that they report
+ * to this profiler.
+ */
+void LayerProfiler::profileMap(mapnik::Map *map)
+{
+    std::vector<mapnik::layer>& layers = map->layers();
+    for (auto itr = layers.begin(); itr != layers.end(); itr++)
+    {
+        mapnik::datasource_ptr ds = itr->datasource();
+        if (!ds || dynamic_cast<ProfilingDatasource *>(ds.get())) continue;
+        itr->set_datasource(std::make_shared<ProfilingDatasource>(ds, this, itr->name()));
+    }
+}
+
+void LayerProfiler::start()
+{
+    mProfiles.clear();
+    mOrder.clear();
+    mCurrentLayer.clear();
+    mStart = mMark = mEnd = clock::now();
+}
+
+void LayerProfiler::finish()
+{
+    layerStarted("");
+    mEnd = mMark;
+}
+
+/**
+ * Called whenever a layer queries its datasource. Everything since the
+ * previous call belongs to the layer that was rendered before.
+ */
+void LayerProfiler::layerStarted(const std::string& layer)
+{
+    if (layer == mCurrentLayer) return;
+
+    clock::time_point now = clock::now();
+    if (!mCurrentLayer.empty())
+    {
+        mProfiles[mCurrentLayer].total_us += std::chrono::duration_cast<std::chrono::microseconds>(now - mMark).count();
+    }
+    mMark = now;
+    mCurrentLayer = layer;
+
+    if (!layer.empty() && mProfiles.find(layer) == mProfiles.end())
+    {
+        layer_profile p = { 0, 0, 0 };
+        mProfiles[layer] = p;
+        mOrder.push_back(layer);
+    }
+}
+
+void LayerProfiler::addQueryTime(const std::string& layer, long us)
+{
+    mProfiles[layer].query_us += us;
+}
+
+void LayerProfiler::addFeature(const std::string& layer)
+{
+    mProfiles[layer].features++;
+}
+
+long LayerProfiler::getTotalTime() const
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(mEnd - mStart).count();
+}
+
+/**
+ * Machine readable form of the last profile for the response to the
+ * master: "layer,query_ms,symbolizer_ms,features" for each layer,
+ * separated by semicolons. The most expensive layers come first, so that
+ * the list can be cut at a semicolon if the response gets too long.
+ */
+std::string LayerProfiler::toString() const
+{
+    std::vector<std::string> order(mOrder);
+    std::stable_sort(order.begin(), order.end(), [this](const std::string& a, const std::string& b) {
+        return mProfiles.at(a).total_us > mProfiles.at(b).total_us;
+    });
+
+    std::string result;
+    char buffer[64];
+    for (auto itr = order.begin(); itr != order.end(); itr++)
+    {
+        const layer_profile& p = mProfiles.at(*itr);
+        long render_us = p.total_us > p.query_us ? p.total_us - p.query_us : 0;
+        snprintf(buffer, sizeof(buffer), ",%ld,%ld,%ld", p.query_us / 1000, render_us / 1000, p.features);
+        if (!result.empty()) result += ";";
+        result += *itr + buffer;
+    }
+    return result;
+}
+
+/**
+ * Human readable form of the last profile for the log.
+ */
+std::string LayerProfiler::toSummary() const
+{
+    std::string result;
+    char buffer[80];
+    for (auto itr = mOrder.begin(); itr != mOrder.end(); itr++)
+    {
+        const layer_profile& p = mProfiles.at(*itr);
+        long render_us = p.total_us > p.query_us ? p.total_us - p.query_us : 0;
+        snprintf(buffer, sizeof(buffer), " query=%ldms render=%ldms features=%ld", p.query_us / 1000, render_us / 1000, p.features);
+        if (!result.empty()) result += ", ";
+        result += *itr + buffer;
+    }
+    return result;
+}
+
+ProfilingFeatureset::ProfilingFeatureset(const mapnik::featureset_ptr& fs, LayerProfiler *profiler, const std::string& layer) :
+    mFeatureset(fs),
+    mpProfiler(profiler),
+    mLayer(layer)
+{
+}
+
+mapnik::feature_ptr ProfilingFeatureset::next()
+{
+    auto start = std::chrono::steady_clock::now();
+    mapnik::feature_ptr feature = mFeatureset->next();
+    mpProfiler->addQueryTime(mLayer, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    if (feature) mpProfiler->addFeature(mLayer);
+    return feature;
+}
+
+ProfilingDatasource::ProfilingDatasource(const mapnik::datasource_ptr& ds, LayerProfiler *profiler, const std::string& layer) :
+    mapnik::datasource(ds->params()),
+    mDatasource(ds),
+    mpProfiler(profiler),
+    mLayer(layer)
+{
+}
+
+mapnik::featureset_ptr ProfilingDatasource::features(const mapnik::query& q) const
+{
+    mpProfiler->layerStarted(mLayer);
+    auto start = std::chrono::steady_clock::now();
+    mapnik::featureset_ptr fs = mDatasource->features(q);
+    mpProfiler->addQueryTime(mLayer, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    if (!fs) return fs;
+    return std::make_shared<ProfilingFeatureset>(fs, mpProfiler, mLayer);
+}
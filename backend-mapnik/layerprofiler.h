@@ -0,0 +1,107 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+/**
+ * LayerProfiler
+ *
+ * Records where the time for rendering a metatile goes. The datasource of
+ * every layer is wrapped in a ProfilingDatasource which measures the time
+ * spent in the datasource (the query itself and fetching the features) and
+ * counts the features. As Mapnik renders the layers one after the other,
+ * everything from the first query of a layer up to the first query of the
+ * next layer is accounted as the total time for that layer; the symbolizer
+ * time is what is left after subtracting the datasource time.
+ */
+
+#ifndef layerprofiler_included
+#define layerprofiler_included
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <mapnik/version.hpp>
+#include <mapnik/datasource.hpp>
+#include <mapnik/map.hpp>
+
+struct layer_profile {
+    long query_us;
+    long total_us;
+    long features;
+};
+
+class LayerProfiler
+{
+    public:
+
+    LayerProfiler();
+
+    void profileMap(mapnik::Map *map);
+    void start();
+    void finish();
+    void layerStarted(const std::string& layer);
+    void addQueryTime(const std::string& layer, long us);
+    void addFeature(const std::string& layer);
+
+    long getTotalTime() const;
+    std::string toString() const;
+    std::string toSummary() const;
+
+    private:
+
+    typedef std::chrono::steady_clock clock;
+
+    std::map<std::string, layer_profile> mProfiles;
+    std::vector<std::string> mOrder;
+    std::string mCurrentLayer;
+    clock::time_point mStart;
+    clock::time_point mMark;
+    clock::time_point mEnd;
+};
+
+class ProfilingFeatureset : public mapnik::Featureset
+{
+    public:
+
+    ProfilingFeatureset(const mapnik::featureset_ptr& fs, LayerProfiler *profiler, const std::string& layer);
+    mapnik::feature_ptr next();
+
+    private:
+
+    mapnik::featureset_ptr mFeatureset;
+    LayerProfiler *mpProfiler;
+    std::string mLayer;
+};
+
+class ProfilingDatasource : public mapnik::datasource
+{
+    public:
+
+    ProfilingDatasource(const mapnik::datasource_ptr& ds, LayerProfiler *profiler, const std::string& layer);
+
+    datasource_t type() const { return mDatasource->type(); }
+#if MAPNIK_VERSION >= 400000
+    std::optional<mapnik::datasource_geometry_t> get_geometry_type() const { return mDatasource->get_geometry_type(); }
+#else
+    boost::optional<mapnik::datasource_geometry_t> get_geometry_type() const { return mDatasource->get_geometry_type(); }
+#endif
+    mapnik::featureset_ptr features(const mapnik::query& q) const;
+    mapnik::featureset_ptr features_at_point(const mapnik::coord2d& pt, double tol = 0) const { return mDatasource->features_at_point(pt, tol); }
+    mapnik::box2d<double> envelope() const { return mDatasource->envelope(); }
+    mapnik::layer_descriptor get_descriptor() const { return mDatasource->get_descriptor(); }
+
+    private:
+
+    mapnik::datasource_ptr mDatasource;
+    LayerProfiler *mpProfiler;
+    std::string mLayer;
+};
+
+#endif
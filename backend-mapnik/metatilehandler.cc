@@ -10,13 +10,16 @@
 #include "metatilehandler.h"
 #include "renderrequest.h"
 #include "renderresponse.h"
+#include "tracer.h"
 
 #include "sys/time.h"
-#include <boost/filesystem.hpp>
 #include <mapnik/image_util.hpp>
 #include <limits.h>
+#include <time.h>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <functional>
 
 #include <mapnik/version.hpp>
 #include <mapnik/map.hpp>
@@ -24,6 +27,7 @@
 #include <mapnik/font_engine_freetype.hpp>
 #include <mapnik/agg_renderer.hpp>
 #include <mapnik/image_util.hpp>
+#include <mapnik/image_compositing.hpp>
 #include <mapnik/load_map.hpp>
 
 #if MAPNIK_VERSION >= 400000
@@ -48,21 +52,31 @@ MetatileHandler::MetatileHandler(const std::string& tiledir, unsigned int tiledi
     mImageType(imagetype),
     mBufferSize(buffersize),
     mScaleFactor(scalefactor),
-    mTileDirDepth(tiledir_depth),
-    mTileDir(tiledir) 
+    mWriter(tiledir, tiledir_depth, mtrowcol, mtrowcol),
+    mStaticLayerCache(NULL),
+    mImagePool(NULL),
+    mLayerProfiler(NULL),
+    mProfileThreshold(0)
 {
+    mSplitMap.staticlayers = NULL;
+    mSplitMap.dynamiclayers = NULL;
     for (unsigned int i=0; i<=MAXZOOM; i++)
     {
         mPerZoomMap[i]=NULL;
+        mPerZoomSplitMap[i].staticlayers = NULL;
+        mPerZoomSplitMap[i].dynamiclayers = NULL;
     }
 
-    if (tiledir_depth > MAXDEPTH)
-    {
-        throw std::invalid_argument("tiledir depth must not be greater than " + MAXDEPTH);
-    }
+    // the style hash identifies cached static layer rasters, so it covers
+    // everything that changes what the rasters look like.
+    std::ostringstream stylekey;
+    stylekey << tilesize << "/" << scalefactor << "/" << buffersize << "/" << mtrowcol;
 
     for (auto itr = stylefiles.begin(); itr != stylefiles.end(); itr++)
     {
+        std::ifstream stylefile(itr->second);
+        stylekey << "/" << itr->first << "=" << stylefile.rdbuf();
+
         if (itr->first == "")
         {
             load_map(mMap, itr->second);
@@ -86,6 +100,10 @@ MetatileHandler::MetatileHandler(const std::string& tiledir, unsigned int tiledi
         }
     }
 
+    char hash[20];
+    snprintf(hash, sizeof(hash), "%016zx", std::hash<std::string>()(stylekey.str()));
+    mStyleHash = hash;
+
     fourpow[0] = 1;
     twopow[0] = 1;
     for (unsigned int i = 1; i < MAXZOOM; i++)
@@ -97,9 +115,113 @@ MetatileHandler::MetatileHandler(const std::string& tiledir, unsigned int tiledi
 
 MetatileHandler::~MetatileHandler()
 {
+    delete mSplitMap.staticlayers;
+    delete mSplitMap.dynamiclayers;
+    for (unsigned int i=0; i<=MAXZOOM; i++)
+    {
+        delete mPerZoomSplitMap[i].staticlayers;
+        delete mPerZoomSplitMap[i].dynamiclayers;
+    }
+    delete mStaticLayerCache;
+    delete mLayerProfiler;
+}
+
+/**
+ * Enable the static layer cache. The named layers are rendered once per
+ * metatile and kept as a raster, all other layers are composited on top
+ * of it for every request. The map background belongs to the static part.
+ */
+void MetatileHandler::setStaticLayers(const std::set<std::string>& layers, const std::string& cachedir, unsigned int cachesize, unsigned int disksize)
+{
+    if (layers.empty()) return;
+
+    splitMap(mMap, mSplitMap, layers);
+    for (unsigned int i=0; i<=MAXZOOM; i++)
+    {
+        if (mPerZoomMap[i])
+        {
+            splitMap(*(mPerZoomMap[i]), mPerZoomSplitMap[i], layers);
+        }
+    }
+
+    // sizes are configured in MB
+    mStaticLayerCache = new StaticLayerCache(cachedir, mStyleHash, static_cast<size_t>(cachesize) << 20, static_cast<uintmax_t>(disksize) << 20);
+    info("static layer cache enabled (style hash %s, %u MB in memory, directory '%s' with %u MB)",
+        mStyleHash.c_str(), cachesize, cachedir.c_str(), disksize);
+}
+
+/**
+ * Enable per-layer profiling. The profile of every request is sent back to
+ * the master, and requests taking longer than threshold milliseconds are
+ * also logged.
+ */
+void MetatileHandler::setProfiling(long threshold)
+{
+    mLayerProfiler = new LayerProfiler();
+    mProfileThreshold = threshold;
+
+    mLayerProfiler->profileMap(&mMap);
+    for (unsigned int i=0; i<=MAXZOOM; i++)
+    {
+        if (mPerZoomMap[i]) mLayerProfiler->profileMap(mPerZoomMap[i]);
+        if (mPerZoomSplitMap[i].staticlayers) mLayerProfiler->profileMap(mPerZoomSplitMap[i].staticlayers);
+        if (mPerZoomSplitMap[i].dynamiclayers) mLayerProfiler->profileMap(mPerZoomSplitMap[i].dynamiclayers);
+    }
+    if (mSplitMap.staticlayers) mLayerProfiler->profileMap(mSplitMap.staticlayers);
+    if (mSplitMap.dynamiclayers) mLayerProfiler->profileMap(mSplitMap.dynamiclayers);
+
+    info("layer profiling enabled (threshold %ld ms)", threshold);
+}
+
+void MetatileHandler::setFreshnessIndex(const std::string& dir)
+{
+    mWriter.setFreshnessIndex(dir);
+}
+
+/**
+ * Log the datasource type and spatial index status of every layer and
+ * build missing indexes if requested (see SpatialIndexChecker). Called
+ * before setStaticLayers() and setProfiling(), which copy and wrap the
+ * datasources.
+ */
+void MetatileHandler::checkSpatialIndexes(const std::string& name, bool build)
+{
+    SpatialIndexChecker checker(name, build);
+
+    checker.checkMap(&mMap);
+    for (unsigned int i=0; i<=MAXZOOM; i++)
+    {
+        if (mPerZoomMap[i]) checker.checkMap(mPerZoomMap[i]);
+    }
+    checker.logSummary();
 }
 
-const NetworkResponse *MetatileHandler::handleRequest(const NetworkRequest *request)
+void MetatileHandler::splitMap(const mapnik::Map& map, split_map& split, const std::set<std::string>& layers) const
+{
+    if (map.background_image())
+    {
+        throw std::invalid_argument("static layers cannot be used with a map background image");
+    }
+
+    split.staticlayers = new mapnik::Map(map);
+    split.dynamiclayers = new mapnik::Map(map);
+    split.dynamiclayers->set_background(mapnik::color(0, 0, 0, 0));
+
+    std::vector<mapnik::layer>& sl = split.staticlayers->layers();
+    std::vector<mapnik::layer>& dl = split.dynamiclayers->layers();
+    for (auto itr = sl.begin(); itr != sl.end(); )
+    {
+        itr = layers.count(itr->name()) ? itr + 1 : sl.erase(itr);
+    }
+    for (auto itr = dl.begin(); itr != dl.end(); )
+    {
+        itr = layers.count(itr->name()) ? dl.erase(itr) : itr + 1;
+    }
+
+    debug("split map into %zu static and %zu dynamic layers", sl.size(), dl.size());
+}
+
+NetworkResponse *MetatileHandler::handleRequest(const NetworkRequest *request)
 {
     debug(">> MetatileHandler::handleRequest");
     timeval start, end;
@@ -139,6 +261,8 @@ const NetworkResponse *MetatileHandler::handleRequest(const NetworkRequest *requ
     rr.scale_factor = mScaleFactor;
     rr.buffer_size = mBufferSize;
     rr.zoom = z;
+    rr.x = x;
+    rr.y = y;
 
     // we specify the bbox in epsg:3857, and we also want our image returned
     // in this projection.
@@ -150,9 +274,13 @@ const NetworkResponse *MetatileHandler::handleRequest(const NetworkRequest *requ
 
     std::string map = request->getParam("map", "default");
 
+    std::string id = request->getParam("id", "");
+    long long render_start = Tracer::now();
     updateStatus("rendering z=%d x=%d y=%d map=%s", z, x, y, map.c_str());
     const RenderResponse *rrs = render(&rr);
     updateStatus("idle");
+    long long encode_start = Tracer::now();
+    Tracer::span("render", id, render_start, encode_start);
 
     NetworkResponse *resp;
 
@@ -162,38 +290,10 @@ const NetworkResponse *MetatileHandler::handleRequest(const NetworkRequest *requ
     }
     else
     {
-        meta_layout m;
         int numtiles = mMetaTileRows * mMetaTileColumns;
-        entry *offsets = static_cast<entry *>(malloc(sizeof(entry) * numtiles));
         std::vector<std::string> rawpng(numtiles);
-        memset(&m, 0, sizeof(m));
-        memset(offsets, 0, numtiles * sizeof(entry));
-
-        // it seems that mod_tile expects us to always put the theoretical
-        // number of tiles in this meta tile, not the real number (in standard
-        // setup, only zoom levels 3+ will have 64 tiles, 0-2 have less)
-        // m.count = mtr * mtc;
-        m.count = mMetaTileRows * mMetaTileColumns;
-        memcpy(m.magic, "META", 4);
-        m.x = x;
-        m.y = y;
-        m.z = z;
-        size_t offset = sizeof(m) + numtiles * sizeof(entry);
         int index = 0;
 
-        char metafilename[PATH_MAX];
-        xyz_to_meta(metafilename, PATH_MAX, mTileDir.c_str(), x, y, z);
-        if (!mkdirp(mTileDir.c_str(), x, y, z))
-        {
-            free(offsets);
-            return NetworkResponse::makeErrorResponse(request, "renderer internal error");
-        }
-
-        std::string tmpfilename = metafilename; 
-        tmpfilename += "." + std::to_string(getpid()) + ".tmp";
-        std::ofstream outfile(tmpfilename, std::ios::out | std::ios::binary | std::ios::trunc);
-        outfile.write(reinterpret_cast<const char*>(&m), sizeof(m));
-
         for (unsigned int col = 0; col < mMetaTileColumns; col++)
         {
             for (unsigned int row = 0; row < mMetaTileRows; row++)
@@ -209,37 +309,21 @@ const NetworkResponse *MetatileHandler::handleRequest(const NetworkRequest *requ
                         row * mTileHeight, mTileWidth, mTileHeight, rrs->image->data());
 #endif
                     rawpng[index] = mapnik::save_to_string(view, mImageType);
-                    offsets[index].offset = offset;
-                    offset += offsets[index].size = rawpng[index].length();
-                }
-                else
-                {
-                    offsets[index].offset = 0;
-                    offsets[index].size = 0;
                 }
                 index++;
             }
         }
-
-        outfile.write(reinterpret_cast<const char*>(offsets), numtiles * sizeof(entry));
-
-        for (int i=0; i < index; i++)
-        {
-            outfile.write(rawpng[i].data(), rawpng[i].size());
-        }
-
-        outfile.close();
-        free(offsets);
         delete rrs;
 
-        if (outfile.fail())
+        long long write_start = Tracer::now();
+        Tracer::span("encode", id, encode_start, write_start);
+
+        std::string metafilename;
+        if (!mWriter.write(x, y, z, rawpng, metafilename))
         {
-            unlink(tmpfilename.c_str());
-            return NetworkResponse::makeErrorResponse(request, "cannot write metatile");
+            return NetworkResponse::makeErrorResponse(request, "%s", mWriter.getError().c_str());
         }
-
-        rename(tmpfilename.c_str(), metafilename);
-        debug("created %s", metafilename);
+        Tracer::span("write", id, write_start, Tracer::now());
 
         resp = new NetworkResponse(request);
         resp->setParam("map", map);
@@ -252,70 +336,15 @@ const NetworkResponse *MetatileHandler::handleRequest(const NetworkRequest *requ
         char buffer[20];
         snprintf(buffer, 20, "%ld", (end.tv_sec-start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000);
         resp->setParam("render_time", buffer);
+        if (mLayerProfiler)
+        {
+            resp->setParam("layer_profile", mLayerProfiler->toString());
+        }
     }
     debug("<< MetatileHandler::handleRequest");
     return resp;
 }
 
-void MetatileHandler::xyz_to_meta(char *path, size_t len, const char *tile_dir, int x, int y, int z) const
-{
-    unsigned int i;
-    unsigned char hash[MAXDEPTH];
-    size_t printed;
-
-    for (i=0; i<mTileDirDepth; i++) {
-        hash[i] = ((x & 0x0f) << 4) | (y & 0x0f);
-        x >>= 4;
-        y >>= 4;
-    }
-    printed = snprintf(path, len, "%s/%d", tile_dir, z);
-    path+=printed;
-    len-=printed;
-    for (i=mTileDirDepth-1; i>0; i--)
-    {
-        printed = snprintf(path, len, "/%u", hash[i]);
-        path += printed;
-        len -= printed;
-    }
-    snprintf(path, len, "/%u.meta", hash[0]);
-    return;
-}
-
-bool MetatileHandler::mkdirp(const char *tile_dir, int x, int y, int z) const
-{
-    unsigned int i;
-    unsigned char hash[MAXDEPTH];
-    char path[PATH_MAX];
-    char *p = path;
-    size_t printed;
-    size_t len=PATH_MAX-1;
-
-    for (i=0; i<mTileDirDepth; i++) {
-        hash[i] = ((x & 0x0f) << 4) | (y & 0x0f);
-        x >>= 4;
-        y >>= 4;
-    }
-    printed = snprintf(p, len, "%s/%d", tile_dir, z);
-    p+=printed;
-    len-=printed;
-    for (i=mTileDirDepth-1; i>0; i--)
-    {
-        printed = snprintf(p, len, "/%u", hash[i]);
-        p+= printed;
-        len -= printed;
-    }
-    try
-    {
-        boost::filesystem::create_directories(path);
-    }
-    catch(std::exception const& ex)
-    {
-        error("cannot create directory %s: %s", path, ex.what());
-        return false;
-    }
-    return true;
-}
-
 const RenderResponse *MetatileHandler::render(const RenderRequest *rr)
 {
     debug(">> MetatileHandler::render");
@@ -352,24 +381,44 @@ const RenderResponse *MetatileHandler::render(const RenderRequest *rr)
     }
 
     mapnik::box2d<double> bbox(west, south, east, north);
-    map->resize(rr->width, rr->height);
-    map->zoom_to_box(bbox);
-    if (rr->buffer_size > -1)
-    {
-        map->set_buffer_size(rr->buffer_size);
-    }
-    else if (map->buffer_size() < 128)
-    {
-        map->set_buffer_size(128);
-    }
 
     debug("width: %d, height:%d", rr->width, rr->height);
-    RenderResponse *resp = new RenderResponse();
-    resp->image = new mapnik::image_32(rr->width, rr->height);
-    mapnik::agg_renderer<mapnik::image_32> renderer(*map, *(resp->image), rr->scale_factor, 0u, 0u);
+    RenderResponse *resp = new RenderResponse(mImagePool);
+    resp->image = mImagePool->acquire(rr->width, rr->height);
+    const split_map& split = mPerZoomMap[rr->zoom] ? mPerZoomSplitMap[rr->zoom] : mSplitMap;
+    if (mLayerProfiler) mLayerProfiler->start();
     try
     {
-        renderer.apply();
+        if (mStaticLayerCache)
+        {
+            if (!mStaticLayerCache->get(rr->x, rr->y, rr->zoom, *(resp->image)))
+            {
+                setupMap(split.staticlayers, rr, bbox);
+                clearImage(resp->image, split.staticlayers);
+                mapnik::agg_renderer<mapnik::image_32> renderer(*(split.staticlayers), *(resp->image), rr->scale_factor, 0u, 0u);
+                renderer.apply();
+                mStaticLayerCache->put(rr->x, rr->y, rr->zoom, *(resp->image));
+            }
+
+            RenderResponse dynamic(mImagePool);
+            dynamic.image = mImagePool->acquire(rr->width, rr->height);
+            setupMap(split.dynamiclayers, rr, bbox);
+            mapnik::agg_renderer<mapnik::image_32> renderer(*(split.dynamiclayers), *(dynamic.image), rr->scale_factor, 0u, 0u);
+            renderer.apply();
+
+            mapnik::premultiply_alpha(*(resp->image));
+            mapnik::premultiply_alpha(*(dynamic.image));
+            mapnik::composite(*(resp->image), *(dynamic.image), mapnik::src_over);
+            mapnik::demultiply_alpha(*(resp->image));
+            debug("static layer cache: %lu hits, %lu misses", mStaticLayerCache->getHits(), mStaticLayerCache->getMisses());
+        }
+        else
+        {
+            setupMap(map, rr, bbox);
+            clearImage(resp->image, map);
+            mapnik::agg_renderer<mapnik::image_32> renderer(*map, *(resp->image), rr->scale_factor, 0u, 0u);
+            renderer.apply();
+        }
     }
     catch (mapnik::datasource_exception const& dex)
     {
@@ -383,8 +432,44 @@ const RenderResponse *MetatileHandler::render(const RenderRequest *rr)
         resp = NULL;
         error("Mapnik config error: %s", ex.what());
     }
+
+    if (mLayerProfiler)
+    {
+        mLayerProfiler->finish();
+        if (mLayerProfiler->getTotalTime() >= mProfileThreshold)
+        {
+            info("slow render z=%d x=%d y=%d (%ld ms): %s", rr->zoom, rr->x, rr->y,
+                mLayerProfiler->getTotalTime(), mLayerProfiler->toSummary().c_str());
+        }
+    }
     debug("<< MetatileHandler::render");
 
     return resp;
 }
 
+void MetatileHandler::setupMap(mapnik::Map *map, const RenderRequest *rr, const mapnik::box2d<double>& bbox) const
+{
+    map->resize(rr->width, rr->height);
+    map->zoom_to_box(bbox);
+    if (rr->buffer_size > -1)
+    {
+        map->set_buffer_size(rr->buffer_size);
+    }
+    else if (map->buffer_size() < 128)
+    {
+        map->set_buffer_size(128);
+    }
+}
+
+/**
+ * Images from the pool still contain the previous rendering. The renderer
+ * overwrites them with the map background colour anyway, so they only
+ * have to be cleared if the map has no background.
+ */
+void MetatileHandler::clearImage(mapnik::image_32 *image, const mapnik::Map *map) const
+{
+    if (!map->background())
+    {
+        memset(image->bytes(), 0, image->size());
+    }
+}
@@ -19,6 +19,7 @@
 #define metatilehandler_included
 
 #include <string>
+#include <set>
 #include <mapnik/map.hpp>
 
 #include "requesthandler.h"
@@ -26,20 +27,17 @@
 #include "networkresponse.h"
 #include "renderrequest.h"
 #include "renderresponse.h"
+#include "staticlayercache.h"
+#include "imagepool.h"
+#include "layerprofiler.h"
+#include "metatilewriter.h"
+#include "spatialindex.h"
 
-#define MAXZOOM 25
-#define MAXDEPTH 10
-
-struct entry {
-    int offset;
-    int size;
-};
-
-struct meta_layout {
-    char magic[4];
-    int count; // METATILE ^ 2
-    int x, y, z; // lowest x,y of this metatile, plus z
-    // entry index[]; // count entries
+// a map split into the layers that are cached as a static raster and
+// the layers that are rendered on top of it for every request
+struct split_map {
+    mapnik::Map *staticlayers;
+    mapnik::Map *dynamiclayers;
 };
 
 class MetatileHandler : public RequestHandler
@@ -48,16 +46,22 @@ class MetatileHandler : public RequestHandler
 
     MetatileHandler(const std::string& tiledir, unsigned int tiledir_depth, const std::map<std::string,std::string>& stylefiles, unsigned int tilesize, double scalefactor, int buffersize, unsigned int mtrowcol, const std::string & imagetype);
     ~MetatileHandler();
-    const NetworkResponse *handleRequest(const NetworkRequest *request);
-    void xyz_to_meta(char *path, size_t len, const char *tile_dir, int x, int y, int z) const;
-    bool mkdirp(const char *tile_dir, int x, int y, int z) const;
+    NetworkResponse *handleRequest(const NetworkRequest *request);
     const std::string getRequestType() const { return "metatile_request"; }
+    void setImagePool(ImagePool *pool) { mImagePool = pool; }
+    void setStaticLayers(const std::set<std::string>& layers, const std::string& cachedir, unsigned int cachesize, unsigned int disksize);
+    void setProfiling(long threshold);
+    void setFreshnessIndex(const std::string& dir);
+    void checkSpatialIndexes(const std::string& name, bool build);
 
     private:
 
     int64_t fourpow[MAXZOOM];
     int64_t twopow[MAXZOOM];
     const RenderResponse *render(const RenderRequest *rr);
+    void setupMap(mapnik::Map *map, const RenderRequest *rr, const mapnik::box2d<double>& bbox) const;
+    void clearImage(mapnik::image_32 *image, const mapnik::Map *map) const;
+    void splitMap(const mapnik::Map& map, split_map& split, const std::set<std::string>& layers) const;
 
     unsigned int mTileWidth;
     unsigned int mTileHeight;
@@ -66,10 +70,16 @@ class MetatileHandler : public RequestHandler
     std::string mImageType;
     int mBufferSize;
     double mScaleFactor;
-    unsigned int mTileDirDepth;
-    std::string mTileDir;
+    MetatileWriter mWriter;
     mapnik::Map mMap;
     mapnik::Map *mPerZoomMap[MAXZOOM+1];
+    std::string mStyleHash;
+    split_map mSplitMap;
+    split_map mPerZoomSplitMap[MAXZOOM+1];
+    StaticLayerCache *mStaticLayerCache;
+    ImagePool *mImagePool;
+    LayerProfiler *mLayerProfiler;
+    long mProfileThreshold;
 };
 
 #endif
@@ -0,0 +1,179 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+#include "metatilewriter.h"
+
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fstream>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+
+MetatileWriter::MetatileWriter(const std::string& tiledir, unsigned int tiledir_depth, unsigned int columns, unsigned int rows) :
+    mTileDir(tiledir),
+    mTileDirDepth(tiledir_depth),
+    mColumns(columns),
+    mRows(rows),
+    mFreshnessIndex(NULL)
+{
+    if (tiledir_depth > MAXDEPTH)
+    {
+        throw std::invalid_argument("tiledir depth must not be greater than " + std::to_string(MAXDEPTH));
+    }
+}
+
+MetatileWriter::~MetatileWriter()
+{
+    delete mFreshnessIndex;
+}
+
+/**
+ * Record the render time of every metatile written in the freshness
+ * index in dir (see FreshnessIndex), so that tirex-freshness and
+ * tirex-batch don't have to stat the metatile files.
+ */
+void MetatileWriter::setFreshnessIndex(const std::string& dir)
+{
+    mFreshnessIndex = new FreshnessIndex(dir, true, mColumns, mRows);
+    info("freshness index enabled (directory '%s')", dir.c_str());
+}
+
+/**
+ * Write the metatile with the lowest tile x,y on zoom level z. The tiles
+ * are the encoded images in column-major order (index = column * rows +
+ * row), empty strings for tiles outside of the world.
+ *
+ * Returns false if the metatile could not be written, see error().
+ */
+bool MetatileWriter::write(int x, int y, int z, const std::vector<std::string>& tiles, std::string& filename)
+{
+    meta_layout m;
+    int numtiles = mColumns * mRows;
+    std::vector<entry> offsets(numtiles);
+    memset(&m, 0, sizeof(m));
+
+    // it seems that mod_tile expects us to always put the theoretical
+    // number of tiles in this meta tile, not the real number (in standard
+    // setup, only zoom levels 3+ will have 64 tiles, 0-2 have less)
+    m.count = numtiles;
+    memcpy(m.magic, "META", 4);
+    m.x = x;
+    m.y = y;
+    m.z = z;
+
+    size_t offset = sizeof(m) + numtiles * sizeof(entry);
+    for (int i = 0; i < numtiles; i++)
+    {
+        if (i < static_cast<int>(tiles.size()) && !tiles[i].empty())
+        {
+            offsets[i].offset = offset;
+            offset += offsets[i].size = tiles[i].length();
+        }
+        else
+        {
+            offsets[i].offset = 0;
+            offsets[i].size = 0;
+        }
+    }
+
+    char metafilename[PATH_MAX];
+    xyz_to_meta(metafilename, PATH_MAX, mTileDir.c_str(), x, y, z);
+    filename = metafilename;
+    if (!mkdirp(mTileDir.c_str(), x, y, z))
+    {
+        mError = "cannot create directory";
+        return false;
+    }
+
+    std::string tmpfilename = filename + "." + std::to_string(getpid()) + ".tmp";
+    std::ofstream outfile(tmpfilename, std::ios::out | std::ios::binary | std::ios::trunc);
+    outfile.write(reinterpret_cast<const char*>(&m), sizeof(m));
+    outfile.write(reinterpret_cast<const char*>(offsets.data()), numtiles * sizeof(entry));
+    for (int i = 0; i < numtiles && i < static_cast<int>(tiles.size()); i++)
+    {
+        outfile.write(tiles[i].data(), tiles[i].size());
+    }
+    outfile.close();
+
+    if (outfile.fail())
+    {
+        unlink(tmpfilename.c_str());
+        mError = "cannot write metatile";
+        return false;
+    }
+
+    rename(tmpfilename.c_str(), metafilename);
+    debug("created %s", metafilename);
+    if (mFreshnessIndex && z <= FRESHNESS_MAX_ZOOM && !mFreshnessIndex->set(z, x, y, time(NULL)))
+    {
+        warning("cannot update freshness index: %s", mFreshnessIndex->error().c_str());
+    }
+
+    return true;
+}
+
+void MetatileWriter::xyz_to_meta(char *path, size_t len, const char *tile_dir, int x, int y, int z) const
+{
+    unsigned int i;
+    unsigned char hash[MAXDEPTH];
+    size_t printed;
+
+    for (i=0; i<mTileDirDepth; i++) {
+        hash[i] = ((x & 0x0f) << 4) | (y & 0x0f);
+        x >>= 4;
+        y >>= 4;
+    }
+    printed = snprintf(path, len, "%s/%d", tile_dir, z);
+    path+=printed;
+    len-=printed;
+    for (i=mTileDirDepth-1; i>0; i--)
+    {
+        printed = snprintf(path, len, "/%u", hash[i]);
+        path += printed;
+        len -= printed;
+    }
+    snprintf(path, len, "/%u.meta", hash[0]);
+    return;
+}
+
+bool MetatileWriter::mkdirp(const char *tile_dir, int x, int y, int z) const
+{
+    unsigned int i;
+    unsigned char hash[MAXDEPTH];
+    char path[PATH_MAX];
+    char *p = path;
+    size_t printed;
+    size_t len=PATH_MAX-1;
+
+    for (i=0; i<mTileDirDepth; i++) {
+        hash[i] = ((x & 0x0f) << 4) | (y & 0x0f);
+        x >>= 4;
+        y >>= 4;
+    }
+    printed = snprintf(p, len, "%s/%d", tile_dir, z);
+    p+=printed;
+    len-=printed;
+    for (i=mTileDirDepth-1; i>0; i--)
+    {
+        printed = snprintf(p, len, "/%u", hash[i]);
+        p+= printed;
+        len -= printed;
+    }
+    try
+    {
+        boost::filesystem::create_directories(path);
+    }
+    catch(std::exception const& ex)
+    {
+        error("cannot create directory %s: %s", path, ex.what());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+/**
+ * MetatileWriter
+ *
+ * Writes metatiles in the format mod_tile reads into the tile directory:
+ * header, offset table and the encoded tiles go into a temporary file
+ * which is then renamed into place, so readers never see a half-written
+ * metatile. Updates the freshness index if one is configured.
+ *
+ * This is the output path of MetatileHandler and SyntheticHandler, so it
+ * must not depend on Mapnik.
+ */
+
+#ifndef metatilewriter_included
+#define metatilewriter_included
+
+#include <string>
+#include <vector>
+
+#include "debuggable.h"
+#include "freshindex.h"
+
+#define MAXZOOM 25
+#define MAXDEPTH 10
+
+struct entry {
+    int offset;
+    int size;
+};
+
+struct meta_layout {
+    char magic[4];
+    int count; // METATILE ^ 2
+    int x, y, z; // lowest x,y of this metatile, plus z
+    // entry index[]; // count entries
+};
+
+class MetatileWriter : public Debuggable
+{
+    public:
+
+    MetatileWriter(const std::string& tiledir, unsigned int tiledir_depth, unsigned int columns, unsigned int rows);
+    ~MetatileWriter();
+
+    void setFreshnessIndex(const std::string& dir);
+    bool write(int x, int y, int z, const std::vector<std::string>& tiles, std::string& filename);
+    const std::string& getError() const { return mError; }
+
+    void xyz_to_meta(char *path, size_t len, const char *tile_dir, int x, int y, int z) const;
+    bool mkdirp(const char *tile_dir, int x, int y, int z) const;
+
+    private:
+
+    std::string mTileDir;
+    unsigned int mTileDirDepth;
+    unsigned int mColumns;
+    unsigned int mRows;
+    FreshnessIndex *mFreshnessIndex;
+    std::string mError;
+};
+
+#endif
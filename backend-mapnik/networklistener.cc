@@ -18,10 +18,13 @@
 #include <signal.h>
 #include <strings.h>
 #include <unistd.h>
+#include <stdarg.h>
+#include <sys/resource.h>
 
 #include "networklistener.h"
 #include "networkrequest.h"
 #include "networkresponse.h"
+#include "tracer.h"
 
 // stuff for handling the hangup signal properly
 extern "C"
@@ -46,13 +49,17 @@ extern "C"
     }
 }
 
-NetworkListener::NetworkListener(int port, int sockfd, int parentfd, std::map<std::string, RequestHandler *> *handlers, int maxreq) :
+NetworkListener::NetworkListener(int port, int sockfd, int parentfd, std::map<std::string, RequestHandler *> *handlers, int maxreq, long maxrss, long maxgrowth) :
     mpRequestHandlers(handlers),
     mSocket(-1),
     mParent(parentfd),
-    mMaxRequests(maxreq)
+    mMaxRequests(maxreq),
+    mMaxRss(maxrss),
+    mMaxGrowth(maxgrowth),
+    mStatusSlot(-1)
 {
     mRequestCount = 0;
+    memset(&mWorkerStatus, 0, sizeof(mWorkerStatus));
     socklen_t length;
     sockaddr_in server;
 
@@ -81,11 +88,85 @@ NetworkListener::~NetworkListener()
 {
 }
 
+/**
+ * Get current and peak resident set size of this process in kB.
+ */
+void NetworkListener::getMemoryUsage(long &rss, long &peak) const
+{
+    rss = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f)
+    {
+        long size, resident;
+        if (fscanf(f, "%ld %ld", &size, &resident) == 2)
+        {
+            rss = resident * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+        fclose(f);
+    }
+
+    rusage usage;
+    peak = getrusage(RUSAGE_SELF, &usage) ? 0 : usage.ru_maxrss;
+}
+
+/**
+ * Log why this process is about to exit and tell the backend manager,
+ * which will then start a fresh process.
+ */
+void NetworkListener::recycle(const char *fmt, ...) const
+{
+    char reason[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(reason, sizeof(reason), fmt, ap);
+    va_end(ap);
+
+    notice("recycling process: %s", reason);
+    if (mParent > -1)
+    {
+        std::string msg = std::string("recycle: ") + reason + "\n";
+        if (write(mParent, msg.data(), msg.length())) {};
+    }
+}
+
+/**
+ * Set the slot in the status shared memory of the master that this worker
+ * should keep updated. The backend manager assigns the slot.
+ */
+void NetworkListener::setStatusSlot(int slot, const char *renderer)
+{
+    mStatusSlot = slot;
+    mWorkerStatus.pid = getpid();
+    snprintf(mWorkerStatus.renderer, sizeof(mWorkerStatus.renderer), "%s", renderer ? renderer : "");
+}
+
+void NetworkListener::updateStatus(uint32_t state, const NetworkRequest *req, long rss)
+{
+    if (mStatusSlot < 0) return;
+
+    mWorkerStatus.state = state;
+    mWorkerStatus.updated = time(NULL);
+    if (rss >= 0) mWorkerStatus.rss = rss;
+    if (req)
+    {
+        snprintf(mWorkerStatus.map, sizeof(mWorkerStatus.map), "%s", req->getParam("map", "").c_str());
+        mWorkerStatus.x = req->getParam("x", 0);
+        mWorkerStatus.y = req->getParam("y", 0);
+        mWorkerStatus.z = req->getParam("z", 0);
+        mWorkerStatus.job_started = Tracer::now() / 1000;
+    }
+
+    // this fails silently if the master isn't running, the next update
+    // will attach to its shared memory once it is back
+    mStatus.writeWorker(mStatusSlot, mWorkerStatus);
+}
+
 void NetworkListener::run()
 {
     sockaddr_in client;
     socklen_t fromlen = sizeof(sockaddr_in);
     char buf[MAX_DGRAM];
+    char out[MAX_DGRAM];
 
     // install SIGHUP signal handler. use sigaction to avoid restarting after signal.
     gHangupOccurred = 0;
@@ -95,6 +176,7 @@ void NetworkListener::run()
     time_t last_alive_sent = 0;
     install_sighup_handler(false);
     ignore_sigpipe();
+    updateStatus(STATUS_WORKER_IDLE, NULL, -1);
     while (!gHangupOccurred)
     {
         timeval to = { 5, 0 };
@@ -148,11 +230,13 @@ void NetworkListener::run()
         else
         {
             errcnt = 0;
+            long long received = Tracer::now();
+            long rss_before, rss_after, peak;
+            getMemoryUsage(rss_before, peak);
             NetworkRequest *req = new NetworkRequest();
-            std::string strbuf(buf, n);
-            debug("read: %s", strbuf.c_str());
-            const NetworkResponse *resp;
-            if (!req->parse(strbuf))
+            NetworkResponse *resp;
+            if (msg_format(buf, n) == MSG_FORMAT_TEXT) debug("read: %.*s", static_cast<int>(n), buf); else debug("read binary message (%d bytes)", n);
+            if (!req->parse(buf, n))
             {
                 error("error parsing request");
                 resp = NetworkResponse::makeErrorResponse(NULL, "cannot parse request");
@@ -164,6 +248,8 @@ void NetworkListener::run()
 
                 if (h != mpRequestHandlers->end())
                 {
+                    Tracer::span("received", req->getParam("id", ""), received, Tracer::now());
+                    updateStatus(STATUS_WORKER_RENDERING, req, rss_before);
                     if (!(resp = h->second->handleRequest(req)))
                     {
                         error("handler returned null");
@@ -180,10 +266,29 @@ void NetworkListener::run()
                 install_sighup_handler(false);
             }
 
-            std::string responseString;
-            resp->build(responseString);
-            debug("sending: %s", responseString.c_str());
-            n = sendto(mSocket, responseString.data(), responseString.length(), 0, reinterpret_cast<sockaddr *>(&client), fromlen);
+            getMemoryUsage(rss_after, peak);
+            resp->setParam("rss", rss_after);
+            resp->setParam("peak_rss", peak);
+
+            if (resp->getParam("result", "") == "error") mWorkerStatus.errors++; else mWorkerStatus.rendered++;
+            updateStatus(STATUS_WORKER_IDLE, NULL, rss_after);
+
+            size_t len = resp->build(out, MAX_DGRAM);
+
+            // the layer profile can get longer than the master reads, leave
+            // out the cheapest layers (at the end) until the response fits
+            std::string profile = resp->getParam("layer_profile", "");
+            while (len > MASTER_MAX_DGRAM && !profile.empty())
+            {
+                size_t over = len - MASTER_MAX_DGRAM;
+                size_t pos = profile.size() > over ? profile.rfind(';', profile.size() - over) : std::string::npos;
+                profile.erase(pos == std::string::npos ? 0 : pos);
+                resp->setParam("layer_profile", profile);
+                len = resp->build(out, MAX_DGRAM);
+            }
+
+            if (resp->getFormat() == MSG_FORMAT_TEXT) debug("sending: %.*s", static_cast<int>(len), out); else debug("sending binary message (%zu bytes)", len);
+            n = len ? sendto(mSocket, out, len, 0, reinterpret_cast<sockaddr *>(&client), fromlen) : -1;
             if (n < 0)
             {
                 error("error in sendto");
@@ -192,7 +297,17 @@ void NetworkListener::run()
             delete req;
             if (mMaxRequests > -1 && ++mRequestCount > mMaxRequests) 
             {
-                error("maxrequests reached, terminating");
+                recycle("maxrequests (%d) reached", mMaxRequests);
+                break;
+            }
+            if (mMaxRss > 0 && rss_after > mMaxRss)
+            {
+                recycle("rss of %ld kB exceeds max_rss_mb (%ld kB)", rss_after, mMaxRss);
+                break;
+            }
+            if (mMaxGrowth > 0 && rss_after - rss_before > mMaxGrowth)
+            {
+                recycle("rss grew by %ld kB during one request, more than max_rss_growth_mb (%ld kB)", rss_after - rss_before, mMaxGrowth);
                 break;
             }
         }
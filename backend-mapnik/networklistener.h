@@ -13,6 +13,10 @@
  * Class that handles the main network loop, waiting for input on the
  * specified UDP socket, then calling the appropriate request handler
  * for the type of request received.
+ *
+ * After each request the memory usage of the process is checked, and the
+ * listener returns so that the process can be restarted once it has grown
+ * beyond the configured limits.
  */
 
 #ifndef networklistener_included
@@ -24,26 +28,42 @@
 #include "requesthandler.h"
 #include "mortal.h"
 #include "debuggable.h"
+#include "statussegment.h"
+
+class NetworkRequest;
 
 #define MAX_DGRAM 0xffff
 
+// the master only reads this much of a response (see $Tirex::MAX_PACKET_SIZE)
+#define MASTER_MAX_DGRAM 512
+
 class NetworkListener : public Mortal, public Debuggable
 {
 
     public:
 
-    NetworkListener(int port, int sockfd, int parentfd, std::map<std::string, RequestHandler *> *handlers, int maxreq);
+    NetworkListener(int port, int sockfd, int parentfd, std::map<std::string, RequestHandler *> *handlers, int maxreq, long maxrss, long maxgrowth);
     ~NetworkListener();
 
     void run();
+    void setStatusSlot(int slot, const char *renderer);
 
     private:
 
+    void getMemoryUsage(long &rss, long &peak) const;
+    void recycle(const char *fmt, ...) const;
+    void updateStatus(uint32_t state, const NetworkRequest *req, long rss);
+
     std::map<std::string, RequestHandler *> *mpRequestHandlers;
     int mSocket;
     int mParent;
     int mMaxRequests;
     int mRequestCount;
+    long mMaxRss;
+    long mMaxGrowth;
+    StatusSegment mStatus;
+    int mStatusSlot;
+    status_worker mWorkerStatus;
 
 };
 #endif
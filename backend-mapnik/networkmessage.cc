@@ -12,8 +12,11 @@
 
 #include "networkmessage.h"
 
-NetworkMessage::NetworkMessage()
+NetworkMessage::NetworkMessage() :
+    mStorageUsed(0)
 {
+    mMsg.format = MSG_FORMAT_TEXT;
+    mMsg.count = 0;
 }
 
 NetworkMessage::~NetworkMessage()
@@ -22,65 +25,112 @@ NetworkMessage::~NetworkMessage()
 
 const std::string NetworkMessage::getParam(const std::string &key, const std::string &def) const
 {
-    std::map<std::string, std::string>::const_iterator i = mParams.find(key);
-    return (i == mParams.end() ? def : i->second);
+    const msg_field *f = msg_find(mMsg, key.c_str());
+    if (!f) return def;
+    if (!f->is_number) return std::string(f->value, f->valuelen);
+
+    char buffer[16];
+    return std::string(buffer, msg_value(*f, buffer, sizeof(buffer)));
 }
 
 int NetworkMessage::getParam(const std::string &key, int def) const
 {
-    std::map<std::string, std::string>::const_iterator i = mParams.find(key);
-    return (i == mParams.end() ? def : atoi(i->second.c_str()));
+    const msg_field *f = msg_find(mMsg, key.c_str());
+    int value;
+    if (!f) return def;
+    return msg_get_int(*f, value) ? value : 0;
 }
 
-void NetworkMessage::setParam(const std::string &key, const std::string &value)
-{
-    mParams[key] = value;
-}
-void NetworkMessage::setParam(const std::string &key, int value)
+/**
+ * Copy data into the storage of this message. Returns NULL if it is full.
+ */
+const char *NetworkMessage::store(const char *data, size_t len)
 {
-    char buffer[32];
-    snprintf(buffer, 31, "%d", value);
-    buffer[31]=0;
-    mParams[key] = buffer;
+    if (mStorageUsed + len > sizeof(mStorage))
+    {
+        error("message too large, can't store %zu more bytes", len);
+        return NULL;
+    }
+    char *p = mStorage + mStorageUsed;
+    memcpy(p, data, len);
+    mStorageUsed += len;
+    return p;
 }
 
-bool NetworkMessage::parse(const std::string &buffer)
+void NetworkMessage::set(const char *key, const char *value, size_t valuelen, int32_t number, bool is_number)
 {
-    debug(">> NetworkMessage::parse");
-    char *dup = strdup(buffer.c_str());
-    char *token;
-    token = strtok(dup, "\r\n");
-    while (token)
+    // the length must fit into the binary format, also when overwriting
+    if (valuelen > MSG_MAX_VALUE)
     {
-        char *eq = strchr(token, '=');
-        if (eq)
+        error("value of field '%s' too long", key);
+        return;
+    }
+
+    msg_field *f = const_cast<msg_field *>(msg_find(mMsg, key));
+    if (!f)
+    {
+        if (mMsg.count == MSG_MAX_FIELDS)
         {
-            *eq++ = 0;
-            mParams[token] = eq;
+            error("can't add field '%s' to message", key);
+            return;
         }
-        else
+        f = &mMsg.fields[mMsg.count];
+        size_t keylen = strlen(key);
+
+        // the names of well-known keys are static, others need a copy
+        f->key = NULL;
+        for (int i = 1; i < msg_num_keys; i++)
         {
-            // invalid line
+            if (!strcmp(msg_keys[i], key)) f->key = msg_keys[i];
         }
-        token = strtok(NULL, "\r\n");
+        if (!f->key && !(f->key = store(key, keylen))) return;
+        f->keylen = keylen;
+        mMsg.count++;
     }
-    free(dup);
+
+    f->is_number = is_number;
+    f->number    = number;
+    f->value     = NULL;
+    f->valuelen  = 0;
+    if (!is_number && (f->value = store(value, valuelen))) f->valuelen = valuelen;
+}
+
+void NetworkMessage::setParam(const std::string &key, const std::string &value)
+{
+    set(key.c_str(), value.data(), value.length(), 0, false);
+}
+
+void NetworkMessage::setParam(const std::string &key, int value)
+{
+    set(key.c_str(), NULL, 0, value, true);
+}
+
+bool NetworkMessage::parse(const char *buffer, size_t len)
+{
+    debug(">> NetworkMessage::parse");
+    mStorageUsed = 0;
+    bool ok = msg_parse(buffer, len, mMsg);
+    if (!ok) mMsg.count = 0;
     debug("<< NetworkMessage::parse");
-    return true;
+    return ok;
 }
 
-bool NetworkMessage::build(std::string &buffer) const
+/**
+ * Write the message in its format into buffer. Returns the length or 0
+ * if it doesn't fit.
+ */
+size_t NetworkMessage::build(char *buffer, size_t size) const
 {
     debug(">> NetworkMessage::build");
-    buffer.clear();
-    for (std::map<std::string, std::string>::const_iterator i =
-        mParams.begin(); i != mParams.end(); i++)
-    {
-        buffer.append(i->first);
-        buffer.append("=");
-        buffer.append(i->second);
-        buffer.append("\n");
-    }
+    size_t len = msg_write(mMsg, mMsg.format, buffer, size);
     debug("<< NetworkMessage::build");
-    return true;
+    return len;
+}
+
+bool NetworkMessage::build(std::string &buffer) const
+{
+    char tmp[MESSAGE_STORAGE_SIZE];
+    size_t len = build(tmp, sizeof(tmp));
+    buffer.assign(tmp, len);
+    return len > 0;
 }
@@ -25,6 +25,15 @@
  * x=16
  * y=24
  * z=5
+ *
+ * Messages can also be sent in the binary format described in
+ * native/message.h. Requests are parsed in whatever format they arrive
+ * and the response to a request uses the same format, so the master
+ * decides which format is used (see the "protocol" renderer option).
+ *
+ * Parsing doesn't copy the request: the fields point into the buffer
+ * given to parse(), which must outlive the message. Values set with
+ * setParam() are kept in a fixed buffer inside the message.
  */
 
 #ifndef networkmessage_included
@@ -32,19 +41,30 @@
 
 #include "debuggable.h"
 
+#include "message.h"
+
 #include <string>
-#include <map>
+
+#define MESSAGE_STORAGE_SIZE 0xffff
 
 class NetworkMessage : public Debuggable
 {
     private:
-        std::map<std::string, std::string> mParams;
+        msg_view mMsg;
+        char mStorage[MESSAGE_STORAGE_SIZE];
+        size_t mStorageUsed;
+
+        const char *store(const char *data, size_t len);
+        void set(const char *key, const char *value, size_t valuelen, int32_t number, bool is_number);
 
     public:
         NetworkMessage();
         ~NetworkMessage();
-        bool parse(const std::string &buffer);
+        bool parse(const char *buffer, size_t len);
         bool build(std::string &buffer) const;
+        size_t build(char *buffer, size_t size) const;
+        int getFormat() const { return mMsg.format; }
+        void setFormat(int format) { mMsg.format = format; }
         const std::string getParam(const std::string &key, const std::string &def) const;
         int getParam(const std::string &key, int def) const;
         void setParam(const std::string &key, const std::string &value);
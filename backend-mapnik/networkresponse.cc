@@ -17,6 +17,7 @@
 
 NetworkResponse::NetworkResponse(const NetworkRequest *request)
 {
+    setFormat(request->getFormat());
     std::string id = request->getParam("id", "");
     if (id.length()) setParam("id", id);
     std::string type = request->getType();
@@ -31,7 +32,7 @@ NetworkResponse::~NetworkResponse()
 {
 }
 
-const NetworkResponse *NetworkResponse::makeErrorResponse(const NetworkRequest *request, const char *fmt, ...)
+NetworkResponse *NetworkResponse::makeErrorResponse(const NetworkRequest *request, const char *fmt, ...)
 {
     char buffer[0xffff];
     va_list ap;
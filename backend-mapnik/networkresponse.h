@@ -27,7 +27,7 @@ class NetworkResponse : public NetworkMessage
     private:
 
     public:
-    static const NetworkResponse *makeErrorResponse(const NetworkRequest *request, const char *fmt, ...);
+    static NetworkResponse *makeErrorResponse(const NetworkRequest *request, const char *fmt, ...);
     NetworkResponse(const NetworkRequest *request);
     NetworkResponse();
     ~NetworkResponse();
@@ -10,14 +10,15 @@
 #include "renderd.h"
 
 #include <iostream>
-#include <syslog.h>
+#include <unistd.h>
 
 #include <mapnik/version.hpp>
 #include <mapnik/datasource_cache.hpp>
 #include <mapnik/font_engine_freetype.hpp>
 #include <exception>
+#include <chrono>
 
-#include "networklistener.h"
+#include "fontindex.h"
 
 bool RenderDaemon::loadFonts(const boost::filesystem::path &dir, bool recurse)
 {
@@ -41,18 +42,10 @@ bool RenderDaemon::loadFonts(const boost::filesystem::path &dir, bool recurse)
     return true;
 }
 
-bool RenderDaemon::loadMapnikWrapper(const char *configfile)
+bool RenderDaemon::loadMapConfig(const char *configfile)
 {
     // create mapnik instances
     bool rv = false;
-    FILE *f = fopen(configfile, "r");
-    if (!f)
-    {
-        warning("cannot open '%s'", configfile);
-        return rv;
-    }
-
-    char linebuf[255];
     std::string tiledir;
     std::map<std::string, std::string> mapfiles;
     std::string stylename;
@@ -61,86 +54,106 @@ bool RenderDaemon::loadMapnikWrapper(const char *configfile)
     double scalefactor = 1.0;
     int buffersize = -1;
     std::string imagetype = "png256";
-    int lineno = 0;
     int tiledir_depth = 5;
+    std::set<std::string> staticlayers;
+    std::string staticcachedir;
+    std::string freshindex;
+    std::string spatialindex = "check";
+    unsigned int staticcachesize = 64;
+    unsigned int staticdisksize = 1024;
+    bool profile = false;
+    long profilethreshold = 10000;
 
-    while (char *line = fgets(linebuf, sizeof(linebuf), f))
-    {
-        lineno++;
-        while (isspace(*line)) line++;
-        if (*line == '#') continue;
-        if (!*line) continue;
-        char *eq = strchr(line, '=');
-        if (eq)
+    bool ok = readMapConfig(configfile, [&](const char *name, char *value, int lineno) {
+        if (!strcmp(name, "tiledir"))
         {
-            char *last = eq-1;
-            // trim space before equal sign
-            while (last > line && isspace(*last)) *last-- = 0;
-            *eq++ = 0;
-            // trim space after equal sign
-            while (isspace(*eq)) eq++;
-            // trim space at end of line
-            last = eq + strlen(eq) - 1;
-            while (last > eq && isspace(*last)) *last-- = 0;
-            if (!strcmp(line, "tiledir"))
-            {
-                tiledir.assign(eq);
-            }
-            else if (!strcmp(line, "tiledir_depth"))
-            {
-                tiledir_depth = atoi(eq);
-            }
-            else if (!strncmp(line, "mapfile", 7))
-            {
-                mapfiles.insert(std::pair<std::string, std::string>(line+7, eq));
-            }
-            else if (!strcmp(line, "scalefactor"))
-            {
-                scalefactor = atof(eq);
-            }
-            else if (!strcmp(line, "buffersize"))
-            {
-                buffersize = atoi(eq);
-            }
-            else if (!strcmp(line, "tilesize"))
-            {
-                tilesize = atoi(eq);
-            }
-            else if (!strcmp(line, "metarowscols"))
-            {
-                mtrowcol = atoi(eq);
-            }
-            else if (!strcmp(line, "maxrequests"))
-            {
-                mMaxRequests  = atoi(eq);
-            }
-            else if (!strcmp(line, "name"))
-            {
-                stylename.assign(eq);
-            }
-            else if (!strcmp(line, "imagetype"))
-            {
-                imagetype.assign(eq);
-            }
-            else if (!strcmp(line, "minz"))
-            {
-                // no error
-            }
-            else if (!strcmp(line, "maxz"))
+            tiledir.assign(value);
+        }
+        else if (!strcmp(name, "tiledir_depth"))
+        {
+            tiledir_depth = atoi(value);
+        }
+        else if (!strncmp(name, "mapfile", 7))
+        {
+            mapfiles.insert(std::pair<std::string, std::string>(name+7, value));
+        }
+        else if (!strcmp(name, "scalefactor"))
+        {
+            scalefactor = atof(value);
+        }
+        else if (!strcmp(name, "buffersize"))
+        {
+            buffersize = atoi(value);
+        }
+        else if (!strcmp(name, "tilesize"))
+        {
+            tilesize = atoi(value);
+        }
+        else if (!strcmp(name, "metarowscols"))
+        {
+            mtrowcol = atoi(value);
+        }
+        else if (!strcmp(name, "maxrequests"))
+        {
+            mMaxRequests  = atoi(value);
+        }
+        else if (!strcmp(name, "name"))
+        {
+            stylename.assign(value);
+        }
+        else if (!strcmp(name, "imagetype"))
+        {
+            imagetype.assign(value);
+        }
+        else if (!strcmp(name, "staticlayers"))
+        {
+            char *tkn = strtok(value, ", ");
+            while (tkn)
             {
-                // no error
+                staticlayers.insert(tkn);
+                tkn = strtok(NULL, ", ");
             }
-            else
+        }
+        else if (!strcmp(name, "staticcache_dir"))
+        {
+            staticcachedir.assign(value);
+        }
+        else if (!strcmp(name, "staticcache_size"))
+        {
+            staticcachesize = atoi(value);
+        }
+        else if (!strcmp(name, "staticcache_disk_size"))
+        {
+            staticdisksize = atoi(value);
+        }
+        else if (!strcmp(name, "spatialindex"))
+        {
+            spatialindex.assign(value);
+            if (spatialindex != "check" && spatialindex != "build" && spatialindex != "off")
             {
-                warning("parse error on line %d of config file %s", lineno, configfile);
+                warning("invalid spatialindex '%s' on line %d of config file %s, using 'check'", value, lineno, configfile);
+                spatialindex = "check";
             }
         }
+        else if (!strcmp(name, "freshindex"))
+        {
+            freshindex.assign(value);
+        }
+        else if (!strcmp(name, "profile"))
+        {
+            profile = atoi(value);
+        }
+        else if (!strcmp(name, "profile_threshold"))
+        {
+            profilethreshold = atol(value);
+        }
         else
         {
-            warning("parse error on line %d of config file %s", lineno, configfile);
+            return false;
         }
-    }
-    fclose(f);
+        return true;
+    });
+    if (!ok) return rv;
 
     if (mapfiles.empty())
     {
@@ -168,9 +181,15 @@ bool RenderDaemon::loadMapnikWrapper(const char *configfile)
 
     try
     {
-        mHandlerMap[stylename] = new MetatileHandler(tiledir, tiledir_depth, mapfiles, tilesize, 
+        MetatileHandler *handler = new MetatileHandler(tiledir, tiledir_depth, mapfiles, tilesize,
             scalefactor, buffersize, mtrowcol, imagetype);
+        mHandlerMap[stylename] = handler;
         mHandlerMap[stylename]->setStatusReceiver(this);
+        handler->setImagePool(&mImagePool);
+        if (spatialindex != "off") handler->checkSpatialIndexes(stylename, spatialindex == "build");
+        handler->setStaticLayers(staticlayers, staticcachedir, staticcachesize, staticdisksize);
+        if (profile) handler->setProfiling(profilethreshold);
+        if (!freshindex.empty()) handler->setFreshnessIndex(freshindex);
         debug("added style '%s' from map %s", stylename.c_str(), configfile);
         rv = true;
     }
@@ -183,48 +202,9 @@ bool RenderDaemon::loadMapnikWrapper(const char *configfile)
 }
 
 RenderDaemon::RenderDaemon(int argc, char **argv) :
-    mArgc(argc),
-    mArgv(argv),
-    mProgramName(argc ? argv[0] : "")
+    BackendDaemon(argc, argv, "tirex-backend-mapnik", "mapnik")
 {
-    setStatus("initializing");
-
-    mMaxRequests = -1;
-
-    char *tmp = getenv("TIREX_BACKEND_DEBUG");
-    Debuggable::msDebugLogging = tmp ? true : false;
-
-    std::string strfac;
-    tmp = getenv("TIREX_BACKEND_SYSLOG_FACILITY");
-    if (tmp) strfac = tmp;
-    int fac = LOG_DAEMON;
-    if (strfac.empty()) fac = LOG_DAEMON;
-    else if (strfac == "local0") fac = LOG_LOCAL0;
-    else if (strfac == "local1") fac = LOG_LOCAL1;
-    else if (strfac == "local2") fac = LOG_LOCAL2;
-    else if (strfac == "local3") fac = LOG_LOCAL3;
-    else if (strfac == "local4") fac = LOG_LOCAL4;
-    else if (strfac == "local5") fac = LOG_LOCAL4;
-    else if (strfac == "local6") fac = LOG_LOCAL6;
-    else if (strfac == "user") fac = LOG_USER;
-    else if (strfac == "daemon") fac = LOG_DAEMON;
-    else
-    {
-        die(2, "Cannot use log facility '%s' - only local0-local7, user, daemon are allowed.", strfac.c_str());
-    }
-    openlog("tirex-backend-mapnik", Debuggable::msDebugLogging ? LOG_PERROR|LOG_PID : LOG_PID, fac);
-    info("Renderer started (name=%s)", getenv("TIREX_BACKEND_NAME"));
-
-    tmp = getenv("TIREX_BACKEND_SOCKET_FILENO");
-    mSocketFd = tmp ? atoi(tmp) : -1;
-
-    tmp = getenv("TIREX_BACKEND_PIPE_FILENO");
-    mParentFd = tmp ? atoi(tmp) : -1;
-
-    tmp = getenv("TIREX_BACKEND_PORT");
-    mPort = tmp ? atoi(tmp) : 9320;
-
-    tmp = getenv("TIREX_BACKEND_CFG_plugindir");
+    char *tmp = getenv("TIREX_BACKEND_CFG_plugindir");
 #if MAPNIK_VERSION >= 200200
     if (tmp) mapnik::datasource_cache::instance().register_datasources(tmp);
 #else
@@ -234,25 +214,29 @@ RenderDaemon::RenderDaemon(int argc, char **argv) :
     tmp = getenv("TIREX_BACKEND_CFG_fontdir_recurse");
     bool fr = tmp ? atoi(tmp) : true;
     tmp = getenv("TIREX_BACKEND_CFG_fontdir");
-    if (tmp) loadFonts(tmp, fr);
-
-    tmp = getenv("TIREX_BACKEND_MAP_CONFIGS");
-    if (tmp)
+    char *fontindex = getenv("TIREX_BACKEND_CFG_fontindex");
+    if (tmp && fontindex)
     {
-        char *dup = strdup(tmp);
-        char *tkn = strtok(dup, " ");
-        while (tkn)
-        {
-            if (!loadMapnikWrapper(tkn)) {
-                die(2, "Unable to load map");
-            }
-            tkn = strtok(NULL, " ");
-        }
+        auto start = std::chrono::steady_clock::now();
+        FontIndex index(fontindex);
+        index.registerFonts(tmp, fr);
+        index.save();
+        long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        info("registered %lu font faces in %ld ms (%lu files from font index, %lu scanned), saved about %lu ms",
+            index.getFaces(), elapsed, index.getHits(), index.getMisses(), index.getSavedTime() / 1000);
+    }
+    else if (tmp)
+    {
+        loadFonts(tmp, fr);
     }
 
-    if (mHandlerMap.empty())
-        die(2, "Cannot load any Mapnik styles");
+    tmp = getenv("TIREX_BACKEND_CFG_imagepool_size");
+    unsigned int poolsize = tmp ? atoi(tmp) : 2;
+    tmp = getenv("TIREX_BACKEND_CFG_imagepool_hugepages");
+    bool hugepages = tmp ? atoi(tmp) : false;
+    mImagePool.configure(poolsize, hugepages);
 
+    loadMapConfigs();
 }
 
 RenderDaemon::~RenderDaemon()
@@ -261,19 +245,8 @@ RenderDaemon::~RenderDaemon()
 
 void RenderDaemon::run()
 {
-    NetworkListener listener(mPort, mSocketFd, mParentFd, &mHandlerMap, mMaxRequests);
-    setStatus("idle");
-    listener.run();
-}
-
-void RenderDaemon::setStatus(const char *status)
-{
-#ifdef __linux__
-    char **p = mArgv;
-    for (int i=1;i<mArgc;i++) { for (char *c = *(++p); *c != 0; c++) *c=0; }
-//    sprintf(*mArgv, "%s: %s", mProgramName.c_str(), status);
-    sprintf(*mArgv, "mapnik: %s                                ", status);
-#endif
+    BackendDaemon::run();
+    info("image pool: %lu hits, %lu allocations", mImagePool.getHits(), mImagePool.getAllocations());
 }
 
 int main(int argc, char **argv)
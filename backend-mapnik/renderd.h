@@ -11,32 +11,19 @@
 #define renderd_included
 
 #include "metatilehandler.h"
-#include "requesthandler.h"
-#include "mortal.h"
-#include "debuggable.h"
-#include "statusreceiver.h"
+#include "backenddaemon.h"
+#include "imagepool.h"
 #include <boost/filesystem.hpp>
 #include <string>
-#include <map>
+#include <set>
 
-class RenderDaemon : public Mortal, public Debuggable, public StatusReceiver
+class RenderDaemon : public BackendDaemon
 {
     private:
 
     bool loadFonts(const boost::filesystem::path &dir, bool recurse);
-    bool loadMapnikWrapper(const char *file);
-    int mPort;
-    int mSocketFd;
-    int mParentFd;
-    std::map<std::string, RequestHandler *> mHandlerMap;
-    int mArgc;
-    int mMaxRequests;
-    char **mArgv;
-    std::string mProgramName;
-
-    protected:
-
-    void setStatus(const char *status);
+    bool loadMapConfig(const char *file);
+    ImagePool mImagePool;
 
     public:
 
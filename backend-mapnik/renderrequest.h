@@ -11,7 +11,8 @@
  * RenderRequest
  *
  * Class that encapsulates a render request. Any metatile information
- * must already have been resolved into plain coordinates.
+ * must already have been resolved into plain coordinates. The metatile
+ * position is only kept as a key for caching.
  */
 
 #ifndef renderrequest_included
@@ -31,6 +32,8 @@ class RenderRequest
         unsigned int srs;
         unsigned int bbox_srs;
         unsigned int zoom;
+        int x;
+        int y;
 };
 
 #endif
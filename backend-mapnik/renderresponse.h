@@ -11,20 +11,14 @@
  * RenderResponse
  *
  * Class that encapsulates a render response - usually a plain image.
+ * If the image was taken from an ImagePool it is handed back to the
+ * pool when the response is deleted.
  */
 
 #ifndef renderresponse_included
 #define renderresponse_included
 
-#include <mapnik/version.hpp>
-#if MAPNIK_VERSION >= 300000
-#define image_data_32 image_rgba8
-#define image_32 image_rgba8
-#include <mapnik/image.hpp>
-#include <mapnik/image_view_any.hpp>
-#else
-#include <mapnik/graphics.hpp>
-#endif
+#include "imagepool.h"
 
 class RenderResponse
 {
@@ -34,9 +28,10 @@ class RenderResponse
 #else
         mapnik::Image32 *image;
 #endif
+        ImagePool *pool;
 
-    RenderResponse() { image = NULL; }
-    ~RenderResponse() { if (image) delete image; }
+    RenderResponse(ImagePool *p = NULL) { image = NULL; pool = p; }
+    ~RenderResponse() { if (pool) pool->release(image); else if (image) delete image; }
 
 };
 
@@ -42,7 +42,7 @@ class RequestHandler : public Debuggable
 
     void setStatusReceiver(StatusReceiver *sr) { mpStatusReceiver = sr; }
     virtual const std::string getRequestType() const = 0;
-    virtual const NetworkResponse *handleRequest(const NetworkRequest *request) = 0;
+    virtual NetworkResponse *handleRequest(const NetworkRequest *request) = 0;
 };
 
 #endif
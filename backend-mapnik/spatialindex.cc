@@ -0,0 +1,227 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+#include "spatialindex.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <mapnik/datasource.hpp>
+#include <mapnik/datasource_cache.hpp>
+#include <mapnik/params.hpp>
+
+static const char *status_names[] = { "ok", "missing", "built", "build failed" };
+
+static bool file_exists(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && st.st_size > 0;
+}
+
+static bool ends_with(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() && !strcasecmp(s.c_str() + s.size() - suffix.size(), suffix.c_str());
+}
+
+SpatialIndexChecker::SpatialIndexChecker(const std::string& mapname, bool build) :
+    mMapName(mapname),
+    mBuild(build),
+    mLayers(0),
+    mMissing(0),
+    mBuilt(0)
+{
+}
+
+/**
+ * Check the datasources of all layers in the map, log type and index
+ * status of every layer and build missing indexes if enabled. Must be
+ * called before the datasources are wrapped or the map is split.
+ */
+void SpatialIndexChecker::checkMap(mapnik::Map *map)
+{
+    std::vector<mapnik::layer>& layers = map->layers();
+    for (auto itr = layers.begin(); itr != layers.end(); itr++)
+    {
+        mapnik::datasource_ptr ds = itr->datasource();
+        if (!ds) continue;
+        mLayers++;
+
+        mapnik::parameters params = ds->params();
+        auto type = params.get<std::string>("type");
+        auto file = params.get<std::string>("file");
+        auto base = params.get<std::string>("base");
+        std::string typestr = type ? *type : "unknown";
+
+        if (!file)
+        {
+            info("map %s layer '%s': %s datasource", mMapName.c_str(), itr->name().c_str(), typestr.c_str());
+            continue;
+        }
+
+        std::string datafile = *file;
+        if (base && !base->empty() && datafile[0] != '/') datafile = *base + "/" + datafile;
+
+        // the shape plugin accepts the name with and without .shp, the ogr
+        // plugin replaces the extension by .ogrindex; csv and geojson files
+        // without index are read into memory and indexed there
+        std::string indexfile;
+        const char *tool = NULL;
+        if (typestr == "shape")
+        {
+            if (ends_with(datafile, ".shp")) datafile.erase(datafile.size() - 4);
+            indexfile = datafile + ".index";
+            datafile += ".shp";
+            tool = "shapeindex";
+        }
+        else if (typestr == "ogr")
+        {
+            size_t dot = datafile.find_last_of('.');
+            indexfile = datafile.substr(0, dot) + ".ogrindex";
+            tool = "ogrindex";
+        }
+        else
+        {
+            info("map %s layer '%s': %s datasource, file %s, no index needed", mMapName.c_str(), itr->name().c_str(), typestr.c_str(), datafile.c_str());
+            continue;
+        }
+
+        index_status status = checkFile(datafile, indexfile, tool);
+        if (status == INDEX_MISSING || status == INDEX_FAILED)
+        {
+            mMissing++;
+            warning("map %s layer '%s': %s datasource, file %s, spatial index %s (every query reads the whole file, create %s with %s)",
+                mMapName.c_str(), itr->name().c_str(), typestr.c_str(), datafile.c_str(), status_names[status], indexfile.c_str(), tool);
+            continue;
+        }
+
+        info("map %s layer '%s': %s datasource, file %s, spatial index %s", mMapName.c_str(), itr->name().c_str(), typestr.c_str(), datafile.c_str(), status_names[status]);
+
+        // the plugins only look for the index when the datasource is created
+        if (status == INDEX_BUILT)
+        {
+            try
+            {
+#if MAPNIK_VERSION >= 200200
+                itr->set_datasource(mapnik::datasource_cache::instance().create(params));
+#else
+                itr->set_datasource(mapnik::datasource_cache::instance()->create(params));
+#endif
+            }
+            catch (std::exception const& ex)
+            {
+                warning("map %s layer '%s': cannot re-create datasource: %s", mMapName.c_str(), itr->name().c_str(), ex.what());
+            }
+        }
+    }
+}
+
+void SpatialIndexChecker::logSummary() const
+{
+    info("map %s: %u layers, %u data files, %u spatial indexes missing, %u built", mMapName.c_str(), mLayers,
+        static_cast<unsigned int>(mFiles.size()), mMissing, mBuilt);
+}
+
+SpatialIndexChecker::index_status SpatialIndexChecker::checkFile(const std::string& datafile, const std::string& indexfile, const char *tool)
+{
+    auto itr = mFiles.find(datafile);
+    if (itr != mFiles.end()) return itr->second;
+
+    index_status status = lockAndCheck(datafile, indexfile, tool);
+    if (status == INDEX_BUILT) mBuilt++;
+
+    mFiles[datafile] = status;
+    return status;
+}
+
+/**
+ * Look for the index while holding the lock on the data file, so that an
+ * index another backend process is just writing is not taken for a
+ * complete one. If that process had the lock, its index is new and the
+ * datasource has to be re-created like for an index built here. If the
+ * index is missing and building is enabled, it is built.
+ */
+SpatialIndexChecker::index_status SpatialIndexChecker::lockAndCheck(const std::string& datafile, const std::string& indexfile, const char *tool)
+{
+    int fd = open(datafile.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        warning("cannot open %s: %s", datafile.c_str(), strerror(errno));
+        return file_exists(indexfile) ? INDEX_OK : (mBuild ? INDEX_FAILED : INDEX_MISSING);
+    }
+
+    bool waited = false;
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0)
+    {
+        waited = true;
+        if (errno != EWOULDBLOCK || flock(fd, LOCK_EX) < 0)
+        {
+            warning("cannot lock %s: %s", datafile.c_str(), strerror(errno));
+            close(fd);
+            return mBuild ? INDEX_FAILED : INDEX_MISSING;
+        }
+    }
+
+    index_status status;
+    if (file_exists(indexfile))
+    {
+        status = waited ? INDEX_BUILT : INDEX_OK;
+    }
+    else if (!mBuild)
+    {
+        status = INDEX_MISSING;
+    }
+    else
+    {
+        status = buildIndex(datafile, indexfile, tool) ? INDEX_BUILT : INDEX_FAILED;
+    }
+
+    close(fd);
+    return status;
+}
+
+/**
+ * Run the index tool for the data file. Called with the data file locked,
+ * the other backend processes wait on the lock and find the index when
+ * they get it.
+ */
+bool SpatialIndexChecker::buildIndex(const std::string& datafile, const std::string& indexfile, const char *tool)
+{
+
+    notice("building spatial index %s with %s", indexfile.c_str(), tool);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) dup2(devnull, 1);
+        execlp(tool, tool, datafile.c_str(), static_cast<char *>(NULL));
+        _exit(127);
+    }
+
+    int status = -1;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0)
+    {
+        warning("cannot run %s: %s", tool, strerror(errno));
+        return false;
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !file_exists(indexfile))
+    {
+        warning("%s %s failed (status %d)", tool, datafile.c_str(), WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        return false;
+    }
+
+    return true;
+}
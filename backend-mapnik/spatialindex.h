@@ -0,0 +1,67 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+/**
+ * SpatialIndexChecker
+ *
+ * Looks at the datasources of all layers in a map and reports file based
+ * datasources that have no spatial index. Without index Mapnik's shape
+ * (and ogr) plugin reads the whole file for every query, which makes
+ * every render of such a layer slow.
+ *
+ * If building is enabled, missing indexes are created with the tools that
+ * come with Mapnik (shapeindex, ogrindex), so that the index format
+ * matches the installed Mapnik version, and the datasources of the layers
+ * are re-created to pick them up. Several backend processes start at the
+ * same time, so the data file is locked while its index is built and
+ * while the others look for the index.
+ */
+
+#ifndef spatialindex_included
+#define spatialindex_included
+
+#include <map>
+#include <string>
+
+#include <mapnik/version.hpp>
+#include <mapnik/map.hpp>
+
+#include "debuggable.h"
+
+class SpatialIndexChecker : public Debuggable
+{
+    public:
+
+    SpatialIndexChecker(const std::string& mapname, bool build);
+
+    void checkMap(mapnik::Map *map);
+    void logSummary() const;
+
+    private:
+
+    enum index_status {
+        INDEX_OK,
+        INDEX_MISSING,
+        INDEX_BUILT,
+        INDEX_FAILED
+    };
+
+    index_status checkFile(const std::string& datafile, const std::string& indexfile, const char *tool);
+    index_status lockAndCheck(const std::string& datafile, const std::string& indexfile, const char *tool);
+    bool buildIndex(const std::string& datafile, const std::string& indexfile, const char *tool);
+
+    std::string mMapName;
+    bool mBuild;
+    std::map<std::string, index_status> mFiles;     // data file -> status
+    unsigned int mLayers;
+    unsigned int mMissing;
+    unsigned int mBuilt;
+};
+
+#endif
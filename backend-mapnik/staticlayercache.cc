@@ -0,0 +1,272 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+#include "staticlayercache.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <zlib.h>
+#include <algorithm>
+#include <fstream>
+#include <tuple>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+struct static_raster_header {
+    char magic[4];
+    unsigned int width;
+    unsigned int height;
+    unsigned int length;    // of the compressed raster following the header
+};
+
+StaticLayerCache::StaticLayerCache(const std::string &cachedir, const std::string &stylehash, size_t memorylimit, uintmax_t disklimit) :
+    mMemoryLimit(memorylimit),
+    mMemoryUsed(0),
+    mDiskLimit(disklimit),
+    mDiskUsed(0),
+    mHits(0),
+    mMisses(0)
+{
+    if (!cachedir.empty())
+    {
+        mCacheRoot = cachedir;
+        mCacheDir = cachedir + "/" + stylehash;
+
+        // find out how much is in the cache directory already (this also
+        // cleans it up if the limit was lowered)
+        if (mDiskLimit > 0) cleanDisk(mDiskLimit);
+    }
+}
+
+StaticLayerCache::~StaticLayerCache()
+{
+}
+
+uint64_t StaticLayerCache::makeKey(int x, int y, int z) const
+{
+    return (static_cast<uint64_t>(z) << 58) | (static_cast<uint64_t>(x) << 29) | static_cast<uint64_t>(y);
+}
+
+std::string StaticLayerCache::makePath(int x, int y, int z) const
+{
+    return mCacheDir + "/" + std::to_string(z) + "/" + std::to_string(x) + "/" + std::to_string(y) + ".slc";
+}
+
+/**
+ * Copy the cached static raster for the given metatile into image.
+ * Returns false if there is no cached raster of the right size.
+ */
+bool StaticLayerCache::get(int x, int y, int z, mapnik::image_32 &image)
+{
+    uint64_t key = makeKey(x, y, z);
+    auto found = mIndex.find(key);
+    if (found != mIndex.end())
+    {
+        const lru_entry &cached = *(found->second);
+        if (cached.width == image.width() && cached.height == image.height() && unpack(cached.data, image))
+        {
+            // move to front of LRU list
+            mLru.splice(mLru.begin(), mLru, found->second);
+            mHits++;
+            return true;
+        }
+    }
+
+    std::string data;
+    if (!mCacheDir.empty() && readFile(x, y, z, image, data))
+    {
+        insert(key, image, data);
+        mHits++;
+        return true;
+    }
+
+    mMisses++;
+    return false;
+}
+
+void StaticLayerCache::put(int x, int y, int z, const mapnik::image_32 &image)
+{
+    std::string data;
+    if (!pack(image, data))
+    {
+        error("cannot compress static layer raster");
+        return;
+    }
+
+    insert(makeKey(x, y, z), image, data);
+    if (!mCacheDir.empty())
+    {
+        writeFile(x, y, z, image, data);
+    }
+}
+
+void StaticLayerCache::insert(uint64_t key, const mapnik::image_32 &image, const std::string &data)
+{
+    auto found = mIndex.find(key);
+    if (found != mIndex.end())
+    {
+        mMemoryUsed -= found->second->data.size();
+        mLru.erase(found->second);
+        mIndex.erase(found);
+    }
+
+    if (data.size() > mMemoryLimit) return;
+
+    while (!mLru.empty() && mMemoryUsed + data.size() > mMemoryLimit)
+    {
+        mMemoryUsed -= mLru.back().data.size();
+        mIndex.erase(mLru.back().key);
+        mLru.pop_back();
+    }
+
+    mLru.push_front(lru_entry{key, static_cast<unsigned int>(image.width()), static_cast<unsigned int>(image.height()), data});
+    mIndex[key] = mLru.begin();
+    mMemoryUsed += data.size();
+}
+
+/**
+ * Compress the raster. Static layers are mostly empty or uniform, so even
+ * the fastest zlib level makes them a lot smaller.
+ */
+bool StaticLayerCache::pack(const mapnik::image_32 &image, std::string &data) const
+{
+    uLongf len = compressBound(image.size());
+    data.resize(len);
+    if (compress2(reinterpret_cast<Bytef *>(&data[0]), &len, reinterpret_cast<const Bytef *>(image.bytes()), image.size(), Z_BEST_SPEED) != Z_OK)
+    {
+        return false;
+    }
+    data.resize(len);
+    return true;
+}
+
+bool StaticLayerCache::unpack(const std::string &data, mapnik::image_32 &image) const
+{
+    uLongf len = image.size();
+    return uncompress(reinterpret_cast<Bytef *>(image.bytes()), &len, reinterpret_cast<const Bytef *>(data.data()), data.size()) == Z_OK &&
+        len == image.size();
+}
+
+bool StaticLayerCache::readFile(int x, int y, int z, mapnik::image_32 &image, std::string &data) const
+{
+    std::string path = makePath(x, y, z);
+    std::ifstream infile(path, std::ios::in | std::ios::binary);
+    if (!infile) return false;
+
+    static_raster_header h;
+    infile.read(reinterpret_cast<char *>(&h), sizeof(h));
+    if (infile.fail() || memcmp(h.magic, "SLCZ", 4) || h.width != image.width() || h.height != image.height() ||
+        h.length > compressBound(image.size()))
+    {
+        warning("ignoring invalid static layer raster %s", path.c_str());
+        return false;
+    }
+
+    data.resize(h.length);
+    infile.read(&data[0], h.length);
+    if (infile.fail() || !unpack(data, image))
+    {
+        warning("ignoring broken static layer raster %s", path.c_str());
+        return false;
+    }
+
+    // the modification time tells cleanDisk() when the file was used last
+    utime(path.c_str(), NULL);
+
+    debug("read static layer raster %s", path.c_str());
+    return true;
+}
+
+void StaticLayerCache::writeFile(int x, int y, int z, const mapnik::image_32 &image, const std::string &data)
+{
+    std::string path = makePath(x, y, z);
+    try
+    {
+        boost::filesystem::create_directories(boost::filesystem::path(path).parent_path());
+    }
+    catch (std::exception const& ex)
+    {
+        error("cannot create directory for %s: %s", path.c_str(), ex.what());
+        return;
+    }
+
+    static_raster_header h;
+    memcpy(h.magic, "SLCZ", 4);
+    h.width = image.width();
+    h.height = image.height();
+    h.length = data.size();
+
+    std::string tmpfilename = path + "." + std::to_string(getpid()) + ".tmp";
+    std::ofstream outfile(tmpfilename, std::ios::out | std::ios::binary | std::ios::trunc);
+    outfile.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    outfile.write(data.data(), data.size());
+    outfile.close();
+
+    if (outfile.fail())
+    {
+        unlink(tmpfilename.c_str());
+        error("cannot write static layer raster %s", path.c_str());
+        return;
+    }
+
+    rename(tmpfilename.c_str(), path.c_str());
+    debug("created static layer raster %s", path.c_str());
+
+    // the other backend processes write into the same directory, so this
+    // is only an estimate, cleanDisk() finds out the real size
+    mDiskUsed += sizeof(h) + data.size();
+    if (mDiskLimit > 0 && mDiskUsed > mDiskLimit)
+    {
+        cleanDisk(mDiskLimit / 4 * 3);
+    }
+}
+
+/**
+ * Remove the least recently used files from the cache directory (of all
+ * styles) until it is not larger than target bytes.
+ */
+void StaticLayerCache::cleanDisk(uintmax_t target)
+{
+    std::vector<std::tuple<time_t, uintmax_t, boost::filesystem::path>> files;
+    uintmax_t total = 0;
+
+    try
+    {
+        if (!boost::filesystem::exists(mCacheRoot)) return;
+        for (boost::filesystem::recursive_directory_iterator itr(mCacheRoot), end; itr != end; ++itr)
+        {
+            if (!boost::filesystem::is_regular_file(itr->status())) continue;
+            uintmax_t size = boost::filesystem::file_size(itr->path());
+            files.push_back(std::make_tuple(boost::filesystem::last_write_time(itr->path()), size, itr->path()));
+            total += size;
+        }
+    }
+    catch (std::exception const& ex)
+    {
+        error("cannot read static layer cache directory %s: %s", mCacheRoot.c_str(), ex.what());
+        return;
+    }
+
+    mDiskUsed = total;
+    if (total <= target) return;
+
+    std::sort(files.begin(), files.end());
+    unsigned long removed = 0;
+    for (auto itr = files.begin(); itr != files.end() && mDiskUsed > target; itr++)
+    {
+        boost::system::error_code ec;
+        if (boost::filesystem::remove(std::get<2>(*itr), ec))
+        {
+            mDiskUsed -= std::get<1>(*itr);
+            removed++;
+        }
+    }
+    info("removed %lu static layer rasters from %s, %ju MB left", removed, mCacheRoot.c_str(), mDiskUsed / (1024 * 1024));
+}
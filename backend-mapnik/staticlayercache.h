@@ -0,0 +1,81 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+/**
+ * StaticLayerCache
+ *
+ * Keeps rendered rasters of the "static" layers of a style (layers that
+ * practically never change, like hillshading or coastlines) per metatile,
+ * so that a re-render only has to draw the dynamic layers on top of them.
+ *
+ * Rasters are kept zlib compressed in an in-memory LRU list of limited
+ * size and, if a cache directory is configured, also written to disk so
+ * that they survive backend restarts. The directory is limited in size
+ * too: when it grows beyond the limit, the least recently used files are
+ * removed. Entries are keyed by a hash over the style, so a changed style
+ * never picks up stale rasters (rasters of old styles are removed by the
+ * size limit eventually). If the data of a static layer changes, the cache
+ * directory has to be cleared by hand.
+ */
+
+#ifndef staticlayercache_included
+#define staticlayercache_included
+
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <unordered_map>
+
+#include "debuggable.h"
+#include "renderresponse.h"
+
+class StaticLayerCache : public Debuggable
+{
+    public:
+
+    StaticLayerCache(const std::string &cachedir, const std::string &stylehash, size_t memorylimit, uintmax_t disklimit);
+    ~StaticLayerCache();
+
+    bool get(int x, int y, int z, mapnik::image_32 &image);
+    void put(int x, int y, int z, const mapnik::image_32 &image);
+
+    unsigned long getHits() const { return mHits; }
+    unsigned long getMisses() const { return mMisses; }
+
+    private:
+
+    struct lru_entry {
+        uint64_t key;
+        unsigned int width;
+        unsigned int height;
+        std::string data;   // compressed raster
+    };
+
+    uint64_t makeKey(int x, int y, int z) const;
+    std::string makePath(int x, int y, int z) const;
+    bool pack(const mapnik::image_32 &image, std::string &data) const;
+    bool unpack(const std::string &data, mapnik::image_32 &image) const;
+    bool readFile(int x, int y, int z, mapnik::image_32 &image, std::string &data) const;
+    void writeFile(int x, int y, int z, const mapnik::image_32 &image, const std::string &data);
+    void cleanDisk(uintmax_t target);
+    void insert(uint64_t key, const mapnik::image_32 &image, const std::string &data);
+
+    std::string mCacheRoot;
+    std::string mCacheDir;
+    size_t mMemoryLimit;
+    size_t mMemoryUsed;
+    uintmax_t mDiskLimit;
+    uintmax_t mDiskUsed;
+    std::list<lru_entry> mLru;
+    std::unordered_map<uint64_t, std::list<lru_entry>::iterator> mIndex;
+    unsigned long mHits;
+    unsigned long mMisses;
+};
+
+#endif
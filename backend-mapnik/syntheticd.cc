@@ -0,0 +1,192 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+#include "syntheticd.h"
+
+#include <unistd.h>
+#include <exception>
+
+#include "synthetichandler.h"
+
+// options of the mapnik backend, ignored so that the map configs of a
+// mapnik setup can be used unchanged
+static const char *mapnik_options[] = { "scalefactor", "buffersize", "imagetype", "staticlayers", "staticcache_dir",
+    "staticcache_size", "staticcache_disk_size", "spatialindex", "profile", "profile_threshold", NULL };
+
+/**
+ * Parse the zoom level suffix of options like "render_time.12". Returns
+ * -1 for no suffix (all zoom levels), -2 if the suffix is invalid.
+ */
+static int zoom_suffix(const char *suffix)
+{
+    if (!*suffix) return -1;
+    if (*suffix != '.') return -2;
+
+    char *endptr;
+    long num = strtol(suffix + 1, &endptr, 10);
+    if (endptr == suffix + 1 || *endptr || num < 0 || num > MAXZOOM) return -2;
+    return num;
+}
+
+bool SyntheticDaemon::loadMapConfig(const char *configfile)
+{
+    std::string tiledir;
+    std::string stylename;
+    unsigned int tilesize = 256;
+    unsigned int mtrowcol = 8;
+    int tiledir_depth = 5;
+    std::string freshindex;
+    std::map<int, std::string> rendertimes;
+    std::map<int, std::string> tilesizes;
+    bool png = false;
+    bool busy = false;
+    double errorrate = 0;
+    unsigned int seed = 0;
+
+    bool ok = readMapConfig(configfile, [&](const char *name, char *value, int) {
+        if (!strcmp(name, "tiledir"))
+        {
+            tiledir.assign(value);
+        }
+        else if (!strcmp(name, "tiledir_depth"))
+        {
+            tiledir_depth = atoi(value);
+        }
+        else if (!strcmp(name, "tilesize"))
+        {
+            tilesize = atoi(value);
+        }
+        else if (!strcmp(name, "metarowscols"))
+        {
+            mtrowcol = atoi(value);
+        }
+        else if (!strcmp(name, "maxrequests"))
+        {
+            mMaxRequests = atoi(value);
+        }
+        else if (!strcmp(name, "name"))
+        {
+            stylename.assign(value);
+        }
+        else if (!strcmp(name, "freshindex"))
+        {
+            freshindex.assign(value);
+        }
+        else if (!strncmp(name, "render_time", 11) && zoom_suffix(name + 11) >= -1)
+        {
+            rendertimes[zoom_suffix(name + 11)] = value;
+        }
+        else if (!strncmp(name, "tile_sizes", 10) && zoom_suffix(name + 10) >= -1)
+        {
+            tilesizes[zoom_suffix(name + 10)] = value;
+        }
+        else if (!strcmp(name, "png"))
+        {
+            png = atoi(value);
+        }
+        else if (!strcmp(name, "busy"))
+        {
+            busy = atoi(value);
+        }
+        else if (!strcmp(name, "error_rate"))
+        {
+            errorrate = atof(value);
+        }
+        else if (!strcmp(name, "seed"))
+        {
+            seed = strtoul(value, NULL, 10);
+        }
+        else
+        {
+            bool mapnik_option = !strncmp(name, "mapfile", 7);
+            for (const char **o = mapnik_options; *o; o++)
+            {
+                if (!strcmp(name, *o)) mapnik_option = true;
+            }
+            return mapnik_option;
+        }
+        return true;
+    });
+    if (!ok) return false;
+
+    if (tiledir.empty())
+    {
+        warning("cannot add %s: missing tiledir option", configfile);
+        return false;
+    }
+
+    if (access(tiledir.c_str(), W_OK) == -1)
+    {
+        warning("cannot add %s: tile directory '%s' not accessible", configfile, tiledir.c_str());
+        return false;
+    }
+
+    if (stylename.empty())
+    {
+        warning("cannot add %s: missing name option", configfile);
+        return false;
+    }
+
+    SyntheticHandler *handler;
+    try
+    {
+        handler = new SyntheticHandler(tiledir, tiledir_depth, tilesize, mtrowcol);
+    }
+    catch (std::exception const& ex)
+    {
+        warning("cannot add %s", configfile);
+        warning("%s", ex.what());
+        return false;
+    }
+
+    for (auto itr = rendertimes.begin(); itr != rendertimes.end(); itr++)
+    {
+        if (!handler->setRenderTime(itr->first, itr->second))
+        {
+            warning("cannot add %s: invalid render time distribution '%s'", configfile, itr->second.c_str());
+            delete handler;
+            return false;
+        }
+    }
+    for (auto itr = tilesizes.begin(); itr != tilesizes.end(); itr++)
+    {
+        if (!handler->setTileSizes(itr->first, itr->second))
+        {
+            warning("cannot add %s: invalid tile size histogram '%s'", configfile, itr->second.c_str());
+            delete handler;
+            return false;
+        }
+    }
+    handler->setPng(png);
+    handler->setBusy(busy);
+    handler->setErrorRate(errorrate);
+    handler->setSeed(seed);
+    if (!freshindex.empty()) handler->setFreshnessIndex(freshindex);
+    handler->setStatusReceiver(this);
+    mHandlerMap[stylename] = handler;
+    debug("added synthetic style '%s' from map %s", stylename.c_str(), configfile);
+    return true;
+}
+
+SyntheticDaemon::SyntheticDaemon(int argc, char **argv) :
+    BackendDaemon(argc, argv, "tirex-backend-synthetic", "synthetic")
+{
+    loadMapConfigs();
+}
+
+SyntheticDaemon::~SyntheticDaemon()
+{
+}
+
+int main(int argc, char **argv)
+{
+    SyntheticDaemon sd(argc, argv);
+    sd.run();
+    exit(9); // return with EXIT_CODE_RESTART==9 which means everything is ok, the backend can be restarted if the backend-manager wants to
+}
@@ -0,0 +1,36 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+/**
+ * SyntheticDaemon
+ *
+ * The synthetic backend: the network loop of the mapnik backend with a
+ * SyntheticHandler for every map instead of Mapnik (see there). It does
+ * not link against Mapnik and needs no database, so it can be used to
+ * load test the master, the tile storage and tile syncing.
+ */
+
+#ifndef syntheticd_included
+#define syntheticd_included
+
+#include "backenddaemon.h"
+
+class SyntheticDaemon : public BackendDaemon
+{
+    private:
+
+    bool loadMapConfig(const char *file);
+
+    public:
+
+    SyntheticDaemon(int argc, char **argv);
+    ~SyntheticDaemon();
+};
+
+#endif
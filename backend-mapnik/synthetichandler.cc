@@ -0,0 +1,394 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+#include "synthetichandler.h"
+#include "tracer.h"
+
+#include <sys/time.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <chrono>
+#include <numeric>
+#include <sstream>
+
+// sizes of typical metatiles of a street map: many empty (sea or land)
+// tiles of about 100 bytes, the rest spread over a few kB to tens of kB
+#define DEFAULT_TILE_SIZES "103:40,2000:20,10000:25,30000:10,80000:5"
+
+// size of the random filler the tiles are cut from if they are not PNGs
+#define FILLER_SIZE (1024 * 1024)
+
+RenderTimeDistribution::RenderTimeDistribution() :
+    mType(FIXED),
+    mA(0),
+    mB(0)
+{
+}
+
+bool RenderTimeDistribution::parse(const std::string& spec)
+{
+    size_t colon = spec.find(':');
+    if (colon == std::string::npos) return false;
+
+    std::string type = spec.substr(0, colon);
+    std::vector<double> params;
+    std::istringstream in(spec.substr(colon + 1));
+    std::string param;
+    while (std::getline(in, param, ','))
+    {
+        char *end;
+        double value = strtod(param.c_str(), &end);
+        if (param.empty() || *end || value < 0) return false;
+        params.push_back(value);
+    }
+
+    unsigned int needed = 2;
+    if (type == "fixed") { mType = FIXED; needed = 1; }
+    else if (type == "uniform") mType = UNIFORM;
+    else if (type == "normal") mType = NORMAL;
+    else if (type == "lognormal") mType = LOGNORMAL;
+    else if (type == "exponential") { mType = EXPONENTIAL; needed = 1; }
+    else return false;
+
+    if (params.size() != needed) return false;
+    if (mType == UNIFORM && params[1] < params[0]) return false;
+    if (mType == LOGNORMAL && params[0] <= 0) return false;
+
+    mA = params[0];
+    mB = needed > 1 ? params[1] : 0;
+    return true;
+}
+
+double RenderTimeDistribution::draw(std::mt19937& rng) const
+{
+    double ms = mA;
+    switch (mType)
+    {
+        case FIXED:
+            break;
+        case UNIFORM:
+            ms = std::uniform_real_distribution<double>(mA, mB)(rng);
+            break;
+        case NORMAL:
+            ms = std::normal_distribution<double>(mA, mB)(rng);
+            break;
+        case LOGNORMAL:
+            ms = std::lognormal_distribution<double>(log(mA), mB)(rng);
+            break;
+        case EXPONENTIAL:
+            if (mA > 0) ms = std::exponential_distribution<double>(1 / mA)(rng);
+            break;
+    }
+    return ms < 0 ? 0 : ms;
+}
+
+TileSizeHistogram::TileSizeHistogram()
+{
+}
+
+bool TileSizeHistogram::parse(const std::string& spec)
+{
+    std::vector<unsigned int> sizes;
+    std::vector<double> weights;
+    std::istringstream in(spec);
+    std::string bucket;
+    while (std::getline(in, bucket, ','))
+    {
+        char *end;
+        unsigned long size = strtoul(bucket.c_str(), &end, 10);
+        if (end == bucket.c_str() || *end != ':' || size == 0 || size > 0x7fffffff) return false;
+        if (!sizes.empty() && size <= sizes.back()) return false;
+        char *wend;
+        double weight = strtod(end + 1, &wend);
+        if (wend == end + 1 || *wend || weight < 0) return false;
+        sizes.push_back(size);
+        weights.push_back(weight);
+    }
+    if (sizes.empty() || std::accumulate(weights.begin(), weights.end(), 0.0) <= 0) return false;
+
+    mSizes = sizes;
+    mWeights = weights;
+    return true;
+}
+
+unsigned int TileSizeHistogram::draw(std::mt19937& rng) const
+{
+    unsigned int bucket = std::discrete_distribution<unsigned int>(mWeights.begin(), mWeights.end())(rng);
+    if (bucket == 0) return mSizes[0];
+    return std::uniform_int_distribution<unsigned int>(mSizes[bucket-1] + 1, mSizes[bucket])(rng);
+}
+
+static std::string png_uint32(uint32_t value)
+{
+    char buf[4] = { static_cast<char>(value >> 24), static_cast<char>(value >> 16), static_cast<char>(value >> 8), static_cast<char>(value) };
+    return std::string(buf, 4);
+}
+
+static std::string png_chunk(const char *type, const std::string& data)
+{
+    uLong crc = crc32(0, reinterpret_cast<const Bytef *>(type), 4);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(data.data()), data.size());
+    return png_uint32(data.size()) + std::string(type, 4) + data + png_uint32(crc);
+}
+
+SyntheticHandler::SyntheticHandler(const std::string& tiledir, unsigned int tiledir_depth, unsigned int tilesize, unsigned int mtrowcol) :
+    mTileSize(tilesize),
+    mMetaTileRows(mtrowcol),
+    mMetaTileColumns(mtrowcol),
+    mWriter(tiledir, tiledir_depth, mtrowcol, mtrowcol),
+    mPng(false),
+    mBusy(false),
+    mErrorRate(0),
+    mSeed(0),
+    mErrorRng(static_cast<unsigned int>(getpid()) ^ static_cast<unsigned int>(time(NULL)))
+{
+    mRenderTimes[-1].parse("fixed:0");
+    mTileSizes[-1].parse(DEFAULT_TILE_SIZES);
+
+    // incompressible filler for the tiles if they are not PNGs, extended
+    // when a larger tile is needed
+    std::mt19937 rng(0);
+    mFiller.resize(FILLER_SIZE);
+    for (auto itr = mFiller.begin(); itr != mFiller.end(); itr++) *itr = static_cast<char>(rng());
+}
+
+SyntheticHandler::~SyntheticHandler()
+{
+}
+
+/**
+ * Set the render time distribution for a zoom level, or for all zoom
+ * levels without their own if zoom is -1.
+ */
+bool SyntheticHandler::setRenderTime(int zoom, const std::string& spec)
+{
+    RenderTimeDistribution dist;
+    if (!dist.parse(spec)) return false;
+    mRenderTimes[zoom] = dist;
+    return true;
+}
+
+/**
+ * Set the tile size histogram for a zoom level, or for all zoom levels
+ * without their own if zoom is -1.
+ */
+bool SyntheticHandler::setTileSizes(int zoom, const std::string& spec)
+{
+    TileSizeHistogram hist;
+    if (!hist.parse(spec)) return false;
+    mTileSizes[zoom] = hist;
+    return true;
+}
+
+/**
+ * Write real PNG images (light and dark grey tiles in a checkerboard
+ * pattern, padded to the size drawn) instead of random bytes, for tests
+ * of tile servers that look into the tiles.
+ */
+void SyntheticHandler::setPng(bool png)
+{
+    mPng = png;
+    if (mPng && mPngs[0].empty())
+    {
+        mPngs[0] = makePng(0xf2);
+        mPngs[1] = makePng(0xaa);
+    }
+}
+
+void SyntheticHandler::setFreshnessIndex(const std::string& dir)
+{
+    mWriter.setFreshnessIndex(dir);
+}
+
+const RenderTimeDistribution& SyntheticHandler::renderTime(int zoom) const
+{
+    auto itr = mRenderTimes.find(zoom);
+    return itr != mRenderTimes.end() ? itr->second : mRenderTimes.at(-1);
+}
+
+const TileSizeHistogram& SyntheticHandler::tileSizes(int zoom) const
+{
+    auto itr = mTileSizes.find(zoom);
+    return itr != mTileSizes.end() ? itr->second : mTileSizes.at(-1);
+}
+
+/**
+ * Spend ms milliseconds "rendering": sleeping, or with busy set burning
+ * CPU, so that load based limits of the master see a realistic load.
+ */
+void SyntheticHandler::simulate(double ms) const
+{
+    if (ms <= 0) return;
+
+    if (mBusy)
+    {
+        auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(static_cast<long>(ms * 1000));
+        volatile unsigned long spin = 0;
+        while (std::chrono::steady_clock::now() < end)
+        {
+            for (int i = 0; i < 1000; i++) spin = spin + i;
+        }
+    }
+    else
+    {
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(ms / 1000);
+        ts.tv_nsec = static_cast<long>((ms - ts.tv_sec * 1000.0) * 1000000);
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+    }
+}
+
+/**
+ * A tile of the given size: random bytes or a PNG, padded with a private
+ * ancillary chunk that PNG decoders skip. The random bytes are cut from
+ * the filler (wrapping around at its end) at a position drawn from rng,
+ * so that tiles don't share a common prefix that compresses or dedupes.
+ */
+std::string SyntheticHandler::makeTile(unsigned int size, bool dark, std::mt19937& rng)
+{
+    if (mPng)
+    {
+        const std::string& png = mPngs[dark ? 1 : 0];
+        if (size <= png.size() + 12) return png;
+
+        // the IEND chunk at the end of the image is 12 bytes
+        std::string padding(size - png.size() - 12, '\0');
+        return png.substr(0, png.size() - 12) + png_chunk("tiRx", padding) + png.substr(png.size() - 12);
+    }
+
+    if (size > mFiller.size())
+    {
+        std::mt19937 rng(mFiller.size());
+        size_t old = mFiller.size();
+        mFiller.resize(size);
+        for (size_t i = old; i < size; i++) mFiller[i] = static_cast<char>(rng());
+    }
+
+    size_t start = std::uniform_int_distribution<size_t>(0, mFiller.size() - 1)(rng);
+    std::string tile = mFiller.substr(start, size);
+    if (tile.size() < size) tile += mFiller.substr(0, size - tile.size());
+    return tile;
+}
+
+/**
+ * A single colour tile, 1 bit with a palette like the empty tiles
+ * Mapnik writes with png256, so it is about as small.
+ */
+std::string SyntheticHandler::makePng(unsigned char grey) const
+{
+    // every row starts with filter type 0, all pixels have palette index 0
+    unsigned int rowbytes = (mTileSize + 7) / 8;
+    std::string raw((rowbytes + 1) * mTileSize, '\0');
+
+    uLongf length = compressBound(raw.size());
+    std::string idat(length, '\0');
+    compress2(reinterpret_cast<Bytef *>(&idat[0]), &length, reinterpret_cast<const Bytef *>(raw.data()), raw.size(), Z_BEST_COMPRESSION);
+    idat.resize(length);
+
+    std::string ihdr = png_uint32(mTileSize) + png_uint32(mTileSize) + std::string("\x01\x03\x00\x00\x00", 5);
+    std::string plte(3, static_cast<char>(grey));
+
+    return std::string("\x89PNG\r\n\x1a\n", 8) + png_chunk("IHDR", ihdr) + png_chunk("PLTE", plte) + png_chunk("IDAT", idat) + png_chunk("IEND", "");
+}
+
+NetworkResponse *SyntheticHandler::handleRequest(const NetworkRequest *request)
+{
+    debug(">> SyntheticHandler::handleRequest");
+    timeval start, end;
+    gettimeofday(&start, NULL);
+
+    int x = request->getParam("x", -1);
+    int y = request->getParam("y", -1);
+    int z = request->getParam("z", -1);
+
+    if (z < 0 || z > MAXZOOM)
+    {
+        error("given value for 'z' (%d) is out of range", z);
+        return NetworkResponse::makeErrorResponse(request, "invalid value for z");
+    }
+
+    if (x < 0 || x % mMetaTileColumns)
+    {
+        error("given value for 'x' (%d) is not divisible by %d", x, mMetaTileColumns);
+        return NetworkResponse::makeErrorResponse(request, "invalid value for x");
+    }
+
+    if (y < 0 || y % mMetaTileRows)
+    {
+        error("given value for 'y' (%d) is not divisible by %d", y, mMetaTileRows);
+        return NetworkResponse::makeErrorResponse(request, "invalid value for y");
+    }
+
+    // tiles outside of the world on low zoom levels stay empty
+    unsigned int mtc = mMetaTileColumns;
+    if (mtc > 1u << z) mtc = 1u << z;
+    unsigned int mtr = mMetaTileRows;
+    if (mtr > 1u << z) mtr = 1u << z;
+
+    std::string map = request->getParam("map", "default");
+    std::string id = request->getParam("id", "");
+
+    std::seed_seq seed{ mSeed, static_cast<unsigned int>(z), static_cast<unsigned int>(x), static_cast<unsigned int>(y) };
+    std::mt19937 rng(seed);
+
+    long long render_start = Tracer::now();
+    updateStatus("rendering z=%d x=%d y=%d map=%s", z, x, y, map.c_str());
+    simulate(renderTime(z).draw(rng));
+    updateStatus("idle");
+    long long encode_start = Tracer::now();
+    Tracer::span("render", id, render_start, encode_start);
+
+    if (mErrorRate > 0 && std::uniform_real_distribution<double>(0, 1)(mErrorRng) < mErrorRate)
+    {
+        return NetworkResponse::makeErrorResponse(request, "simulated error");
+    }
+
+    const TileSizeHistogram& sizes = tileSizes(z);
+    std::vector<std::string> tiles(mMetaTileRows * mMetaTileColumns);
+    int index = 0;
+    for (unsigned int col = 0; col < mMetaTileColumns; col++)
+    {
+        for (unsigned int row = 0; row < mMetaTileRows; row++)
+        {
+            if ((col < mtc) && (row < mtr))
+            {
+                tiles[index] = makeTile(sizes.draw(rng), (col + row) % 2, rng);
+            }
+            index++;
+        }
+    }
+
+    long long write_start = Tracer::now();
+    Tracer::span("encode", id, encode_start, write_start);
+
+    std::string metafilename;
+    if (!mWriter.write(x, y, z, tiles, metafilename))
+    {
+        return NetworkResponse::makeErrorResponse(request, "%s", mWriter.getError().c_str());
+    }
+    Tracer::span("write", id, write_start, Tracer::now());
+
+    NetworkResponse *resp = new NetworkResponse(request);
+    resp->setParam("map", map);
+    resp->setParam("result", "ok");
+    resp->setParam("x", x);
+    resp->setParam("y", y);
+    resp->setParam("z", z);
+    resp->setParam("metatile", metafilename);
+    gettimeofday(&end, NULL);
+    char buffer[20];
+    snprintf(buffer, 20, "%ld", (end.tv_sec-start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000);
+    resp->setParam("render_time", buffer);
+
+    debug("<< SyntheticHandler::handleRequest");
+    return resp;
+}
@@ -0,0 +1,119 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+/**
+ * SyntheticHandler
+ *
+ * Handles metatile requests like MetatileHandler, but without rendering
+ * anything: it waits for a render time drawn from a configurable
+ * distribution and writes a metatile with tiles of sizes drawn from a
+ * histogram through the same MetatileWriter. This allows load tests of
+ * the master, the tile storage and tile syncing at rates no database
+ * could render.
+ *
+ * Render time and tile sizes are drawn from a random generator seeded
+ * with the metatile coordinates, so the same metatile always takes the
+ * same time and has the same size, in every process and every run.
+ */
+
+#ifndef synthetichandler_included
+#define synthetichandler_included
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "requesthandler.h"
+#include "networkrequest.h"
+#include "networkresponse.h"
+#include "metatilewriter.h"
+
+/**
+ * Render time distribution in milliseconds, given as
+ * "fixed:MS", "uniform:MIN,MAX", "normal:MEAN,STDDEV",
+ * "lognormal:MEDIAN,SIGMA" or "exponential:MEAN".
+ */
+class RenderTimeDistribution
+{
+    public:
+
+    RenderTimeDistribution();
+    bool parse(const std::string& spec);
+    double draw(std::mt19937& rng) const;
+
+    private:
+
+    enum { FIXED, UNIFORM, NORMAL, LOGNORMAL, EXPONENTIAL } mType;
+    double mA;
+    double mB;
+};
+
+/**
+ * Tile size histogram, given as comma separated "BYTES:WEIGHT" pairs with
+ * increasing sizes. A bucket is chosen by weight and the size is drawn
+ * uniformly between the size of the previous bucket and its own. Tiles
+ * from the first bucket have exactly its size, it is meant for empty
+ * tiles.
+ */
+class TileSizeHistogram
+{
+    public:
+
+    TileSizeHistogram();
+    bool parse(const std::string& spec);
+    unsigned int draw(std::mt19937& rng) const;
+
+    private:
+
+    std::vector<unsigned int> mSizes;
+    std::vector<double> mWeights;
+};
+
+class SyntheticHandler : public RequestHandler
+{
+    public:
+
+    SyntheticHandler(const std::string& tiledir, unsigned int tiledir_depth, unsigned int tilesize, unsigned int mtrowcol);
+    ~SyntheticHandler();
+    NetworkResponse *handleRequest(const NetworkRequest *request);
+    const std::string getRequestType() const { return "metatile_request"; }
+
+    bool setRenderTime(int zoom, const std::string& spec);
+    bool setTileSizes(int zoom, const std::string& spec);
+    void setPng(bool png);
+    void setBusy(bool busy) { mBusy = busy; }
+    void setErrorRate(double rate) { mErrorRate = rate; }
+    void setSeed(unsigned int seed) { mSeed = seed; }
+    void setFreshnessIndex(const std::string& dir);
+
+    private:
+
+    const RenderTimeDistribution& renderTime(int zoom) const;
+    const TileSizeHistogram& tileSizes(int zoom) const;
+    void simulate(double ms) const;
+    std::string makeTile(unsigned int size, bool dark, std::mt19937& rng);
+    std::string makePng(unsigned char grey) const;
+
+    unsigned int mTileSize;
+    unsigned int mMetaTileRows;
+    unsigned int mMetaTileColumns;
+    MetatileWriter mWriter;
+    std::map<int, RenderTimeDistribution> mRenderTimes;    // zoom (-1: all) -> distribution
+    std::map<int, TileSizeHistogram> mTileSizes;           // zoom (-1: all) -> histogram
+    bool mPng;
+    bool mBusy;
+    double mErrorRate;
+    unsigned int mSeed;
+    std::string mFiller;
+    std::string mPngs[2];
+    std::mt19937 mErrorRng;
+};
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+#include "tracer.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+int Tracer::msFd = -1;
+
+bool Tracer::open(const char *filename)
+{
+    msFd = ::open(filename, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (msFd < 0) return false;
+
+    // the closing bracket is optional in the trace event format, so
+    // the file only needs the opening one.
+    struct stat st;
+    if (!fstat(msFd, &st) && st.st_size == 0)
+    {
+        if (write(msFd, "[\n", 2)) {};
+    }
+    return true;
+}
+
+/**
+ * Current time in microseconds since the epoch.
+ */
+long long Tracer::now()
+{
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<long long>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+void Tracer::span(const char *name, const std::string& id, long long start, long long end)
+{
+    if (msFd < 0) return;
+
+    // ids are generated by the master and never need escaping, but make
+    // sure we don't write broken JSON if someone sends us something odd.
+    std::string safeid;
+    for (std::string::const_iterator c = id.begin(); c != id.end(); c++)
+    {
+        if (*c != '"' && *c != '\\' && *c >= ' ') safeid += *c;
+    }
+
+    char buffer[512];
+    int len = snprintf(buffer, sizeof(buffer),
+        "{\"name\":\"%s\",\"cat\":\"backend\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d,\"args\":{\"id\":\"%s\"}},\n",
+        name, start, end - start, getpid(), getpid(), safeid.c_str());
+    if (len > 0 && len < static_cast<int>(sizeof(buffer)))
+    {
+        // a single write per event so that events from several processes
+        // appending to the same file don't get mixed up
+        if (write(msFd, buffer, len)) {};
+    }
+}
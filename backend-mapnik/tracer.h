@@ -0,0 +1,40 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Mapnik rendering backend
+ *
+ * Originally written by Jochen Topf & Frederik Ramm.
+ *
+ */
+
+/**
+ * Tracer
+ *
+ * Writes trace spans for rendering jobs to an append-only file in the
+ * Trace Event Format understood by chrome://tracing and Perfetto. The
+ * master writes its spans in the same format (see Tirex::Trace), keyed
+ * by the same job id.
+ *
+ * Tracing is off unless a trace file was opened.
+ */
+
+#ifndef tracer_included
+#define tracer_included
+
+#include <string>
+
+class Tracer
+{
+    public:
+
+    static bool open(const char *filename);
+    static bool enabled() { return msFd >= 0; }
+    static long long now();
+    static void span(const char *name, const std::string& id, long long start, long long end);
+
+    private:
+
+    static int msFd;
+};
+
+#endif
@@ -67,6 +67,8 @@ our $MASTER_SYSLOG_FACILITY          = 'daemon';
 our $MASTER_PIDFILE                  = '/run/tirex/tirex-master.pid';
 our $MASTER_LOGFILE                  = '/var/log/tirex/jobs.log';
 our $MASTER_RENDERING_TIMEOUT        = 60; # minutes
+our $MASTER_COST_FILE                = '/var/cache/tirex/stats/costs';
+our $MASTER_QUEUE_FILE               = '/var/cache/tirex/stats/queue';
 
 our $BACKEND_MANAGER_SYSLOG_FACILITY = 'daemon';
 our $BACKEND_MANAGER_PIDFILE         = '/run/tirex/tirex-backend-manager.pid';
@@ -87,12 +89,16 @@ our $MODTILE_PERM                    = 0666;
 =head2 Tirex::parse_msg($string)
 
 Parse a message with linefeed separated var=value assignments into a hash ref. Carriage returns are removed.
+Messages in the binary format (see L<Tirex::Message>) are decoded, malformed ones give an empty hash.
 
 =cut
 
 sub parse_msg
 {
     my $string = shift;
+
+    return Tirex::Message::decode_binary($string) || {} if (Tirex::Message::is_binary($string));
+
     my $msg;
     foreach (split(/\r?\n/m, $string))
     {
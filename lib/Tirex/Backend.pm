@@ -16,6 +16,7 @@ use GD;
 use Tirex;
 use Tirex::Renderer;
 use Tirex::Map;
+use Tirex::Status;
 
 #-----------------------------------------------------------------------------
 
@@ -88,6 +89,33 @@ sub set_status
     $0 = $self->{'name'} . ': ' . $text;
 }
 
+=head2 $backend->update_worker_status(state => 'rendering', map => ..., ...)
+
+Update the status slot of this worker in the shared memory of the master (see
+L<Tirex::Status/update_worker>). Does nothing if the backend manager didn't
+assign a slot or if the master isn't running.
+
+=cut
+
+sub update_worker_status
+{
+    my $self = shift;
+    my %args = @_;
+
+    my $slot = $self->{'status_slot'};
+    return unless (defined $slot && $slot >= 0);
+
+    $self->{'status'} = eval { Tirex::Status->new() } unless (defined $self->{'status'});
+    return unless (defined $self->{'status'});
+
+    $self->{'status'}->update_worker($slot,
+        renderer => $self->{'renderer_name'},
+        rendered => $self->{'count_rendered'},
+        errors   => $self->{'count_errors'},
+        %args,
+    );
+}
+
 
 =head2 $backend->main()
 
@@ -109,6 +137,11 @@ sub main
     my $pipe_fileno     = $ENV{'TIREX_BACKEND_PIPE_FILENO'}     or $self->error_disable('missing TIREX_BACKEND_PIPE_FILENO');
     my $socket_fileno   = $ENV{'TIREX_BACKEND_SOCKET_FILENO'};
 
+    $self->{'renderer_name'}  = $renderer_name;
+    $self->{'status_slot'}    = $ENV{'TIREX_BACKEND_STATUS_SLOT'};
+    $self->{'count_rendered'} = 0;
+    $self->{'count_errors'}   = 0;
+
     $Tirex::DEBUG = 1 if (defined $ENV{'TIREX_BACKEND_DEBUG'});
 
     my @mapfiles = split(' ', $mapfiles);
@@ -172,16 +205,28 @@ sub main
         alarm($alive_timeout);
 
         $self->set_status('idle');
+        $self->update_worker_status(state => 'idle');
 
         # this will block waiting for new commands on socket
         # if a signal comes in (ALRM or from parent) it will return with EINTR
-        my $msg = Tirex::Message->new_from_socket($socket);
-        if (! $msg)
+        my $buf;
+        if (! $socket->recv($buf, $Tirex::MAX_PACKET_SIZE))
         {
             next if ($!{'EINTR'});
             $self->error_restart("error reading from socket: $!");
         }
 
+        # answer in the format of the request
+        my $binary = Tirex::Message::is_binary($buf);
+        my $msg = eval { Tirex::Message->new_from_string($buf) };
+        if (! $msg)
+        {
+            my $error = $@;
+            chomp $error;
+            ::syslog('warning', 'ignoring invalid request: %s', $error);
+            next;
+        }
+
         alarm(0);
 
         ::syslog('debug', 'got request: %s', $msg->to_s()) if ($Tirex::DEBUG);
@@ -192,6 +237,8 @@ sub main
 
         if ($map)
         {
+            $self->update_worker_status(state => 'rendering', map => $map->get_name(), x => $msg->{'x'}, y => $msg->{'y'}, z => $msg->{'z'}, job_started => int(Time::HiRes::time() * 1000));
+
             my $metatile  = $msg->to_metatile();
             my $filename  = $map->get_tiledir() . '/' . $metatile->get_filename();
 
@@ -207,12 +254,14 @@ sub main
 
                 $msg = $msg->reply();
                 $msg->{'render_time'} = int(Time::HiRes::tv_interval($t0) * 1000); # in milliseconds
+                $self->{'count_rendered'}++;
 
                 ::syslog('debug', 'sending response: %s', $msg->to_s()) if ($Tirex::DEBUG);
             }
             else
             {
                 ::syslog('err', 'backend error');
+                $self->{'count_errors'}++;
                 $msg = $msg->reply('ERROR_BACKEND', 'The backend failed to produce a meta tile');
             }
         }
@@ -221,7 +270,7 @@ sub main
             ::syslog('err', 'unknown map: %s', $msg->{'map'});
             $msg = $msg->reply('ERROR_UNKNOWN_MAP', "The map " . $msg->{'map'} . " is unknown to renderer " . $renderer_name);
         }
-        $msg->send($socket) or $self->error_restart("error when sending: $!");
+        $msg->send($socket, undef, $binary) or $self->error_restart("error when sending: $!");
 
         ::syslog('debug', 'done with request') if ($Tirex::DEBUG);
     }
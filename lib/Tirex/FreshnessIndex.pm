@@ -0,0 +1,143 @@
+#-----------------------------------------------------------------------------
+#
+#  Tirex/FreshnessIndex.pm
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Carp;
+use Fcntl;
+
+#-----------------------------------------------------------------------------
+
+package Tirex::FreshnessIndex;
+
+my $HEADER_SIZE = 64;
+my $MAX_ZOOM    = 20;
+
+my %indexes;
+
+=head1 NAME
+
+Tirex::FreshnessIndex - read the metatile freshness index of a map
+
+=head1 SYNOPSIS
+
+ use Tirex::FreshnessIndex;
+
+ my $index = Tirex::FreshnessIndex->new( dir => '/var/cache/tirex/freshness/example' );
+ my $time = $index->get($z, $x, $y);
+
+=head1 DESCRIPTION
+
+The freshness index keeps the time each metatile of a map was last
+rendered. It is written by the mapnik backend (and tirex-expire) for maps
+with the I<freshindex> option in their config, see native/freshindex.h for
+the format: one file per zoom level up to zoom level 20 with a 64 byte
+header and one 32 bit time in host byte order per metatile, 0 if the
+metatile was never rendered. Metatiles written before the index existed
+or by other backends are not in the index, so for 0 the metatile file has
+to be checked (L<Tirex::Metatile> does that).
+
+This module only reads single entries. To query large areas use the
+tirex-freshness command.
+
+=head1 METHODS
+
+=head2 Tirex::FreshnessIndex->new( dir => $dir )
+
+Create new index reader. The files are only opened when needed.
+
+=cut
+
+sub new
+{
+    my $class = shift;
+    my %args  = @_;
+    my $self  = bless \%args => $class;
+
+    Carp::croak("need dir for freshness index") unless (defined $self->{'dir'});
+
+    $self->{'columns'} ||= $Tirex::METATILE_COLUMNS;
+    $self->{'rows'}    ||= $Tirex::METATILE_ROWS;
+    $self->{'zooms'}     = {};
+
+    return $self;
+}
+
+=head2 Tirex::FreshnessIndex->for_map($map)
+
+Get the (cached) index reader for the map or undef if the map has no
+freshness index.
+
+=cut
+
+sub for_map
+{
+    my $class = shift;
+    my $map   = shift;
+
+    my $dir = $map->{'freshindex'};
+    return unless (defined $dir && $dir ne '');
+
+    $indexes{$dir} ||= $class->new( dir => $dir );
+
+    return $indexes{$dir};
+}
+
+=head2 $index->get($z, $x, $y)
+
+Get the time (seconds since the epoch) the metatile containing the tile
+z/x/y was last rendered, 0 if it was never rendered. Returns undef if
+there is no index for this zoom level.
+
+=cut
+
+sub get
+{
+    my $self = shift;
+    my $z    = shift;
+    my $x    = shift;
+    my $y    = shift;
+
+    my $zf = $self->_open($z) or return;
+
+    my $mx = int($x / $self->{'columns'});
+    my $my = int($y / $self->{'rows'});
+    return 0 if ($mx >= $zf->{'width'} || $my >= $zf->{'height'});
+
+    my $buf = '';
+    sysseek($zf->{'fh'}, $HEADER_SIZE + ($my * $zf->{'width'} + $mx) * 4, Fcntl::SEEK_SET) or return;
+    sysread($zf->{'fh'}, $buf, 4) == 4 or return;
+
+    return unpack('L', $buf);
+}
+
+sub _open
+{
+    my $self = shift;
+    my $z    = shift;
+
+    return if ($z < 0 || $z > $MAX_ZOOM);
+    return $self->{'zooms'}->{$z} if (exists $self->{'zooms'}->{$z});
+
+    $self->{'zooms'}->{$z} = undef;
+
+    sysopen(my $fh, "$self->{'dir'}/$z.fresh", Fcntl::O_RDONLY) or return;
+
+    my $header = '';
+    sysread($fh, $header, $HEADER_SIZE) == $HEADER_SIZE or return;
+    my ($magic, $zoom, $columns, $rows, $width, $height) = unpack('a8 L5', $header);
+    return unless ($magic eq 'TIREXFI1' && $zoom == $z && $columns == $self->{'columns'} && $rows == $self->{'rows'});
+
+    $self->{'zooms'}->{$z} = { fh => $fh, width => $width, height => $height };
+
+    return $self->{'zooms'}->{$z};
+}
+
+
+1;
+
+#-- THE END ------------------------------------------------------------------
@@ -10,6 +10,8 @@ use warnings;
 use Carp;
 use List::Util qw();
 
+use Tirex::Trace;
+
 #-----------------------------------------------------------------------------
 
 package Tirex::Job;
@@ -43,6 +45,7 @@ It can have any or all of the following parameters:
 
  expire       -- the time when this job will expire (seconds since epoch)
  request_time -- the time when this request came in (seconds since epoch, will be set to current time if not set)
+ source       -- name of the source of the request (see L<Tirex::Queue::Fairness>)
 
 =cut
 
@@ -60,6 +63,7 @@ sub new
     $self->{'success'} = 0;
     $self->{'request_time'} = time unless (defined $self->{'request_time'});
     $self->{'id'} = $self->{'request_time'} . "_" . ($self + 0);
+    $self->{'trace_queued'} = Tirex::Trace->now() if (Tirex::Trace->enabled());
 
     return $self;
 }
@@ -264,6 +268,33 @@ sub set_bucket
     return;
 }
 
+=head2 $job->get_source()
+
+Get name of the source of this job.
+
+=cut
+
+sub get_source
+{
+    my $self = shift;
+
+    return $self->{'source'};
+}
+
+=head2 $job->set_source($source)
+
+Set name of the source of this job.
+
+=cut
+
+sub set_source
+{
+    my $self = shift;
+
+    $self->{'source'} = shift;
+    return;
+}
+
 =head2 $job->get_success()
 
 Get success flag for this job.
@@ -313,6 +344,7 @@ Merge two jobs for the same metatile into one. This method will look into both j
  * expire will be the maximum of the expire times of the old jobs, if there is no expire time for at least one job, the result will have no expire time either
  * notify will be the concatenation of both notifies
  * request_time will be the minimum of both request times
+ * source will be the source of the job with the higher priority, of the second job if both have the same
 
 This methods assumes that the metatiles are the same, it does no check.
 
@@ -328,6 +360,7 @@ sub merge
         request_time => List::Util::min($self->{'request_time'}, $other->{'request_time'}),
         prio         => List::Util::min($self->get_prio(),       $other->get_prio()),
         expire       => (defined($self->{'expire'}) && defined($other->{'expire'})) ? List::Util::max($self->{'expire'}, $other->{'expire'}) : undef,
+        source       => $other->get_prio() <= $self->get_prio() ? $other->{'source'} : $self->{'source'},
     );
 
     foreach my $n (@{$self->{'notify'} }) { $job->add_notify($n); }
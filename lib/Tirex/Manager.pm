@@ -9,11 +9,13 @@ use warnings;
 
 use Carp;
 use IO::Socket::INET;
+use List::Util;
 
 use Tirex;
 use Tirex::Map;
 use Tirex::Manager::Bucket;
 use Tirex::Manager::RenderingJobs;
+use Tirex::Trace;
 
 #-----------------------------------------------------------------------------
 
@@ -36,11 +38,18 @@ how many parallel renderings are allowed, the priority of the jobs etc.
 
 =head1 METHODS
 
-=head2 Tirex::Manager->new( queue => $queue )
+=head2 Tirex::Manager->new( queue => $queue, cost_model => $model )
 
 Create a new rendering manager. Parameters are:
 
- queue   the queue with the rendering requests (see Tirex::Queue)
+ queue       the queue with the rendering requests (see Tirex::Queue)
+ cost_model  optional model of the render times (see Tirex::Manager::CostModel)
+
+If there is a cost model, the render times of all jobs are added to it. The
+expected render times are used for the maxcost limit of the buckets and, if
+the config option master_cost_timeout_factor is set, a job is timed out
+after this many times its expected render time (but not earlier than
+master_cost_min_timeout seconds and not later than master_rendering_timeout).
 
 =cut
 
@@ -63,6 +72,13 @@ sub new
     };
 
     $self->{'rendering_timeout'} = Tirex::Config::get('master_rendering_timeout', $Tirex::MASTER_RENDERING_TIMEOUT) * 60; # config is in minutes, but we need in seconds
+    $self->{'timeout_factor'} = Tirex::Config::get('master_cost_timeout_factor', 0, qr{^[0-9]+(\.[0-9]+)?$});
+    $self->{'min_timeout'} = Tirex::Config::get('master_cost_min_timeout', 60, qr{^[0-9]+$});
+    # never give up on a job earlier than the backend manager gives up on the
+    # worker rendering it, or the master would forget jobs that are still
+    # rendering and start more than maxproc
+    $self->{'min_timeout'} = List::Util::max($self->{'min_timeout'}, Tirex::Config::get('backend_manager_alive_timeout', $Tirex::BACKEND_MANAGER_ALIVE_TIMEOUT, qr{^[0-9]+$}) * 60);
+    $self->{'timeout_check_interval'} = ($self->{'timeout_factor'} && defined $self->{'cost_model'} ? List::Util::min($self->{'rendering_timeout'}, $self->{'min_timeout'}) : $self->{'rendering_timeout'}) / 10;
     $self->{'next_timeout_check'} = time() + $self->{'rendering_timeout'};
     $self->{'rendering_jobs'} = Tirex::Manager::RenderingJobs->new( timeout => $self->{'rendering_timeout'} );
 
@@ -70,8 +86,16 @@ sub new
 
     $self->{'buckets'} = [];
 
+    # state of the workers of sticky renderers, by renderer name and worker index
+    $self->{'workers'} = {};
+    $self->{'worker_seq'} = 0;
+
+    # per-layer render profiles reported by backends, by map, zoom and layer
+    $self->{'layer_profile'} = {};
+
     $self->{'load'} = 0;
     $self->{'last_load_check'} = 0;
+    $self->{'last_pressure_check'} = 0;
 
     return $self;
 }
@@ -147,6 +171,19 @@ sub get_socket
     return $self->{'socket'};
 }
 
+=head2 $rm->get_rendering_jobs()
+
+Returns the jobs that are currently rendering.
+
+=cut
+
+sub get_rendering_jobs
+{
+    my $self = shift;
+
+    return $self->{'rendering_jobs'}->jobs();
+}
+
 sub requests_by_metatile
 {
     my $self = shift;
@@ -171,7 +208,7 @@ sub schedule
     if (time() >= $self->{'next_timeout_check'})
     {
         $self->{'stats'}->{'count_timeouted'} += $self->{'rendering_jobs'}->check_timeout();
-        $self->{'next_timeout_check'} = time() + $self->{'rendering_timeout'} / 10;
+        $self->{'next_timeout_check'} = time() + $self->{'timeout_check_interval'};
     }
 
     while ($self->run()) {};
@@ -209,15 +246,17 @@ sub run
     my $prio = $job->get_prio();
     my $bucket;
 
-    # the current system load
+    # the current system load and resource pressure
     my $current_load = $self->get_load();
+    my $pressure     = $self->get_pressure();
+    my $current_cost = $self->{'rendering_jobs'}->expected_cost();
 
     # Check if buckets can render. Start at bucket with lowest priority and end at the
     # bucket with the right priority for this job. If any of the buckets can't render
     # we stop there. If all of them can render we go on.
     foreach my $b (@{$self->{'buckets'}})
     {
-        return 0 unless ( $b->can_render($self->{'rendering_jobs'}->count(), $current_load) );
+        return 0 unless ( $b->can_render($self->{'rendering_jobs'}->count(), $current_load, $pressure, $current_cost) );
         # break from loop if the currently looked at bucket is the right for the priority of this job
         if ($b->for_prio($prio))
         {
@@ -232,6 +271,16 @@ sub run
 
     ::syslog('debug', 'request rendering of job id=%s prio=%s map=%s x=%d y=%d z=%d', $job->get_id(), $job->get_prio(), $job->get_map(), $job->get_x(), $job->get_y(), $job->get_z()) if ($Tirex::DEBUG);
 
+    if (defined $self->{'cost_model'})
+    {
+        my $expected = $self->{'cost_model'}->estimate($job->get_metatile());
+        if (defined $expected)
+        {
+            $job->{'expected_cost'} = $expected;
+            $job->{'timeout'} = List::Util::min($self->{'rendering_timeout'}, List::Util::max($self->{'min_timeout'}, int($self->{'timeout_factor'} * $expected / 1000))) if ($self->{'timeout_factor'});
+        }
+    }
+
     # do all the necessary housekeeping...
     $self->{'rendering_jobs'}->add($job);
     $bucket->add_job($job);
@@ -239,6 +288,12 @@ sub run
     # update statistics
     $self->{'stats'}->{'count_requested'}++;
 
+    if (Tirex::Trace->enabled())
+    {
+        $job->{'trace_dispatched'} = Tirex::Trace->now();
+        Tirex::Trace->span('queued', $job, $job->{'trace_queued'}, $job->{'trace_dispatched'}) if (defined $job->{'trace_queued'});
+    }
+
     # and actually send the job to the renderer
     $self->send($job);
 
@@ -248,7 +303,9 @@ sub run
 
 =head2 $rm->send($job)
 
-Send a job to the rendering daemon.
+Send a job to the rendering daemon, in the binary format if the renderer
+is configured with protocol=binary. For sticky renderers the job is sent
+to the worker chosen by choose_worker().
 
 =cut
 
@@ -257,8 +314,9 @@ sub send
     my $self = shift;
     my $job  = shift;
 
-    my $map  = Tirex::Map->get($job->get_map());
-    my $port = $map->get_renderer()->get_port();
+    my $map      = Tirex::Map->get($job->get_map());
+    my $renderer = $map->get_renderer();
+    my $port     = $renderer->is_sticky() ? $renderer->get_worker_port($self->choose_worker($renderer, $job)) : $renderer->get_port();
     my $sock;
 
     eval { $sock = Socket::pack_sockaddr_in($port, Socket::INADDR_LOOPBACK) };
@@ -270,7 +328,88 @@ sub send
 
     ::syslog('debug', 'sending request to port %d id=%s prio=%s map=%s x=%d y=%d z=%d', $port, $job->get_id(), $job->get_prio(), $job->get_map(), $job->get_x(), $job->get_y(), $job->get_z()) if ($Tirex::DEBUG);
 
-    return $self->{'socket'}->send( $job->to_s( type => 'metatile_render_request' ), undef, $sock );
+    my $request = $renderer->get_protocol() eq 'binary' ? $job->to_msg( type => 'metatile_render_request' )->serialize_binary()
+                                                        : $job->to_s( type => 'metatile_render_request' );
+
+    return $self->{'socket'}->send( $request, undef, $sock );
+}
+
+=head2 $rm->choose_worker($renderer, $job)
+
+Choose the worker of a sticky renderer that should render the job and
+remember the job for it. Returns the index of the worker.
+
+Workers that are still rendering a job are only used if all of them are.
+Among the others the worker whose last job was the most similar is chosen,
+so that the caches of the worker processes (styles, fonts, images, database
+connections and the database and OS caches for the area) are used as much
+as possible. If there are several equally good workers the one that was
+idle for the longest time is chosen.
+
+=cut
+
+sub choose_worker
+{
+    my $self     = shift;
+    my $renderer = shift;
+    my $job      = shift;
+
+    my $workers = $self->{'workers'}->{$renderer->get_name()} ||= [];
+
+    my $best;
+    my $best_score;
+    foreach my $n (0 .. $renderer->get_procs() - 1)
+    {
+        my $worker = $workers->[$n] ||= { jobs => {}, last => undef, last_used => 0 };
+
+        # forget jobs that are done or timed out
+        foreach my $id (keys %{$worker->{'jobs'}})
+        {
+            delete $worker->{'jobs'}->{$id} unless ($self->{'rendering_jobs'}->find_by_id($id));
+        }
+
+        my $score = similarity($worker->{'last'}, $job->get_metatile()) - 10 * scalar(keys %{$worker->{'jobs'}});
+        if (!defined($best) || $score > $best_score || ($score == $best_score && $worker->{'last_used'} < $workers->[$best]->{'last_used'}))
+        {
+            $best = $n;
+            $best_score = $score;
+        }
+    }
+
+    my $worker = $workers->[$best];
+    $worker->{'jobs'}->{$job->get_id()} = 1;
+    $worker->{'last'} = $job->get_metatile();
+    $worker->{'last_used'} = ++$self->{'worker_seq'};
+    $job->{'worker'} = $best;
+
+    return $best;
+}
+
+=head2 Tirex::Manager::similarity($metatile1, $metatile2)
+
+How similar two metatiles are for rendering: 0 if they are for different
+maps (or the first is undef), 1 for the same map, plus 2 if they are in the
+same band of four zoom levels (where a style usually has the same layers
+and rules active), plus 1 if they are in the same area (the same tile on the
+zoom level four levels below the smaller zoom of the two).
+
+=cut
+
+sub similarity
+{
+    my $mt1 = shift;
+    my $mt2 = shift;
+
+    return 0 unless (defined $mt1 && $mt1->get_map() eq $mt2->get_map());
+
+    my $score = 1;
+    $score += 2 if (int($mt1->get_z() / 4) == int($mt2->get_z() / 4));
+
+    my $z = List::Util::max(0, List::Util::min($mt1->get_z(), $mt2->get_z()) - 4);
+    $score += 1 if (($mt1->get_x() >> ($mt1->get_z() - $z)) == ($mt2->get_x() >> ($mt2->get_z() - $z)) &&
+                    ($mt1->get_y() >> ($mt1->get_z() - $z)) == ($mt2->get_y() >> ($mt2->get_z() - $z)));
+
+    return $score;
 }
 
 =head2 $rm->done($msg)
@@ -291,6 +430,12 @@ sub done
     # if the job is found in our records, we remove it.
     if ($job)
     {
+        if (Tirex::Trace->enabled())
+        {
+            $job->{'trace_done'} = Tirex::Trace->now();
+            Tirex::Trace->span('dispatched', $job, $job->{'trace_dispatched'}, $job->{'trace_done'}) if (defined $job->{'trace_dispatched'});
+        }
+
         my $success = (defined($msg->{'result'}) && $msg->{'result'} eq 'ok');
         $job->set_success($success);
         if ($success)
@@ -315,6 +460,9 @@ sub done
             $self->{'stats'}->{'max_render_time'}->{$job->get_map()}->[$job->get_z()] = $max;
 
             $job->{'render_time'} = $msg->{'render_time'};
+            $self->{'cost_model'}->add($job->get_metatile(), $msg->{'render_time'}) if (defined $self->{'cost_model'} && defined $msg->{'render_time'});
+
+            $self->add_layer_profile($job, $msg->{'layer_profile'}) if (defined $msg->{'layer_profile'});
         }
         else
         {
@@ -342,6 +490,34 @@ sub done
     return $job;
 }
 
+=head2 $rm->add_layer_profile($job, $profile)
+
+Add the per-layer profile sent by a backend for a job to the statistics. The
+profile is a list of "layer,query_ms,render_ms,features" entries separated by
+semicolons. Entries that can't be parsed (for instance because the message
+was cut off) are skipped.
+
+=cut
+
+sub add_layer_profile
+{
+    my $self    = shift;
+    my $job     = shift;
+    my $profile = shift;
+
+    my $layers = $self->{'layer_profile'}->{$job->get_map()}->{$job->get_z()} ||= {};
+    foreach my $entry (split(/;/, $profile))
+    {
+        my ($layer, $query_time, $render_time, $features) = $entry =~ m{^([^,]+),([0-9]+),([0-9]+),([0-9]+)$} or next;
+
+        my $stats = $layers->{$layer} ||= { count => 0, sum_query_time => 0, sum_render_time => 0, sum_features => 0 };
+        $stats->{'count'}++;
+        $stats->{'sum_query_time'}  += $query_time;
+        $stats->{'sum_render_time'} += $render_time;
+        $stats->{'sum_features'}    += $features;
+    }
+}
+
 =head2 $rm->log_stats()
 
 Write statistics to log file.
@@ -381,22 +557,27 @@ sub status
     my $self = shift;
 
     my $current_load = $self->get_load();
+    my $pressure     = $self->get_pressure();
+    my $current_cost = $self->{'rendering_jobs'}->expected_cost();
 
     # 0 + in the following to force numbers for JSON
     my $status = {
         load            => 0 + $current_load,
+        pressure        => $pressure,
         num_rendering   => 0 + $self->{'rendering_jobs'}->count(),
         stats           => $self->{'stats'},
+        layer_profile   => $self->{'layer_profile'},
         buckets         => [],
         rendering       => [],
     };
 
     foreach my $bucket (@{$self->{'buckets'}})
     {
-        push(@{$status->{'buckets'}}, $bucket->status($self->{'rendering_jobs'}->count(), $current_load));
+        push(@{$status->{'buckets'}}, $bucket->status($self->{'rendering_jobs'}->count(), $current_load, $pressure, $current_cost));
     }
 
     $status->{'rendering'} = $self->{'rendering_jobs'}->status();
+    $status->{'cost_model'} = { cells => 0 + $self->{'cost_model'}->size(), rendering_cost => int($current_cost) } if (defined $self->{'cost_model'});
 
     return $status;
 }
@@ -438,6 +619,75 @@ sub get_load
     return $self->{'load'};
 }
 
+=head2 $rm->get_pressure()
+
+Get the current resource pressure on the machine from the Linux pressure stall
+information (PSI). If the config option 'master_pressure_cgroup' is set to the
+directory of a cgroup (v2), the pressure for this cgroup is used and the memory
+available to it before it reaches its limit is added.
+
+Returns a hash reference:
+
+ cpu              { 10 => $avg10, 60 => $avg60, 300 => $avg300 }
+ memory           the same for memory
+ io               the same for I/O
+ memory_available memory left in the cgroup in MB
+
+The averages are the percentage of time some tasks were stalled waiting for
+the resource. Entries are missing if the information is not available (old
+kernel, no cgroup configured or no memory limit). The result is cached for
+one second.
+
+=cut
+
+sub get_pressure
+{
+    my $self = shift;
+
+    return $self->{'pressure'} if ($self->{'last_pressure_check'} == time());
+
+    my $cgroup = Tirex::Config::get('master_pressure_cgroup', '');
+    my %pressure;
+
+    foreach my $resource (qw( cpu memory io ))
+    {
+        my $file = $cgroup ne '' ? "$cgroup/$resource.pressure" : ($self->{'pressure_dir'} || '/proc/pressure') . "/$resource";
+        open(my $fh, '<', $file) or next;
+        while (<$fh>)
+        {
+            if (/^some avg10=([0-9.]+) avg60=([0-9.]+) avg300=([0-9.]+)/)
+            {
+                $pressure{$resource} = { 10 => 0 + $1, 60 => 0 + $2, 300 => 0 + $3 };
+            }
+        }
+        close($fh);
+    }
+
+    if ($cgroup ne '')
+    {
+        my $max     = _read_number("$cgroup/memory.max");
+        my $current = _read_number("$cgroup/memory.current");
+        $pressure{'memory_available'} = int(($max - $current) / (1024 * 1024)) if (defined $max && defined $current);
+    }
+
+    $self->{'pressure'} = \%pressure;
+    $self->{'last_pressure_check'} = time();
+
+    return $self->{'pressure'};
+}
+
+# read a file containing a single number, returns undef if it doesn't (memory.max contains 'max' if there is no limit)
+sub _read_number
+{
+    my $file = shift;
+
+    open(my $fh, '<', $file) or return;
+    my $value = <$fh>;
+    close($fh);
+
+    return (defined $value && $value =~ /^([0-9]+)$/) ? $1 : undef;
+}
+
 =head1 SEE ALSO
 
 L<Tirex::Manager::Test>
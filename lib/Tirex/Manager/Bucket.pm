@@ -31,11 +31,35 @@ To simplify the configuration of rendering parameters for different zoom
 levels, they are configured through Buckets. One Bucket contains the
 configuration for a range of zoom levels.
 
+Besides the number of rendering processes and the load average a bucket can
+limit rendering based on Linux pressure stall information (PSI) and the free
+memory of a cgroup (see L<Tirex::Manager/get_pressure>). The load average
+reacts slowly and doesn't know about memory or I/O saturation, PSI shows
+directly how much of the time tasks were waiting for CPU, memory, or I/O.
+These optional parameters are available:
+
+ maxpsi_cpu     do not render if tasks were waiting for the CPU more than
+                this percentage of the time
+ maxpsi_memory  the same for memory
+ maxpsi_io      the same for I/O
+ psi_window     time window for the PSI averages in seconds: 10 (default),
+                60, or 300
+ minmem         do not render if the cgroup has less than this many MB of
+                memory left before it reaches its limit
+
+Limits for signals that are not available on the system are ignored.
+
+If the master has a cost model (see L<Tirex::Manager::CostModel>) the bucket
+can also limit the expected render time of the jobs currently rendering:
+
+ maxcost        do not render if the expected render times of all
+                rendering jobs add up to this many seconds or more
+
 =head1 METHODS
 
-=head2 Tirex::Manager::Bucket->new( name => $name, minprio => $minprio, maxproc => $maxproc, maxload => $maxload )
+=head2 Tirex::Manager::Bucket->new( name => $name, minprio => $minprio, maxproc => $maxproc, maxload => $maxload, ... )
 
-Create new rendering bucket.
+Create new rendering bucket. See above for the optional parameters.
 
 =cut
 
@@ -50,6 +74,13 @@ sub new
     Carp::croak("need 'maxproc' parameter for bucket") unless ($self->{'maxproc'});
     Carp::croak("need 'maxload' parameter for bucket") unless ($self->{'maxload'});
 
+    foreach my $param (qw( maxpsi_cpu maxpsi_memory maxpsi_io minmem maxcost ))
+    {
+        Carp::croak("parameter '$param' for bucket must be a number") if (defined $self->{$param} && $self->{$param} !~ /^[0-9]+(\.[0-9]+)?$/);
+    }
+    $self->{'psi_window'} = 10 unless (defined $self->{'psi_window'});
+    Carp::croak("parameter 'psi_window' for bucket must be 10, 60, or 300") unless ($self->{'psi_window'} =~ /^(10|60|300)$/);
+
     $self->{'numproc'} = 0;
     $self->{'active'} = 1;
 
@@ -203,7 +234,47 @@ sub for_prio
     }
 }
 
-=head2 $bucket->can_render($num_rendering, $current_load)
+=head2 $bucket->limit($num_rendering, $current_load, $pressure, $current_cost)
+
+Finds out why a job in this rendering bucket can't be rendered. $pressure is
+the hash returned by L<Tirex::Manager/get_pressure>, $current_cost the sum
+of the expected render times of the rendering jobs in milliseconds, both are
+optional.
+
+Returns one of 'inactive', 'maxproc', 'load', 'psi_cpu', 'psi_memory', 'psi_io',
+'memory' or 'cost', or the empty string if a job can be rendered.
+
+=cut
+
+sub limit
+{
+    my $self          = shift;
+    my $num_rendering = shift;
+    my $current_load  = shift;
+    my $pressure      = shift || {};
+    my $current_cost  = shift || 0;
+
+    return 'inactive' if (! $self->{'active'});
+
+    return 'maxproc' if ($num_rendering >= $self->{'maxproc'});
+
+    return 'load' if ($current_load >= $self->{'maxload'});
+
+    foreach my $resource (qw( cpu memory io ))
+    {
+        my $max = $self->{"maxpsi_$resource"};
+        next unless (defined $max && defined $pressure->{$resource});
+        return "psi_$resource" if ($pressure->{$resource}->{$self->{'psi_window'}} >= $max);
+    }
+
+    return 'memory' if (defined $self->{'minmem'} && defined $pressure->{'memory_available'} && $pressure->{'memory_available'} < $self->{'minmem'});
+
+    return 'cost' if (defined $self->{'maxcost'} && $current_cost >= $self->{'maxcost'} * 1000);
+
+    return '';
+}
+
+=head2 $bucket->can_render($num_rendering, $current_load, $pressure, $current_cost)
 
 Finds out if a job in this rendering bucket can be rendered.
 
@@ -212,26 +283,27 @@ Returns
  1     if it can be rendered
  0     if there are already maxproc or more rendering processes
        or if bucket is not active
- undef if the load is higher or equal than maxload
+ undef if the load is higher or equal than maxload or one of the
+       pressure or cost limits is reached
 
 =cut
 
 sub can_render
 {
-    my $self          = shift;
-    my $num_rendering = shift;
-    my $current_load  = shift;
-
-    return 0 if (! $self->{'active'});
+    my $self = shift;
 
-    return 0 if ($num_rendering >= $self->{'maxproc'});
+    my $limit = $self->limit(@_);
 
-    return $current_load >= $self->{'maxload'} ? undef : 1;
+    return 1 if ($limit eq '');
+    return 0 if ($limit eq 'inactive' || $limit eq 'maxproc');
+    return undef;
 }
 
-=head2 $bucket->status($num_rendering, $current_load)
+=head2 $bucket->status($num_rendering, $current_load, $pressure, $current_cost)
 
-Return status of bucket.
+Return status of bucket. The status contains the reason why the bucket can't
+render in 'limited_by' (see limit()) and the pressure and cost limits if they
+are configured.
 
 =cut
 
@@ -240,6 +312,10 @@ sub status
     my $self          = shift;
     my $num_rendering = shift;
     my $current_load  = shift;
+    my $pressure      = shift;
+    my $current_cost  = shift;
+
+    my $limit = $self->limit($num_rendering, $current_load, $pressure, $current_cost);
 
     # 0 + in the following to force numbers for JSON
     return {
@@ -250,7 +326,10 @@ sub status
         maxproc    => 0 + $self->{'maxproc'},
         maxload    => 0 + $self->{'maxload'},
         active     => $self->get_active(),
-        can_render => $self->can_render($num_rendering, $current_load) ? JSON::true : JSON::false, 
+        can_render => $limit eq '' ? JSON::true : JSON::false,
+        limited_by => $limit,
+        (map { defined $self->{$_} ? ($_ => 0 + $self->{$_}) : () } qw( maxpsi_cpu maxpsi_memory maxpsi_io minmem maxcost )),
+        (grep { defined $self->{$_} } qw( maxpsi_cpu maxpsi_memory maxpsi_io )) ? (psi_window => 0 + $self->{'psi_window'}) : (),
     };
 }
 
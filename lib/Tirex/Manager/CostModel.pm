@@ -0,0 +1,257 @@
+#-----------------------------------------------------------------------------
+#
+#  Tirex/Manager/CostModel.pm
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Carp;
+
+use Tirex;
+
+#-----------------------------------------------------------------------------
+
+package Tirex::Manager::CostModel;
+
+=head1 NAME
+
+Tirex::Manager::CostModel - Learned render times of metatiles
+
+=head1 SYNOPSIS
+
+ use Tirex::Manager::CostModel;
+ my $model = Tirex::Manager::CostModel->new( file => '/var/cache/tirex/costs' );
+ $model->load();
+
+ $model->add($metatile, $render_time);
+ my $expected = $model->estimate($metatile);
+
+ $model->save();
+
+=head1 DESCRIPTION
+
+The cost model keeps the render times reported by the backends for each map,
+zoom level and cell, where a cell is a square of 2^cell_bits x 2^cell_bits
+metatiles. For every cell and for every map and zoom level it stores a
+weighted average of the render times. The weight of older render times
+decays with the half life given in seconds, so that the model follows
+changes in the data or the style.
+
+The estimate for a metatile is the average for its cell or, if nothing was
+rendered in this cell yet, the average for its map and zoom level. If the
+model has more than max_cells cells, the cells with the lowest weight are
+dropped.
+
+The model is saved to a text file with one line per cell, so it survives a
+restart of the master.
+
+=head1 METHODS
+
+=head2 Tirex::Manager::CostModel->new( file => $file, cell_bits => 3, halflife => 86400, max_cells => 100000 )
+
+Create new cost model. All parameters are optional, without file the model
+can't be saved or loaded.
+
+=cut
+
+sub new
+{
+    my $class = shift;
+    my %args = @_;
+    my $self = bless \%args => $class;
+
+    $self->{'cell_bits'} = 3      unless (defined $self->{'cell_bits'});
+    $self->{'halflife'}  = 86400  unless (defined $self->{'halflife'});
+    $self->{'max_cells'} = 100000 unless (defined $self->{'max_cells'});
+
+    Carp::croak("cell_bits for cost model must be a number") unless ($self->{'cell_bits'} =~ /^[0-9]+$/);
+    Carp::croak("halflife for cost model must be a positive number") unless ($self->{'halflife'} =~ /^[0-9]+$/ && $self->{'halflife'} > 0);
+    Carp::croak("max_cells for cost model must be a number") unless ($self->{'max_cells'} =~ /^[0-9]+$/);
+
+    # cost by key, each entry is [average render time in ms, weight, time of last update]
+    $self->{'cells'}  = {};
+    $self->{'zooms'}  = {};
+
+    return $self;
+}
+
+=head2 $model->cell_key($metatile)
+
+Returns the key of the cell containing the metatile.
+
+=cut
+
+sub cell_key
+{
+    my $self     = shift;
+    my $metatile = shift;
+
+    my $shift = $self->{'cell_bits'} + 3; # metatiles are 8 tiles wide
+    return join(' ', $metatile->get_map(), $metatile->get_z(), $metatile->get_x() >> $shift, $metatile->get_y() >> $shift);
+}
+
+=head2 $model->add($metatile, $render_time, $time)
+
+Add the render time (in milliseconds) of a metatile to the model. The time
+defaults to now.
+
+=cut
+
+sub add
+{
+    my $self        = shift;
+    my $metatile    = shift;
+    my $render_time = shift;
+    my $now         = shift || time();
+
+    _add_sample($self->{'cells'}->{$self->cell_key($metatile)} ||= [0, 0, $now], $render_time, $now, $self->{'halflife'});
+    _add_sample($self->{'zooms'}->{$metatile->get_map() . ' ' . $metatile->get_z()} ||= [0, 0, $now], $render_time, $now, $self->{'halflife'});
+
+    $self->prune() if (scalar(keys %{$self->{'cells'}}) > $self->{'max_cells'});
+
+    return;
+}
+
+sub _add_sample
+{
+    my ($entry, $value, $now, $halflife) = @_;
+
+    my $weight = _weight($entry, $now, $halflife);
+    $entry->[0] = ($entry->[0] * $weight + $value) / ($weight + 1);
+    $entry->[1] = $weight + 1;
+    $entry->[2] = $now;
+}
+
+# weight of an entry decayed to the given time
+sub _weight
+{
+    my ($entry, $now, $halflife) = @_;
+
+    my $age = $now - $entry->[2];
+    return $age > 0 ? $entry->[1] * 0.5 ** ($age / $halflife) : $entry->[1];
+}
+
+=head2 $model->estimate($metatile)
+
+Returns the expected render time of the metatile in milliseconds or undef
+if nothing is known about its map and zoom level.
+
+=cut
+
+sub estimate
+{
+    my $self     = shift;
+    my $metatile = shift;
+
+    my $entry = $self->{'cells'}->{$self->cell_key($metatile)} || $self->{'zooms'}->{$metatile->get_map() . ' ' . $metatile->get_z()};
+
+    return defined $entry ? $entry->[0] : undef;
+}
+
+=head2 $model->size()
+
+Returns the number of cells in the model.
+
+=cut
+
+sub size
+{
+    my $self = shift;
+
+    return scalar(keys %{$self->{'cells'}});
+}
+
+=head2 $model->prune()
+
+Drop the cells with the lowest weight until only 90% of max_cells are left.
+
+=cut
+
+sub prune
+{
+    my $self = shift;
+
+    my $now   = time();
+    my $cells = $self->{'cells'};
+    my %weight = map { $_ => _weight($cells->{$_}, $now, $self->{'halflife'}) } keys %$cells;
+    my @keys = sort { $weight{$a} <=> $weight{$b} } keys %$cells;
+
+    my $drop = scalar(@keys) - int($self->{'max_cells'} * 0.9);
+    delete @$cells{@keys[0 .. $drop - 1]} if ($drop > 0);
+
+    return;
+}
+
+=head2 $model->load()
+
+Load the model from its file. The current content of the model is lost.
+
+Returns true if the file was read, false otherwise.
+
+=cut
+
+sub load
+{
+    my $self = shift;
+
+    return unless (defined $self->{'file'});
+
+    open(my $fh, '<', $self->{'file'}) or return;
+
+    $self->{'cells'} = {};
+    $self->{'zooms'} = {};
+    while (my $line = <$fh>)
+    {
+        # map zoom cellx celly average weight updated, cellx and celly are '-' for the entries for the whole zoom level
+        next unless ($line =~ /^(\S+) ([0-9]+) ([0-9]+|-) ([0-9]+|-) ([0-9.eE+-]+) ([0-9.eE+-]+) ([0-9]+)$/);
+        if ($3 eq '-')
+        {
+            $self->{'zooms'}->{"$1 $2"} = [0 + $5, 0 + $6, 0 + $7];
+        }
+        else
+        {
+            $self->{'cells'}->{"$1 $2 $3 $4"} = [0 + $5, 0 + $6, 0 + $7];
+        }
+    }
+    close($fh);
+
+    return 1;
+}
+
+=head2 $model->save()
+
+Save the model to its file. The file is written under a temporary name and
+then renamed, so that a crash doesn't leave a half written file.
+
+Returns true if the file was written, false otherwise.
+
+=cut
+
+sub save
+{
+    my $self = shift;
+
+    return unless (defined $self->{'file'});
+
+    my $tmpfile = $self->{'file'} . '.tmp';
+    open(my $fh, '>', $tmpfile) or return;
+
+    foreach my $key (sort keys %{$self->{'zooms'}})
+    {
+        printf $fh "%s - - %.1f %.3f %d\n", $key, @{$self->{'zooms'}->{$key}};
+    }
+    foreach my $key (sort keys %{$self->{'cells'}})
+    {
+        printf $fh "%s %.1f %.3f %d\n", $key, @{$self->{'cells'}->{$key}};
+    }
+
+    close($fh) or return;
+    return rename($tmpfile, $self->{'file'});
+}
+
+
+1;
+
+#-- THE END ------------------------------------------------------------------
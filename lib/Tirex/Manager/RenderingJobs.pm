@@ -8,6 +8,7 @@ use strict;
 use warnings;
 
 use Carp;
+use List::Util;
 
 use Tirex;
 
@@ -62,6 +63,20 @@ sub count
     return scalar(keys %{$self->{'requests_by_id'}});
 }
 
+=head2 $rj->jobs()
+
+Returns the jobs currently rendering in the order they were sent to the
+backends.
+
+=cut
+
+sub jobs
+{
+    my $self = shift;
+
+    return sort { $a->{'rendering_requested'} <=> $b->{'rendering_requested'} } values %{$self->{'requests_by_id'}};
+}
+
 =head2 $rj->add($job)
 
 Add a job. Returns the job added.
@@ -97,6 +112,21 @@ sub remove
     return $job;
 }
 
+=head2 $rj->expected_cost()
+
+Returns the sum of the expected render times (in milliseconds) of the jobs
+currently rendering. Jobs without an expected render time (see
+L<Tirex::Manager::CostModel>) count as 0.
+
+=cut
+
+sub expected_cost
+{
+    my $self = shift;
+
+    return List::Util::sum(0, map { $_->{'expected_cost'} || 0 } values %{$self->{'requests_by_id'}});
+}
+
 =head2 $rj->find_by_id($id)
 
 Find a currently rendering job by its id.
@@ -128,7 +158,8 @@ sub find_by_metatile
 =head2 $rj->check_timeout()
 
 Check if there are any jobs older than the timeout and remove them. They will have been killed
-by tirex-backend-manager in the mean time.
+by tirex-backend-manager in the mean time. Jobs can have their own, shorter timeout (in
+seconds) in $job->{'timeout'}.
 
 Returns the number of jobs removed.
 
@@ -140,10 +171,10 @@ sub check_timeout
 
     my $count = 0;
 
-    my $timeout = time() - $self->{'timeout'};
+    my $now = time();
     foreach my $job (values %{$self->{'requests_by_id'}})
     {
-        if ($job->{'rendering_requested'} < $timeout) {
+        if ($job->{'rendering_requested'} < $now - ($job->{'timeout'} || $self->{'timeout'})) {
             my $bucket = $job->get_bucket();
             $bucket->remove_job($job) if (defined $bucket);
             $self->remove($job);
@@ -175,6 +206,8 @@ sub status
             z    => 0 + $_->get_z(),
             prio => 0 + $_->get_prio(),
             age  => time() - $_->{'rendering_requested'},
+            defined $_->{'worker'} ? (worker => 0 + $_->{'worker'}) : (),
+            defined $_->{'expected_cost'} ? (expected_cost => int($_->{'expected_cost'})) : (),
         };
     } sort {
         $a->get_prio() == $b->get_prio()
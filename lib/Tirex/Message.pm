@@ -13,6 +13,13 @@ use Carp;
 
 package Tirex::Message;
 
+our $BINARY_MAGIC = "\0TX\x01";
+
+# keys with a one-byte code in binary messages, must be kept in sync with
+# msg_keys in native/message.cc, new keys may only be appended
+our @BINARY_KEYS = (undef, qw( type id map x y z prio expire result errmsg render_time rss peak_rss metatile layer_profile ));
+our %BINARY_KEY_INDEX = map { $BINARY_KEYS[$_] => $_ } 1 .. $#BINARY_KEYS;
+
 =head1 NAME
 
 Tirex::Message - A message 
@@ -30,6 +37,13 @@ of the Tirex system.
 return and a newline). Each line has the form "key=value". No spaces are
 allowed before or after the key or equals sign.
 
+Between the master and the backends messages can also be sent in a compact
+binary format (see native/message.h for the layout). Binary messages start
+with a NUL byte, so they can be told apart from text messages, and all
+methods that read messages understand both formats. The master uses the
+binary format for renderers with "protocol=binary" in their config, the
+backends answer in the format of the request.
+
 =head1 METHODS
 
 =head2 Tirex::Message->new( type => '...', field1key => "field2value", ... )
@@ -65,6 +79,13 @@ sub new_from_string
     my $class  = shift;
     my $string = shift;
 
+    if (is_binary($string))
+    {
+        my $fields = decode_binary($string);
+        Carp::croak("invalid binary message") unless ($fields);
+        return $class->new(%$fields);
+    }
+
     my %hash;
     foreach my $line (split(/\r?\n/, $string))
     {
@@ -75,6 +96,75 @@ sub new_from_string
     return $class->new(%hash);
 }
 
+=head2 Tirex::Message::is_binary($string)
+
+Is this a message in the binary format?
+
+=cut
+
+sub is_binary
+{
+    return substr($_[0], 0, 4) eq $BINARY_MAGIC;
+}
+
+=head2 Tirex::Message::decode_binary($string)
+
+Decode a message in the binary format into a hash ref. Returns undef if the
+message is malformed.
+
+=cut
+
+sub decode_binary
+{
+    my $string = shift;
+
+    return unless (is_binary($string));
+
+    my %fields;
+    my $len = length($string);
+    my $pos = 4;
+    while ($pos < $len)
+    {
+        my $tag = ord(substr($string, $pos++, 1));
+
+        my $key;
+        if (my $index = $tag & 0x7f)
+        {
+            $key = $BINARY_KEYS[$index];
+            return unless (defined $key);
+        }
+        else
+        {
+            return if ($pos >= $len);
+            my $keylen = ord(substr($string, $pos++, 1));
+            return if ($keylen == 0 || $pos + $keylen > $len);
+            $key = substr($string, $pos, $keylen);
+            return if ($key =~ tr/=\r\n\0//);
+            $pos += $keylen;
+        }
+
+        if ($tag & 0x80)
+        {
+            return if ($pos + 4 > $len);
+            $fields{$key} = unpack('l>', substr($string, $pos, 4));
+            $pos += 4;
+        }
+        else
+        {
+            return if ($pos + 2 > $len);
+            my $valuelen = unpack('n', substr($string, $pos, 2));
+            $pos += 2;
+            return if ($pos + $valuelen > $len);
+            my $value = substr($string, $pos, $valuelen);
+            return if ($value =~ tr/\r\n\0//);
+            $fields{$key} = $value;
+            $pos += $valuelen;
+        }
+    }
+
+    return \%fields;
+}
+
 =head2 Tirex::Message->new_from_socket($socket)
 
 Read a datagram from given socket and create new message from it.
@@ -143,6 +233,53 @@ sub serialize
     return $self->_to_s('', "\n");
 }
 
+=head2 $msg->serialize_binary()
+
+Serialize this message into the binary format. Values that are plain
+decimal numbers in the range of a 32 bit integer are sent as integers,
+everything else as strings.
+
+If a value is undefined the field is not added. Croaks if a key or value
+can't be represented.
+
+=cut
+
+sub serialize_binary
+{
+    my $self = shift;
+
+    my $string = $BINARY_MAGIC;
+    foreach my $key (sort keys %$self)
+    {
+        my $value = $self->{$key};
+        next unless (defined $value);
+
+        my $index = $BINARY_KEY_INDEX{$key} || 0;
+
+        # same as the regex /\A(?:0|-?[1-9][0-9]*)\z/ plus range check, but faster
+        my $is_number = do { no warnings 'numeric'; int($value) eq $value && $value >= -2147483648 && $value <= 2147483647 };
+
+        $string .= chr($index | ($is_number ? 0x80 : 0));
+        if (!$index)
+        {
+            Carp::croak("key '$key' can't be sent in binary message") if (length($key) == 0 || length($key) > 255);
+            $string .= chr(length($key)) . $key;
+        }
+
+        if ($is_number)
+        {
+            $string .= pack('l>', $value);
+        }
+        else
+        {
+            Carp::croak("value of '$key' too long for binary message") if (length($value) > 65535);
+            $string .= pack('n', length($value)) . $value;
+        }
+    }
+
+    return $string;
+}
+
 =head2 $msg->to_s()
 
 Return string version of this message, for instance for debugging.
@@ -168,9 +305,10 @@ sub _to_s
     return join($joinstring, map { defined($self->{$_}) ? "$_=$self->{$_}$endstring" : '' } sort(keys %$self) );
 }
 
-=head2 $msg->send($socket, $dest)
+=head2 $msg->send($socket, $dest[, $binary])
 
-Send message through $socket to $dest.
+Send message through $socket to $dest. If $binary is true, the message is
+sent in the binary format.
 
 =cut
 
@@ -179,8 +317,9 @@ sub send
     my $self   = shift;
     my $socket = shift;
     my $dest   = shift;
+    my $binary = shift;
 
-    return $socket->send($self->serialize(), undef, $dest);
+    return $socket->send($binary ? $self->serialize_binary() : $self->serialize(), undef, $dest);
 }
 
 =head2 $msg->to_metatile()
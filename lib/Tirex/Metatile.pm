@@ -11,6 +11,8 @@ use Carp;
 use Math::Trig;
 use File::stat;
 
+use Tirex::FreshnessIndex;
+
 #-----------------------------------------------------------------------------
 
 package Tirex::Metatile;
@@ -295,15 +297,17 @@ sub get_filename
 
 Does the metatile file for this metatile exist?
 
+This and the older() and newer() methods use the freshness index of the
+map instead of the metatile file if the map has one (see
+L<Tirex::FreshnessIndex>).
+
 =cut
 
 sub exists
 {
     my $self = shift;
 
-    my $s = $self->_stat() or return 0;
-
-    return 1;
+    return defined $self->_mtime() ? 1 : 0;
 }
 
 =head2 $mt->older($time)
@@ -319,9 +323,10 @@ sub older
     my $self = shift;
     my $time = shift;
 
-    my $s = $self->_stat() or return 2;
+    my $mtime = $self->_mtime();
+    return 2 unless (defined $mtime);
 
-    return $s->mtime() < $time;
+    return $mtime < $time;
 }
 
 =head2 $mt->newer($time)
@@ -337,9 +342,10 @@ sub newer
     my $self = shift;
     my $time = shift;
 
-    my $s = $self->_stat() or return 2;
+    my $mtime = $self->_mtime();
+    return 2 unless (defined $mtime);
 
-    return $s->mtime() > $time;
+    return $mtime > $time;
 }
 
 =head2 $mt->size()
@@ -357,6 +363,26 @@ sub size
     return $s->size();
 }
 
+# mtime of the metatile file or time from the freshness index, undef if
+# the metatile doesn't exist. Metatiles that are not in the index (written
+# before there was an index or by a backend that doesn't update it) are
+# looked up on disk.
+sub _mtime
+{
+    my $self = shift;
+
+    my $index = Tirex::FreshnessIndex->for_map(Tirex::Map->get($self->get_map()));
+    if ($index)
+    {
+        my $time = $index->get($self->{'z'}, $self->{'x'}, $self->{'y'});
+        return $time if ($time);
+    }
+
+    my $s = $self->_stat() or return;
+
+    return $s->mtime();
+}
+
 # call stat on the metatile file and memoize the result
 sub _stat
 {
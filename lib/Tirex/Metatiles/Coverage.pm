@@ -0,0 +1,306 @@
+#-----------------------------------------------------------------------------
+#
+#  Tirex/Metatiles/Coverage.pm
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Carp;
+use JSON;
+use List::Util qw();
+use Math::Trig;
+use POSIX ();
+
+#-----------------------------------------------------------------------------
+
+package Tirex::Metatiles::Coverage;
+
+=head1 NAME
+
+Tirex::Metatiles::Coverage - metatiles covered by a polygon
+
+=head1 SYNOPSIS
+
+ use Tirex::Metatiles::Coverage;
+
+ my $coverage = Tirex::Metatiles::Coverage->new_from_file('germany.geojson');
+
+ my $rows = $coverage->rows($zoom, 8, 8);
+ while (my ($y, $spans) = $rows->())
+ {
+     foreach my $span (@$spans)
+     {
+         my ($xmin, $xmax) = @$span;
+         ...
+     }
+ }
+
+=head1 DESCRIPTION
+
+Finds the metatiles that intersect a polygon (or several polygons, with or
+without holes) on a zoom level. The polygon is read from a GeoJSON file
+(Polygon and MultiPolygon geometries, also inside Features,
+FeatureCollections and GeometryCollections) or a WKT file (POLYGON or
+MULTIPOLYGON) with coordinates in WGS84 longitude and latitude.
+
+The metatiles are found with a scanline algorithm at metatile resolution:
+for each row of metatiles the edges of the polygon crossing the row mark
+the metatiles on the boundary, the crossings of the edges with the middle
+of the row give the spans inside. Inside and outside are decided by the
+even-odd rule, so rings inside other rings are holes. Only one row of
+metatiles is kept in memory at a time.
+
+The edges of the polygon are straight lines in the Mercator projection.
+
+=head1 METHODS
+
+=head2 Tirex::Metatiles::Coverage->new( rings => [ [ [lon, lat], ... ], ... ] )
+
+Create coverage from a list of rings. Rings don't have to be closed.
+
+Croaks if there are no rings with at least three points.
+
+=cut
+
+sub new
+{
+    my $class = shift;
+    my %args = @_;
+    my $self = bless \%args => $class;
+
+    # edges as [x0, y0, x1, y1] in Mercator coordinates from 0 to 1 (y from north to south)
+    my @edges;
+    foreach my $ring (@{$self->{'rings'}})
+    {
+        next unless (@$ring >= 3);
+        my @points = map { [ _lon2u($_->[0]), _lat2v($_->[1]) ] } @$ring;
+        for (my $i = 0; $i < @points; $i++)
+        {
+            my ($p, $q) = ($points[$i], $points[($i + 1) % @points]);
+            next if ($p->[0] == $q->[0] && $p->[1] == $q->[1]);
+            push(@edges, $p->[1] <= $q->[1] ? [ @$p, @$q ] : [ @$q, @$p ]);
+        }
+    }
+    Carp::croak('no polygon with at least three points') unless (@edges);
+
+    # sorted by upper end, so that the scanline only looks at the edges it needs
+    $self->{'edges'} = [ sort { $a->[1] <=> $b->[1] } @edges ];
+    $self->{'vmin'}  = $self->{'edges'}->[0]->[1];
+    $self->{'vmax'}  = List::Util::max(map { $_->[3] } @edges);
+
+    return $self;
+}
+
+=head2 Tirex::Metatiles::Coverage->new_from_file($filename)
+
+Create coverage from the polygons in a GeoJSON or WKT file.
+
+Croaks if the file can't be read or has no polygons.
+
+=cut
+
+sub new_from_file
+{
+    my $class    = shift;
+    my $filename = shift;
+
+    open(my $fh, '<', $filename) or Carp::croak("can't open polygon file '$filename': $!");
+    my $content = do { local $/; <$fh> };
+    close($fh);
+
+    my $rings = $content =~ /^\s*[{\[]/ ? parse_geojson($content) : parse_wkt($content);
+    Carp::croak("no polygons in '$filename'") unless (@$rings);
+
+    return $class->new( rings => $rings, file => $filename );
+}
+
+=head2 Tirex::Metatiles::Coverage::parse_geojson($json)
+
+Returns the rings of all polygons in the GeoJSON text.
+
+=cut
+
+sub parse_geojson
+{
+    my $json = shift;
+
+    my $data = eval { JSON::from_json($json) };
+    Carp::croak("can't parse GeoJSON: $@") if ($@);
+
+    my @rings;
+    my @objects = ($data);
+    while (my $obj = shift @objects)
+    {
+        next unless (ref($obj) eq 'HASH' && defined $obj->{'type'});
+        my $type = $obj->{'type'};
+        if    ($type eq 'FeatureCollection')  { push(@objects, @{$obj->{'features'}   || []}); }
+        elsif ($type eq 'Feature')            { push(@objects, $obj->{'geometry'}); }
+        elsif ($type eq 'GeometryCollection') { push(@objects, @{$obj->{'geometries'} || []}); }
+        elsif ($type eq 'Polygon')            { push(@rings, @{$obj->{'coordinates'}}); }
+        elsif ($type eq 'MultiPolygon')       { push(@rings, @$_) foreach (@{$obj->{'coordinates'}}); }
+    }
+
+    return \@rings;
+}
+
+=head2 Tirex::Metatiles::Coverage::parse_wkt($wkt)
+
+Returns the rings of the POLYGON or MULTIPOLYGON in the WKT text (an
+optional "SRID=4326;" prefix is allowed).
+
+=cut
+
+sub parse_wkt
+{
+    my $wkt = shift;
+
+    Carp::croak("can't parse WKT: only POLYGON and MULTIPOLYGON are allowed") unless ($wkt =~ /^\s*(?:SRID=[0-9]+;\s*)?(?:MULTI)?POLYGON\s*\(/i);
+
+    my @rings;
+    while ($wkt =~ /\(([^()]*)\)/g)
+    {
+        my @ring;
+        foreach my $point (split(/,/, $1))
+        {
+            Carp::croak("can't parse WKT point '$point'") unless ($point =~ /^\s*(-?[0-9.]+(?:[eE][-+]?[0-9]+)?)\s+(-?[0-9.]+(?:[eE][-+]?[0-9]+)?)(?:\s+\S+)*\s*$/);
+            push(@ring, [$1, $2]);
+        }
+        push(@rings, \@ring);
+    }
+
+    return \@rings;
+}
+
+sub _lon2u
+{
+    my $lon = shift;
+    return ($lon + 180) / 360;
+}
+
+sub _lat2v
+{
+    my $lat = shift;
+
+    $lat = -85.05113 if ($lat < -85.05113);
+    $lat =  85.05113 if ($lat >  85.05113);
+    $lat = $lat * Math::Trig::pi / 180;
+
+    return (1 - log(Math::Trig::tan($lat) + Math::Trig::sec($lat)) / Math::Trig::pi) / 2;
+}
+
+=head2 $coverage->rows($zoom, $mtx, $mty)
+
+Returns an iterator over the rows of metatiles with size $mtx x $mty tiles
+covered on the given zoom level. Each call returns the row (in metatiles,
+from the north) and a reference to a sorted list of spans [xmin, xmax] (in
+metatiles, inclusive) or an empty list after the last row.
+
+=cut
+
+sub rows
+{
+    my $self = shift;
+    my $zoom = shift;
+    my $mtx  = shift;
+    my $mty  = shift;
+
+    my $sx    = 2 ** $zoom / $mtx;
+    my $sy    = 2 ** $zoom / $mty;
+    my $cols  = List::Util::max(1, POSIX::ceil($sx));
+    my $nrows = List::Util::max(1, POSIX::ceil($sy));
+
+    my $edges = $self->{'edges'};
+    my $next_edge = 0;
+    my @active;
+
+    my $row  = List::Util::max(0, int($self->{'vmin'} * $sy));
+    my $last = List::Util::min($nrows - 1, int($self->{'vmax'} * $sy));
+
+    my $col = sub { my $x = int(shift); return $x < 0 ? 0 : $x >= $cols ? $cols - 1 : $x; };
+
+    return sub {
+        while ($row <= $last)
+        {
+            my $top    = $row / $sy;
+            my $bottom = ($row + 1) / $sy;
+            my $middle = ($row + 0.5) / $sy;
+            my $y      = $row++;
+
+            push(@active, $edges->[$next_edge++]) while ($next_edge < @$edges && $edges->[$next_edge]->[1] <= $bottom);
+            @active = grep { $_->[3] >= $top } @active;
+            next unless (@active);
+
+            my @spans;
+            my @crossings;
+            foreach my $e (@active)
+            {
+                my ($x0, $y0, $x1, $y1) = @$e;
+
+                # part of the edge inside this row of metatiles
+                my ($xa, $xb) = ($x0, $x1);
+                if ($y1 > $y0)
+                {
+                    my $ya = $y0 < $top    ? $top    : $y0;
+                    my $yb = $y1 > $bottom ? $bottom : $y1;
+                    $xa = $x0 + ($x1 - $x0) * ($ya - $y0) / ($y1 - $y0);
+                    $xb = $x0 + ($x1 - $x0) * ($yb - $y0) / ($y1 - $y0);
+                }
+                ($xa, $xb) = ($xb, $xa) if ($xa > $xb);
+                push(@spans, [ $col->($xa * $sx), $col->($xb * $sx) ]);
+
+                push(@crossings, $x0 + ($x1 - $x0) * ($middle - $y0) / ($y1 - $y0)) if ($y0 <= $middle && $middle < $y1);
+            }
+
+            # spans inside the polygon
+            @crossings = sort { $a <=> $b } @crossings;
+            for (my $i = 0; $i + 1 < @crossings; $i += 2)
+            {
+                push(@spans, [ $col->($crossings[$i] * $sx), $col->($crossings[$i + 1] * $sx) ]);
+            }
+
+            # merge overlapping and adjacent spans
+            my @merged;
+            foreach my $span (sort { $a->[0] <=> $b->[0] } @spans)
+            {
+                if (@merged && $span->[0] <= $merged[-1]->[1] + 1)
+                {
+                    $merged[-1]->[1] = $span->[1] if ($span->[1] > $merged[-1]->[1]);
+                }
+                else
+                {
+                    push(@merged, [ @$span ]);
+                }
+            }
+
+            return ($y, \@merged);
+        }
+        return;
+    };
+}
+
+=head2 $coverage->count($zoom, $mtx, $mty)
+
+Returns the number of metatiles covered on the given zoom level.
+
+=cut
+
+sub count
+{
+    my $self = shift;
+
+    my $count = 0;
+    my $rows = $self->rows(@_);
+    while (my ($y, $spans) = $rows->())
+    {
+        $count += $_->[1] - $_->[0] + 1 foreach (@$spans);
+    }
+
+    return $count;
+}
+
+
+1;
+
+#-- THE END ------------------------------------------------------------------
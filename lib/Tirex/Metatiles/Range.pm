@@ -11,6 +11,8 @@ use Carp;
 use List::Util qw();
 use Math::Trig;
 
+use Tirex::Metatiles::Coverage;
+
 #-----------------------------------------------------------------------------
 
 package Tirex::Metatiles::Range;
@@ -24,11 +26,16 @@ Tirex::Metatiles::Range - range of metatiles
  use Tirex::Metatiles::Range;
 
  $range = Tirex::Metatiles::Range->new( z => '3-4', lon => '8-9', lat => '48-49' );
+ $range = Tirex::Metatiles::Range->new( z => '3-4', polygon => 'germany.geojson' );
 
 =head1 DESCRIPTION
 
 A range of metatiles for one or more maps, one or more zoom levels and an x/y range for a lon/lat bounding box.
 
+Instead of a rectangle the range can also cover the metatiles intersecting a polygon read from a GeoJSON or WKT
+file (parameter 'polygon', see L<Tirex::Metatiles::Coverage>). The metatiles are then found row by row while
+iterating, so even large polygons on high zoom levels don't need much memory.
+
 Is used to easily iterate over all those metatiles.
 
 =head1 METHODS
@@ -90,12 +97,20 @@ sub new
     # make sure we have all needed parameters
     Carp::croak("missing 'map' parameter") if ( ! exists($self->{'maps'}));
     Carp::croak("missing 'z' or 'zmin'/'zmax' parameter") if ( ! exists($self->{'z'}) && ! exists($self->{'zmin'}) && ! exists($self->{'zmax'}) );
-    Carp::croak("missing 'x' or 'xmin'/'xmax' or 'lon' or 'lonmin/lonmax' or 'bbox' parameter")
-        if ( ! exists($self->{'x'}) && ! exists($self->{'xmin'}) && ! exists($self->{'xmax'}) &&
-             ! exists($self->{'lon'}) && ! exists($self->{'lonmin'}) && ! exists($self->{'lonmax'}) );
-    Carp::croak("missing 'y' or 'ymin'/'ymax' or 'lat' or 'latmin/latmax' or 'bbox' parameter")
-        if ( ! exists($self->{'y'}) && ! exists($self->{'ymin'}) && ! exists($self->{'ymax'}) &&
-             ! exists($self->{'lat'}) && ! exists($self->{'latmin'}) && ! exists($self->{'latmax'}) );
+    if (exists($self->{'coverage'}))
+    {
+        Carp::croak("you cannot have parameter 'polygon' and x/y/lon/lat/bbox parameters")
+            if ( grep { exists($self->{$_}) } qw( xmin xmax ymin ymax lonmin lonmax latmin latmax ) );
+    }
+    else
+    {
+        Carp::croak("missing 'x' or 'xmin'/'xmax' or 'lon' or 'lonmin/lonmax' or 'bbox' or 'polygon' parameter")
+            if ( ! exists($self->{'x'}) && ! exists($self->{'xmin'}) && ! exists($self->{'xmax'}) &&
+                 ! exists($self->{'lon'}) && ! exists($self->{'lonmin'}) && ! exists($self->{'lonmax'}) );
+        Carp::croak("missing 'y' or 'ymin'/'ymax' or 'lat' or 'latmin/latmax' or 'bbox' or 'polygon' parameter")
+            if ( ! exists($self->{'y'}) && ! exists($self->{'ymin'}) && ! exists($self->{'ymax'}) &&
+                 ! exists($self->{'lat'}) && ! exists($self->{'latmin'}) && ! exists($self->{'latmax'}) );
+    }
 
     # make sure min is always smaller than max
     ($self->{'zmin'  }, $self->{'zmax'  }) = (List::Util::min($self->{'zmin'  }, $self->{'zmax'  }), List::Util::max($self->{'zmin'  }, $self->{'zmax'  })) if (defined $self->{'zmin'  });
@@ -105,7 +120,7 @@ sub new
     ($self->{'latmin'}, $self->{'latmax'}) = (List::Util::min($self->{'latmin'}, $self->{'latmax'}), List::Util::max($self->{'latmin'}, $self->{'latmax'})) if (defined $self->{'latmin'});
 
     # if there is only one zoom level, calculate x/y range now
-    if ($self->{'zmin'} == $self->{'zmax'})
+    if ($self->{'zmin'} == $self->{'zmax'} && ! exists($self->{'coverage'}))
     {
         ($self->{'xmin'}, $self->{'xmax'}) = $self->_get_range_x($self->{'zmin'});
         ($self->{'ymin'}, $self->{'ymax'}) = $self->_get_range_y($self->{'zmin'});
@@ -146,6 +161,12 @@ sub _parse_key_value
 
     elsif ($key eq 'bbox')   { $self->_parse_bbox($value); }
 
+    elsif ($key eq 'polygon')
+    {
+        $self->{'polygon'}  = $value;
+        $self->{'coverage'} = Tirex::Metatiles::Coverage->new_from_file($value);
+    }
+
     elsif ($key eq 'init')   { $self->_parse_init($value); }
 
     else { Carp::croak("unknown parameter: '$key'"); }
@@ -187,6 +208,14 @@ sub reset
 
     $self->{'current_map_pos'} = 0;
     $self->{'current_z'} = $self->{'zmin'};
+    $self->{'metatiles'} = 0;
+
+    if (exists($self->{'coverage'}))
+    {
+        $self->{'rows'} = $self->{'coverage'}->rows($self->{'current_z'}, $self->{'mtx'}, $self->{'mty'});
+        $self->_next_row();
+        return $self;
+    }
 
     ($self->{'ymin_for_current_z'}, $self->{'ymax_for_current_z'}) = $self->_get_range_y($self->{'current_z'});
     ($self->{'xmin_for_current_z'}, $self->{'xmax_for_current_z'}) = $self->_get_range_x($self->{'current_z'});
@@ -194,11 +223,37 @@ sub reset
     $self->{'current_y'} = $self->{'ymin_for_current_z'};
     $self->{'current_x'} = $self->{'xmin_for_current_z'};
 
-    $self->{'metatiles'} = 0;
-
     return $self;
 }
 
+# go to the next row of metatiles covered by the polygon (on this or the
+# next zoom levels), sets finished flag if there is none
+sub _next_row
+{
+    my $self = shift;
+
+    while (1)
+    {
+        my ($y, $spans) = $self->{'rows'}->();
+        if (defined $y)
+        {
+            $self->{'spans'}     = $spans;
+            $self->{'span_pos'}  = 0;
+            $self->{'current_y'} = $y * $self->{'mty'};
+            $self->{'current_x'} = $spans->[0]->[0] * $self->{'mtx'};
+            return;
+        }
+
+        $self->{'current_z'}++;
+        if ($self->{'current_z'} > $self->{'zmax'})
+        {
+            $self->{'finished'} = 1;
+            return;
+        }
+        $self->{'rows'} = $self->{'coverage'}->rows($self->{'current_z'}, $self->{'mtx'}, $self->{'mty'});
+    }
+}
+
 sub _get_range_x
 {
     my $self = shift;
@@ -248,6 +303,12 @@ sub count
     my $maps = scalar(@{$self->{'maps'}});
 
     my $tiles = 0;
+    if (exists($self->{'coverage'}))
+    {
+        $tiles += $self->{'coverage'}->count($_, $self->{'mtx'}, $self->{'mty'}) foreach ($self->{'zmin'} .. $self->{'zmax'});
+        return $maps * $tiles;
+    }
+
     foreach my $zoom ($self->{'zmin'} .. $self->{'zmax'})
     {
         my ($ymin, $ymax) = $self->_get_range_y($zoom);
@@ -280,7 +341,15 @@ sub to_s
 {
     my $self = shift;
 
-    if ($self->{'lonmin'})
+    if (exists($self->{'coverage'}))
+    {
+        return sprintf('maps=%s z=%s polygon=%s',
+            join(',', @{$self->{'maps'}}),
+            _range_to_s($self->{'zmin'}, $self->{'zmax'}),
+            $self->{'polygon'}
+        );
+    }
+    elsif ($self->{'lonmin'})
     {
         return sprintf('maps=%s z=%s lon=%s lat=%s',
             join(',', @{$self->{'maps'}}),
@@ -331,6 +400,29 @@ sub next
 
     $self->{'current_map_pos'}++;
 
+    if (exists($self->{'coverage'}))
+    {
+        if ($self->{'current_map_pos'} >= scalar(@{$self->{'maps'}}))
+        {
+            $self->{'current_map_pos'} = 0;
+            $self->{'current_x'} += $self->{'mtx'};
+            if ($self->{'current_x'} > $self->{'spans'}->[$self->{'span_pos'}]->[1] * $self->{'mtx'})
+            {
+                $self->{'span_pos'}++;
+                if ($self->{'span_pos'} < scalar(@{$self->{'spans'}}))
+                {
+                    $self->{'current_x'} = $self->{'spans'}->[$self->{'span_pos'}]->[0] * $self->{'mtx'};
+                }
+                else
+                {
+                    $self->_next_row();
+                }
+            }
+        }
+        $self->{'metatiles'}++;
+        return $metatile;
+    }
+
     if ($self->{'current_map_pos'} >= scalar(@{$self->{'maps'}}))
     {
         $self->{'current_x'} += $self->{'mtx'};
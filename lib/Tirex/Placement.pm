@@ -0,0 +1,306 @@
+#-----------------------------------------------------------------------------
+#
+#  Tirex/Placement.pm
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Carp;
+use POSIX ();
+
+#-----------------------------------------------------------------------------
+
+package Tirex::Placement;
+
+=head1 NAME
+
+Tirex::Placement - CPU and NUMA placement of backend workers
+
+=head1 SYNOPSIS
+
+ use Tirex::Placement;
+ my $topology = Tirex::Placement->new();
+
+ my $placement = $topology->place('spread', $index, $cpuset);
+ Tirex::Placement::apply($placement, 'preferred') or die("placement failed: $!");
+
+=head1 DESCRIPTION
+
+On machines with several CPU sockets, rendering processes that migrate
+between cores lose their caches and allocate memory on remote NUMA nodes.
+The tirex-backend-manager can place the workers of a renderer on particular
+CPUs according to one of these policies:
+
+ none    workers can run on all CPUs (or all CPUs in the cpuset)
+ spread  workers are distributed round-robin over the NUMA nodes, each
+         worker can run on all CPUs of its node
+ core    each worker gets a physical core of its own (with all its
+         hardware threads), the cores are taken round-robin from the
+         NUMA nodes
+
+The placement is applied to the worker process after the fork, so it is
+inherited by the renderer executed in it.
+
+The CPU topology is read from sysfs.
+
+=head1 METHODS
+
+=head2 Tirex::Placement->new( sysfs => '/sys/devices/system' )
+
+Read the CPU topology.
+
+=cut
+
+our @POLICIES = qw( none spread core );
+
+sub new
+{
+    my $class = shift;
+    my %args = @_;
+    my $self = bless \%args => $class;
+
+    $self->{'sysfs'} = '/sys/devices/system' unless (defined $self->{'sysfs'});
+
+    my $sysfs = $self->{'sysfs'};
+
+    # CPU -> NUMA node (everything is on node 0 if there is no NUMA information)
+    my %node;
+    foreach my $dir (glob("$sysfs/node/node*"))
+    {
+        next unless ($dir =~ m{/node([0-9]+)$});
+        my $n = $1;
+        $node{$_} = $n foreach (parse_cpulist(_read_line("$dir/cpulist")));
+    }
+
+    # the CPUs online with their node and physical core
+    $self->{'cpus'} = {};
+    my $online = _read_line("$sysfs/cpu/online");
+    my @online = defined $online ? parse_cpulist($online) : map { m{/cpu([0-9]+)$} ? $1 : () } glob("$sysfs/cpu/cpu[0-9]*");
+    foreach my $cpu (@online)
+    {
+        my $topology = "$sysfs/cpu/cpu$cpu/topology";
+        my $package = _read_line("$topology/physical_package_id");
+        my $core    = _read_line("$topology/core_id");
+        $self->{'cpus'}->{$cpu} = {
+            node => $node{$cpu} || 0,
+            core => (defined $package ? $package : 0) . ':' . (defined $core ? $core : $cpu),
+        };
+    }
+
+    Carp::croak("can't find any CPUs in $sysfs") unless (%{$self->{'cpus'}});
+
+    return $self;
+}
+
+sub _read_line
+{
+    my $file = shift;
+
+    open(my $fh, '<', $file) or return;
+    my $line = <$fh>;
+    close($fh);
+
+    return unless (defined $line);
+    chomp $line;
+    return $line;
+}
+
+=head2 Tirex::Placement::parse_cpulist($list)
+
+Parse list of CPUs in the format used by the kernel (for instance "0-3,8,10-11").
+
+Returns the sorted list of CPU numbers or an empty list if the format is wrong.
+
+=cut
+
+sub parse_cpulist
+{
+    my $list = shift;
+
+    return () unless (defined $list);
+
+    my %cpus;
+    foreach my $range (split(/,/, $list))
+    {
+        if ($range =~ /^\s*([0-9]+)\s*$/)
+        {
+            $cpus{$1} = 1;
+        }
+        elsif ($range =~ /^\s*([0-9]+)-([0-9]+)\s*$/ && $1 <= $2)
+        {
+            $cpus{$_} = 1 foreach ($1 .. $2);
+        }
+        else
+        {
+            return ();
+        }
+    }
+
+    return sort { $a <=> $b } keys %cpus;
+}
+
+=head2 Tirex::Placement::format_cpulist(@cpus)
+
+Format list of CPU numbers in the kernel format.
+
+=cut
+
+sub format_cpulist
+{
+    my @cpus = sort { $a <=> $b } @_;
+
+    my @ranges;
+    while (@cpus)
+    {
+        my $first = shift @cpus;
+        my $last = $first;
+        $last = shift @cpus while (@cpus && $cpus[0] == $last + 1);
+        push(@ranges, $first == $last ? $first : "$first-$last");
+    }
+
+    return join(',', @ranges);
+}
+
+=head2 $topology->get_cpus()
+
+Returns the sorted list of online CPUs.
+
+=cut
+
+sub get_cpus
+{
+    my $self = shift;
+
+    return sort { $a <=> $b } keys %{$self->{'cpus'}};
+}
+
+=head2 $topology->place($policy, $index, $cpuset)
+
+Find the placement of the worker with the given index (0 .. procs-1). If
+$cpuset is given, only CPUs in this list (in kernel format) are used.
+
+Returns a hash reference with the list of CPUs ('cpus') and the NUMA node
+('node', undef if the worker isn't bound to a node) or undef if the worker
+can run anywhere.
+
+=cut
+
+sub place
+{
+    my $self   = shift;
+    my $policy = shift || 'none';
+    my $index  = shift || 0;
+    my $cpuset = shift;
+
+    Carp::croak("unknown placement policy '$policy'") unless (grep { $_ eq $policy } @POLICIES);
+
+    my @allowed = $self->get_cpus();
+    if (defined $cpuset && $cpuset ne '')
+    {
+        my %set = map { $_ => 1 } parse_cpulist($cpuset);
+        @allowed = grep { $set{$_} } @allowed;
+        Carp::croak("no online CPUs in cpuset '$cpuset'") unless (@allowed);
+    }
+
+    if ($policy eq 'none')
+    {
+        return unless (defined $cpuset && $cpuset ne '');
+        return { cpus => \@allowed, node => undef };
+    }
+
+    my %by_node;
+    push(@{$by_node{$self->{'cpus'}->{$_}->{'node'}}}, $_) foreach (@allowed);
+    my @nodes = sort { $a <=> $b } keys %by_node;
+
+    if ($policy eq 'spread')
+    {
+        my $node = $nodes[$index % scalar(@nodes)];
+        return { cpus => $by_node{$node}, node => $node };
+    }
+
+    # policy 'core': list the cores of each node in order of their first CPU,
+    # then take them round-robin from the nodes
+    my @cores_by_node;
+    foreach my $node (@nodes)
+    {
+        my %cores;
+        push(@{$cores{$self->{'cpus'}->{$_}->{'core'}}}, $_) foreach (@{$by_node{$node}});
+        push(@cores_by_node, [ sort { $a->[0] <=> $b->[0] } values %cores ]);
+    }
+
+    my @cores;
+    while (grep { @$_ } @cores_by_node)
+    {
+        foreach my $list (@cores_by_node)
+        {
+            push(@cores, shift @$list) if (@$list);
+        }
+    }
+
+    my $cpus = $cores[$index % scalar(@cores)];
+    return { cpus => $cpus, node => $self->{'cpus'}->{$cpus->[0]}->{'node'} };
+}
+
+=head2 Tirex::Placement::apply($placement, $memory)
+
+Apply placement (as returned by place()) to the current process. The CPU
+affinity is set to the CPUs of the placement. If the placement has a NUMA
+node, the memory policy is set according to $memory: 'preferred' (the
+default) to allocate memory on this node if possible, 'bind' to allocate
+memory only on this node, or 'none' to leave the memory policy alone.
+
+Returns true on success, false otherwise (with $! set).
+
+=cut
+
+sub apply
+{
+    my $placement = shift;
+    my $memory    = shift || 'preferred';
+
+    return 1 unless (defined $placement);
+
+    my ($sys_sched_setaffinity, $sys_set_mempolicy) = _syscalls() or do { $! = POSIX::ENOSYS(); return; };
+
+    my $cpumask = _mask(@{$placement->{'cpus'}});
+    return if (syscall($sys_sched_setaffinity, 0, length($cpumask), $cpumask) != 0);
+
+    if (defined $placement->{'node'} && $memory ne 'none')
+    {
+        my $nodemask = _mask($placement->{'node'});
+        my $mode = $memory eq 'bind' ? 2 : 1; # MPOL_BIND : MPOL_PREFERRED
+        return if (syscall($sys_set_mempolicy, $mode, $nodemask, 8 * length($nodemask) + 1) != 0);
+    }
+
+    return 1;
+}
+
+# bit mask in the format of the kernel (array of longs)
+sub _mask
+{
+    my $mask = '';
+    vec($mask, $_, 1) = 1 foreach (@_);
+    $mask .= "\0" x ((8 - length($mask) % 8) % 8);
+    return $mask;
+}
+
+# system call numbers for sched_setaffinity and set_mempolicy
+sub _syscalls
+{
+    return unless ($^O eq 'linux');
+
+    eval {
+        package main;
+        require 'syscall.ph';
+    };
+    return if ($@ || ! defined &main::SYS_sched_setaffinity || ! defined &main::SYS_set_mempolicy);
+
+    return (&main::SYS_sched_setaffinity(), &main::SYS_set_mempolicy());
+}
+
+
+1;
+
+#-- THE END ------------------------------------------------------------------
@@ -9,6 +9,7 @@ use warnings;
 
 use Carp;
 use Data::Dumper;
+use Scalar::Util qw();
 
 use Tirex::Job;
 
@@ -34,14 +35,40 @@ Tirex::PrioQueue - Queue for one priority
 
 PrioQueues hold all jobs with a certain priority. They are never accessed directly, only through a L<Tirex::Queue> object.
 
+By default jobs are served first in, first out. With the 'hilbert' or 'morton' order, jobs are
+served in the order of their position on a Hilbert or Morton (Z-order) curve instead: the next
+job is the one following the last job served on the curve, wrapping around at the end. So
+consecutive jobs render metatiles close to each other and the database and OS caches for their
+area are still warm. The positions of all metatiles are on the same curve through zoom level 30,
+so that metatiles on different zoom levels covering the same area are also close.
+
+With the 'cost' order, the job with the lowest expected render time according to a
+L<Tirex::Manager::CostModel> is served first (shortest expected job first), jobs with the
+same expected render time are served first in, first out. During a backlog cheap metatiles
+don't have to wait for expensive ones. Jobs for which the model knows nothing are treated
+as cheap, so that the model learns about them quickly.
+
+So that no job has to wait forever, the oldest job is served first whenever it is older than
+max_age seconds. This doesn't change the position on the curve, the jobs after it are served
+from where the curve was left.
+
+For these orders the jobs are kept in two binary heaps keyed by their position on the curve:
+one with the jobs after the last job served and one with the jobs before it, which becomes
+the first heap when the curve wraps around. Adding and serving a job takes logarithmic time,
+so a large backlog doesn't slow down the master. Removed jobs are only marked and dropped when
+they come up or when there are more of them than jobs in the queue.
+
 =head1 METHODS
 
-=head2 Tirex::PrioQueue->new(prio => $prio);
+=head2 Tirex::PrioQueue->new(prio => $prio, order => $order, max_age => $max_age, cost_model => $model);
 
-Create new priority queue object.
+Create new priority queue object. Order is 'fifo' (default), 'hilbert', 'morton' or 'cost',
+max_age defaults to 60 seconds. The 'cost' order needs the cost_model.
 
 =cut
 
+our %ORDERS = ( fifo => undef, hilbert => \&hilbert_key, morton => \&morton_key, cost => undef );
+
 sub new
 {
     my $class = shift;
@@ -50,6 +77,18 @@ sub new
 
     return undef unless (defined($self->{'prio'}) && $self->{'prio'} =~ /^[0-9]+$/);
 
+    $self->{'order'} = 'fifo' unless (defined $self->{'order'});
+    return undef unless (exists $ORDERS{$self->{'order'}});
+    $self->{'curve'} = $ORDERS{$self->{'order'}};
+    if ($self->{'order'} eq 'cost')
+    {
+        return undef unless (defined $self->{'cost_model'});
+        my $model = $self->{'cost_model'};
+        my $seq = 0;
+        $self->{'curve'} = sub { return sprintf('%012d%012d', $model->estimate($_[0]) || 0, $seq++); };
+    }
+    $self->{'max_age'} = 60 unless (defined $self->{'max_age'});
+
     return $self->reset();
 }
 
@@ -94,6 +133,11 @@ sub reset
     $self->{'offset'}  = 0;
     $self->{'size'}    = 0;
     $self->{'maxsize'} = 0;
+    $self->{'ahead'}   = [];    # heap of [curve key, job] after the cursor (not used for fifo)
+    $self->{'behind'}  = [];    # heap of [curve key, job] before the cursor
+    $self->{'stale'}   = 0;     # number of removed jobs still in the heaps
+    $self->{'cursor'}  = '';    # curve key of the last job served
+    $self->{'peeked'}  = undef; # job returned by the last peek()
     return $self;
 }
 
@@ -120,6 +164,17 @@ sub add
     $self->{'size'}++;
     $self->{'maxsize'} = $self->{'size'} if ($self->{'size'} > $self->{'maxsize'});
 
+    if ($self->{'curve'})
+    {
+        my $key = $self->{'curve'}->($job->get_metatile());
+        my $entry = [$key, $job];
+        _heap_push($key lt $self->{'cursor'} ? $self->{'behind'} : $self->{'ahead'}, $entry);
+
+        # weak, so that the job doesn't keep its entry alive (and the entry the job)
+        $job->{'curve_entry'} = $entry;
+        Scalar::Util::weaken($job->{'curve_entry'});
+    }
+
     return $job;
 }
 
@@ -144,6 +199,15 @@ sub remove
     $job->set_pos(undef);
     $self->{'size'}--;
 
+    if ($self->{'curve'})
+    {
+        # the entry stays in its heap until it comes up or the heaps are rebuilt
+        my $entry = delete $job->{'curve_entry'};
+        $entry->[1] = undef if (defined $entry);
+        $self->_rebuild() if (++$self->{'stale'} > $self->{'size'} + 64);
+    }
+    $self->{'peeked'} = undef if (defined $self->{'peeked'} && $self->{'peeked'} == $job);
+
     $self->clean();
     return $job;
 }
@@ -183,7 +247,8 @@ sub clean
 
 =head2 $pq->peek()
 
-Get first element of the priority queue without removing it.
+Get the job that is to be served next without removing it. A call to next() directly after
+peek() will return the same job.
 
 Returns false if the queue is empty.
 
@@ -193,12 +258,33 @@ sub peek
 {
     my $self = shift;
 
-    return $self->{'queue'}->[0];
+    my $first = $self->{'queue'}->[0];
+    return $first unless ($self->{'curve'} && defined $first);
+
+    # starvation guard
+    return $self->{'peeked'} = $first if ($first->age() >= $self->{'max_age'});
+
+    my $ahead = $self->{'ahead'};
+    while (1)
+    {
+        if (! @$ahead)
+        {
+            # wrap around to the beginning of the curve
+            ($ahead, $self->{'behind'}) = ($self->{'behind'}, $ahead);
+            $self->{'ahead'} = $ahead;
+            $self->{'cursor'} = '';
+            return unless (@$ahead);
+        }
+        last if (defined $ahead->[0]->[1]);
+        _heap_pop($ahead);
+        $self->{'stale'}--;
+    }
+    return $self->{'peeked'} = $ahead->[0]->[1];
 }
 
 =head2 $pq->next()
 
-Remove and return first element of the priority queue.
+Remove and return the job that is to be served next (see peek()).
 
 Returns false if there are no jobs in the queue.
 
@@ -212,6 +298,21 @@ sub next
 
     return if ($self->empty());
 
+    if ($self->{'curve'})
+    {
+        my $job = $self->{'peeked'};
+        $job = $self->peek() unless (defined $job);
+        my $entry = $job->{'curve_entry'};
+        if ($entry == $self->{'ahead'}->[0])
+        {
+            _heap_pop($self->{'ahead'});
+            $self->{'cursor'} = $entry->[0] unless ($self->{'order'} eq 'cost');
+            $self->{'stale'}--;     # remove() counts it as stale, but it isn't in a heap any more
+        }
+        $self->remove($job);
+        return $job;
+    }
+
     $self->{'size'}--;
     $self->{'offset'}++;
    
@@ -235,7 +336,7 @@ sub age_first
     my $self = shift;
 
     return if ($self->empty());
-    return $self->peek()->age();
+    return $self->{'queue'}->[0]->age();
 }
 
 =head2 $pq->age_last()
@@ -254,6 +355,19 @@ sub age_last
     return $self->{'queue'}->[-1]->age();
 }
 
+=head2 $pq->jobs()
+
+Returns all jobs in the priority queue in the order they came in.
+
+=cut
+
+sub jobs
+{
+    my $self = shift;
+
+    return grep { defined($_) } @{$self->{'queue'}};
+}
+
 =head2 $pq->reset_maxsize()
 
 Reset maxsize. New maxsize will be equal to current size.
@@ -270,6 +384,124 @@ sub reset_maxsize
     return $self->{'maxsize'};
 }
 
+=head2 Tirex::PrioQueue::hilbert_key($metatile)
+
+Returns the position of the metatile on a Hilbert curve through all tiles of zoom level 30
+as a string that sorts in curve order. The curve runs through the area of a tile on a lower
+zoom level in one piece, so that tile gets the position where the curve enters its area,
+which is its position on the curve for its own zoom level times 4^(30-z). The zoom level and
+map are appended so that the key is unique.
+
+=cut
+
+sub hilbert_key
+{
+    my $metatile = shift;
+
+    my $z = $metatile->get_z();
+    my $x = $metatile->get_x();
+    my $y = $metatile->get_y();
+
+    my $d = 0;
+    for (my $s = (1 << $z) >> 1; $s > 0; $s >>= 1)
+    {
+        my $rx = ($x & $s) ? 1 : 0;
+        my $ry = ($y & $s) ? 1 : 0;
+        $d += $s * $s * ((3 * $rx) ^ $ry);
+
+        # rotate quadrant so that the curve continues there
+        if ($ry == 0)
+        {
+            if ($rx == 1)
+            {
+                $x = $s - 1 - ($x & ($s - 1));
+                $y = $s - 1 - ($y & ($s - 1));
+            }
+            ($x, $y) = ($y, $x);
+        }
+    }
+
+    return sprintf('%015x%02d%s', $d << (2 * (30 - $z)), $z, $metatile->get_map());
+}
+
+=head2 Tirex::PrioQueue::morton_key($metatile)
+
+Like hilbert_key(), but for the Morton curve (bits of x and y interleaved).
+
+=cut
+
+sub morton_key
+{
+    my $metatile = shift;
+
+    my $z = $metatile->get_z();
+    my $x = $metatile->get_x();
+    my $y = $metatile->get_y();
+
+    my $d = 0;
+    for (my $bit = $z - 1; $bit >= 0; $bit--)
+    {
+        $d = ($d << 2) | ((($y >> $bit) & 1) << 1) | (($x >> $bit) & 1);
+    }
+
+    return sprintf('%015x%02d%s', $d << (2 * (30 - $z)), $z, $metatile->get_map());
+}
+
+# drop the removed jobs from the heaps
+sub _rebuild
+{
+    my $self = shift;
+
+    foreach my $name ('ahead', 'behind')
+    {
+        my @heap;
+        _heap_push(\@heap, $_) foreach (grep { defined $_->[1] } @{$self->{$name}});
+        $self->{$name} = \@heap;
+    }
+    $self->{'stale'} = 0;
+}
+
+# add entry to a binary heap of [curve key, job] entries (smallest key first)
+sub _heap_push
+{
+    my $heap  = shift;
+    my $entry = shift;
+
+    my $i = scalar(@$heap);
+    while ($i > 0)
+    {
+        my $parent = ($i - 1) >> 1;
+        last if ($heap->[$parent]->[0] le $entry->[0]);
+        $heap->[$i] = $heap->[$parent];
+        $i = $parent;
+    }
+    $heap->[$i] = $entry;
+}
+
+# remove and return the entry with the smallest key from a binary heap
+sub _heap_pop
+{
+    my $heap = shift;
+
+    my $top  = $heap->[0];
+    my $last = pop(@$heap);
+    my $size = scalar(@$heap);
+    return $top unless ($size);
+
+    my $i = 0;
+    while (1)
+    {
+        my $child = 2 * $i + 1;
+        last if ($child >= $size);
+        $child++ if ($child + 1 < $size && $heap->[$child + 1]->[0] lt $heap->[$child]->[0]);
+        last if ($last->[0] le $heap->[$child]->[0]);
+        $heap->[$i] = $heap->[$child];
+        $i = $child;
+    }
+    $heap->[$i] = $last;
+    return $top;
+}
+
 =head2 $pq->remove_jobs_for_unknown_maps()
 
 Remove all jobs from this prioqueue where the map is undefined. This can happen
@@ -0,0 +1,347 @@
+#-----------------------------------------------------------------------------
+#
+#  Tirex/PrioQueue/Fair.pm
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Carp;
+use List::Util;
+
+use Tirex::PrioQueue;
+
+#-----------------------------------------------------------------------------
+
+package Tirex::PrioQueue::Fair;
+
+=head1 NAME
+
+Tirex::PrioQueue::Fair - Queue for one priority with weighted fair queuing of sources
+
+=head1 SYNOPSIS
+
+ use Tirex::PrioQueue::Fair;
+ my $pq = Tirex::PrioQueue::Fair->new(prio => 7, fairness => $fairness);
+
+ $pq->add($job);
+ $pq->remove($job);
+
+ $job = $pq->next();
+
+=head1 DESCRIPTION
+
+Like L<Tirex::PrioQueue>, but the jobs of every source (see
+L<Tirex::Queue::Fairness>) are kept in their own L<Tirex::PrioQueue>,
+which serves them in the configured order, and the sources take turns by
+weighted fair queuing: a source with twice the weight of another gets
+twice as many of the jobs served while both have jobs queued, no matter
+how many jobs each of them has queued.
+
+This is start-time fair queuing with a cost of 1 per job: every source has
+a virtual start time, serving one of its jobs advances it by 1/weight and
+the source with the lowest start time is served next. The virtual time of
+the queue is the start time of the source served last, a source that had
+no jobs queued starts there, so it can't save up its share while it is
+idle.
+
+Used by L<Tirex::Queue> instead of Tirex::PrioQueue if the queue has a
+fairness object. Only accessed through the Tirex::Queue object.
+
+=head1 METHODS
+
+=head2 Tirex::PrioQueue::Fair->new(prio => $prio, fairness => $fairness, order => $order, max_age => $max_age, cost_model => $model);
+
+Create new priority queue object. The order, max_age and cost_model are
+handed to the queues of the sources.
+
+=cut
+
+sub new
+{
+    my $class = shift;
+    my %args = @_;
+    my $self = bless \%args => $class;
+
+    return undef unless (defined($self->{'prio'}) && $self->{'prio'} =~ /^[0-9]+$/);
+    return undef unless (defined $self->{'fairness'});
+    return undef unless (defined $self->_new_queue());
+
+    return $self->reset();
+}
+
+sub _new_queue
+{
+    my $self = shift;
+
+    return Tirex::PrioQueue->new(prio => $self->{'prio'}, order => $self->{'order'}, max_age => $self->{'max_age'}, cost_model => $self->{'cost_model'});
+}
+
+=head2 $pq->size()
+
+Returns the size of the priority queue.
+
+=cut
+
+sub size
+{
+    my $self = shift;
+    return $self->{'size'};
+}
+
+=head2 $pq->empty()
+
+Is the priority queue empty?
+
+=cut
+
+sub empty
+{
+    my $self = shift;
+    return $self->{'size'} == 0;
+}
+
+=head2 $pq->reset()
+
+Reset the queue. All jobs on the queue will be lost!
+
+Returns priority queue itself, so that calls can be chained.
+
+=cut
+
+sub reset
+{
+    my $self = shift;
+    $self->{'sources'} = {};    # source name -> { queue => Tirex::PrioQueue, start => virtual start time }
+    $self->{'vtime'}   = 0;
+    $self->{'size'}    = 0;
+    $self->{'maxsize'} = 0;
+    return $self;
+}
+
+=head2 $pq->add($job)
+
+Add job to the queue of its source. The job will only be added if the job priority and the
+queue priority are the same.
+
+Returns the job if it was added, undef otherwise.
+
+=cut
+
+sub add
+{
+    my $self = shift;
+    my $job  = shift;
+
+    return if (ref($job) ne 'Tirex::Job');
+    return if ($job->get_prio() != $self->{'prio'});
+
+    my $key = $self->{'fairness'}->key($job);
+    my $source = $self->{'sources'}->{$key} ||= { queue => $self->_new_queue(), start => 0 };
+
+    $source->{'start'} = $self->{'vtime'} if ($source->{'queue'}->empty() && $source->{'start'} < $self->{'vtime'});
+    $source->{'queue'}->add($job);
+    $job->{'fair_key'} = $key;
+
+    $self->{'size'}++;
+    $self->{'maxsize'} = $self->{'size'} if ($self->{'size'} > $self->{'maxsize'});
+
+    return $job;
+}
+
+=head2 $pq->remove($job)
+
+Remove a job from the priority queue.
+
+Returns the job or undef if the job was not on this queue.
+
+=cut
+
+sub remove
+{
+    my $self = shift;
+    my $job  = shift;
+
+    my $source = $self->{'sources'}->{$job->{'fair_key'} || ''};
+    return unless (defined $source && defined $source->{'queue'}->remove($job));
+
+    $self->{'size'}--;
+    return $job;
+}
+
+# the source with the lowest virtual start time among those with jobs
+sub _select
+{
+    my $self = shift;
+
+    my $best;
+    foreach my $key (sort keys %{$self->{'sources'}})
+    {
+        my $source = $self->{'sources'}->{$key};
+        next if ($source->{'queue'}->empty());
+        $best = $key if (! defined $best || $source->{'start'} < $self->{'sources'}->{$best}->{'start'});
+    }
+
+    return $best;
+}
+
+=head2 $pq->peek()
+
+Get the job that is to be served next without removing it.
+
+Returns false if the queue is empty.
+
+=cut
+
+sub peek
+{
+    my $self = shift;
+
+    my $key = $self->_select();
+    return unless (defined $key);
+
+    return $self->{'sources'}->{$key}->{'queue'}->peek();
+}
+
+=head2 $pq->next()
+
+Remove and return the job that is to be served next (see peek()).
+
+Returns false if there are no jobs in the queue.
+
+=cut
+
+sub next
+{
+    my $self = shift;
+
+    my $key = $self->_select();
+    return unless (defined $key);
+
+    my $source = $self->{'sources'}->{$key};
+    my $job = $source->{'queue'}->next();
+    $self->{'vtime'} = $source->{'start'};
+    $source->{'start'} += 1 / $self->{'fairness'}->weight($key);
+    $self->{'size'}--;
+
+    return $job;
+}
+
+=head2 $pq->age_first()
+
+Returns age (in seconds) of the oldest job in the priority queue.
+
+Returns false if the priority queue is empty.
+
+=cut
+
+sub age_first
+{
+    my $self = shift;
+
+    return if ($self->empty());
+    return List::Util::max(map { $_->{'queue'}->age_first() || 0 } values %{$self->{'sources'}});
+}
+
+=head2 $pq->age_last()
+
+Returns age (in seconds) of the newest job in the priority queue.
+
+Returns false if the priority queue is empty.
+
+=cut
+
+sub age_last
+{
+    my $self = shift;
+
+    return if ($self->empty());
+    return List::Util::min(map { $_->{'queue'}->age_last() } grep { ! $_->{'queue'}->empty() } values %{$self->{'sources'}});
+}
+
+=head2 $pq->jobs()
+
+Returns all jobs in the priority queue in the order they came in.
+
+=cut
+
+sub jobs
+{
+    my $self = shift;
+
+    return sort { $a->{'request_time'} <=> $b->{'request_time'} } map { $_->{'queue'}->jobs() } values %{$self->{'sources'}};
+}
+
+=head2 $pq->reset_maxsize()
+
+Reset maxsize. New maxsize will be equal to current size.
+
+Returns new maxsize;
+
+=cut
+
+sub reset_maxsize
+{
+    my $self = shift;
+
+    $_->{'queue'}->reset_maxsize() foreach (values %{$self->{'sources'}});
+    $self->{'maxsize'} = $self->{'size'};
+    return $self->{'maxsize'};
+}
+
+=head2 $pq->remove_jobs_for_unknown_maps()
+
+Remove all jobs from this prioqueue where the map is undefined.
+
+=cut
+
+sub remove_jobs_for_unknown_maps
+{
+    my $self = shift;
+
+    my $size = 0;
+    foreach my $source (values %{$self->{'sources'}})
+    {
+        $source->{'queue'}->remove_jobs_for_unknown_maps();
+        $size += $source->{'queue'}->size();
+    }
+    $self->{'size'} = $size;
+}
+
+=head2 $pq->status()
+
+Return status of the priority queue, with the number of queued jobs per source.
+
+=cut
+
+sub status
+{
+    my $self = shift;
+
+    # 0 + in the following to force integer values for JSON
+    my %status = (
+        size    => 0 + $self->size(),
+        maxsize => 0 + $self->{'maxsize'},
+        prio    => 0 + $self->{'prio'},
+        sources => { map { ($_ => 0 + $self->{'sources'}->{$_}->{'queue'}->size()) } grep { ! $self->{'sources'}->{$_}->{'queue'}->empty() } keys %{$self->{'sources'}} },
+    );
+
+    unless ($self->empty()) {
+        $status{'age_last'}  = 0 + $self->age_last();
+        $status{'age_first'} = 0 + $self->age_first();
+    }
+
+    return \%status;
+}
+
+=head1 SEE ALSO
+
+L<Tirex::PrioQueue>, L<Tirex::Queue::Fairness>, L<Tirex::Queue>
+
+=cut
+
+
+1;
+
+#-- THE END ------------------------------------------------------------------
@@ -12,6 +12,7 @@ use Data::Dumper;
 
 use Tirex::Job;
 use Tirex::PrioQueue;
+use Tirex::PrioQueue::Fair;
 
 #-----------------------------------------------------------------------------
 
@@ -36,18 +37,28 @@ Tirex::Queue implements a prioritized queue of L<Tirex::Job> items.
 
 =head1 METHODS
 
-=head2 Tirex::Queue->new()
+=head2 Tirex::Queue->new( order => $order, max_age => $max_age, cost_model => $model, fairness => $fairness )
 
-Create new Tirex queue object. Normally, this can not fail.
+Create new Tirex queue object. The optional order, max_age and cost_model arguments are
+handed to the priority queues and set the order of jobs within a priority (see
+L<Tirex::PrioQueue>).
+
+With a L<Tirex::Queue::Fairness> object the jobs of different sources with the same
+priority are served by weighted fair queuing (see L<Tirex::PrioQueue::Fair>).
+
+Croaks if the order is unknown or if the order is 'cost' and there is no cost model.
 
 =cut
 
 sub new
 {
     my $class = shift;
-    my %args = ();
+    my %args = @_;
     my $self = bless \%args => $class;
 
+    Carp::croak("unknown queue order '$self->{'order'}'") if (defined $self->{'order'} && ! exists $Tirex::PrioQueue::ORDERS{$self->{'order'}});
+    Carp::croak("queue order 'cost' needs a cost model") if (defined $self->{'order'} && $self->{'order'} eq 'cost' && ! defined $self->{'cost_model'});
+
     return $self->reset();
 }
 
@@ -84,6 +95,21 @@ sub size
     return $self->{'size'};
 }
 
+=head2 $queue->size_of_prio($prio)
+
+Returns the number of jobs with the given priority in the queue.
+
+=cut
+
+sub size_of_prio
+{
+    my $self = shift;
+    my $prio = shift;
+
+    my $pq = $self->{'queues'}->[$prio];
+    return defined $pq ? $pq->size() : 0;
+}
+
 =head2 $queue->empty()
 
 Is the queue empty?
@@ -163,7 +189,11 @@ sub _add
     $newjob = $oldjob->merge($newjob) if ($oldjob);
 
     my $prio = $newjob->get_prio();
-    $self->{'queues'}->[$prio] = Tirex::PrioQueue->new(prio => $prio) unless (defined($self->{'queues'}->[$prio]));
+    unless (defined($self->{'queues'}->[$prio]))
+    {
+        my $class = defined $self->{'fairness'} ? 'Tirex::PrioQueue::Fair' : 'Tirex::PrioQueue';
+        $self->{'queues'}->[$prio] = $class->new(prio => $prio, order => $self->{'order'}, max_age => $self->{'max_age'}, cost_model => $self->{'cost_model'}, fairness => $self->{'fairness'});
+    }
     $self->{'queues'}->[$prio]->add($newjob);
 
     $self->{'jobs'}->{$newjob->hash_key()} = $newjob;
@@ -204,7 +234,7 @@ sub in_queue
 
 =head2 $queue->next()
 
-Removes the topmost job from the queue and return it.
+Removes the topmost job from the queue and return it. This is the job peek() returned.
 Returns undef if the queue is empty.
 
 =cut
@@ -247,6 +277,20 @@ sub peek
     return undef;
 }
 
+=head2 $queue->jobs()
+
+Returns all jobs in the queue, ordered by priority and within a priority in
+the order they came in. The jobs stay in the queue.
+
+=cut
+
+sub jobs
+{
+    my $self = shift;
+
+    return map { $_->jobs() } grep { defined($_) } @{$self->{'queues'}};
+}
+
 =head2 $pq->reset_maxsize()
 
 Reset maxsize. New maxsize will be equal to current size.
@@ -306,7 +350,7 @@ sub remove_jobs_for_unknown_maps
 
 =head1 SEE ALSO
 
-L<Tirex::PrioQueue>, L<Tirex::Job>
+L<Tirex::PrioQueue>, L<Tirex::Job>, L<Tirex::Queue::Native>
 
 =cut
 
@@ -0,0 +1,309 @@
+#-----------------------------------------------------------------------------
+#
+#  Tirex/Queue/Fairness.pm
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Carp;
+use List::Util;
+use Time::HiRes;
+
+#-----------------------------------------------------------------------------
+
+package Tirex::Queue::Fairness;
+
+=head1 NAME
+
+Tirex::Queue::Fairness - Rate limits and weights for the sources of jobs
+
+=head1 SYNOPSIS
+
+ use Tirex::Queue::Fairness;
+
+ my $fairness = Tirex::Queue::Fairness->new( sources => [
+     { name => 'modtile', weight => 8 },
+     { name => 'batch',   weight => 1, rate => 100, burst => 1000 },
+ ]);
+
+ my $queue = Tirex::Queue->new( fairness => $fairness );
+ $queue->add($job) if ($fairness->admit($job, $queue->in_queue($job)));
+
+=head1 DESCRIPTION
+
+Every job has a source (see L<Tirex::Job>): 'modtile' for requests from
+mod_tile, the source name sent in the request for requests through the
+master socket (tirex-batch sends 'batch'), 'command' if there is none, and
+'default' for jobs without source, for instance jobs restored from the
+queue snapshot.
+
+Each source can have a token bucket: it gets I<rate> tokens per second, up
+to I<burst> tokens, and each new job it sends takes one. A job that doesn't
+get a token is rejected. Jobs for metatiles that are already queued or
+rendering don't take a token, they are merged with the existing job.
+
+Within a priority the jobs of the sources are served by weighted fair
+queuing (see L<Tirex::PrioQueue::Fair>): when several sources have jobs
+queued with the same priority, each gets a share of the rendering slots
+proportional to its I<weight>.
+
+Sources without their own config count as the source named 'default',
+which defaults to weight 1 and no rate limit. They share its token bucket
+and its share of the rendering slots, so a client can't get around a rate
+limit or get a bigger share by sending requests under many different names.
+
+The number of admitted, merged and rejected jobs is counted per source.
+
+=head1 METHODS
+
+=head2 Tirex::Queue::Fairness->new( sources => [ { name => ..., weight => ..., rate => ..., burst => ... }, ... ] )
+
+Create new fairness object. The source configs are usually the I<source>
+lines from the config file.
+
+Croaks on invalid config.
+
+=cut
+
+sub new
+{
+    my $class = shift;
+    my %args  = @_;
+    my $self  = bless {} => $class;
+
+    $self->{'config'} = {};
+    foreach my $source (@{$args{'sources'} || []})
+    {
+        my %config = %$source;
+        Carp::croak("source needs a name") unless (defined $config{'name'});
+        Carp::croak("invalid source name '$config{'name'}'") unless ($config{'name'} =~ /^[a-z0-9_]+$/);
+        $config{'weight'} = 1 unless (defined $config{'weight'});
+        Carp::croak("invalid weight for source '$config{'name'}'") unless ($config{'weight'} =~ /^[0-9]+(\.[0-9]+)?$/ && $config{'weight'} > 0);
+        if (defined $config{'rate'})
+        {
+            Carp::croak("invalid rate for source '$config{'name'}'") unless ($config{'rate'} =~ /^[0-9]+(\.[0-9]+)?$/);
+            $config{'burst'} = List::Util::max(1, $config{'rate'}) unless (defined $config{'burst'});
+            Carp::croak("invalid burst for source '$config{'name'}'") unless ($config{'burst'} =~ /^[1-9][0-9]*$/);
+        }
+        $self->{'config'}->{$config{'name'}} = \%config;
+    }
+    $self->{'config'}->{'default'} ||= { name => 'default', weight => 1 };
+
+    $self->{'state'} = {};
+
+    return $self;
+}
+
+=head2 Tirex::Queue::Fairness->new_from_config()
+
+Create new fairness object from the I<source> lines in the config file.
+
+Returns undef if there are none.
+
+=cut
+
+sub new_from_config
+{
+    my $class = shift;
+
+    my $sources = Tirex::Config::get('source');
+    return unless (defined $sources && ref($sources) eq 'ARRAY' && scalar(@$sources) > 0);
+
+    return $class->new( sources => $sources );
+}
+
+=head2 $fairness->key($job)
+
+Returns the name of the source of the job used for queueing and counting.
+
+=cut
+
+sub key
+{
+    my $self = shift;
+    my $job  = shift;
+
+    return $self->source_key($job->get_source());
+}
+
+=head2 $fairness->source_key($name)
+
+Returns the name used for queueing and counting for a source name: the
+name itself if there is a config for it, 'default' otherwise.
+
+=cut
+
+sub source_key
+{
+    my $self = shift;
+    my $key  = shift;
+
+    return $key if (defined $key && exists $self->{'config'}->{$key});
+    return 'default';
+}
+
+=head2 $fairness->weight($key)
+
+Returns the weight of the source.
+
+=cut
+
+sub weight
+{
+    my $self = shift;
+    my $key  = shift;
+
+    return $self->_config($key)->{'weight'};
+}
+
+=head2 $fairness->admit($job, $merged, $now)
+
+Decide whether the job is admitted to the queue. Set $merged if the job
+is merged with a job that is already queued or rendering, those are
+always admitted. $now defaults to the current time.
+
+Returns true if the job is admitted, false if it was rejected because
+its source is over its rate limit.
+
+=cut
+
+sub admit
+{
+    my $self   = shift;
+    my $job    = shift;
+    my $merged = shift;
+    my $now    = shift;
+
+    my $key    = $self->key($job);
+    my $config = $self->_config($key);
+    my $state  = $self->_state($key, $config);
+
+    if ($merged)
+    {
+        $state->{'merged'}++;
+        return 1;
+    }
+
+    if (defined $config->{'rate'})
+    {
+        $self->_refill($state, $config, $now);
+
+        if ($state->{'tokens'} < 1)
+        {
+            $state->{'rejected'}++;
+            return 0;
+        }
+        $state->{'tokens'}--;
+    }
+
+    $state->{'admitted'}++;
+    return 1;
+}
+
+=head2 $fairness->tokens($key, $now)
+
+Returns the number of whole tokens the source has now, undef if it has no
+rate limit.
+
+=cut
+
+sub tokens
+{
+    my $self = shift;
+    my $key  = shift;
+    my $now  = shift;
+
+    my $config = $self->_config($key);
+    return unless (defined $config->{'rate'});
+
+    my $state = $self->_state($key, $config);
+    $self->_refill($state, $config, $now);
+
+    return int($state->{'tokens'});
+}
+
+=head2 $fairness->status()
+
+Returns the config and counters of all sources that sent jobs.
+
+=cut
+
+sub status
+{
+    my $self = shift;
+
+    my @status;
+    foreach my $key (sort keys %{$self->{'state'}})
+    {
+        my $config = $self->_config($key);
+        my $state  = $self->{'state'}->{$key};
+
+        # 0 + in the following to force numeric values for JSON
+        my %s = (
+            name     => $key,
+            weight   => 0 + $config->{'weight'},
+            admitted => 0 + $state->{'admitted'},
+            merged   => 0 + $state->{'merged'},
+            rejected => 0 + $state->{'rejected'},
+        );
+        if (defined $config->{'rate'})
+        {
+            $s{'rate'}   = 0 + $config->{'rate'};
+            $s{'burst'}  = 0 + $config->{'burst'};
+            $s{'tokens'} = 0 + int($state->{'tokens'});
+        }
+        push(@status, \%s);
+    }
+
+    return \@status;
+}
+
+sub _refill
+{
+    my $self   = shift;
+    my $state  = shift;
+    my $config = shift;
+    my $now    = shift;
+
+    $now = Time::HiRes::time() unless (defined $now);
+    $state->{'tokens'} = List::Util::min($config->{'burst'}, $state->{'tokens'} + ($now - $state->{'last'}) * $config->{'rate'}) if ($now > $state->{'last'});
+    $state->{'last'} = $now;
+}
+
+sub _config
+{
+    my $self = shift;
+    my $key  = shift;
+
+    return $self->{'config'}->{$key} || $self->{'config'}->{'default'};
+}
+
+sub _state
+{
+    my $self   = shift;
+    my $key    = shift;
+    my $config = shift;
+
+    $self->{'state'}->{$key} ||= {
+        admitted => 0,
+        merged   => 0,
+        rejected => 0,
+        tokens   => defined $config->{'burst'} ? $config->{'burst'} : 0,
+        last     => 0,
+    };
+
+    return $self->{'state'}->{$key};
+}
+
+=head1 SEE ALSO
+
+L<Tirex::Queue>, L<Tirex::PrioQueue::Fair>
+
+=cut
+
+
+1;
+
+#-- THE END ------------------------------------------------------------------
@@ -0,0 +1,521 @@
+#-----------------------------------------------------------------------------
+#
+#  Tirex/Queue/Journal.pm
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Carp;
+use IO::Handle;
+
+use Tirex::Job;
+use Tirex::Map;
+use Tirex::Metatile;
+
+#-----------------------------------------------------------------------------
+
+package Tirex::Queue::Journal;
+
+our $SNAPSHOT_MAGIC = 'TIREXQS1';
+our $JOURNAL_MAGIC  = 'TIREXQJ1';
+
+=head1 NAME
+
+Tirex::Queue::Journal - Keep the job queue across restarts of the master
+
+=head1 SYNOPSIS
+
+ use Tirex::Queue::Journal;
+
+ my $journal = Tirex::Queue::Journal->new( queue => Tirex::Queue->new(), file => '/var/cache/tirex/stats/queue' );
+ my ($restored, $skipped) = $journal->restore();
+
+ $journal->add( Tirex::Job->new(...) );
+ my $job = $journal->next();
+
+ $journal->flush();     # every few seconds
+ $journal->snapshot();  # every few minutes and on exit
+
+=head1 DESCRIPTION
+
+Wraps a L<Tirex::Queue> or L<Tirex::Queue::Native> and has the same methods,
+so it can be used everywhere instead of the queue.
+
+The content of the queue is written to a snapshot file from time to time and
+on exit. Every job added to the queue and every job leaving it is also written
+to a journal (the snapshot file name with '.journal' appended). Journal
+records are collected in memory and appended to the file on flush(), so if
+the master crashes, only the changes since the last flush are lost. A new
+snapshot starts a new journal.
+
+If the snapshot or the journal can't be written, the journal is disabled
+and the queue is used without it. Nothing is collected in memory then. The
+snapshot and journal files are removed, because they don't match the queue
+any more and would bring back a stale queue on the next start. Only the
+snapshot on exit is tried again, if it works the next start has the queue
+from the exit.
+
+On start the jobs from the snapshot and the journal are put back into the
+queue with their original priorities, request times (so they keep their
+age) and expire times. Jobs that came in already are merged with them as
+usual. Jobs for maps that don't exist any more and expired jobs are dropped.
+
+Both files are binary. The snapshot starts with the magic 'TIREXQS1', a
+generation number, the time it was written and the number of jobs, followed
+by the list of map names and one record of 23 bytes per job (map index,
+prio, z, x, y, request time, expire time, all unsigned big-endian). The
+journal starts with the magic 'TIREXQJ1' and the generation of the snapshot
+it belongs to, followed by 'a' records for added jobs (with the map name
+instead of the index) and 'r' records for removed metatiles. A journal that
+belongs to another snapshot is ignored, an incomplete record at the end
+(from a crash while writing) too.
+
+=head1 METHODS
+
+=head2 Tirex::Queue::Journal->new( queue => $queue, file => $file )
+
+Create journal for the queue. The queue should be empty.
+
+=cut
+
+sub new
+{
+    my $class = shift;
+    my %args = @_;
+    my $self = bless \%args => $class;
+
+    Carp::croak("need queue for queue journal") unless (defined $self->{'queue'});
+    Carp::croak("need file for queue journal")  unless (defined $self->{'file'} && $self->{'file'} ne '');
+
+    $self->{'journal_file'} = $self->{'file'} . '.journal';
+    $self->{'generation'}   = 0;
+    $self->{'buffer'}       = '';
+    $self->{'records'}      = 0;
+    $self->{'disabled'}     = 0;
+
+    return $self;
+}
+
+=head2 $journal->get_queue()
+
+Returns the queue.
+
+=cut
+
+sub get_queue
+{
+    my $self = shift;
+    return $self->{'queue'};
+}
+
+#-----------------------------------------------------------------------------
+# queue methods that change the queue are written to the journal
+#-----------------------------------------------------------------------------
+
+=head2 Queue methods
+
+add(), remove(), next() and reset() change the queue and are written to the
+journal, all other methods of L<Tirex::Queue> are handed through to the
+queue. reset() writes a new snapshot at once.
+
+=cut
+
+sub add
+{
+    my $self = shift;
+
+    my @jobs = map { ref($_) eq 'ARRAY' ? @$_ : $_ } @_;
+    foreach my $job (@jobs)
+    {
+        last unless (defined $self->{'journal_fh'});
+        next unless (ref($job) eq 'Tirex::Job');
+        $self->{'buffer'} .= pack('a C/a N C N N N N', 'a', $job->get_map(), $job->get_prio(), $job->get_z(), $job->get_x(), $job->get_y(), $job->{'request_time'}, $job->{'expire'} || 0);
+        $self->{'records'}++;
+    }
+    $self->{'queue'}->add(@jobs);
+
+    return $self;
+}
+
+sub remove
+{
+    my $self = shift;
+    my $job  = shift;
+
+    my $oldjob = $self->{'queue'}->remove($job);
+    $self->_record_remove($oldjob) if (defined $oldjob);
+
+    return $oldjob;
+}
+
+sub next
+{
+    my $self = shift;
+
+    my $job = $self->{'queue'}->next();
+    $self->_record_remove($job) if (defined $job);
+
+    return $job;
+}
+
+sub reset
+{
+    my $self = shift;
+
+    $self->{'queue'}->reset();
+    $self->snapshot();
+
+    return $self;
+}
+
+sub _record_remove
+{
+    my $self = shift;
+    my $job  = shift;
+
+    return unless (defined $self->{'journal_fh'});
+    $self->{'buffer'} .= pack('a C/a C N N', 'r', $job->get_map(), $job->get_z(), $job->get_x(), $job->get_y());
+    $self->{'records'}++;
+}
+
+sub size                         { my $self = shift; return $self->{'queue'}->size(@_);                         }
+sub size_of_prio                 { my $self = shift; return $self->{'queue'}->size_of_prio(@_);                 }
+sub empty                        { my $self = shift; return $self->{'queue'}->empty(@_);                        }
+sub status                       { my $self = shift; return $self->{'queue'}->status(@_);                       }
+sub in_queue                     { my $self = shift; return $self->{'queue'}->in_queue(@_);                     }
+sub peek                         { my $self = shift; return $self->{'queue'}->peek(@_);                         }
+sub jobs                         { my $self = shift; return $self->{'queue'}->jobs(@_);                         }
+sub reset_maxsize                { my $self = shift; return $self->{'queue'}->reset_maxsize(@_);                }
+sub remove_jobs_for_unknown_maps { my $self = shift; return $self->{'queue'}->remove_jobs_for_unknown_maps(@_); }
+
+#-----------------------------------------------------------------------------
+
+=head2 $journal->flush()
+
+Append the journal records collected since the last flush to the journal
+file.
+
+Returns true if the records were written. Returns false and disables the
+journal if they couldn't be written or the journal is disabled already.
+
+=cut
+
+sub flush
+{
+    my $self = shift;
+
+    return if ($self->{'disabled'});
+    return 1 if ($self->{'buffer'} eq '');
+
+    my $written = syswrite($self->{'journal_fh'}, $self->{'buffer'});
+    unless (defined $written && $written == length($self->{'buffer'}))
+    {
+        $self->disable();
+        return;
+    }
+
+    $self->{'buffer'} = '';
+    return 1;
+}
+
+=head2 $journal->snapshot(@jobs)
+
+Write all jobs in the queue to the snapshot file and start a new journal. The
+snapshot is written under a temporary name and then renamed, so that a crash
+doesn't leave a half written file.
+
+Jobs given as arguments are written to the snapshot before the jobs in the
+queue (unless they are in the queue). The master uses this on exit for the
+jobs that are currently rendering, so that they are rendered again after the
+restart.
+
+The snapshot file is synced to disk before it is renamed, so this blocks
+until the data is on the disk. With big queues on slow disks this can take
+a moment, that's why the master only does it every few minutes (see
+master_queue_snapshot_interval) and not on every flush.
+
+This also works if the journal is disabled, the snapshot is written and the
+journal is enabled again if it can be written now. The master only does that
+on exit.
+
+Returns true if the snapshot was written. Returns false and disables the
+journal if it couldn't be written.
+
+=cut
+
+sub snapshot
+{
+    my $self = shift;
+
+    my $ok = $self->_snapshot(@_);
+    if ($ok)
+    {
+        $self->{'disabled'} = 0;
+    }
+    else
+    {
+        $self->disable();
+    }
+
+    return $ok;
+}
+
+sub _snapshot
+{
+    my $self = shift;
+
+    my $generation = $self->{'generation'} + 1;
+    my @jobs = ((grep { ! $self->{'queue'}->in_queue($_) } @_), $self->{'queue'}->jobs());
+
+    my %maps;
+    my @maps;
+    my $records = '';
+    foreach my $job (@jobs)
+    {
+        # this runs for every job in the queue, so no accessor methods here
+        my $mt  = $job->{'metatile'};
+        my $map = $mt->{'map'};
+        unless (exists $maps{$map})
+        {
+            $maps{$map} = scalar(@maps);
+            push(@maps, $map);
+        }
+        $records .= pack('n N C N N N N', $maps{$map}, $job->{'prio'}, $mt->{'z'}, $mt->{'x'}, $mt->{'y'}, $job->{'request_time'}, $job->{'expire'} || 0);
+    }
+
+    my $tmpfile = $self->{'file'} . '.tmp';
+    open(my $fh, '>', $tmpfile) or return;
+    binmode($fh);
+    print $fh pack('a8 N N N n', $SNAPSHOT_MAGIC, $generation, time(), scalar(@jobs), scalar(@maps));
+    print $fh pack('C/a', $_) foreach (@maps);
+    print $fh $records;
+    $fh->flush() && $fh->sync() or return;
+    close($fh) or return;
+    rename($tmpfile, $self->{'file'}) or return;
+
+    # everything up to now is in the snapshot, the journal starts from here
+    $self->{'generation'} = $generation;
+    $self->{'buffer'}     = '';
+    $self->{'records'}    = 0;
+    close($self->{'journal_fh'}) if (defined $self->{'journal_fh'});
+    delete $self->{'journal_fh'};
+
+    my $jtmpfile = $self->{'journal_file'} . '.tmp';
+    open(my $jfh, '>', $jtmpfile) or return;
+    binmode($jfh);
+    $jfh->autoflush(1);
+    print $jfh pack('a8 N', $JOURNAL_MAGIC, $generation);
+    rename($jtmpfile, $self->{'journal_file'}) or return;
+    $self->{'journal_fh'} = $jfh;
+
+    return 1;
+}
+
+=head2 $journal->disable()
+
+Stop writing the snapshot and the journal and remove both files, so that
+the next start doesn't restore the queue from an old snapshot. The queue is
+still used through the journal object, but changes are not recorded any
+more. This is done automatically after an error, so that the master doesn't
+retry (and log the error) all the time.
+
+=cut
+
+sub disable
+{
+    my $self = shift;
+
+    {
+        local $!; # keep the error for the caller
+        if (defined $self->{'journal_fh'})
+        {
+            close($self->{'journal_fh'});
+            delete $self->{'journal_fh'};
+        }
+        unlink($self->{'file'}, $self->{'file'} . '.tmp', $self->{'journal_file'}, $self->{'journal_file'} . '.tmp');
+    }
+    $self->{'buffer'}   = '';
+    $self->{'records'}  = 0;
+    $self->{'disabled'} = 1;
+
+    return;
+}
+
+=head2 $journal->is_disabled()
+
+Returns true if the journal was disabled.
+
+=cut
+
+sub is_disabled
+{
+    my $self = shift;
+    return $self->{'disabled'};
+}
+
+=head2 $journal->get_generation()
+
+Returns the generation of the last snapshot written or read, 0 if there
+is none.
+
+=cut
+
+sub get_generation
+{
+    my $self = shift;
+    return $self->{'generation'};
+}
+
+=head2 $journal->get_records()
+
+Returns the number of journal records since the last snapshot.
+
+=cut
+
+sub get_records
+{
+    my $self = shift;
+    return $self->{'records'};
+}
+
+=head2 $journal->restore()
+
+Put the jobs from the snapshot and the journal into the queue and write a new
+snapshot. Call this once before using the queue.
+
+Returns the number of jobs restored and the number of jobs dropped (because
+their map is unknown, they are expired or broken).
+
+=cut
+
+sub restore
+{
+    my $self = shift;
+
+    my $queue   = $self->{'queue'};
+    my $skipped = 0;
+
+    my $make_job = sub {
+        my ($map, $prio, $z, $x, $y, $request_time, $expire) = @_;
+        return unless (defined Tirex::Map->get($map));
+        my $job = eval {
+            Tirex::Job->new(
+                metatile     => Tirex::Metatile->new(map => $map, x => $x, y => $y, z => $z),
+                prio         => $prio,
+                request_time => $request_time,
+                $expire ? (expire => $expire) : (),
+            );
+        };
+        return $job;
+    };
+
+    my $generation = 0;
+    if (defined(my $data = _slurp($self->{'file'})))
+    {
+        my ($magic, $gen, $time, $count, $nmaps) = length($data) >= 22 ? unpack('a8 N N N n', $data) : ('');
+        if ($magic eq $SNAPSHOT_MAGIC)
+        {
+            $generation = $gen;
+            my $pos = 22;
+            my @maps;
+            foreach (1 .. $nmaps)
+            {
+                last if ($pos >= length($data));
+                my $len = unpack('C', substr($data, $pos, 1));
+                push(@maps, substr($data, $pos + 1, $len));
+                $pos += 1 + $len;
+            }
+            for (; $pos + 23 <= length($data); $pos += 23)
+            {
+                my ($m, @fields) = unpack('n N C N N N N', substr($data, $pos, 23));
+                my $job = defined $maps[$m] ? $make_job->($maps[$m], @fields) : undef;
+                if ($job)
+                {
+                    $queue->add($job);
+                }
+                else
+                {
+                    $skipped++;
+                }
+            }
+        }
+    }
+
+    my $data = _slurp($self->{'journal_file'});
+    if (defined $data && length($data) >= 12 && substr($data, 0, 8) eq $JOURNAL_MAGIC && unpack('N', substr($data, 8, 4)) == $generation)
+    {
+        my $pos = 12;
+        while ($pos + 2 <= length($data))
+        {
+            my ($type, $len) = unpack('a C', substr($data, $pos, 2));
+            my $size = 2 + $len + ($type eq 'a' ? 21 : 9);
+            last if ($pos + $size > length($data));
+            my $map  = substr($data, $pos + 2, $len);
+            my $rest = substr($data, $pos + 2 + $len, $size - 2 - $len);
+            $pos += $size;
+
+            if ($type eq 'a')
+            {
+                my $job = $make_job->($map, unpack('N C N N N N', $rest));
+                if ($job)
+                {
+                    $queue->add($job);
+                }
+                else
+                {
+                    $skipped++;
+                }
+            }
+            elsif ($type eq 'r')
+            {
+                my ($z, $x, $y) = unpack('C N N', $rest);
+                my $job = $make_job->($map, 1, $z, $x, $y, 0, 0);
+                $queue->remove($job) if ($job);
+            }
+            else
+            {
+                last;
+            }
+        }
+    }
+
+    # jobs that expired while the master was down
+    foreach my $job ($queue->jobs())
+    {
+        if ($job->expired())
+        {
+            $queue->remove($job);
+            $skipped++;
+        }
+    }
+
+    $self->{'generation'} = $generation;
+    $self->snapshot();
+
+    return ($queue->size(), $skipped);
+}
+
+sub _slurp
+{
+    my $file = shift;
+
+    open(my $fh, '<', $file) or return;
+    binmode($fh);
+    my $data = do { local $/; <$fh> };
+    close($fh);
+
+    return $data;
+}
+
+=head1 SEE ALSO
+
+L<Tirex::Queue>, L<Tirex::Queue::Native>
+
+=cut
+
+
+1;
+
+#-- THE END ------------------------------------------------------------------
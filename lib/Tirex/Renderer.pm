@@ -127,6 +127,11 @@ sub new
     Carp::croak("missing procs") unless (defined $args{'procs'} );
 
     Carp::croak("renderer with name $args{'name'} already exists") if ($Renderers{$args{'name'}});
+    Carp::croak("protocol must be 'text' or 'binary'") if (defined $args{'protocol'} && $args{'protocol'} !~ /^(text|binary)$/);
+    Carp::croak("worker_port must be a port number") if (defined $args{'worker_port'} && $args{'worker_port'} !~ /^[0-9]+$/);
+    Carp::croak("placement must be 'none', 'spread' or 'core'") if (defined $args{'placement'} && $args{'placement'} !~ /^(none|spread|core)$/);
+    Carp::croak("cpuset must be a list of CPUs like '0-7,16-23'") if (defined $args{'cpuset'} && $args{'cpuset'} !~ /^[0-9]+(-[0-9]+)?(,[0-9]+(-[0-9]+)?)*$/);
+    Carp::croak("numa_memory must be 'preferred', 'bind' or 'none'") if (defined $args{'numa_memory'} && $args{'numa_memory'} !~ /^(preferred|bind|none)$/);
 
     foreach my $cfg ( qw( name path port procs syslog_facility debug filename ) )
     {
@@ -254,6 +259,97 @@ Get port of this renderer.
 
 sub get_port { return shift->{'port' }; }
 
+=head2 $rend->get_protocol();
+
+Get the format of the messages the master sends to this renderer, 'text'
+(the default) or 'binary'. This is set with the renderer specific option
+"protocol".
+
+=cut
+
+sub get_protocol { return shift->{'config'}->{'protocol'} || 'text'; }
+
+=head2 $rend->is_sticky();
+
+Does every worker of this renderer have its own socket? This is the case if
+the renderer specific option "worker_port" is set. The master then sends each
+job to a particular worker, preferably one that rendered a similar metatile
+before (see L<Tirex::Manager>).
+
+=cut
+
+sub is_sticky { return defined shift->{'config'}->{'worker_port'}; }
+
+=head2 $rend->get_worker_port($n);
+
+Get port of the worker with index $n (0 .. procs-1) of a sticky renderer.
+
+=cut
+
+sub get_worker_port
+{
+    my $self = shift;
+    my $n    = shift;
+
+    return $self->{'config'}->{'worker_port'} + $n;
+}
+
+=head2 $rend->get_ports();
+
+Get all ports the workers of this renderer read requests from. This is the
+port for normal renderers and one port per worker for sticky renderers.
+
+=cut
+
+sub get_ports
+{
+    my $self = shift;
+
+    return ($self->get_port()) unless ($self->is_sticky());
+    return map { $self->get_worker_port($_) } (0 .. $self->get_procs() - 1);
+}
+
+=head2 $rend->get_placement();
+
+Get the placement policy for the workers of this renderer ('none', 'spread' or
+'core', see L<Tirex::Placement>). This is set with the renderer specific option
+"placement".
+
+=cut
+
+sub get_placement { return shift->{'config'}->{'placement'} || 'none'; }
+
+=head2 $rend->get_cpuset();
+
+Get the list of CPUs the workers of this renderer may run on or undef if they
+can run on all CPUs. This is set with the renderer specific option "cpuset".
+
+=cut
+
+sub get_cpuset { return shift->{'config'}->{'cpuset'}; }
+
+=head2 $rend->get_numa_memory();
+
+Get the memory policy for workers placed on a NUMA node: 'preferred' (default),
+'bind' or 'none'. This is set with the renderer specific option "numa_memory".
+
+=cut
+
+sub get_numa_memory { return shift->{'config'}->{'numa_memory'} || 'preferred'; }
+
+=head2 $rend->has_placement();
+
+Are the workers of this renderer placed on particular CPUs?
+
+=cut
+
+sub has_placement
+{
+    my $self = shift;
+
+    return $self->get_placement() ne 'none' || defined $self->get_cpuset();
+}
+
 =head2 $rend->get_procs();
 
 Get procs of this renderer.
@@ -360,18 +456,40 @@ sub status
     return \@status;
 }
 
-=head2 $rend->add_worker($pid);
+=head2 $rend->add_worker($pid, $index);
 
-Add process id to list of currently running workers.
+Add process id to list of currently running workers. The index of the worker
+(0 .. procs-1) selects its port for sticky renderers.
 
 =cut
 
 sub add_worker
+{
+    my $self  = shift;
+    my $pid   = shift;
+    my $index = shift;
+
+    $self->{'workers'}->{$pid} = defined $index ? $index : 0;
+}
+
+=head2 $rend->free_worker_index();
+
+Return the lowest worker index not used by a running worker or undef if all
+are in use.
+
+=cut
+
+sub free_worker_index
 {
     my $self = shift;
-    my $pid  = shift;
 
-    $self->{'workers'}->{$pid} = 1;
+    my %used = map { $_ => 1 } values %{$self->{'workers'}};
+    foreach my $index (0 .. $self->get_procs() - 1)
+    {
+        return $index unless ($used{$index});
+    }
+
+    return;
 }
 
 =head2 $rend->remove_worker($pid);
@@ -79,6 +79,17 @@ sub get_timeout
     return $self->{'timeout'};
 }
 
+=head2 $source->source_key()
+
+Name of the source for rate limits and fair queuing (see L<Tirex::Queue::Fairness>).
+
+=cut
+
+sub source_key
+{
+    return 'default';
+}
+
 # XXX overwrite this in subclass
 sub name
 {
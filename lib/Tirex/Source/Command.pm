@@ -105,7 +105,7 @@ sub make_job
     }
 
     my $job = eval {
-        Tirex::Job->new( metatile => $metatile, prio => $self->{'prio'} );
+        Tirex::Job->new( metatile => $metatile, prio => $self->{'prio'}, source => $self->source_key() );
     };
 
     # if we couldn't create the job...
@@ -174,6 +174,20 @@ sub name
     return 'C';
 }
 
+=head2 $source->source_key()
+
+The source name sent by the client in the 'source' field of the request
+(tirex-batch sends 'batch'), or 'command' if there is none.
+
+=cut
+
+sub source_key
+{
+    my $self = shift;
+
+    return (defined $self->{'source'} && $self->{'source'} =~ /^[a-z0-9_]{1,32}$/) ? $self->{'source'} : 'command';
+}
+
 #-----------------------------------------------------------------------------
 
 1;
@@ -165,7 +165,8 @@ sub make_job
         Tirex::Job->new(
             metatile => $metatile,
             # enum protoCmd { cmdIgnore, cmdRender, cmdDirty, cmdDone, cmdNotDone, cmdRenderPrio, cmdRenderBulk, cmdRenderLow };
-            'prio' => [99, 2, 10, 99, 99, 1, 20, 25]->[$self->{'cmd'}] 
+            'prio' => [99, 2, 10, 99, 99, 1, 20, 25]->[$self->{'cmd'}],
+            source => $self->source_key(),
         );
     };
 
@@ -256,6 +257,11 @@ sub name
     return 'M';
 }
 
+sub source_key
+{
+    return 'modtile';
+}
+
 #-----------------------------------------------------------------------------
 
 1;
@@ -8,9 +8,10 @@ use strict;
 use warnings;
 
 use Carp;
+use List::Util;
+use POSIX;
 
-use IPC::SysV qw(IPC_RMID);
-use IPC::ShareLite;
+use IPC::SysV qw(IPC_CREAT IPC_EXCL IPC_RMID);
 use JSON;
 
 #-----------------------------------------------------------------------------
@@ -19,15 +20,46 @@ package Tirex::Status;
 
 our $SHMKEY = 0x00002468;
 
-# use pretty printing of JSON in shared memory
+# use pretty printing of JSON returned by read()
 # it might make sense to set this to 1 for debugging
 our $pretty = 1;
 
 # permissions for shared memory
-# you need write permissions even for read-only access!
-# (probably because of locking)
 our $mode = 0666;
 
+# Layout of the shared memory segment. This must be kept in sync with
+# native/statussegment.h, see there for a description.
+our $MAGIC           = 0x54535854;
+our $LAYOUT_VERSION  = 2;
+our $MAX_PRIOS       = 32;
+our $MAX_BUCKETS     = 16;
+our $MAX_RENDERING   = 256;
+our $MAX_MAPS        = 32;
+our $MAX_ZOOMS       = 32;
+our $MAX_WORKERS     = 128;
+our $BLOB_SIZE       = 65536;
+
+my $HEADER_PACK    = 'L9 x28';
+my $MASTER_PACK    = 'L L q q d L L L L L L Q Q Q Q S S S S';
+my $PRIO_PACK      = 'L L L L l l';
+my $BUCKET_PACK    = 'Z32 L L L L d C C C x5';
+my $RENDERING_PACK = 'Z32 L L L L q';
+my $MAP_PACK       = "Z32 L x4 L$MAX_ZOOMS L$MAX_ZOOMS Q$MAX_ZOOMS";
+my $WORKER_PACK    = 'L L Z32 Z32 L L L L q q Q Q Q';
+
+my $HEADER_SIZE    = 64;
+my $MASTER_SIZE    = 96 + 24 * $MAX_PRIOS + 64 * $MAX_BUCKETS + 56 * $MAX_RENDERING + 552 * $MAX_MAPS;
+my $BLOB_OFFSET    = $HEADER_SIZE + $MASTER_SIZE;
+my $WORKER_SIZE    = 128;
+my $WORKER_OFFSET  = $BLOB_OFFSET + 8 + $BLOB_SIZE;
+my $SEGMENT_SIZE   = $WORKER_OFFSET + $WORKER_SIZE * $MAX_WORKERS;
+
+our @WORKER_STATES = ('free', 'idle', 'rendering');
+
+# reasons why a bucket can't render (see Tirex::Manager::Bucket::limit())
+our @BUCKET_LIMITS = ('', 'inactive', 'maxproc', 'load', 'psi_cpu', 'psi_memory', 'psi_io', 'memory', 'cost');
+my %LIMIT_CODE = map { $BUCKET_LIMITS[$_] => $_ } 0 .. $#BUCKET_LIMITS;
+
 =head1 NAME
 
 Tirex::Status - Status of running master daemon in shared memory
@@ -40,6 +72,15 @@ my $status = Tirex::Status->new();
 
 This package manages the status of the master daemon in shared memory.
 
+The status is kept in a SysV shared memory segment with a fixed binary layout
+(described in native/statussegment.h in the Tirex sources). The master writes
+its part of the status, every backend worker writes a slot of its own. Each of
+these parts has a single writer and is protected by a sequence counter
+(seqlock), so writers never block and readers retry if they catch a writer in
+the middle of an update.
+
+The C++ class StatusSegment in native/statussegment.h reads the same segment.
+
 =head1 METHODS
 
 =head2 Tirex::Status->new( master => 1 );
@@ -56,26 +97,120 @@ sub new
     my $self = bless \%args => $class;
 
     # if we are the master, remove pre-existing shared memory segments and
-    # semaphore
+    # semaphore (older versions used a semaphore for locking)
     if ($self->{'master'})
     {
         my $id = shmget($SHMKEY, 0, 0);
         shmctl($id, IPC::SysV::IPC_RMID, 0) if (defined($id));
         $id = semget($SHMKEY, 0, 0);
         semctl($id, IPC::SysV::IPC_RMID, 0, 0) if (defined($id));
-    }
 
-    $self->{'share'} = IPC::ShareLite->new(
-        -key       => $SHMKEY,
-        -mode      => $mode,
-        -create    => $self->{'master'} ? 1 : 0,
-        -destroy   => $self->{'master'} ? 1 : 0,
-        -exclusive => $self->{'master'} ? 1 : 0,
-    ) or Carp::croak("cannot connect to shared memory: $!");
+        $self->{'id'} = shmget($SHMKEY, $SEGMENT_SIZE, IPC::SysV::IPC_CREAT | IPC::SysV::IPC_EXCL | $mode);
+        Carp::croak("cannot create shared memory: $!") unless (defined $self->{'id'});
+        $self->{'creator'} = $$;
+        $self->{'seq'} = 0;
+        $self->{'blob_seq'} = 0;
+        $self->{'blob'} = '';
+
+        $self->_shmwrite(pack($HEADER_PACK, $MAGIC, $LAYOUT_VERSION, $SEGMENT_SIZE, $MAX_PRIOS, $MAX_BUCKETS, $MAX_RENDERING, $MAX_MAPS, $MAX_WORKERS, $BLOB_SIZE), 0);
+    }
+    else
+    {
+        $self->_attach() or Carp::croak("cannot connect to shared memory: $!");
+    }
 
     return $self;
 }
 
+sub _attach
+{
+    my $self = shift;
+
+    my $id = shmget($SHMKEY, 0, 0);
+    return unless (defined $id);
+
+    my $header;
+    return unless (shmread($id, $header, 0, $HEADER_SIZE));
+    my ($magic, $version, $size) = unpack($HEADER_PACK, $header);
+    unless ($magic == $MAGIC && $version == $LAYOUT_VERSION && $size == $SEGMENT_SIZE)
+    {
+        $! = POSIX::EINVAL();
+        return;
+    }
+
+    $self->{'id'} = $id;
+    return 1;
+}
+
+sub _shmwrite
+{
+    my $self   = shift;
+    my $data   = shift;
+    my $offset = shift;
+
+    shmwrite($self->{'id'}, $data, $offset, length($data)) or Carp::croak("cannot write to shared memory: $!");
+}
+
+# read section at offset with given size that starts with a sequence counter
+sub _read_section
+{
+    my $self   = shift;
+    my $offset = shift;
+    my $size   = shift;
+
+    foreach my $try (1 .. 1000)
+    {
+        my ($data, $after);
+        shmread($self->{'id'}, $data,  $offset, $size) or return;
+        shmread($self->{'id'}, $after, $offset, 4)     or return;
+        my $before = unpack('L', $data);
+        return $data if ($before % 2 == 0 && $before == unpack('L', $after));
+    }
+    return;
+}
+
+# write section at offset that starts with a sequence counter
+sub _write_section
+{
+    my $self   = shift;
+    my $offset = shift;
+    my $seq    = shift;
+    my $data   = shift;
+
+    $self->_shmwrite(pack('L', $seq + 1), $offset);
+    $self->_shmwrite($data, $offset + 4);
+    $self->_shmwrite(pack('L', $seq + 2), $offset);
+
+    return $seq + 2;
+}
+
+sub _pack_array
+{
+    my $template = shift;
+    my $max      = shift;
+    my $size     = shift;
+    my @entries  = @_;
+
+    splice(@entries, $max) if (@entries > $max);
+    my $data = join('', map { pack($template, @$_) } @entries);
+    return $data . ("\0" x ($size * $max - length($data)));
+}
+
+# log that a part of the status doesn't fit into the shared memory, but only
+# once until it fits again
+sub _truncated
+{
+    my $self    = shift;
+    my $what    = shift;
+    my $message = shift;
+
+    if (defined($message) && !defined($self->{'truncated'}->{$what}))
+    {
+        ::syslog('warning', 'status in shared memory is incomplete: %s', $message);
+    }
+    $self->{'truncated'}->{$what} = $message;
+}
+
 =head2 $status->destroy()
 
 Destroy shared memory segment.
@@ -85,46 +220,285 @@ Destroy shared memory segment.
 sub destroy
 {
     my $self = shift;
-    delete $self->{'share'};
+
+    if ($self->{'master'} && defined($self->{'id'}) && $self->{'creator'} == $$)
+    {
+        shmctl($self->{'id'}, IPC::SysV::IPC_RMID, 0);
+    }
+    delete $self->{'id'};
+}
+
+sub DESTROY
+{
+    my $self = shift;
+    $self->destroy();
 }
 
 =head2 $status->update(key1 => val1, key2 => val2, ...)
 
-Update shared memory with current status. Call with
-key-value pairs that should be added to status.
+Update shared memory with current status. Call with key-value pairs that
+should be added to status. The master calls this with 'started', 'queue',
+'rm', 'renderers', 'maps', and 'sources'.
 
 =cut
 
 sub update
 {
     my $self    = shift;
+    my %status  = @_;
+
+    my $queue = $status{'queue'} || {};
+    my $rm    = $status{'rm'}    || {};
+    my $stats = $rm->{'stats'}   || {};
+
+    # PSI averages over 10 seconds in hundredths of a percent
+    my $pressure = $rm->{'pressure'} || {};
+    my $has_psi  = (grep { defined $pressure->{$_} } qw( cpu memory io )) ? 1 : 0;
+
+    my @prios     = map { [ $_->{'prio'}, $_->{'size'}, $_->{'maxsize'}, defined($_->{'age_first'}) ? 1 : 0, $_->{'age_first'} || 0, $_->{'age_last'} || 0 ] } @{$queue->{'prioqueues'} || []};
+    my @buckets   = map { [ $_->{'name'}, $_->{'minprio'}, $_->{'maxprio'}, $_->{'numproc'}, $_->{'maxproc'}, $_->{'maxload'}, $_->{'active'} ? 1 : 0, $_->{'can_render'} ? 1 : 0, $LIMIT_CODE{$_->{'limited_by'} || ''} || 0 ] } @{$rm->{'buckets'} || []};
+    my @rendering = map { [ $_->{'map'}, $_->{'x'}, $_->{'y'}, $_->{'z'}, $_->{'prio'}, $_->{'age'} ] } @{$rm->{'rendering'} || []};
+    my @maps      = map {
+        my $map = $_;
+        my @pad = (0) x $MAX_ZOOMS;
+        my @zooms = map { [ (@{$stats->{$_}->{$map}}, @pad)[0 .. $MAX_ZOOMS-1] ] } qw( count_rendered max_render_time sum_render_time );
+        [ $map, scalar(@{$stats->{'count_rendered'}->{$map}}), map { @$_ } @zooms ];
+    } sort keys %{$stats->{'count_rendered'} || {}};
+
+    $self->_truncated('prios',     @prios     > $MAX_PRIOS     ? sprintf('%d of %d priorities',      $MAX_PRIOS,     scalar(@prios))     : undef);
+    $self->_truncated('buckets',   @buckets   > $MAX_BUCKETS   ? sprintf('%d of %d buckets',         $MAX_BUCKETS,   scalar(@buckets))   : undef);
+    $self->_truncated('rendering', @rendering > $MAX_RENDERING ? sprintf('%d of %d rendering jobs',  $MAX_RENDERING, scalar(@rendering)) : undef);
+    $self->_truncated('maps',      @maps      > $MAX_MAPS      ? sprintf('%d of %d map statistics',  $MAX_MAPS,      scalar(@maps))      : undef);
+
+    my $data = pack($MASTER_PACK,
+        0, $$, time(), $status{'started'} || 0, $rm->{'load'} || 0,
+        $queue->{'size'} || 0, $queue->{'maxsize'} || 0,
+        List::Util::min(scalar(@prios),     $MAX_PRIOS),
+        List::Util::min(scalar(@buckets),   $MAX_BUCKETS),
+        List::Util::min(scalar(@rendering), $MAX_RENDERING),
+        List::Util::min(scalar(@maps),      $MAX_MAPS),
+        $stats->{'count_requested'} || 0, $stats->{'count_expired'} || 0, $stats->{'count_timeouted'} || 0, $stats->{'count_error'} || 0,
+        (map { int(100 * ($pressure->{$_}->{'10'} || 0) + 0.5) } qw( cpu memory io )), $has_psi,
+    );
+    $data .= _pack_array($PRIO_PACK,      $MAX_PRIOS,     24,  @prios);
+    $data .= _pack_array($BUCKET_PACK,    $MAX_BUCKETS,   64,  @buckets);
+    $data .= _pack_array($RENDERING_PACK, $MAX_RENDERING, 56,  @rendering);
+    $data .= _pack_array($MAP_PACK,       $MAX_MAPS,      552, @maps);
+
+    $self->{'seq'} = $self->_write_section($HEADER_SIZE, $self->{'seq'}, substr($data, 4));
+
+    # the parts without fixed layout only change on config reload (or
+    # with profiling or source counters enabled), only write them if they
+    # changed
+    my %config  = ( renderers => $status{'renderers'} || [], maps => $status{'maps'} || [], sources => $status{'sources'} || [] );
+    my $profile = $rm->{'layer_profile'} || {};
+    my $blob    = _blob(\%config, $profile);
+
+    # if it doesn't fit, leave out whole sections (the least important
+    # first) instead of cutting the JSON
+    my @dropped;
+    foreach my $section (qw( layer_profile sources maps renderers ))
+    {
+        last if (length($blob) <= $BLOB_SIZE);
+        if ($section eq 'layer_profile') { $profile = {}; } else { $config{$section} = []; }
+        push(@dropped, $section);
+        $blob = _blob(\%config, $profile);
+    }
+    $self->_truncated('blob', @dropped ? 'left out ' . join(', ', @dropped) : undef);
+
+    if ($blob ne $self->{'blob'})
+    {
+        $self->{'blob_seq'} = $self->_write_section($BLOB_OFFSET, $self->{'blob_seq'}, pack('L', length($blob)) . $blob);
+        $self->{'blob'} = $blob;
+    }
+
+    return;
+}
+
+sub _blob
+{
+    my $config  = shift;
+    my $profile = shift;
+
+    return JSON::to_json($config, { canonical => 1 }) . "\0" . JSON::to_json($profile, { canonical => 1 });
+}
+
+=head2 $status->update_worker($slot, key1 => val1, ...)
+
+Update status slot of a backend worker. Keys are 'renderer', 'state' ('idle',
+'rendering', or 'free'), 'map', 'x', 'y', 'z' (the job that is being
+rendered), 'job_started' (in milliseconds since the epoch), 'rendered' and
+'errors' (counters), and 'rss' (in kB).
+
+Returns false if the master isn't running.
+
+=cut
+
+sub update_worker
+{
+    my $self = shift;
+    my $slot = shift;
+    my %args = @_;
+
+    return if ($slot < 0 || $slot >= $MAX_WORKERS);
+
+    my $offset = $WORKER_OFFSET + $slot * $WORKER_SIZE;
+    my %states = ( free => 0, idle => 1, rendering => 2 );
+
+    $args{'state'} = 'idle' unless (defined $args{'state'});
+
+    my $data = pack($WORKER_PACK, 0, $args{'state'} eq 'free' ? 0 : $$,
+        $args{'renderer'} || '', $args{'map'} || '', $args{'x'} || 0, $args{'y'} || 0, $args{'z'} || 0, $states{$args{'state'}} || 0,
+        $args{'job_started'} || 0, time(), $args{'rendered'} || 0, $args{'errors'} || 0, $args{'rss'} || 0);
+
+    # the master might have been restarted in the meantime, in which case
+    # we have to attach to the new segment
+    foreach my $try (1, 2)
+    {
+        my $seq;
+        if (shmread($self->{'id'}, $seq, $offset, 4))
+        {
+            $seq = (unpack('L', $seq) + 1) & ~1;
+            return 1 if (eval { $self->_write_section($offset, $seq, substr($data, 4)); 1 });
+        }
+        $self->_attach() or return;
+    }
+    return;
+}
+
+=head2 $status->read_status()
+
+Read status from shared memory.
+
+Returns a hash with the status in the same structure as given to update() plus
+'pid', 'updated' and the worker status in 'workers'. Returns undef if the
+shared memory was not accessible.
+
+=cut
+
+sub read_status
+{
+    my $self = shift;
+
+    my $data = $self->_read_section($HEADER_SIZE, $MASTER_SIZE) or return;
+    my $blob = $self->_read_section($BLOB_OFFSET, 8 + $BLOB_SIZE) or return;
+
+    my ($seq, $pid, $updated, $started, $load, $size, $maxsize, $num_prios, $num_buckets, $num_rendering, $num_maps,
+        $count_requested, $count_expired, $count_timeouted, $count_error, @psi) = unpack($MASTER_PACK, $data);
+
+    my $offset = 96;
+    my @prioqueues;
+    foreach my $n (0 .. $num_prios - 1)
+    {
+        my ($prio, $size, $maxsize, $has_age, $age_first, $age_last) = unpack($PRIO_PACK, substr($data, $offset + 24 * $n, 24));
+        my %pq = ( prio => $prio, size => $size, maxsize => $maxsize );
+        @pq{'age_first', 'age_last'} = ($age_first, $age_last) if ($has_age);
+        push(@prioqueues, \%pq);
+    }
+    $offset += 24 * $MAX_PRIOS;
+
+    my @buckets;
+    foreach my $n (0 .. $num_buckets - 1)
+    {
+        my %b;
+        @b{qw( name minprio maxprio numproc maxproc maxload active can_render limited_by )} = unpack($BUCKET_PACK, substr($data, $offset + 64 * $n, 64));
+        $b{'can_render'} = $b{'can_render'} ? JSON::true : JSON::false;
+        $b{'limited_by'} = $BUCKET_LIMITS[$b{'limited_by'}] || '';
+        push(@buckets, \%b);
+    }
+    $offset += 64 * $MAX_BUCKETS;
+
+    my @rendering;
+    foreach my $n (0 .. $num_rendering - 1)
+    {
+        my %r;
+        @r{qw( map x y z prio age )} = unpack($RENDERING_PACK, substr($data, $offset + 56 * $n, 56));
+        push(@rendering, \%r);
+    }
+    $offset += 56 * $MAX_RENDERING;
+
+    my %stats = (
+        count_requested => $count_requested,
+        count_expired   => $count_expired,
+        count_timeouted => $count_timeouted,
+        count_error     => $count_error,
+        count_rendered  => {},
+        sum_render_time => {},
+        max_render_time => {},
+    );
+    foreach my $n (0 .. $num_maps - 1)
+    {
+        my ($name, $zooms, @values) = unpack($MAP_PACK, substr($data, $offset + 552 * $n, 552));
+        $zooms = $MAX_ZOOMS if ($zooms > $MAX_ZOOMS);
+        $stats{'count_rendered' }->{$name} = [ @values[0 .. $zooms-1] ];
+        $stats{'max_render_time'}->{$name} = [ @values[$MAX_ZOOMS .. $MAX_ZOOMS+$zooms-1] ];
+        $stats{'sum_render_time'}->{$name} = [ @values[2*$MAX_ZOOMS .. 2*$MAX_ZOOMS+$zooms-1] ];
+    }
+
+    my $length = unpack('L', substr($blob, 4, 4));
+    my ($config, $profile) = split(/\0/, substr($blob, 8, $length), 2);
+    $config = eval { JSON::from_json($config) } || {};
+    $profile = eval { JSON::from_json($profile) } || {};
 
     my %status = (
-        'pid'     => 0 + $$, # force integer for JSON
-        'updated' => time(),
-        @_
+        pid     => $pid,
+        updated => $updated,
+        started => $started,
+        queue   => {
+            size       => $size,
+            maxsize    => $maxsize,
+            prioqueues => \@prioqueues,
+        },
+        rm      => {
+            load          => $load,
+            num_rendering => $num_rendering,
+            stats         => \%stats,
+            layer_profile => $profile,
+            ($psi[3] ? (pressure => { cpu => { 10 => $psi[0] / 100 }, memory => { 10 => $psi[1] / 100 }, io => { 10 => $psi[2] / 100 } }) : ()),
+            buckets       => \@buckets,
+            rendering     => \@rendering,
+        },
+        renderers => $config->{'renderers'} || [],
+        maps      => $config->{'maps'} || [],
+        sources   => $config->{'sources'} || [],
+        workers   => $self->read_workers(),
     );
 
-    $self->write(JSON::to_json(\%status, { pretty => $pretty }) . "\n");
+    return \%status;
 }
 
-=head2 $status->write($string)
+=head2 $status->read_workers()
 
-Write a string into shared memory.
+Read status of all backend workers. Returns reference to array of hashes.
 
 =cut
 
-sub write
+sub read_workers
 {
     my $self = shift;
-    my $str  = shift;
 
-    $self->{'share'}->store($str);
+    my @workers;
+    foreach my $slot (0 .. $MAX_WORKERS - 1)
+    {
+        my $data = $self->_read_section($WORKER_OFFSET + $slot * $WORKER_SIZE, $WORKER_SIZE) or next;
+        my %w;
+        (undef, @w{qw( pid renderer map x y z state job_started updated rendered errors rss )}) = unpack($WORKER_PACK, $data);
+        next if ($w{'state'} == 0);
+        # skip slots of workers that died without cleaning up
+        next unless (kill(0, $w{'pid'}) || $!{'EPERM'});
+        $w{'state'} = $WORKER_STATES[$w{'state'}] || 'unknown';
+        delete @w{qw( map x y z job_started )} unless ($w{'state'} eq 'rendering');
+        $w{'slot'} = $slot;
+        push(@workers, \%w);
+    }
+
+    return \@workers;
 }
 
 =head2 $status->read()
 
-Read a string from shared memory.
+Read status from shared memory and return it as JSON string. This is the
+same structure older versions of Tirex kept in shared memory.
 
 Returns the string read, or undef if the shared memory was not accessible.
 
@@ -134,9 +508,9 @@ sub read
 {
     my $self = shift;
 
-    my $str = eval { $self->{'share'}->fetch(); };
+    my $status = eval { $self->read_status() } or return;
 
-    return $str;
+    return JSON::to_json($status, { pretty => $pretty, canonical => 1 }) . "\n";
 }
 
 
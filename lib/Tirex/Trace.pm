@@ -0,0 +1,132 @@
+#-----------------------------------------------------------------------------
+#
+#  Tirex/Trace.pm
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Carp;
+use IO::Handle;
+use Fcntl;
+use Time::HiRes;
+
+#-----------------------------------------------------------------------------
+
+package Tirex::Trace;
+
+# file handle of the open trace file, tracing is off if this is undef
+our $fh;
+
+=head1 NAME
+
+Tirex::Trace - Write trace spans for rendering jobs
+
+=head1 SYNOPSIS
+
+ use Tirex::Trace;
+ Tirex::Trace->open('/var/log/tirex/trace.json');
+ my $start = Tirex::Trace->now();
+ ...
+ Tirex::Trace->span('queued', $job, $start, Tirex::Trace->now());
+
+=head1 DESCRIPTION
+
+Spans are written as "complete" events in the Trace Event Format, which can be
+loaded into the Chrome trace viewer (chrome://tracing) or Perfetto. The file is
+only ever appended to. The opening bracket of the JSON array is written when the
+file is created, and the closing bracket is optional in this format, so the
+master and the rendering backends can all append to the same file.
+
+Every span carries the job id, so the life of a job can be followed from the
+master through the backend and back.
+
+If no trace file was opened, all methods do nothing.
+
+=head1 METHODS
+
+=head2 Tirex::Trace->open($filename)
+
+Open trace file for appending. Croaks if the file can't be opened.
+
+=cut
+
+sub open
+{
+    my $class    = shift;
+    my $filename = shift;
+
+    sysopen($fh, $filename, Fcntl::O_WRONLY|Fcntl::O_APPEND|Fcntl::O_CREAT) or Carp::croak("Can't open trace file '$filename': $!");
+    $fh->autoflush(1);
+    print $fh "[\n" if (-z $filename);
+
+    return;
+}
+
+=head2 Tirex::Trace->close()
+
+Close trace file.
+
+=cut
+
+sub close
+{
+    if ($fh)
+    {
+        CORE::close($fh);
+        undef $fh;
+    }
+    return;
+}
+
+=head2 Tirex::Trace->enabled()
+
+Returns true if tracing is enabled.
+
+=cut
+
+sub enabled
+{
+    return defined $fh;
+}
+
+=head2 Tirex::Trace->now()
+
+Returns current time in (fractional) seconds since the epoch.
+
+=cut
+
+sub now
+{
+    return Time::HiRes::time();
+}
+
+=head2 Tirex::Trace->span($name, $job, $start, $end)
+
+Write span for a job. Start and end are in (fractional) seconds since the epoch.
+
+=cut
+
+sub span
+{
+    my $class = shift;
+    my $name  = shift;
+    my $job   = shift;
+    my $start = shift;
+    my $end   = shift;
+
+    return unless ($fh);
+
+    # one print per event so that events from different processes don't mix
+    print $fh sprintf(qq({"name":"%s","cat":"master","ph":"X","ts":%d,"dur":%d,"pid":%d,"tid":%d,"args":{"id":"%s","map":"%s","x":%d,"y":%d,"z":%d,"prio":%d}},\n),
+        $name, $start * 1_000_000, ($end - $start) * 1_000_000, $$, $$,
+        $job->get_id(), $job->get_map(), $job->get_x(), $job->get_y(), $job->get_z(), $job->get_prio());
+
+    return;
+}
+
+
+1;
+
+#-- THE END ------------------------------------------------------------------
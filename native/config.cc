@@ -0,0 +1,91 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Config files
+ *
+ */
+
+#include "config.h"
+
+#include <glob.h>
+#include <fstream>
+
+static std::string trim(const std::string& str)
+{
+    size_t begin = str.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) return "";
+    size_t end = str.find_last_not_of(" \t\r");
+    return str.substr(begin, end - begin + 1);
+}
+
+/**
+ * Read "key=value" lines from a config file. Comments start with '#',
+ * values can be quoted. Returns false if the file can't be opened.
+ */
+bool config_read(const std::string& filename, config_map& config)
+{
+    std::ifstream file(filename.c_str());
+    if (!file) return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) continue;
+
+        std::string key   = trim(line.substr(0, eq));
+        std::string value = trim(line.substr(eq + 1));
+        if (value.size() >= 2 && value[0] == '"' && value[value.size() - 1] == '"') value = value.substr(1, value.size() - 2);
+
+        if (!key.empty() && key.find_first_of(" \t") == std::string::npos) config[key] = value;
+    }
+
+    return true;
+}
+
+/**
+ * Read the configs of all maps in configdir/renderer/RENDERER/MAP.conf
+ * like Tirex::Renderer does, keyed by map name.
+ */
+void config_read_maps(const std::string& configdir, std::map<std::string, config_map>& maps)
+{
+    glob_t g;
+    std::string pattern = configdir + "/renderer/*/*.conf";
+
+    if (glob(pattern.c_str(), 0, NULL, &g) != 0) return;
+
+    for (size_t i = 0; i < g.gl_pathc; i++)
+    {
+        config_map map;
+        if (config_read(g.gl_pathv[i], map) && !config_get(map, "name", "").empty())
+        {
+            maps[config_get(map, "name", "")] = map;
+        }
+    }
+
+    globfree(&g);
+}
+
+/**
+ * Find the config of the map with the given name.
+ */
+bool config_find_map(const std::string& configdir, const std::string& name, config_map& config)
+{
+    std::map<std::string, config_map> maps;
+    config_read_maps(configdir, maps);
+
+    std::map<std::string, config_map>::const_iterator it = maps.find(name);
+    if (it == maps.end()) return false;
+
+    config = it->second;
+    return true;
+}
+
+std::string config_get(const config_map& config, const std::string& key, const std::string& def)
+{
+    config_map::const_iterator it = config.find(key);
+    return it == config.end() ? def : it->second;
+}
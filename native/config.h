@@ -0,0 +1,31 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Config files
+ *
+ */
+
+/**
+ * Minimal reader for the Tirex config files (tirex.conf and the renderer
+ * and map configs below renderer/) for native tools that need to find the
+ * tile directory of a map or the master socket. Only the simple
+ * "key=value" lines are understood, see Tirex::Config for the full format.
+ */
+
+#ifndef config_included
+#define config_included
+
+#include <map>
+#include <string>
+
+#define TIREX_CONFIGDIR "/etc/tirex"
+#define TIREX_SOCKET_DIR "/run/tirex"
+
+typedef std::map<std::string, std::string> config_map;
+
+bool config_read(const std::string& filename, config_map& config);
+bool config_find_map(const std::string& configdir, const std::string& name, config_map& config);
+void config_read_maps(const std::string& configdir, std::map<std::string, config_map>& maps);
+std::string config_get(const config_map& config, const std::string& key, const std::string& def);
+
+#endif
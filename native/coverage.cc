@@ -0,0 +1,455 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Polygon coverage
+ *
+ */
+
+#include "coverage.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+static double lon2u(double lon)
+{
+    return (lon + 180.0) / 360.0;
+}
+
+static double lat2v(double lat)
+{
+    if (lat < -85.05113) lat = -85.05113;
+    if (lat >  85.05113) lat =  85.05113;
+    lat = lat * M_PI / 180.0;
+    return (1.0 - log(tan(lat) + 1.0 / cos(lat)) / M_PI) / 2.0;
+}
+
+Coverage::Coverage() :
+    mSorted(true),
+    mMinY(1.0),
+    mMaxY(0.0)
+{
+}
+
+/**
+ * Add a ring of the polygon. It doesn't have to be closed, rings with
+ * less than three points are ignored.
+ */
+void Coverage::addRing(const coverage_ring& ring)
+{
+    if (ring.size() < 3) return;
+
+    for (size_t i = 0; i < ring.size(); i++)
+    {
+        const std::pair<double, double>& p = ring[i];
+        const std::pair<double, double>& q = ring[(i + 1) % ring.size()];
+        if (p == q) continue;
+
+        edge e = { lon2u(p.first), lat2v(p.second), lon2u(q.first), lat2v(q.second) };
+        if (e.y0 > e.y1)
+        {
+            std::swap(e.x0, e.x1);
+            std::swap(e.y0, e.y1);
+        }
+        mEdges.push_back(e);
+        mMinY = std::min(mMinY, e.y0);
+        mMaxY = std::max(mMaxY, e.y1);
+    }
+    mSorted = false;
+}
+
+bool Coverage::readFile(const std::string& filename, std::string& error)
+{
+    std::ifstream in(filename);
+    if (!in)
+    {
+        error = "can't open polygon file '" + filename + "'";
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = buffer.str();
+
+    size_t start = text.find_first_not_of(" \t\r\n");
+    std::vector<coverage_ring> rings;
+    bool ok = start != std::string::npos && (text[start] == '{' || text[start] == '[') ? parseGeoJSON(text, rings, error) : parseWKT(text, rings, error);
+    if (!ok) return false;
+
+    for (auto itr = rings.begin(); itr != rings.end(); ++itr) addRing(*itr);
+    if (empty())
+    {
+        error = "no polygons in '" + filename + "'";
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Minimal JSON reader, only as much as needed to find the polygons in
+ * GeoJSON.
+ */
+namespace {
+
+struct json_value {
+    enum { null, number, string, array, object, other } type;
+    double num;
+    std::string str;
+    std::vector<json_value> items;                  // array elements or object values
+    std::vector<std::string> keys;                  // object keys
+
+    json_value() : type(null), num(0) {}
+
+    const json_value *get(const char *key) const
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            if (keys[i] == key) return &items[i];
+        }
+        return NULL;
+    }
+};
+
+class json_parser
+{
+    public:
+
+    json_parser(const std::string& text) : mText(text), mPos(0) {}
+
+    bool parse(json_value& value)
+    {
+        if (!parseValue(value, 0)) return false;
+        skipSpace();
+        return mPos == mText.size();
+    }
+
+    size_t position() const { return mPos; }
+
+    private:
+
+    void skipSpace()
+    {
+        while (mPos < mText.size() && isspace(static_cast<unsigned char>(mText[mPos]))) mPos++;
+    }
+
+    bool expect(char c)
+    {
+        skipSpace();
+        if (mPos < mText.size() && mText[mPos] == c)
+        {
+            mPos++;
+            return true;
+        }
+        return false;
+    }
+
+    bool parseString(std::string& str)
+    {
+        if (!expect('"')) return false;
+        while (mPos < mText.size() && mText[mPos] != '"')
+        {
+            if (mText[mPos] == '\\') mPos++; // escapes are kept as they are, only keys and types are compared
+            if (mPos < mText.size()) str += mText[mPos++];
+        }
+        return expect('"');
+    }
+
+    bool parseValue(json_value& value, int depth)
+    {
+        if (depth > 64) return false;
+        skipSpace();
+        if (mPos >= mText.size()) return false;
+
+        char c = mText[mPos];
+        if (c == '{')
+        {
+            mPos++;
+            value.type = json_value::object;
+            if (expect('}')) return true;
+            do {
+                std::string key;
+                if (!parseString(key) || !expect(':')) return false;
+                value.keys.push_back(key);
+                value.items.push_back(json_value());
+                if (!parseValue(value.items.back(), depth + 1)) return false;
+            } while (expect(','));
+            return expect('}');
+        }
+        if (c == '[')
+        {
+            mPos++;
+            value.type = json_value::array;
+            if (expect(']')) return true;
+            do {
+                value.items.push_back(json_value());
+                if (!parseValue(value.items.back(), depth + 1)) return false;
+            } while (expect(','));
+            return expect(']');
+        }
+        if (c == '"')
+        {
+            value.type = json_value::string;
+            return parseString(value.str);
+        }
+        if (c == '-' || isdigit(static_cast<unsigned char>(c)))
+        {
+            const char *begin = mText.c_str() + mPos;
+            char *end;
+            value.type = json_value::number;
+            value.num = strtod(begin, &end);
+            mPos += end - begin;
+            return end != begin;
+        }
+        for (const char *word : { "true", "false", "null" })
+        {
+            if (mText.compare(mPos, strlen(word), word) == 0)
+            {
+                value.type = json_value::other;
+                mPos += strlen(word);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const std::string& mText;
+    size_t mPos;
+};
+
+bool json_ring(const json_value& value, coverage_ring& ring)
+{
+    if (value.type != json_value::array) return false;
+    for (auto itr = value.items.begin(); itr != value.items.end(); ++itr)
+    {
+        if (itr->type != json_value::array || itr->items.size() < 2 ||
+            itr->items[0].type != json_value::number || itr->items[1].type != json_value::number) return false;
+        ring.push_back(std::make_pair(itr->items[0].num, itr->items[1].num));
+    }
+    return true;
+}
+
+bool json_polygon(const json_value& value, std::vector<coverage_ring>& rings)
+{
+    if (value.type != json_value::array) return false;
+    for (auto itr = value.items.begin(); itr != value.items.end(); ++itr)
+    {
+        rings.push_back(coverage_ring());
+        if (!json_ring(*itr, rings.back())) return false;
+    }
+    return true;
+}
+
+bool json_geometry(const json_value& value, std::vector<coverage_ring>& rings)
+{
+    const json_value *type = value.get("type");
+    if (!type || type->type != json_value::string) return true;
+
+    const json_value *list = NULL;
+    if (type->str == "FeatureCollection") list = value.get("features");
+    else if (type->str == "GeometryCollection") list = value.get("geometries");
+    if (list && list->type == json_value::array)
+    {
+        for (auto itr = list->items.begin(); itr != list->items.end(); ++itr)
+        {
+            if (!json_geometry(*itr, rings)) return false;
+        }
+        return true;
+    }
+
+    if (type->str == "Feature")
+    {
+        const json_value *geometry = value.get("geometry");
+        return geometry ? json_geometry(*geometry, rings) : true;
+    }
+
+    const json_value *coordinates = value.get("coordinates");
+    if (type->str == "Polygon")
+    {
+        return coordinates && json_polygon(*coordinates, rings);
+    }
+    if (type->str == "MultiPolygon")
+    {
+        if (!coordinates || coordinates->type != json_value::array) return false;
+        for (auto itr = coordinates->items.begin(); itr != coordinates->items.end(); ++itr)
+        {
+            if (!json_polygon(*itr, rings)) return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+bool Coverage::parseGeoJSON(const std::string& text, std::vector<coverage_ring>& rings, std::string& error)
+{
+    json_value root;
+    json_parser parser(text);
+    if (!parser.parse(root))
+    {
+        error = "can't parse GeoJSON near byte " + std::to_string(parser.position());
+        return false;
+    }
+    if (!json_geometry(root, rings))
+    {
+        error = "can't parse GeoJSON: broken polygon coordinates";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Rings of a WKT POLYGON or MULTIPOLYGON: every innermost pair of
+ * parentheses is a ring of "lon lat" pairs separated by commas.
+ */
+bool Coverage::parseWKT(const std::string& text, std::vector<coverage_ring>& rings, std::string& error)
+{
+    size_t pos = text.find_first_not_of(" \t\r\n");
+    if (pos != std::string::npos && strncasecmp(text.c_str() + pos, "SRID=", 5) == 0)
+    {
+        pos = text.find(';', pos);
+        if (pos != std::string::npos) pos = text.find_first_not_of(" \t\r\n", pos + 1);
+    }
+    if (pos == std::string::npos ||
+        (strncasecmp(text.c_str() + pos, "POLYGON", 7) && strncasecmp(text.c_str() + pos, "MULTIPOLYGON", 12)))
+    {
+        error = "can't parse WKT: only POLYGON and MULTIPOLYGON are allowed";
+        return false;
+    }
+
+    while ((pos = text.find('(', pos)) != std::string::npos)
+    {
+        size_t end = text.find_first_of("()", pos + 1);
+        if (end == std::string::npos)
+        {
+            error = "can't parse WKT: missing ')'";
+            return false;
+        }
+        if (text[end] == '(')
+        {
+            pos = end;
+            continue;
+        }
+
+        coverage_ring ring;
+        const char *p = text.c_str() + pos + 1;
+        const char *stop = text.c_str() + end;
+        while (p < stop)
+        {
+            char *next;
+            double lon = strtod(p, &next);
+            if (next == p) break;
+            p = next;
+            double lat = strtod(p, &next);
+            if (next == p)
+            {
+                error = "can't parse WKT point";
+                return false;
+            }
+            p = next;
+            while (p < stop && *p != ',') p++; // skip z and m
+            if (p < stop) p++;
+            ring.push_back(std::make_pair(lon, lat));
+        }
+        rings.push_back(ring);
+        pos = end + 1;
+    }
+    return true;
+}
+
+void Coverage::rows(int zoom, int mtx, int mty, const std::function<void(uint32_t, const std::vector<coverage_span>&)>& f)
+{
+    if (mEdges.empty()) return;
+
+    if (!mSorted)
+    {
+        std::sort(mEdges.begin(), mEdges.end(), [](const edge& a, const edge& b) { return a.y0 < b.y0; });
+        mSorted = true;
+    }
+
+    double sx = ldexp(1.0, zoom) / mtx;
+    double sy = ldexp(1.0, zoom) / mty;
+    int64_t cols = std::max(static_cast<int64_t>(1), static_cast<int64_t>(ceil(sx)));
+    int64_t nrows = std::max(static_cast<int64_t>(1), static_cast<int64_t>(ceil(sy)));
+
+    auto col = [cols](double x) -> uint32_t {
+        int64_t c = static_cast<int64_t>(x);
+        return static_cast<uint32_t>(c < 0 ? 0 : c >= cols ? cols - 1 : c);
+    };
+
+    size_t next = 0;
+    std::vector<const edge *> active;
+    std::vector<coverage_span> spans;
+    std::vector<double> crossings;
+
+    int64_t last = std::min(nrows - 1, static_cast<int64_t>(mMaxY * sy));
+    for (int64_t row = std::max(static_cast<int64_t>(0), static_cast<int64_t>(mMinY * sy)); row <= last; row++)
+    {
+        double top    = row / sy;
+        double bottom = (row + 1) / sy;
+        double middle = (row + 0.5) / sy;
+
+        while (next < mEdges.size() && mEdges[next].y0 <= bottom) active.push_back(&mEdges[next++]);
+        active.erase(std::remove_if(active.begin(), active.end(), [top](const edge *e) { return e->y1 < top; }), active.end());
+        if (active.empty()) continue;
+
+        spans.clear();
+        crossings.clear();
+        for (auto itr = active.begin(); itr != active.end(); ++itr)
+        {
+            const edge& e = **itr;
+
+            // part of the edge inside this row of metatiles
+            double xa = e.x0, xb = e.x1;
+            if (e.y1 > e.y0)
+            {
+                double ya = e.y0 < top ? top : e.y0;
+                double yb = e.y1 > bottom ? bottom : e.y1;
+                xa = e.x0 + (e.x1 - e.x0) * (ya - e.y0) / (e.y1 - e.y0);
+                xb = e.x0 + (e.x1 - e.x0) * (yb - e.y0) / (e.y1 - e.y0);
+            }
+            if (xa > xb) std::swap(xa, xb);
+            spans.push_back(coverage_span{ col(xa * sx), col(xb * sx) });
+
+            if (e.y0 <= middle && middle < e.y1) crossings.push_back(e.x0 + (e.x1 - e.x0) * (middle - e.y0) / (e.y1 - e.y0));
+        }
+
+        // spans inside the polygon
+        std::sort(crossings.begin(), crossings.end());
+        for (size_t i = 0; i + 1 < crossings.size(); i += 2)
+        {
+            spans.push_back(coverage_span{ col(crossings[i] * sx), col(crossings[i + 1] * sx) });
+        }
+
+        // merge overlapping and adjacent spans
+        std::sort(spans.begin(), spans.end(), [](const coverage_span& a, const coverage_span& b) { return a.xmin < b.xmin; });
+        size_t n = 0;
+        for (size_t i = 1; i < spans.size(); i++)
+        {
+            if (spans[i].xmin <= spans[n].xmax + 1)
+            {
+                spans[n].xmax = std::max(spans[n].xmax, spans[i].xmax);
+            }
+            else
+            {
+                spans[++n] = spans[i];
+            }
+        }
+        spans.resize(n + 1);
+
+        f(static_cast<uint32_t>(row), spans);
+    }
+}
+
+uint64_t Coverage::count(int zoom, int mtx, int mty)
+{
+    uint64_t count = 0;
+    rows(zoom, mtx, mty, [&count](uint32_t, const std::vector<coverage_span>& spans) {
+        for (auto itr = spans.begin(); itr != spans.end(); ++itr) count += itr->xmax - itr->xmin + 1;
+    });
+    return count;
+}
@@ -0,0 +1,75 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Polygon coverage
+ *
+ */
+
+/**
+ * Coverage
+ *
+ * Finds the metatiles intersecting a polygon on each zoom level, the same
+ * way as Tirex::Metatiles::Coverage: the polygon is read from a GeoJSON
+ * (Polygon and MultiPolygon, also inside Features, FeatureCollections and
+ * GeometryCollections) or WKT file (POLYGON or MULTIPOLYGON) in WGS84 and
+ * rasterised with a scanline at metatile resolution. For each row of
+ * metatiles the edges crossing the row mark the metatiles on the boundary
+ * and the crossings of the edges with the middle of the row give the spans
+ * inside (even-odd rule, so inner rings are holes).
+ *
+ * The edges are kept sorted by their northern end and only the edges
+ * crossing the current row are looked at, so a row costs time in the
+ * number of edges crossing it and the memory needed is one row of spans,
+ * independent of the zoom level.
+ */
+
+#ifndef coverage_included
+#define coverage_included
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef std::vector<std::pair<double, double> > coverage_ring; // lon, lat
+
+struct coverage_span {
+    uint32_t xmin;  // metatile columns, inclusive
+    uint32_t xmax;
+};
+
+class Coverage
+{
+    public:
+
+    Coverage();
+
+    void addRing(const coverage_ring& ring);
+    bool readFile(const std::string& filename, std::string& error);
+    bool empty() const { return mEdges.empty(); }
+
+    static bool parseGeoJSON(const std::string& text, std::vector<coverage_ring>& rings, std::string& error);
+    static bool parseWKT(const std::string& text, std::vector<coverage_ring>& rings, std::string& error);
+
+    /**
+     * Call f for every row of metatiles (mtx x mty tiles) on the zoom level
+     * with the row number and the sorted spans of covered metatiles.
+     */
+    void rows(int zoom, int mtx, int mty, const std::function<void(uint32_t, const std::vector<coverage_span>&)>& f);
+
+    uint64_t count(int zoom, int mtx, int mty);
+
+    private:
+
+    struct edge {
+        double x0, y0, x1, y1;  // Mercator from 0 to 1, y0 <= y1
+    };
+
+    std::vector<edge> mEdges;
+    bool mSorted;
+    double mMinY;
+    double mMaxY;
+};
+
+#endif
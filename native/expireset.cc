@@ -0,0 +1,161 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Expire set
+ *
+ */
+
+#include "expireset.h"
+
+#include <algorithm>
+
+/**
+ * Tiles added are expanded to all zoom levels between minz and maxz: on
+ * lower zoom levels the metatile containing the tile is expired, on higher
+ * zoom levels all metatiles covering it. If minz is -1 only the zoom level
+ * of each tile itself is used.
+ *
+ * Be careful with expanding low zoom tiles to high zoom levels, a single
+ * tile on zoom 0 covers 4 billion metatiles on zoom 19.
+ */
+ExpireSet::ExpireSet(int minz, int maxz) :
+    mMinz(minz),
+    mMaxz(maxz),
+    mBitmaps(METATILE_MAX_ZOOM + 1)
+{
+    if (mMinz >= 0 && mMaxz < mMinz) mMaxz = mMinz;
+    if (mMaxz > METATILE_MAX_ZOOM) mMaxz = METATILE_MAX_ZOOM;
+}
+
+/**
+ * Add a tile. Returns false if the tile coordinates are invalid.
+ */
+bool ExpireSet::addTile(int z, uint32_t x, uint32_t y)
+{
+    if (z < 0 || z > METATILE_MAX_ZOOM) return false;
+    if (static_cast<uint64_t>(x) >= (1ULL << z) || static_cast<uint64_t>(y) >= (1ULL << z)) return false;
+
+    int minz = mMinz < 0 ? z : mMinz;
+    int maxz = mMinz < 0 ? z : mMaxz;
+
+    for (int zz = minz; zz <= maxz; zz++)
+    {
+        if (zz <= z)
+        {
+            uint32_t mx = (x >> (z - zz)) / METATILE_COLUMNS;
+            uint32_t my = (y >> (z - zz)) / METATILE_ROWS;
+            setRange(zz, mx, my, mx, my);
+        }
+        else
+        {
+            int d = zz - z;
+            uint64_t x0 = static_cast<uint64_t>(x) << d;
+            uint64_t y0 = static_cast<uint64_t>(y) << d;
+            uint64_t x1 = ((static_cast<uint64_t>(x) + 1) << d) - 1;
+            uint64_t y1 = ((static_cast<uint64_t>(y) + 1) << d) - 1;
+            setRange(zz, x0 / METATILE_COLUMNS, y0 / METATILE_ROWS, x1 / METATILE_COLUMNS, y1 / METATILE_ROWS);
+        }
+    }
+
+    return true;
+}
+
+void ExpireSet::setRange(int z, uint32_t mx0, uint32_t my0, uint32_t mx1, uint32_t my1)
+{
+    bitmap& bm = mBitmaps[z];
+
+    for (uint32_t by = my0 >> BLOCK_BITS; by <= my1 >> BLOCK_BITS; by++)
+    {
+        uint32_t row0 = std::max(my0, by << BLOCK_BITS) & (BLOCK_SIZE - 1);
+        uint32_t row1 = std::min(my1, (by << BLOCK_BITS) + BLOCK_SIZE - 1) & (BLOCK_SIZE - 1);
+
+        for (uint32_t bx = mx0 >> BLOCK_BITS; bx <= mx1 >> BLOCK_BITS; bx++)
+        {
+            uint32_t col0 = std::max(mx0, bx << BLOCK_BITS) & (BLOCK_SIZE - 1);
+            uint32_t col1 = std::min(mx1, (bx << BLOCK_BITS) + BLOCK_SIZE - 1) & (BLOCK_SIZE - 1);
+            uint32_t mask = (col1 == BLOCK_SIZE - 1 ? ~0u : (1u << (col1 + 1)) - 1) & ~((1u << col0) - 1);
+
+            uint64_t key = (static_cast<uint64_t>(bx) << 32) | by;
+            bitmap::iterator it = bm.find(key);
+            if (it == bm.end())
+            {
+                it = bm.insert(std::make_pair(key, block())).first;
+                std::fill(it->second.rows, it->second.rows + BLOCK_SIZE, 0);
+            }
+
+            for (uint32_t row = row0; row <= row1; row++)
+            {
+                it->second.rows[row] |= mask;
+            }
+        }
+    }
+}
+
+uint64_t ExpireSet::count(int z) const
+{
+    uint64_t n = 0;
+    for (bitmap::const_iterator it = mBitmaps[z].begin(); it != mBitmaps[z].end(); ++it)
+    {
+        for (uint32_t row = 0; row < BLOCK_SIZE; row++)
+        {
+            n += __builtin_popcount(it->second.rows[row]);
+        }
+    }
+    return n;
+}
+
+uint64_t ExpireSet::count() const
+{
+    uint64_t n = 0;
+    for (int z = 0; z <= METATILE_MAX_ZOOM; z++)
+    {
+        n += count(z);
+    }
+    return n;
+}
+
+/**
+ * Get all metatiles in the set, sorted so that metatiles in the same
+ * directory of the tile tree (with the given depth) are next to each
+ * other.
+ */
+void ExpireSet::metatiles(std::vector<expire_metatile>& out, int depth) const
+{
+    out.reserve(out.size() + count());
+
+    for (int z = 0; z <= METATILE_MAX_ZOOM; z++)
+    {
+        for (bitmap::const_iterator it = mBitmaps[z].begin(); it != mBitmaps[z].end(); ++it)
+        {
+            uint32_t bx = it->first >> 32;
+            uint32_t by = it->first & 0xffffffff;
+
+            for (uint32_t row = 0; row < BLOCK_SIZE; row++)
+            {
+                uint32_t bits = it->second.rows[row];
+                while (bits)
+                {
+                    uint32_t col = __builtin_ctz(bits);
+                    bits &= bits - 1;
+
+                    expire_metatile mt;
+                    mt.z = z;
+                    mt.x = ((bx << BLOCK_BITS) + col) * METATILE_COLUMNS;
+                    mt.y = ((by << BLOCK_BITS) + row) * METATILE_ROWS;
+
+                    // same hashes as in metatile_path(), most significant first
+                    mt.key = static_cast<uint64_t>(z) << 58;
+                    for (int i = depth - 1, shift = 50; i >= 0 && shift >= 0; i--, shift -= 8)
+                    {
+                        uint64_t hash = (((mt.x >> (4 * i)) & 0x0f) << 4) | ((mt.y >> (4 * i)) & 0x0f);
+                        mt.key |= hash << shift;
+                    }
+
+                    out.push_back(mt);
+                }
+            }
+        }
+    }
+
+    std::sort(out.begin(), out.end());
+}
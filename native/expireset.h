@@ -0,0 +1,72 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Expire set
+ *
+ */
+
+/**
+ * ExpireSet
+ *
+ * Collects tiles from expire lists (as written by osm2pgsql) and collapses
+ * them into the set of unique metatiles over a range of zoom levels.
+ *
+ * There is one bitmap per zoom level with one bit per metatile. Because
+ * the bitmaps for high zoom levels would be huge and expire lists only
+ * cover small parts of the world, each bitmap is split into blocks of
+ * 32x32 metatiles which are only allocated when one of their bits is set.
+ * Setting a bit that is already set costs nothing, so a tile mentioned a
+ * thousand times in the input (or covered by several lower zoom tiles) is
+ * only counted and processed once.
+ */
+
+#ifndef expireset_included
+#define expireset_included
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "metatile.h"
+
+struct expire_metatile {
+    uint64_t key;   // sort key, orders metatiles like their paths
+    uint32_t x;     // tile coordinates of the upper left tile
+    uint32_t y;
+    int z;
+
+    bool operator<(const expire_metatile& other) const { return key < other.key; }
+};
+
+class ExpireSet
+{
+    public:
+
+    ExpireSet(int minz = -1, int maxz = -1);
+
+    bool addTile(int z, uint32_t x, uint32_t y);
+
+    uint64_t count(int z) const;
+    uint64_t count() const;
+
+    void metatiles(std::vector<expire_metatile>& out, int depth) const;
+
+    private:
+
+    static const int BLOCK_BITS = 5;
+    static const uint32_t BLOCK_SIZE = 1 << BLOCK_BITS;
+
+    struct block {
+        uint32_t rows[BLOCK_SIZE];
+    };
+
+    typedef std::unordered_map<uint64_t, block> bitmap;
+
+    void setRange(int z, uint32_t mx0, uint32_t my0, uint32_t mx1, uint32_t my1);
+
+    int mMinz;
+    int mMaxz;
+    std::vector<bitmap> mBitmaps;
+};
+
+#endif
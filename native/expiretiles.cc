@@ -0,0 +1,437 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Expire tiles
+ *
+ */
+
+/**
+ * expiretiles
+ *
+ * Native replacement for utils/expiremeta.pl, installed as tirex-expire.
+ * Reads expire lists with one tile per line in the format "z/x/y" (as
+ * written by osm2pgsql -e) from the files given on the command line or
+ * from STDIN, collapses them into the set of unique metatiles (see
+ * ExpireSet) and applies one of these actions to every metatile with a
+ * pool of threads:
+ *
+ *   touch    - set the mtime of the metatile file back in time, so that
+ *              it is considered old and re-rendered on the next request
+ *   delete   - remove the metatile file
+ *   enqueue  - send a metatile_enqueue_request for the metatile to the
+ *              master (only if the metatile file exists)
+ *   none     - only count the metatiles
+ *
+ * If the map has a freshness index (freshindex in the map config, see
+ * FreshnessIndex) touch and delete also update the index.
+ *
+ * Usage: expiretiles [OPTIONS] -m MAP [FILE...]
+ *
+ *   -c, --config=DIR       config directory (default: /etc/tirex)
+ *   -m, --map=NAME         map to expire (required)
+ *   -z, --minz=N           expand tiles to zoom levels from N ...
+ *   -Z, --maxz=N           ... to N (default: zoom level of each tile only)
+ *   -a, --action=ACTION    touch, delete, enqueue or none (default: touch)
+ *   -t, --time=TIME        mtime for touch in seconds since the epoch
+ *                          (default: 8000 days ago, like expiremeta.pl)
+ *   -p, --prio=N           priority for enqueue (default: 99)
+ *   -e, --expire=TIME      expire time for enqueued jobs, seconds since the
+ *                          epoch or +SECONDS from now
+ *   -j, --threads=N        number of threads (default: number of CPUs)
+ *   -n, --dry-run          don't change anything, only count
+ *
+ * Prints counts and timings to STDOUT. Returns 0 on success, 1 if there
+ * were errors and 2 on errors in the command line.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "expireset.h"
+#include "freshindex.h"
+
+enum expire_action {
+    ACTION_TOUCH,
+    ACTION_DELETE,
+    ACTION_ENQUEUE,
+    ACTION_NONE
+};
+
+struct expire_options {
+    std::string tiledir;
+    std::string map;
+    int sock;
+    int depth;
+    expire_action action;
+    time_t mtime;
+    int prio;
+    time_t expire;
+    bool dryrun;
+    FreshnessIndex *index;  // NULL if the map has no freshness index
+};
+
+struct expire_counts {
+    uint64_t done;
+    uint64_t missing;
+    uint64_t errors;
+
+    expire_counts() : done(0), missing(0), errors(0) { }
+};
+
+static void usage()
+{
+    fprintf(stderr, "Usage: expiretiles [-c CONFIGDIR] -m MAP [-z MINZ] [-Z MAXZ] [-a touch|delete|enqueue|none] [-t TIME] [-p PRIO] [-e EXPIRE] [-j THREADS] [-n] [FILE...]\n");
+    exit(2);
+}
+
+static long intArg(const char *arg, long min, long max)
+{
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value < min || value > max) usage();
+    return value;
+}
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Read expire list from file. Lines that can't be parsed are reported
+ * on STDERR and counted.
+ */
+static void readList(FILE *file, const char *name, ExpireSet& set, uint64_t& lines, uint64_t& invalid)
+{
+    char line[256];
+
+    while (fgets(line, sizeof(line), file))
+    {
+        lines++;
+
+        int z;
+        unsigned long x, y;
+        char rest[2];
+        int n = sscanf(line, "%d/%lu/%lu %1s", &z, &x, &y, rest);
+        if (n == 3 && x <= 0xffffffffUL && y <= 0xffffffffUL && set.addTile(z, x, y)) continue;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') continue;
+
+        fprintf(stderr, "%s:%llu: invalid line: %s\n", name, static_cast<unsigned long long>(lines), line);
+        invalid++;
+    }
+}
+
+static int connectMaster(const std::string& path)
+{
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Apply the action to the metatiles. Threads take chunks of
+ * consecutive metatiles, which are in the same directories most of the
+ * time.
+ */
+static void worker(const expire_options& options, const std::vector<expire_metatile>& metatiles, std::atomic<size_t>& next, expire_counts& counts)
+{
+    static const size_t CHUNK = 256;
+
+    struct timespec times[2];
+    times[0].tv_sec  = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec  = options.mtime;
+    times[1].tv_nsec = 0;
+
+    while (true)
+    {
+        size_t begin = next.fetch_add(CHUNK);
+        if (begin >= metatiles.size()) break;
+        size_t end = std::min(begin + CHUNK, metatiles.size());
+
+        for (size_t i = begin; i < end; i++)
+        {
+            const expire_metatile& mt = metatiles[i];
+
+            if (options.action == ACTION_NONE)
+            {
+                counts.done++;
+                continue;
+            }
+
+            std::string path = options.tiledir + metatile_path(options.depth, mt.z, mt.x, mt.y);
+
+            int rc = 0;
+            if (options.dryrun || options.action == ACTION_ENQUEUE)
+            {
+                struct stat st;
+                rc = stat(path.c_str(), &st);
+            }
+            else if (options.action == ACTION_TOUCH)
+            {
+                rc = utimensat(AT_FDCWD, path.c_str(), times, 0);
+            }
+            else if (options.action == ACTION_DELETE)
+            {
+                rc = unlink(path.c_str());
+            }
+
+            if (options.index && !options.dryrun && (rc == 0 || errno == ENOENT))
+            {
+                if (options.action == ACTION_TOUCH && rc == 0)
+                {
+                    options.index->set(mt.z, mt.x, mt.y, options.mtime);
+                }
+                else if (options.action == ACTION_DELETE)
+                {
+                    options.index->set(mt.z, mt.x, mt.y, 0);
+                }
+            }
+
+            if (rc < 0)
+            {
+                if (errno == ENOENT)
+                {
+                    counts.missing++;
+                }
+                else
+                {
+                    fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+                    counts.errors++;
+                }
+                continue;
+            }
+
+            if (options.sock >= 0)
+            {
+                std::string msg;
+                if (options.expire) msg += "expire=" + std::to_string(options.expire) + "\n";
+                msg += "map=" + options.map + "\nprio=" + std::to_string(options.prio) + "\ntype=metatile_enqueue_request\n" +
+                       "x=" + std::to_string(mt.x) + "\ny=" + std::to_string(mt.y) + "\nz=" + std::to_string(mt.z) + "\n";
+                if (send(options.sock, msg.c_str(), msg.size(), 0) < 0)
+                {
+                    fprintf(stderr, "Can't send request to master: %s\n", strerror(errno));
+                    counts.errors++;
+                    continue;
+                }
+            }
+
+            counts.done++;
+        }
+    }
+
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        { "config",  required_argument, 0, 'c' },
+        { "map",     required_argument, 0, 'm' },
+        { "minz",    required_argument, 0, 'z' },
+        { "maxz",    required_argument, 0, 'Z' },
+        { "action",  required_argument, 0, 'a' },
+        { "time",    required_argument, 0, 't' },
+        { "prio",    required_argument, 0, 'p' },
+        { "expire",  required_argument, 0, 'e' },
+        { "threads", required_argument, 0, 'j' },
+        { "dry-run", no_argument,       0, 'n' },
+        { "help",    no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    std::string configdir = TIREX_CONFIGDIR;
+    int minz = -1;
+    int maxz = -1;
+    unsigned int threads = std::thread::hardware_concurrency();
+
+    expire_options options;
+    options.depth  = 5;
+    options.action = ACTION_TOUCH;
+    options.mtime  = time(NULL) - 8000L * 86400;
+    options.prio   = 99;
+    options.expire = 0;
+    options.dryrun = false;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "c:m:z:Z:a:t:p:e:j:nh", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'c': configdir = optarg; break;
+            case 'm': options.map = optarg; break;
+            case 'z': minz = intArg(optarg, 0, METATILE_MAX_ZOOM); break;
+            case 'Z': maxz = intArg(optarg, 0, METATILE_MAX_ZOOM); break;
+            case 't': options.mtime = intArg(optarg, 0, 0x7fffffffL); break;
+            case 'p': options.prio = intArg(optarg, 1, 1000); break;
+            case 'j': threads = intArg(optarg, 1, 1000); break;
+            case 'n': options.dryrun = true; break;
+            case 'e':
+                options.expire = optarg[0] == '+' ? time(NULL) + intArg(optarg + 1, 0, 0x7fffffffL) : intArg(optarg, 0, 0x7fffffffL);
+                break;
+            case 'a':
+                if      (!strcmp(optarg, "touch"))   options.action = ACTION_TOUCH;
+                else if (!strcmp(optarg, "delete"))  options.action = ACTION_DELETE;
+                else if (!strcmp(optarg, "enqueue")) options.action = ACTION_ENQUEUE;
+                else if (!strcmp(optarg, "none"))    options.action = ACTION_NONE;
+                else usage();
+                break;
+            default: usage();
+        }
+    }
+
+    if (options.map.empty()) usage();
+    if (minz >= 0 && maxz < 0) maxz = minz;
+    if (maxz >= 0 && minz < 0) minz = 0;
+    if (threads < 1) threads = 1;
+
+    config_map tirexconf;
+    config_read(configdir + "/tirex.conf", tirexconf);
+
+    config_map mapconf;
+    if (!config_find_map(configdir, options.map, mapconf))
+    {
+        fprintf(stderr, "unknown map: %s\n", options.map.c_str());
+        return 2;
+    }
+    options.tiledir = config_get(mapconf, "tiledir", "");
+    options.depth = atoi(config_get(mapconf, "tiledir_depth", "5").c_str());
+    while (options.tiledir.size() > 1 && options.tiledir[options.tiledir.size() - 1] == '/') options.tiledir.erase(options.tiledir.size() - 1);
+
+    // datagrams on a unix socket don't get lost, send() blocks if the
+    // master can't keep up
+    options.sock = -1;
+    if (options.action == ACTION_ENQUEUE && !options.dryrun)
+    {
+        std::string socket_name = config_get(tirexconf, "socket_dir", TIREX_SOCKET_DIR) + "/master.sock";
+        options.sock = connectMaster(socket_name);
+        if (options.sock < 0)
+        {
+            fprintf(stderr, "Can't connect to master socket %s: %s\n", socket_name.c_str(), strerror(errno));
+            return 1;
+        }
+    }
+
+    // read expire lists
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    ExpireSet set(minz, maxz);
+    uint64_t lines = 0;
+    uint64_t invalid = 0;
+
+    if (optind == argc)
+    {
+        readList(stdin, "-", set, lines, invalid);
+    }
+    for (int i = optind; i < argc; i++)
+    {
+        FILE *file = !strcmp(argv[i], "-") ? stdin : fopen(argv[i], "r");
+        if (!file)
+        {
+            fprintf(stderr, "Can't open %s: %s\n", argv[i], strerror(errno));
+            return 1;
+        }
+        readList(file, argv[i], set, lines, invalid);
+        if (file != stdin) fclose(file);
+    }
+
+    double time_read = seconds(start);
+
+    // collapse into sorted list of metatiles
+    start = std::chrono::steady_clock::now();
+
+    std::vector<expire_metatile> metatiles;
+    set.metatiles(metatiles, options.depth);
+
+    double time_collapse = seconds(start);
+
+    // the index files are opened before the threads start, a zoom level
+    // without index (for instance above FRESHNESS_MAX_ZOOM) is skipped
+    std::string freshindex = config_get(mapconf, "freshindex", "");
+    options.index = NULL;
+    if (!freshindex.empty() && !options.dryrun && (options.action == ACTION_TOUCH || options.action == ACTION_DELETE))
+    {
+        options.index = new FreshnessIndex(freshindex, true);
+        int lastz = -1;
+        for (size_t i = 0; i < metatiles.size(); i++)
+        {
+            if (metatiles[i].z == lastz) continue;
+            lastz = metatiles[i].z;
+            if (lastz <= FRESHNESS_MAX_ZOOM && !options.index->openZoom(lastz))
+            {
+                fprintf(stderr, "%s\n", options.index->error().c_str());
+            }
+        }
+    }
+
+    // apply action
+    start = std::chrono::steady_clock::now();
+
+    std::atomic<size_t> next(0);
+    std::vector<expire_counts> counts(threads);
+    std::vector<std::thread> pool;
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        pool.push_back(std::thread(worker, std::cref(options), std::cref(metatiles), std::ref(next), std::ref(counts[i])));
+    }
+    for (unsigned int i = 0; i < pool.size(); i++)
+    {
+        pool[i].join();
+    }
+
+    double time_apply = seconds(start);
+
+    if (options.sock >= 0) close(options.sock);
+    delete options.index;
+
+    expire_counts total;
+    for (unsigned int i = 0; i < counts.size(); i++)
+    {
+        total.done    += counts[i].done;
+        total.missing += counts[i].missing;
+        total.errors  += counts[i].errors;
+    }
+
+    static const char *verbs[] = { "touched", "deleted", "enqueued", "counted" };
+
+    printf("lines: %llu (%llu invalid)\n", static_cast<unsigned long long>(lines), static_cast<unsigned long long>(invalid));
+    printf("metatiles: %llu\n", static_cast<unsigned long long>(metatiles.size()));
+    for (int z = 0; z <= METATILE_MAX_ZOOM; z++)
+    {
+        uint64_t n = set.count(z);
+        if (n) printf("  z%d: %llu\n", z, static_cast<unsigned long long>(n));
+    }
+    printf("%s%s: %llu, missing: %llu, errors: %llu\n", verbs[options.action], options.dryrun ? " (dry run)" : "",
+           static_cast<unsigned long long>(total.done), static_cast<unsigned long long>(total.missing), static_cast<unsigned long long>(total.errors));
+    printf("time: read %.3fs, collapse %.3fs, %s %.3fs (%u threads)\n", time_read, time_collapse, options.dryrun ? "check" : verbs[options.action], time_apply, threads);
+
+    return (invalid || total.errors) ? 1 : 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Metatile freshness index
+ *
+ */
+
+#include "freshindex.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+FreshnessIndex::FreshnessIndex(const std::string& dir, bool writable, unsigned int columns, unsigned int rows) :
+    mDir(dir),
+    mWritable(writable),
+    mColumns(columns ? columns : METATILE_COLUMNS),
+    mRows(rows ? rows : METATILE_ROWS)
+{
+    memset(mZooms, 0, sizeof(mZooms));
+}
+
+FreshnessIndex::~FreshnessIndex()
+{
+    for (int z = 0; z <= FRESHNESS_MAX_ZOOM; z++)
+    {
+        if (mZooms[z].map) munmap(mZooms[z].map, mZooms[z].size);
+    }
+}
+
+bool FreshnessIndex::openZoom(int z)
+{
+    if (z < 0 || z > FRESHNESS_MAX_ZOOM) return false;
+
+    zoom_file& zf = mZooms[z];
+    if (zf.tried) return zf.data != NULL;
+    zf.tried = true;
+
+    uint64_t tiles = static_cast<uint64_t>(1) << z;
+    uint32_t width  = std::max(static_cast<uint64_t>(1), (tiles + mColumns - 1) / mColumns);
+    uint32_t height = std::max(static_cast<uint64_t>(1), (tiles + mRows - 1) / mRows);
+    size_t size = sizeof(freshness_header) + static_cast<size_t>(width) * height * sizeof(uint32_t);
+
+    freshness_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FRESHNESS_MAGIC, sizeof(header.magic));
+    header.zoom    = z;
+    header.columns = mColumns;
+    header.rows    = mRows;
+    header.width   = width;
+    header.height  = height;
+
+    std::string path = mDir + "/" + std::to_string(z) + ".fresh";
+
+    if (mWritable && mkdir(mDir.c_str(), 0755) < 0 && errno != EEXIST)
+    {
+        mError = "can't create directory " + mDir + ": " + strerror(errno);
+        return false;
+    }
+
+    int fd = mWritable ? open(path.c_str(), O_RDWR | O_CREAT, 0644) : open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        mError = "can't open " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        mError = "can't stat " + path + ": " + strerror(errno);
+        close(fd);
+        return false;
+    }
+
+    // several backends can create the file at the same time, they all
+    // write the same size and header
+    if (mWritable && st.st_size == 0)
+    {
+        if (ftruncate(fd, size) < 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+        {
+            mError = "can't create " + path + ": " + strerror(errno);
+            close(fd);
+            return false;
+        }
+        st.st_size = size;
+    }
+
+    freshness_header existing;
+    if (static_cast<size_t>(st.st_size) != size || pread(fd, &existing, sizeof(existing), 0) != sizeof(existing) ||
+        (memcmp(&existing, &header, sizeof(header)) && !(mWritable && existing.magic[0] == '\0' && pwrite(fd, &header, sizeof(header), 0) == sizeof(header))))
+    {
+        mError = path + " is not a freshness index for zoom level " + std::to_string(z) + " and metatiles of " +
+                 std::to_string(mColumns) + "x" + std::to_string(mRows) + " tiles";
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, size, mWritable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        mError = "can't map " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    zf.map    = map;
+    zf.data   = reinterpret_cast<uint32_t *>(static_cast<char *>(map) + sizeof(freshness_header));
+    zf.size   = size;
+    zf.width  = width;
+    zf.height = height;
+
+    return true;
+}
+
+uint32_t *FreshnessIndex::slot(int z, uint32_t x, uint32_t y)
+{
+    if (!openZoom(z)) return NULL;
+
+    const zoom_file& zf = mZooms[z];
+    uint32_t mx = x / mColumns;
+    uint32_t my = y / mRows;
+    if (mx >= zf.width || my >= zf.height) return NULL;
+
+    return zf.data + static_cast<size_t>(my) * zf.width + mx;
+}
+
+bool FreshnessIndex::set(int z, uint32_t x, uint32_t y, uint32_t time, bool newer_only)
+{
+    if (!mWritable) return false;
+
+    uint32_t *p = slot(z, x, y);
+    if (!p) return false;
+
+    if (newer_only)
+    {
+        uint32_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+        while (old < time && !__atomic_compare_exchange_n(p, &old, time, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
+    }
+    else
+    {
+        __atomic_store_n(p, time, __ATOMIC_RELAXED);
+    }
+    return true;
+}
+
+uint32_t FreshnessIndex::get(int z, uint32_t x, uint32_t y)
+{
+    uint32_t *p = slot(z, x, y);
+    return p ? __atomic_load_n(p, __ATOMIC_RELAXED) : 0;
+}
+
+bool FreshnessIndex::scan(int z, uint32_t xmin, uint32_t xmax, uint32_t ymin, uint32_t ymax, const std::function<void(uint32_t, uint32_t, uint32_t)>& f)
+{
+    if (!openZoom(z)) return false;
+
+    const zoom_file& zf = mZooms[z];
+    uint32_t mxmax = std::min(xmax / mColumns, zf.width - 1);
+    uint32_t mymax = std::min(ymax / mRows, zf.height - 1);
+
+    for (uint32_t my = ymin / mRows; my <= mymax; my++)
+    {
+        const uint32_t *row = zf.data + static_cast<size_t>(my) * zf.width;
+        for (uint32_t mx = xmin / mColumns; mx <= mxmax; mx++)
+        {
+            f(mx * mColumns, my * mRows, __atomic_load_n(row + mx, __ATOMIC_RELAXED));
+        }
+    }
+    return true;
+}
@@ -0,0 +1,111 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Metatile freshness index
+ *
+ */
+
+/**
+ * FreshnessIndex
+ *
+ * Keeps the time each metatile of a map was last rendered, so that
+ * questions like "which metatiles in this area are older than T" can be
+ * answered without calling stat() on millions of metatile files.
+ *
+ * There is one file per zoom level ("<dir>/<z>.fresh") with a 64 byte
+ * header (see freshness_header) followed by one 32 bit time (seconds
+ * since the epoch, in host byte order, 0 if the metatile was never
+ * rendered) for every metatile, row by row from the north-west. The
+ * files are sparse, only the parts of the world that were rendered use
+ * disk space, and memory-mapped shared, so that the backends writing and
+ * the tools reading see the same data. Times are written with atomic
+ * stores, so several backend processes can update the same file.
+ *
+ * Indexes only exist up to zoom level FRESHNESS_MAX_ZOOM, the files for
+ * higher zoom levels would be too big even as sparse files.
+ */
+
+#ifndef freshindex_included
+#define freshindex_included
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+
+#include "metatile.h"
+
+#define FRESHNESS_MAX_ZOOM      20
+#define FRESHNESS_MAGIC         "TIREXFI1"
+
+struct freshness_header {
+    char magic[8];
+    uint32_t zoom;
+    uint32_t columns;       // metatile size in tiles
+    uint32_t rows;
+    uint32_t width;         // number of metatiles in x direction
+    uint32_t height;        // number of metatiles in y direction
+    uint32_t reserved[9];
+};
+
+class FreshnessIndex
+{
+    public:
+
+    FreshnessIndex(const std::string& dir, bool writable, unsigned int columns = METATILE_COLUMNS, unsigned int rows = METATILE_ROWS);
+    ~FreshnessIndex();
+
+    FreshnessIndex(const FreshnessIndex&) = delete;
+    FreshnessIndex& operator=(const FreshnessIndex&) = delete;
+
+    /**
+     * Map the index file for the zoom level, creating it if the index is
+     * writable. Called by the other methods when needed, call it before
+     * using set() from several threads.
+     */
+    bool openZoom(int z);
+
+    /**
+     * Set the time of the metatile with the given tile coordinates. If
+     * newer_only is set the time is only changed if it is later than the
+     * time in the index.
+     */
+    bool set(int z, uint32_t x, uint32_t y, uint32_t time, bool newer_only = false);
+
+    /**
+     * Time of the metatile with the given tile coordinates, 0 if it was
+     * never rendered or there is no index for the zoom level.
+     */
+    uint32_t get(int z, uint32_t x, uint32_t y);
+
+    /**
+     * Call f with the tile coordinates and time of every metatile in the
+     * range of tile coordinates (inclusive). Returns false if there is no
+     * index for the zoom level.
+     */
+    bool scan(int z, uint32_t xmin, uint32_t xmax, uint32_t ymin, uint32_t ymax, const std::function<void(uint32_t, uint32_t, uint32_t)>& f);
+
+    const std::string& dir() const { return mDir; }
+    const std::string& error() const { return mError; }
+
+    private:
+
+    struct zoom_file {
+        uint32_t *data;
+        void *map;
+        size_t size;
+        uint32_t width;
+        uint32_t height;
+        bool tried;
+    };
+
+    uint32_t *slot(int z, uint32_t x, uint32_t y);
+
+    std::string mDir;
+    bool mWritable;
+    unsigned int mColumns;
+    unsigned int mRows;
+    zoom_file mZooms[FRESHNESS_MAX_ZOOM + 1];
+    std::string mError;
+};
+
+#endif
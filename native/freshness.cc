@@ -0,0 +1,267 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Query the metatile freshness index
+ *
+ */
+
+/**
+ * freshness
+ *
+ * Answers questions like "which metatiles in this area are older than T"
+ * from the freshness index of a map (see FreshnessIndex) instead of
+ * calling stat() on every metatile file. Installed as tirex-freshness.
+ *
+ * The index is written by the mapnik backend for maps that have the
+ * freshindex option set in their config, tirex-expire updates it when
+ * touching or deleting metatiles. For metatiles that were rendered before
+ * the index existed, fill it once from the tile directory with --rebuild.
+ *
+ * The metatiles matching all filters are printed as init strings for
+ * tirex-batch ("map=NAME z=Z x=X y=Y"), so this replaces for instance
+ *
+ *   tirex-batch -f 'older(1700000000)' map=foo z=10-14 bbox=5.8,47.2,15.1,55.1
+ *
+ * with
+ *
+ *   tirex-freshness -m foo -z 10 -Z 14 -b 5.8,47.2,15.1,55.1 -o 1700000000 | tirex-batch
+ *
+ * Usage: freshness [OPTIONS] -m MAP -z MINZ [-Z MAXZ]
+ *
+ *   -c, --config=DIR       config directory (default: /etc/tirex)
+ *   -m, --map=NAME         map (required)
+ *   -i, --index=DIR        index directory (default: freshindex from the
+ *                          map config)
+ *   -z, --minz=N           first zoom level (required)
+ *   -Z, --maxz=N           last zoom level (default: same as minz)
+ *   -b, --bbox=W,S,E,N     only metatiles in this bounding box (lon/lat)
+ *   -o, --older=TIME       only metatiles rendered before TIME or never
+ *   -n, --newer=TIME       only metatiles rendered after TIME or never
+ *   -e, --exists           only metatiles that were rendered
+ *   -N, --not-exists       only metatiles that were never rendered
+ *   -C, --count            only print the number of matching metatiles
+ *                          per zoom level
+ *   -r, --rebuild          fill the index from the mtimes of the metatile
+ *                          files (uses the filters of tiledirscan, not the
+ *                          ones above)
+ *   -j, --threads=N        threads for --rebuild (default: number of CPUs)
+ *
+ * TIME is in seconds since the epoch or the name of a file whose mtime is
+ * used, like the older() and newer() filters of tirex-batch.
+ *
+ * Returns 0 on success, 1 on errors and 2 on errors in the command line.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "config.h"
+#include "freshindex.h"
+#include "tiledir.h"
+
+struct fresh_filter {
+    int64_t older;
+    int64_t newer;
+    bool exists;
+    bool notexists;
+
+    fresh_filter() : older(-1), newer(-1), exists(false), notexists(false) { }
+
+    bool matches(uint32_t time) const
+    {
+        if (exists && !time) return false;
+        if (notexists && time) return false;
+        if (older >= 0 && time && time >= older) return false;
+        if (newer >= 0 && time && time <= newer) return false;
+        return true;
+    }
+};
+
+static void usage()
+{
+    fprintf(stderr, "Usage: freshness [-c CONFIGDIR] -m MAP [-i INDEXDIR] -z MINZ [-Z MAXZ] [-b W,S,E,N] [-o TIME] [-n TIME] [-e] [-N] [-C] [-r [-j THREADS]]\n");
+    exit(2);
+}
+
+static long intArg(const char *arg, long min, long max)
+{
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value < min || value > max) usage();
+    return value;
+}
+
+static int64_t timeArg(const char *arg)
+{
+    if (*arg && strspn(arg, "0123456789") == strlen(arg)) return strtoll(arg, NULL, 10);
+
+    struct stat st;
+    if (stat(arg, &st) < 0)
+    {
+        fprintf(stderr, "Can't stat %s: %s\n", arg, strerror(errno));
+        exit(2);
+    }
+    return st.st_mtime;
+}
+
+static uint32_t lon2x(double lon, int z)
+{
+    double x = floor((lon + 180.0) / 360.0 * ldexp(1.0, z));
+    return static_cast<uint32_t>(std::max(0.0, std::min(x, ldexp(1.0, z) - 1)));
+}
+
+static uint32_t lat2y(double lat, int z)
+{
+    lat = std::max(-85.05113, std::min(85.05113, lat)) * M_PI / 180.0;
+    double y = floor((1.0 - log(tan(lat) + 1.0 / cos(lat)) / M_PI) / 2.0 * ldexp(1.0, z));
+    return static_cast<uint32_t>(std::max(0.0, std::min(y, ldexp(1.0, z) - 1)));
+}
+
+static int rebuild(FreshnessIndex& index, const config_map& mapconf, const std::string& map, int minz, int maxz, unsigned int threads)
+{
+    tiledir_options options;
+    options.dir     = config_get(mapconf, "tiledir", "");
+    options.map     = map;
+    options.depth   = atoi(config_get(mapconf, "tiledir_depth", "5").c_str());
+    options.minz    = minz;
+    options.maxz    = maxz;
+    options.threads = threads;
+
+    for (int z = minz; z <= maxz; z++)
+    {
+        if (!index.openZoom(z))
+        {
+            fprintf(stderr, "%s\n", index.error().c_str());
+            return 1;
+        }
+    }
+
+    std::atomic<uint64_t> count(0);
+    options.visit = [&index, &count](int z, uint32_t x, uint32_t y, int64_t mtime) {
+        if (mtime > 0 && index.set(z, x, y, static_cast<uint32_t>(mtime), true)) count++;
+    };
+
+    TiledirScanner scanner(options);
+    bool ok = scanner.scan();
+    printf("metatiles: %llu\n", static_cast<unsigned long long>(count.load()));
+
+    return ok && !scanner.errors() ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        { "config",     required_argument, 0, 'c' },
+        { "map",        required_argument, 0, 'm' },
+        { "index",      required_argument, 0, 'i' },
+        { "minz",       required_argument, 0, 'z' },
+        { "maxz",       required_argument, 0, 'Z' },
+        { "bbox",       required_argument, 0, 'b' },
+        { "older",      required_argument, 0, 'o' },
+        { "newer",      required_argument, 0, 'n' },
+        { "exists",     no_argument,       0, 'e' },
+        { "not-exists", no_argument,       0, 'N' },
+        { "count",      no_argument,       0, 'C' },
+        { "rebuild",    no_argument,       0, 'r' },
+        { "threads",    required_argument, 0, 'j' },
+        { "help",       no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    std::string configdir = TIREX_CONFIGDIR;
+    std::string map;
+    std::string indexdir;
+    int minz = -1;
+    int maxz = -1;
+    double bbox[4] = { -180.0, -85.05113, 180.0, 85.05113 };
+    fresh_filter filter;
+    bool count = false;
+    bool rebuildIndex = false;
+    unsigned int threads = std::thread::hardware_concurrency();
+
+    int c;
+    while ((c = getopt_long(argc, argv, "c:m:i:z:Z:b:o:n:eNCrj:h", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'c': configdir = optarg; break;
+            case 'm': map = optarg; break;
+            case 'i': indexdir = optarg; break;
+            case 'z': minz = intArg(optarg, 0, FRESHNESS_MAX_ZOOM); break;
+            case 'Z': maxz = intArg(optarg, 0, FRESHNESS_MAX_ZOOM); break;
+            case 'o': filter.older = timeArg(optarg); break;
+            case 'n': filter.newer = timeArg(optarg); break;
+            case 'e': filter.exists = true; break;
+            case 'N': filter.notexists = true; break;
+            case 'C': count = true; break;
+            case 'r': rebuildIndex = true; break;
+            case 'j': threads = intArg(optarg, 1, 1000); break;
+            case 'b':
+                if (sscanf(optarg, "%lf,%lf,%lf,%lf", &bbox[0], &bbox[1], &bbox[2], &bbox[3]) != 4) usage();
+                break;
+            default: usage();
+        }
+    }
+
+    if (map.empty() || minz < 0 || optind != argc) usage();
+    if (maxz < 0) maxz = minz;
+    if (maxz < minz) usage();
+    if (threads < 1) threads = 1;
+
+    config_map mapconf;
+    if (!config_find_map(configdir, map, mapconf))
+    {
+        fprintf(stderr, "unknown map: %s\n", map.c_str());
+        return 2;
+    }
+    if (indexdir.empty()) indexdir = config_get(mapconf, "freshindex", "");
+    if (indexdir.empty())
+    {
+        fprintf(stderr, "map %s has no freshindex in its config\n", map.c_str());
+        return 2;
+    }
+
+    FreshnessIndex index(indexdir, rebuildIndex);
+
+    if (rebuildIndex)
+    {
+        return rebuild(index, mapconf, map, minz, maxz, threads);
+    }
+
+    uint64_t total = 0;
+    for (int z = minz; z <= maxz; z++)
+    {
+        uint64_t n = 0;
+        bool ok = index.scan(z, lon2x(std::min(bbox[0], bbox[2]), z), lon2x(std::max(bbox[0], bbox[2]), z),
+                                lat2y(std::max(bbox[1], bbox[3]), z), lat2y(std::min(bbox[1], bbox[3]), z),
+            [&](uint32_t x, uint32_t y, uint32_t time) {
+                if (!filter.matches(time)) return;
+                n++;
+                if (!count) printf("map=%s z=%d x=%u y=%u\n", map.c_str(), z, x, y);
+            });
+        if (!ok)
+        {
+            fprintf(stderr, "%s\n", index.error().c_str());
+            return 1;
+        }
+        if (count) printf("z%d: %llu\n", z, static_cast<unsigned long long>(n));
+        total += n;
+    }
+
+    if (count)
+    {
+        printf("total: %llu\n", static_cast<unsigned long long>(total));
+    }
+
+    return 0;
+}
@@ -0,0 +1,352 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Native job queue
+ *
+ */
+
+#include "jobqueue.h"
+
+#include <stdexcept>
+
+const JobQueue::handle JobQueue::none;
+
+JobQueue::JobQueue() :
+    mFreeList(none),
+    mIndex(1024, none),
+    mIndexMask(1023),
+    mLowestPrio(0),
+    mSize(0),
+    mMaxSize(0)
+{
+}
+
+/**
+ * Return the small integer used for a map name in the job records,
+ * allocating a new one if the name hasn't been seen before.
+ */
+uint16_t JobQueue::mapId(const std::string& name)
+{
+    auto itr = mMapIds.find(name);
+    if (itr != mMapIds.end()) return itr->second;
+
+    if (mMapNames.size() > 0xffff) throw std::length_error("too many maps in queue");
+    uint16_t id = mMapNames.size();
+    mMapNames.push_back(name);
+    mMapIds[name] = id;
+    return id;
+}
+
+uint32_t JobQueue::hashKey(const queue_key& key)
+{
+    uint64_t h = (uint64_t(key.x) << 32) | key.y;
+    h ^= (uint64_t(key.map) << 8 | key.z) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return uint32_t(h);
+}
+
+JobQueue::handle JobQueue::allocate()
+{
+    if (mFreeList != none)
+    {
+        handle h = mFreeList;
+        mFreeList = mJobs[h].next;
+        return h;
+    }
+    if (mJobs.size() >= none) throw std::length_error("too many jobs in queue");
+    mJobs.push_back(queue_job());
+    return mJobs.size() - 1;
+}
+
+void JobQueue::link(handle h)
+{
+    queue_job& job = mJobs[h];
+    if (job.prio >= mPrios.size())
+    {
+        prio_list empty = { none, none, 0, 0, false };
+        mPrios.resize(job.prio + 1, empty);
+    }
+
+    prio_list& list = mPrios[job.prio];
+    job.prev = list.tail;
+    job.next = none;
+    if (list.tail == none)
+    {
+        list.head = h;
+    }
+    else
+    {
+        mJobs[list.tail].next = h;
+    }
+    list.tail = h;
+    list.used = true;
+    if (++list.size > list.maxsize) list.maxsize = list.size;
+
+    if (job.prio < mLowestPrio) mLowestPrio = job.prio;
+    if (++mSize > mMaxSize) mMaxSize = mSize;
+}
+
+void JobQueue::unlink(handle h)
+{
+    queue_job& job = mJobs[h];
+    prio_list& list = mPrios[job.prio];
+
+    if (job.prev == none) list.head = job.next; else mJobs[job.prev].next = job.next;
+    if (job.next == none) list.tail = job.prev; else mJobs[job.next].prev = job.prev;
+    list.size--;
+    mSize--;
+}
+
+void JobQueue::indexInsert(handle h)
+{
+    // keep load factor at or below 1/2 so that probe sequences stay short
+    if ((mSize + 1) * 2 > mIndex.size()) growIndex();
+
+    uint32_t slot = mJobs[h].hash & mIndexMask;
+    while (mIndex[slot] != none) slot = (slot + 1) & mIndexMask;
+    mIndex[slot] = h;
+}
+
+/**
+ * Remove a job from the index. Instead of leaving a tombstone, entries
+ * further along the probe sequence that would not be found anymore are
+ * moved back into the hole.
+ */
+void JobQueue::indexErase(handle h)
+{
+    uint32_t slot = mJobs[h].hash & mIndexMask;
+    while (mIndex[slot] != h) slot = (slot + 1) & mIndexMask;
+
+    uint32_t hole = slot;
+    for (;;)
+    {
+        slot = (slot + 1) & mIndexMask;
+        if (mIndex[slot] == none) break;
+        uint32_t home = mJobs[mIndex[slot]].hash & mIndexMask;
+        // move entry if its home position is not cyclically in (hole, slot]
+        if (((slot - home) & mIndexMask) >= ((slot - hole) & mIndexMask))
+        {
+            mIndex[hole] = mIndex[slot];
+            hole = slot;
+        }
+    }
+    mIndex[hole] = none;
+}
+
+void JobQueue::growIndex()
+{
+    std::vector<uint32_t> old;
+    old.swap(mIndex);
+    mIndex.assign(old.size() * 2, none);
+    mIndexMask = mIndex.size() - 1;
+
+    for (auto itr = old.begin(); itr != old.end(); itr++)
+    {
+        if (*itr == none) continue;
+        uint32_t slot = mJobs[*itr].hash & mIndexMask;
+        while (mIndex[slot] != none) slot = (slot + 1) & mIndexMask;
+        mIndex[slot] = *itr;
+    }
+}
+
+JobQueue::handle JobQueue::find(const queue_key& key) const
+{
+    uint32_t slot = hashKey(key) & mIndexMask;
+    while (mIndex[slot] != none)
+    {
+        if (mJobs[mIndex[slot]].key == key) return mIndex[slot];
+        slot = (slot + 1) & mIndexMask;
+    }
+    return none;
+}
+
+/**
+ * Add a job to the queue. If there is a job for the same metatile in the
+ * queue already, it is merged with the new one and its data pointer is
+ * returned in replaced (otherwise replaced is set to NULL). The merged job
+ * carries the new data pointer.
+ *
+ * Returns the handle of the job in the queue.
+ */
+JobQueue::handle JobQueue::add(const queue_key& key, unsigned int prio, time_t request_time, time_t expire, void *data, void **replaced)
+{
+    *replaced = NULL;
+
+    handle h = find(key);
+    if (h != none)
+    {
+        queue_job& old = mJobs[h];
+        unlink(h);
+        if (old.prio < prio) prio = old.prio;
+        if (old.request_time < request_time) request_time = old.request_time;
+        expire = (old.expire && expire) ? (old.expire > expire ? old.expire : expire) : 0;
+        *replaced = old.data;
+    }
+    else
+    {
+        h = allocate();
+        mJobs[h].key = key;
+        mJobs[h].hash = hashKey(key);
+        indexInsert(h);
+    }
+
+    queue_job& job = mJobs[h];
+    job.prio = prio;
+    job.request_time = request_time;
+    job.expire = expire;
+    job.data = data;
+    link(h);
+
+    return h;
+}
+
+void *JobQueue::removeHandle(handle h)
+{
+    unlink(h);
+    indexErase(h);
+
+    queue_job& job = mJobs[h];
+    void *data = job.data;
+    job.data = NULL;
+    job.next = mFreeList;
+    mFreeList = h;
+    return data;
+}
+
+/**
+ * Remove the job for a metatile from the queue. Returns its data pointer
+ * or NULL if there was no such job.
+ */
+void *JobQueue::remove(const queue_key& key)
+{
+    handle h = find(key);
+    return h == none ? NULL : removeHandle(h);
+}
+
+/**
+ * Remove all jobs for a map (for instance because it was removed from
+ * the config). The data pointers of the removed jobs are appended to
+ * removed. Returns the number of jobs removed.
+ */
+size_t JobQueue::removeMap(uint16_t map, std::vector<void *>& removed)
+{
+    size_t count = 0;
+    for (auto prio = mPrios.begin(); prio != mPrios.end(); prio++)
+    {
+        handle h = prio->head;
+        while (h != none)
+        {
+            handle next = mJobs[h].next;
+            if (mJobs[h].key.map == map)
+            {
+                removed.push_back(removeHandle(h));
+                count++;
+            }
+            h = next;
+        }
+    }
+    return count;
+}
+
+/**
+ * Returns the handle of the first job in the queue without removing it
+ * or none if the queue is empty.
+ */
+JobQueue::handle JobQueue::peek()
+{
+    if (mSize == 0) return none;
+    while (mPrios[mLowestPrio].head == none) mLowestPrio++;
+    return mPrios[mLowestPrio].head;
+}
+
+/**
+ * Remove the first job from the queue. If job is not NULL the job record
+ * is copied there. Returns the data pointer of the job.
+ */
+void *JobQueue::next(queue_job *job)
+{
+    handle h = peek();
+    if (h == none) return NULL;
+    if (job) *job = mJobs[h];
+    return removeHandle(h);
+}
+
+/**
+ * Append the handles of all jobs to result, ordered by priority and
+ * first-in first-out within a priority. The jobs stay in the queue.
+ */
+void JobQueue::handles(std::vector<handle>& result) const
+{
+    result.reserve(result.size() + mSize);
+    for (auto prio = mPrios.begin(); prio != mPrios.end(); prio++)
+    {
+        for (handle h = prio->head; h != none; h = mJobs[h].next)
+        {
+            result.push_back(h);
+        }
+    }
+}
+
+/**
+ * Remove all jobs. The data pointers of the removed jobs are appended
+ * to removed. Sizes and maxsizes are reset, known map names are kept.
+ */
+void JobQueue::clear(std::vector<void *>& removed)
+{
+    for (auto prio = mPrios.begin(); prio != mPrios.end(); prio++)
+    {
+        for (handle h = prio->head; h != none; h = mJobs[h].next)
+        {
+            removed.push_back(mJobs[h].data);
+        }
+    }
+
+    mJobs.clear();
+    mFreeList = none;
+    mIndex.assign(1024, none);
+    mIndexMask = 1023;
+    mPrios.clear();
+    mLowestPrio = 0;
+    mSize = 0;
+    mMaxSize = 0;
+}
+
+/**
+ * Reset maxsize of the queue and all priorities to the current size.
+ * Returns the new maxsize.
+ */
+size_t JobQueue::resetMaxsize()
+{
+    mMaxSize = mSize;
+    for (auto prio = mPrios.begin(); prio != mPrios.end(); prio++)
+    {
+        prio->maxsize = prio->size;
+    }
+    return mMaxSize;
+}
+
+/**
+ * Fill result with the status of all priorities that have ever been
+ * used, in the same form as Tirex::PrioQueue::status(). Ages are 0 for
+ * empty priorities.
+ */
+void JobQueue::status(std::vector<queue_prio_status>& result, time_t now) const
+{
+    for (size_t prio = 0; prio < mPrios.size(); prio++)
+    {
+        const prio_list& list = mPrios[prio];
+        if (!list.used) continue;
+
+        queue_prio_status s = { static_cast<unsigned int>(prio), list.size, list.maxsize, 0, 0 };
+        if (list.head != none)
+        {
+            s.age_first = now - mJobs[list.head].request_time;
+            s.age_last  = now - mJobs[list.tail].request_time;
+        }
+        result.push_back(s);
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Native job queue
+ *
+ */
+
+/**
+ * JobQueue
+ *
+ * C++ implementation of the queue semantics of Tirex::Queue and
+ * Tirex::PrioQueue for tirex-master:
+ *
+ *  - one job per metatile (map, x, y, z); adding a job for a metatile
+ *    that is already queued merges both jobs (lowest prio, earliest
+ *    request time, latest expire time or none if either has none) and
+ *    moves the merged job to the end of the queue for its priority
+ *  - jobs are taken from the lowest priority number first, FIFO within
+ *    a priority
+ *  - size and maxsize are kept for the whole queue and per priority
+ *
+ * Jobs are kept in a slab of compact records that are linked into
+ * intrusive doubly-linked lists, one list per priority. An open
+ * addressing hash table (linear probing, backward shift deletion) maps
+ * metatiles to slab indexes. Nothing is allocated per job once the slab
+ * and the index have grown to the size needed.
+ *
+ * Each job can carry an opaque data pointer (the Perl job object when
+ * used from Tirex::Queue::Native). The queue never dereferences it, it
+ * is handed back whenever a job leaves the queue.
+ */
+
+#ifndef jobqueue_included
+#define jobqueue_included
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+struct queue_key {
+    uint32_t x;
+    uint32_t y;
+    uint16_t map;
+    uint8_t z;
+
+    bool operator==(const queue_key& other) const
+    {
+        return x == other.x && y == other.y && map == other.map && z == other.z;
+    }
+};
+
+struct queue_job {
+    queue_key key;
+    uint32_t prio;
+    uint32_t prev;
+    uint32_t next;
+    uint32_t hash;
+    time_t request_time;
+    time_t expire;        // 0 if the job never expires
+    void *data;
+};
+
+struct queue_prio_status {
+    unsigned int prio;
+    size_t size;
+    size_t maxsize;
+    time_t age_first;
+    time_t age_last;
+};
+
+class JobQueue
+{
+    public:
+
+    typedef uint32_t handle;
+    static const handle none = 0xffffffff;
+
+    JobQueue();
+
+    uint16_t mapId(const std::string& name);
+    const std::string& mapName(uint16_t id) const { return mMapNames[id]; }
+    size_t mapCount() const { return mMapNames.size(); }
+
+    handle add(const queue_key& key, unsigned int prio, time_t request_time, time_t expire, void *data, void **replaced);
+    handle find(const queue_key& key) const;
+    void *remove(const queue_key& key);
+    void *removeHandle(handle h);
+    size_t removeMap(uint16_t map, std::vector<void *>& removed);
+
+    handle peek();
+    void *next(queue_job *job = NULL);
+    const queue_job& get(handle h) const { return mJobs[h]; }
+    void handles(std::vector<handle>& result) const;
+
+    void clear(std::vector<void *>& removed);
+
+    size_t size() const { return mSize; }
+    size_t maxsize() const { return mMaxSize; }
+    size_t prioSize(unsigned int prio) const { return prio < mPrios.size() ? mPrios[prio].size : 0; }
+    bool empty() const { return mSize == 0; }
+    size_t resetMaxsize();
+    void status(std::vector<queue_prio_status>& result, time_t now) const;
+
+    private:
+
+    struct prio_list {
+        uint32_t head;
+        uint32_t tail;
+        size_t size;
+        size_t maxsize;
+        bool used;
+    };
+
+    static uint32_t hashKey(const queue_key& key);
+
+    handle allocate();
+    void link(handle h);
+    void unlink(handle h);
+    void indexInsert(handle h);
+    void indexErase(handle h);
+    void growIndex();
+
+    std::vector<queue_job> mJobs;
+    uint32_t mFreeList;
+    std::vector<uint32_t> mIndex;
+    uint32_t mIndexMask;
+    std::vector<prio_list> mPrios;
+    size_t mLowestPrio;
+    size_t mSize;
+    size_t mMaxSize;
+    std::vector<std::string> mMapNames;
+    std::unordered_map<std::string, uint16_t> mMapIds;
+};
+
+#endif
@@ -0,0 +1,730 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Load generator
+ *
+ */
+
+/**
+ * loadgen
+ *
+ * Sends metatile_enqueue_requests to a running tirex-master and measures
+ * how long it takes until the master notifies that the metatile was
+ * rendered. Together with the test backend this allows load tests of the
+ * whole pipeline (queue, buckets, backends) on a single machine.
+ *
+ * The requests are either replayed from a log file or generated:
+ *
+ *  - master job logs (/var/log/tirex/jobs.log, the input of
+ *    utils/tirex-stats-joblog), replayed at their request_time
+ *  - Apache combined logs with tile URLs ending in /MAP/Z/X/Y.png (the
+ *    input of utils/tirex-apache-log), replayed at their timestamps
+ *  - without a file random metatiles in the zoom range and bounding box
+ *    given on the command line, with a configurable prio distribution
+ *
+ * Log files are replayed with their original timing (requests within the
+ * same second are spread evenly over that second), optionally sped up
+ * with --speed, or at a fixed rate with --rate. Sending is open-loop: the
+ * next request is sent when it is due, no matter how many are still
+ * outstanding. If the master can't keep up and its socket buffer is
+ * full, this is counted as a stall and sending continues as soon as
+ * possible.
+ *
+ * Usage: loadgen [OPTIONS] [-f FILE]
+ *
+ *   -c, --config=DIR       config directory (default: /etc/tirex)
+ *   -f, --file=FILE        replay requests from job or Apache log ('-' for
+ *                          STDIN)
+ *   -m, --map=MAP          map for generated requests or instead of the map
+ *                          in the log (default for generated: test)
+ *   -r, --rate=N           send N requests per second
+ *                          (default: original timing of the log or 10)
+ *   -s, --speed=F          replay the log F times faster
+ *   -n, --count=N          send at most N requests (default for generated
+ *                          requests: 1000)
+ *   -d, --duration=SECS    stop sending after SECS seconds
+ *   -z, --zoom=MIN[-MAX]   zoom levels for generated requests (default 0-17)
+ *   -b, --bbox=W,S,E,N     area for generated requests (default: world)
+ *   -p, --prio=SPEC        prios of generated requests as PRIO:WEIGHT,...
+ *                          (default: 1)
+ *   -P, --set-prio=N       use this prio for all replayed requests
+ *   -S, --seed=N           seed for the random generator (default: 1)
+ *   -w, --wait=SECS        wait this long for outstanding notifies after
+ *                          the last request was sent (default: 60)
+ *   -j, --json             print the report as JSON
+ *   -q, --quiet            no progress output on STDERR
+ *
+ * The report contains the number of requests, notifies and errors and the
+ * enqueue-to-done latency percentiles for every prio.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "message.h"
+#include "metatile.h"
+
+#define LOADGEN_MAX_PRIO 1000
+
+struct load_request {
+    double at;          // seconds after the start
+    uint32_t x;
+    uint32_t y;
+    uint16_t map;
+    uint8_t z;
+    uint16_t prio;
+};
+
+enum request_state {
+    STATE_UNSENT,
+    STATE_SENT,
+    STATE_DONE,
+    STATE_ERROR
+};
+
+struct prio_stats {
+    unsigned long sent;
+    unsigned long done;
+    unsigned long errors;
+    std::vector<double> latencies;  // in milliseconds
+};
+
+static void usage()
+{
+    fprintf(stderr, "Usage: loadgen [-c CONFIGDIR] [-f FILE] [-m MAP] [-r RATE] [-s SPEED] [-n COUNT] [-d SECS]\n"
+                    "               [-z MINZ[-MAXZ]] [-b W,S,E,N] [-p PRIO:WEIGHT,...] [-P PRIO] [-S SEED] [-w SECS] [-j] [-q]\n");
+    exit(2);
+}
+
+static long intArg(const char *arg, long min, long max)
+{
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value < min || value > max) usage();
+    return value;
+}
+
+static double doubleArg(const char *arg)
+{
+    char *end;
+    double value = strtod(arg, &end);
+    if (*arg == '\0' || *end != '\0' || !(value > 0)) usage();
+    return value;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Log file reader. Keeps the map names and the requests with their
+ * original (absolute) time.
+ */
+class LogReader
+{
+    public:
+
+    LogReader() : mInvalid(0) {}
+
+    void readFile(FILE *file, const char *name);
+    void spread();
+
+    std::vector<std::string> mMaps;
+    std::vector<load_request> mRequests;
+    unsigned long mInvalid;
+
+    private:
+
+    bool parseJoblog(const char *line, load_request& req);
+    bool parseApache(const char *line, load_request& req);
+    uint16_t mapIndex(const std::string& map);
+
+    std::map<std::string, uint16_t> mMapIndex;
+};
+
+uint16_t LogReader::mapIndex(const std::string& map)
+{
+    std::map<std::string, uint16_t>::const_iterator it = mMapIndex.find(map);
+    if (it != mMapIndex.end()) return it->second;
+
+    uint16_t index = mMaps.size();
+    mMaps.push_back(map);
+    mMapIndex[map] = index;
+    return index;
+}
+
+/**
+ * Lines of the master job log look like
+ * "2024-01-02T03:04:05 id=... map=osm x=8 y=16 z=5 prio=1 request_time=1704164640 ..."
+ */
+bool LogReader::parseJoblog(const char *line, load_request& req)
+{
+    std::string map;
+    long x = -1, y = -1, z = -1, prio = 1;
+    double at = -1;
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(line, "%Y-%m-%dT%H:%M:%S", &tm);
+    if (end)
+    {
+        tm.tm_isdst = -1;
+        at = mktime(&tm);
+    }
+
+    for (const char *p = strchr(line, ' '); p; p = strchr(p, ' '))
+    {
+        p++;
+        const char *eq = strchr(p, '=');
+        if (!eq) break;
+        std::string key(p, eq - p);
+        const char *value = eq + 1;
+        size_t len = strcspn(value, " \n");
+
+        if      (key == "map")          map.assign(value, len);
+        else if (key == "x")            x = atol(value);
+        else if (key == "y")            y = atol(value);
+        else if (key == "z")            z = atol(value);
+        else if (key == "prio")         prio = atol(value);
+        else if (key == "request_time" && len > 0) at = atol(value);
+    }
+
+    if (map.empty() || z < 0 || z > METATILE_MAX_ZOOM || x < 0 || y < 0 || at < 0) return false;
+
+    req.at   = at;
+    req.map  = mapIndex(map);
+    req.x    = x;
+    req.y    = y;
+    req.z    = z;
+    req.prio = std::max(1L, std::min(prio, static_cast<long>(LOADGEN_MAX_PRIO)));
+    return true;
+}
+
+/**
+ * Apache combined log: '1.2.3.4 - - [10/Oct/2024:13:55:36 +0200] "GET /tiles/osm/5/8/16.png HTTP/1.1" ...'
+ * Only successful GET requests are used.
+ */
+bool LogReader::parseApache(const char *line, load_request& req)
+{
+    const char *date = strchr(line, '[');
+    if (!date) return false;
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (!strptime(date + 1, "%d/%b/%Y:%H:%M:%S %z", &tm)) return false;
+    long gmtoff = tm.tm_gmtoff;
+    double at = timegm(&tm) - gmtoff;
+
+    const char *request = strstr(date, "\"GET ");
+    if (!request) return false;
+    const char *path = request + 5;
+    const char *pathend = strpbrk(path, " ?\"");
+    if (!pathend || pathend - path < 4 || strncmp(pathend - 4, ".png", 4)) return false;
+
+    // the last four path components are MAP/Z/X/Y.png
+    std::string p(path, pathend - 4 - path);
+    size_t s3 = p.rfind('/');
+    size_t s2 = s3 == std::string::npos || s3 == 0 ? std::string::npos : p.rfind('/', s3 - 1);
+    size_t s1 = s2 == std::string::npos || s2 == 0 ? std::string::npos : p.rfind('/', s2 - 1);
+    size_t s0 = s1 == std::string::npos || s1 == 0 ? std::string::npos : p.rfind('/', s1 - 1);
+    if (s0 == std::string::npos) return false;
+
+    const char *status = strchr(request + 1, '"');
+    if (!status || atoi(status + 1) != 200) return false;
+
+    char *end;
+    long z = strtol(p.c_str() + s1 + 1, &end, 10);
+    if (end != p.c_str() + s2) return false;
+    long x = strtol(p.c_str() + s2 + 1, &end, 10);
+    if (end != p.c_str() + s3) return false;
+    long y = strtol(p.c_str() + s3 + 1, &end, 10);
+    if (*end) return false;
+    if (z < 0 || z > METATILE_MAX_ZOOM || x < 0 || y < 0 || x >= (1L << z) || y >= (1L << z)) return false;
+
+    req.at   = at;
+    req.map  = mapIndex(p.substr(s0 + 1, s1 - s0 - 1));
+    req.x    = x;
+    req.y    = y;
+    req.z    = z;
+    req.prio = 1;
+    return true;
+}
+
+void LogReader::readFile(FILE *file, const char *name)
+{
+    char line[8192];
+    unsigned long lineno = 0;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        lineno++;
+        if (line[0] == '\n' || line[0] == '#') continue;
+
+        load_request req;
+        bool ok = strchr(line, '[') && strchr(line, '"') ? parseApache(line, req) : parseJoblog(line, req);
+        if (ok)
+        {
+            mRequests.push_back(req);
+        }
+        else if (mInvalid++ < 10)
+        {
+            fprintf(stderr, "%s:%lu: ignoring line\n", name, lineno);
+        }
+    }
+}
+
+/**
+ * Sort by time, make the times relative to the first request and spread
+ * the requests with the same (second resolution) time over that second.
+ */
+void LogReader::spread()
+{
+    std::stable_sort(mRequests.begin(), mRequests.end(), [](const load_request& a, const load_request& b) { return a.at < b.at; });
+    if (mRequests.empty()) return;
+
+    double start = mRequests[0].at;
+    for (size_t i = 0; i < mRequests.size(); )
+    {
+        size_t j = i;
+        while (j < mRequests.size() && mRequests[j].at == mRequests[i].at) j++;
+        for (size_t k = i; k < j; k++)
+        {
+            mRequests[k].at = mRequests[k].at - start + static_cast<double>(k - i) / (j - i);
+        }
+        i = j;
+    }
+}
+
+struct synthetic_options {
+    int minz;
+    int maxz;
+    double west, south, east, north;
+    std::vector<int> prios;
+    std::vector<double> weights;
+};
+
+static uint32_t lonToTile(double lon, int z)
+{
+    double x = (lon + 180.0) / 360.0 * (1 << z);
+    return std::min(std::max(x, 0.0), (1 << z) - 1.0);
+}
+
+static uint32_t latToTile(double lat, int z)
+{
+    double r = lat * M_PI / 180.0;
+    double y = (1.0 - log(tan(r) + 1.0 / cos(r)) / M_PI) / 2.0 * (1 << z);
+    return std::min(std::max(y, 0.0), (1 << z) - 1.0);
+}
+
+/**
+ * Random metatiles with a uniform distribution of zoom levels and of
+ * tiles within the bounding box on each zoom level.
+ */
+static void generate(const synthetic_options& options, unsigned long count, double rate, unsigned int seed, std::vector<load_request>& requests)
+{
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> zoom(options.minz, options.maxz);
+    std::discrete_distribution<int> prio(options.weights.begin(), options.weights.end());
+
+    requests.resize(count);
+    for (unsigned long i = 0; i < count; i++)
+    {
+        load_request& req = requests[i];
+        req.at   = i / rate;
+        req.map  = 0;
+        req.z    = zoom(rng);
+        req.prio = options.prios[prio(rng)];
+
+        std::uniform_int_distribution<uint32_t> x(lonToTile(options.west, req.z), lonToTile(options.east, req.z));
+        std::uniform_int_distribution<uint32_t> y(latToTile(options.north, req.z), latToTile(options.south, req.z));
+        req.x = x(rng) & ~(METATILE_COLUMNS - 1);
+        req.y = y(rng) & ~(METATILE_ROWS - 1);
+    }
+}
+
+static bool parsePrios(const char *spec, synthetic_options& options)
+{
+    options.prios.clear();
+    options.weights.clear();
+
+    std::string s(spec);
+    size_t pos = 0;
+    while (pos < s.size())
+    {
+        size_t next = s.find(',', pos);
+        if (next == std::string::npos) next = s.size();
+        std::string item = s.substr(pos, next - pos);
+        size_t colon = item.find(':');
+
+        int prio = atoi(item.c_str());
+        double weight = colon == std::string::npos ? 1 : atof(item.c_str() + colon + 1);
+        if (prio < 1 || prio > LOADGEN_MAX_PRIO || !(weight > 0)) return false;
+
+        options.prios.push_back(prio);
+        options.weights.push_back(weight);
+        pos = next + 1;
+    }
+    return !options.prios.empty();
+}
+
+static int connectMaster(const std::string& path)
+{
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+
+    // the master sends its notifies to our address, so we need one: bind
+    // with only the family set gives an automatic abstract address
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(sa_family_t)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) return 0;
+    size_t rank = static_cast<size_t>(ceil(p / 100.0 * sorted.size()));
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        { "config",   required_argument, 0, 'c' },
+        { "file",     required_argument, 0, 'f' },
+        { "map",      required_argument, 0, 'm' },
+        { "rate",     required_argument, 0, 'r' },
+        { "speed",    required_argument, 0, 's' },
+        { "count",    required_argument, 0, 'n' },
+        { "duration", required_argument, 0, 'd' },
+        { "zoom",     required_argument, 0, 'z' },
+        { "bbox",     required_argument, 0, 'b' },
+        { "prio",     required_argument, 0, 'p' },
+        { "set-prio", required_argument, 0, 'P' },
+        { "seed",     required_argument, 0, 'S' },
+        { "wait",     required_argument, 0, 'w' },
+        { "json",     no_argument,       0, 'j' },
+        { "quiet",    no_argument,       0, 'q' },
+        { "help",     no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    std::string configdir = TIREX_CONFIGDIR;
+    const char *file = NULL;
+    const char *map = NULL;
+    double rate = 0;
+    double speed = 1;
+    long count = -1;
+    double duration = 0;
+    int setprio = 0;
+    unsigned int seed = 1;
+    double wait = 60;
+    bool json = false;
+    bool quiet = false;
+
+    synthetic_options synth;
+    synth.minz  = 0;
+    synth.maxz  = 17;
+    synth.west  = -180;
+    synth.south = -85.0511;
+    synth.east  = 180;
+    synth.north = 85.0511;
+    parsePrios("1", synth);
+
+    int c;
+    while ((c = getopt_long(argc, argv, "c:f:m:r:s:n:d:z:b:p:P:S:w:jqh", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'c': configdir = optarg; break;
+            case 'f': file = optarg; break;
+            case 'm': map = optarg; break;
+            case 'r': rate = doubleArg(optarg); break;
+            case 's': speed = doubleArg(optarg); break;
+            case 'n': count = intArg(optarg, 1, 0x7fffffffL); break;
+            case 'd': duration = doubleArg(optarg); break;
+            case 'P': setprio = intArg(optarg, 1, LOADGEN_MAX_PRIO); break;
+            case 'S': seed = intArg(optarg, 0, 0x7fffffffL); break;
+            case 'w': wait = atof(optarg); break;
+            case 'j': json = true; break;
+            case 'q': quiet = true; break;
+            case 'p':
+                if (!parsePrios(optarg, synth)) usage();
+                break;
+            case 'z':
+                if (sscanf(optarg, "%d-%d", &synth.minz, &synth.maxz) == 1) synth.maxz = synth.minz;
+                if (synth.minz < 0 || synth.maxz > METATILE_MAX_ZOOM || synth.minz > synth.maxz) usage();
+                break;
+            case 'b':
+                if (sscanf(optarg, "%lf,%lf,%lf,%lf", &synth.west, &synth.south, &synth.east, &synth.north) != 4) usage();
+                if (synth.west >= synth.east || synth.south >= synth.north) usage();
+                synth.south = std::max(synth.south, -85.0511);
+                synth.north = std::min(synth.north, 85.0511);
+                break;
+            default: usage();
+        }
+    }
+    if (optind != argc) usage();
+
+    // build the list of requests with their send time
+    std::vector<std::string> maps;
+    std::vector<load_request> requests;
+
+    if (file)
+    {
+        LogReader reader;
+        FILE *in = strcmp(file, "-") ? fopen(file, "r") : stdin;
+        if (!in)
+        {
+            fprintf(stderr, "Can't open %s: %s\n", file, strerror(errno));
+            return 1;
+        }
+        reader.readFile(in, file);
+        if (in != stdin) fclose(in);
+        if (reader.mInvalid) fprintf(stderr, "ignored %lu lines that are not job or Apache log lines\n", reader.mInvalid);
+
+        reader.spread();
+        requests.swap(reader.mRequests);
+        maps = reader.mMaps;
+
+        for (size_t i = 0; i < requests.size(); i++)
+        {
+            requests[i].at = rate > 0 ? i / rate : requests[i].at / speed;
+            if (map) requests[i].map = 0;
+            if (setprio) requests[i].prio = setprio;
+        }
+        if (map) maps.assign(1, map);
+        if (count > 0 && requests.size() > static_cast<size_t>(count)) requests.resize(count);
+    }
+    else
+    {
+        if (rate <= 0) rate = 10;
+        if (count < 0) count = duration > 0 ? static_cast<long>(duration * rate) : 1000;
+        generate(synth, count, rate, seed, requests);
+        maps.assign(1, map ? map : "test");
+    }
+
+    if (duration > 0)
+    {
+        size_t n = 0;
+        while (n < requests.size() && requests[n].at < duration) n++;
+        requests.resize(n);
+    }
+
+    if (requests.empty())
+    {
+        fprintf(stderr, "no requests to send\n");
+        return 1;
+    }
+
+    config_map tirexconf;
+    config_read(configdir + "/tirex.conf", tirexconf);
+    std::string socket_name = config_get(tirexconf, "socket_dir", TIREX_SOCKET_DIR) + "/master.sock";
+
+    int sock = connectMaster(socket_name);
+    if (sock < 0)
+    {
+        fprintf(stderr, "Can't connect to master socket %s: %s\n", socket_name.c_str(), strerror(errno));
+        return 1;
+    }
+
+    std::string idprefix = "loadgen." + std::to_string(getpid()) + ".";
+
+    std::vector<double> sent(requests.size(), 0);
+    std::vector<uint8_t> state(requests.size(), STATE_UNSENT);
+    std::map<int, prio_stats> stats;
+
+    size_t next = 0;
+    size_t outstanding = 0;
+    unsigned long stalls = 0;
+    unsigned long unknown = 0;
+    bool stalled = false;
+
+    double start = now();
+    double last_progress = start;
+    double deadline = 0;
+
+    while (true)
+    {
+        double t = now() - start;
+
+        // send all requests that are due
+        while (next < requests.size() && requests[next].at <= t)
+        {
+            const load_request& req = requests[next];
+            char msg[512];
+            int len = snprintf(msg, sizeof(msg), "id=%s%zu\nmap=%s\nprio=%d\ntype=metatile_enqueue_request\nx=%u\ny=%u\nz=%d\n",
+                               idprefix.c_str(), next, maps[req.map].c_str(), req.prio, req.x, req.y, req.z);
+
+            if (send(sock, msg, len, MSG_DONTWAIT) < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    if (!stalled) stalls++;
+                    stalled = true;
+                    break;
+                }
+                fprintf(stderr, "Can't send to master: %s\n", strerror(errno));
+                return 1;
+            }
+            stalled = false;
+
+            sent[next] = now() - start;
+            state[next] = STATE_SENT;
+            stats[req.prio].sent++;
+            outstanding++;
+            next++;
+        }
+
+        if (next == requests.size())
+        {
+            if (deadline == 0) deadline = t + wait;
+            if (outstanding == 0 || t >= deadline) break;
+        }
+
+        if (!quiet && t - (last_progress - start) >= 10)
+        {
+            last_progress = now();
+            fprintf(stderr, "%.0fs: %zu of %zu sent, %zu outstanding\n", t, next, requests.size(), outstanding);
+        }
+
+        // wait for notifies until the next request is due
+        double until = next < requests.size() ? requests[next].at : deadline;
+        int timeout = stalled ? 100 : std::max(0, static_cast<int>(ceil((until - t) * 1000)));
+        struct pollfd pfd = { sock, static_cast<short>(POLLIN | (stalled ? POLLOUT : 0)), 0 };
+        if (poll(&pfd, 1, std::min(timeout, 1000)) < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            return 1;
+        }
+
+        char buffer[2048];
+        ssize_t len;
+        while ((len = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+        {
+            double done = now() - start;
+            msg_view reply;
+            const msg_field *id, *result;
+            if (!msg_parse(buffer, len, reply) || !(id = msg_find(reply, "id")) || id->is_number ||
+                id->valuelen <= idprefix.size() || memcmp(id->value, idprefix.data(), idprefix.size()))
+            {
+                unknown++;
+                continue;
+            }
+
+            size_t n = strtoul(std::string(id->value + idprefix.size(), id->valuelen - idprefix.size()).c_str(), NULL, 10);
+            if (n >= requests.size() || state[n] != STATE_SENT)
+            {
+                unknown++;
+                continue;
+            }
+
+            prio_stats& ps = stats[requests[n].prio];
+            result = msg_find(reply, "result");
+            if (result && result->valuelen == 2 && !memcmp(result->value, "ok", 2))
+            {
+                state[n] = STATE_DONE;
+                ps.done++;
+                ps.latencies.push_back((done - sent[n]) * 1000);
+            }
+            else
+            {
+                state[n] = STATE_ERROR;
+                ps.errors++;
+            }
+            outstanding--;
+        }
+    }
+
+    double elapsed = now() - start;
+    double send_time = next ? sent[next - 1] : 0;
+    close(sock);
+
+    // report
+    prio_stats total = { 0, 0, 0, std::vector<double>() };
+    for (std::map<int, prio_stats>::iterator it = stats.begin(); it != stats.end(); ++it)
+    {
+        std::sort(it->second.latencies.begin(), it->second.latencies.end());
+        total.sent   += it->second.sent;
+        total.done   += it->second.done;
+        total.errors += it->second.errors;
+        total.latencies.insert(total.latencies.end(), it->second.latencies.begin(), it->second.latencies.end());
+    }
+    std::sort(total.latencies.begin(), total.latencies.end());
+
+    static const double pcts[] = { 50, 90, 99, 99.9 };
+    static const char *pctnames[] = { "p50", "p90", "p99", "p999" };
+
+    if (json)
+    {
+        printf("{\n  \"sent\": %lu,\n  \"done\": %lu,\n  \"errors\": %lu,\n  \"lost\": %lu,\n  \"stalls\": %lu,\n  \"unknown\": %lu,\n",
+               total.sent, total.done, total.errors, total.sent - total.done - total.errors, stalls, unknown);
+        printf("  \"send_seconds\": %.3f,\n  \"elapsed_seconds\": %.3f,\n  \"prio\": {", send_time, elapsed);
+        bool first = true;
+        stats[0] = total;
+        for (std::map<int, prio_stats>::iterator it = stats.begin(); it != stats.end(); ++it)
+        {
+            const prio_stats& ps = it->second;
+            printf("%s\n    \"%s\": { \"sent\": %lu, \"done\": %lu, \"errors\": %lu, \"lost\": %lu",
+                   first ? "" : ",", it->first ? std::to_string(it->first).c_str() : "all", ps.sent, ps.done, ps.errors, ps.sent - ps.done - ps.errors);
+            for (int i = 0; i < 4; i++) printf(", \"%s_ms\": %.1f", pctnames[i], percentile(ps.latencies, pcts[i]));
+            printf(", \"max_ms\": %.1f }", ps.latencies.empty() ? 0 : ps.latencies.back());
+            first = false;
+        }
+        printf("\n  }\n}\n");
+        return 0;
+    }
+
+    printf("sent %lu requests in %.1fs (%.1f/s), %lu done, %lu errors, %lu without notify, %lu stalls\n",
+           total.sent, send_time, send_time > 0 ? total.sent / send_time : 0.0, total.done, total.errors,
+           total.sent - total.done - total.errors, stalls);
+    if (unknown) printf("%lu unexpected messages from master\n", unknown);
+
+    printf("\nlatency from enqueue to done in ms:\n");
+    printf(" prio      sent      done    errors      lost       p50       p90       p99      p999       max\n");
+    stats[0] = total;
+    for (std::map<int, prio_stats>::iterator it = stats.begin(); it != stats.end(); ++it)
+    {
+        if (it->first == 0) continue;
+        const prio_stats& ps = it->second;
+        printf("%5d %9lu %9lu %9lu %9lu", it->first, ps.sent, ps.done, ps.errors, ps.sent - ps.done - ps.errors);
+        for (int i = 0; i < 4; i++) printf(" %9.1f", percentile(ps.latencies, pcts[i]));
+        printf(" %9.1f\n", ps.latencies.empty() ? 0 : ps.latencies.back());
+    }
+    printf("  all %9lu %9lu %9lu %9lu", total.sent, total.done, total.errors, total.sent - total.done - total.errors);
+    for (int i = 0; i < 4; i++) printf(" %9.1f", percentile(total.latencies, pcts[i]));
+    printf(" %9.1f\n", total.latencies.empty() ? 0 : total.latencies.back());
+
+    return 0;
+}
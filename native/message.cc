@@ -0,0 +1,338 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Message codec
+ *
+ */
+
+#include "message.h"
+
+#include <stdio.h>
+#include <string.h>
+
+const char *const msg_keys[] = {
+    NULL,
+    "type", "id", "map", "x", "y", "z", "prio", "expire",
+    "result", "errmsg", "render_time", "rss", "peak_rss", "metatile", "layer_profile"
+};
+
+const int msg_num_keys = sizeof(msg_keys) / sizeof(msg_keys[0]);
+
+static uint16_t get16(const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static int32_t get32(const unsigned char *p)
+{
+    return static_cast<int32_t>((static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+static void put16(char *p, uint16_t value)
+{
+    p[0] = static_cast<char>(value >> 8);
+    p[1] = static_cast<char>(value);
+}
+
+static void put32(char *p, int32_t value)
+{
+    uint32_t v = static_cast<uint32_t>(value);
+    p[0] = static_cast<char>(v >> 24);
+    p[1] = static_cast<char>(v >> 16);
+    p[2] = static_cast<char>(v >> 8);
+    p[3] = static_cast<char>(v);
+}
+
+// characters that can't be part of text messages
+static bool has_invalid(const char *str, size_t len)
+{
+    return memchr(str, '\n', len) || memchr(str, '\r', len) || memchr(str, '\0', len);
+}
+
+static int key_index(const char *key, size_t keylen)
+{
+    for (int i = 1; i < msg_num_keys; i++)
+    {
+        if (keylen && msg_keys[i][0] == key[0] && strlen(msg_keys[i]) == keylen && !memcmp(msg_keys[i], key, keylen)) return i;
+    }
+    return 0;
+}
+
+int msg_format(const char *data, size_t len)
+{
+    return (len >= MSG_BINARY_HEADER && !memcmp(data, MSG_BINARY_MAGIC, MSG_BINARY_HEADER)) ? MSG_FORMAT_BINARY : MSG_FORMAT_TEXT;
+}
+
+/**
+ * Strict check for a plain decimal int32 without leading zeros or plus
+ * sign, only those are written as integers in binary messages.
+ */
+bool msg_parse_int(const char *str, size_t len, int32_t& number)
+{
+    size_t i = 0;
+    bool negative = false;
+
+    if (len > 0 && str[0] == '-')
+    {
+        negative = true;
+        i = 1;
+    }
+    if (i == len || len - i > 10) return false;
+    if (str[i] == '0' && (len - i > 1 || negative)) return false;
+
+    int64_t value = 0;
+    for (; i < len; i++)
+    {
+        if (str[i] < '0' || str[i] > '9') return false;
+        value = value * 10 + (str[i] - '0');
+    }
+    if (negative) value = -value;
+    if (value < INT32_MIN || value > INT32_MAX) return false;
+
+    number = static_cast<int32_t>(value);
+    return true;
+}
+
+static bool parse_text(const char *data, size_t len, msg_view& msg)
+{
+    const char *end = static_cast<const char *>(memchr(data, '\0', len));
+    if (!end) end = data + len;
+
+    const char *p = data;
+    while (p < end)
+    {
+        const char *eol = p;
+        while (eol < end && *eol != '\n' && *eol != '\r') eol++;
+
+        const char *eq = static_cast<const char *>(memchr(p, '=', eol - p));
+        if (eq)
+        {
+            if (msg.count == MSG_MAX_FIELDS || eq - p > MSG_MAX_KEY || eol - eq - 1 > MSG_MAX_VALUE) return false;
+
+            msg_field& f = msg.fields[msg.count++];
+            f.key       = p;
+            f.keylen    = eq - p;
+            f.value     = eq + 1;
+            f.valuelen  = eol - eq - 1;
+            f.number    = 0;
+            f.is_number = false;
+        }
+        // lines without equal sign are ignored
+
+        p = eol + 1;
+    }
+    return true;
+}
+
+static bool parse_binary(const char *data, size_t len, msg_view& msg)
+{
+    const unsigned char *p   = reinterpret_cast<const unsigned char *>(data) + MSG_BINARY_HEADER;
+    const unsigned char *end = reinterpret_cast<const unsigned char *>(data) + len;
+
+    while (p < end)
+    {
+        if (msg.count == MSG_MAX_FIELDS) return false;
+        msg_field& f = msg.fields[msg.count++];
+
+        int tag   = *p++;
+        int index = tag & 0x7f;
+        if (index >= msg_num_keys) return false;
+
+        if (index)
+        {
+            f.key    = msg_keys[index];
+            f.keylen = strlen(msg_keys[index]);
+        }
+        else
+        {
+            if (p == end) return false;
+            f.keylen = *p++;
+            f.key    = reinterpret_cast<const char *>(p);
+            if (f.keylen == 0 || end - p < f.keylen) return false;
+            if (memchr(f.key, '=', f.keylen) || has_invalid(f.key, f.keylen)) return false;
+            p += f.keylen;
+        }
+
+        if (tag & 0x80)
+        {
+            if (end - p < 4) return false;
+            f.value     = NULL;
+            f.valuelen  = 0;
+            f.number    = get32(p);
+            f.is_number = true;
+            p += 4;
+        }
+        else
+        {
+            if (end - p < 2) return false;
+            f.valuelen = get16(p);
+            p += 2;
+            if (end - p < f.valuelen) return false;
+            f.value     = reinterpret_cast<const char *>(p);
+            f.number    = 0;
+            f.is_number = false;
+            if (has_invalid(f.value, f.valuelen)) return false;
+            p += f.valuelen;
+        }
+    }
+    return true;
+}
+
+/**
+ * Parse a message in either format. Returns false if a binary message is
+ * malformed or the message has more than MSG_MAX_FIELDS fields.
+ */
+bool msg_parse(const char *data, size_t len, msg_view& msg)
+{
+    msg.count  = 0;
+    msg.format = msg_format(data, len);
+
+    return msg.format == MSG_FORMAT_BINARY ? parse_binary(data, len, msg) : parse_text(data, len, msg);
+}
+
+/**
+ * Find field by key. If a key appears more than once, the last one wins
+ * like it always did for text messages.
+ */
+const msg_field *msg_find(const msg_view& msg, const char *key)
+{
+    size_t keylen = strlen(key);
+    for (int i = msg.count - 1; i >= 0; i--)
+    {
+        const msg_field& f = msg.fields[i];
+        if (f.keylen == keylen && !memcmp(f.key, key, keylen)) return &f;
+    }
+    return NULL;
+}
+
+/**
+ * Get the value of a field as integer. Text values are converted like
+ * atoi() does (leading whitespace, optional sign, digits up to the first
+ * other character). Returns false if there are no digits at all.
+ */
+bool msg_get_int(const msg_field& field, int& number)
+{
+    if (field.is_number)
+    {
+        number = field.number;
+        return true;
+    }
+
+    const char *p   = field.value;
+    const char *end = field.value + field.valuelen;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if (p == end || *p < '0' || *p > '9') return false;
+
+    long value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        if (value < INT32_MAX) value = value * 10 + (*p - '0');
+    }
+    if (value > INT32_MAX) value = INT32_MAX;
+
+    number = static_cast<int>(negative ? -value : value);
+    return true;
+}
+
+/**
+ * Copy the value of a field as text into buffer (NUL terminated if there
+ * is space). Returns the length of the value.
+ */
+size_t msg_value(const msg_field& field, char *buffer, size_t size)
+{
+    if (field.is_number) return snprintf(buffer, size, "%d", field.number);
+
+    if (size)
+    {
+        size_t n = field.valuelen < size ? field.valuelen : size - 1;
+        memcpy(buffer, field.value, n);
+        buffer[n] = '\0';
+    }
+    return field.valuelen;
+}
+
+static size_t write_text(const msg_view& msg, char *buffer, size_t size)
+{
+    size_t pos = 0;
+    for (int i = 0; i < msg.count; i++)
+    {
+        const msg_field& f = msg.fields[i];
+        if (pos + f.keylen + 1 > size) return 0;
+        memcpy(buffer + pos, f.key, f.keylen);
+        pos += f.keylen;
+        buffer[pos++] = '=';
+
+        if (f.is_number)
+        {
+            char number[16];
+            size_t n = snprintf(number, sizeof(number), "%d", f.number);
+            if (pos + n > size) return 0;
+            memcpy(buffer + pos, number, n);
+            pos += n;
+        }
+        else
+        {
+            if (pos + f.valuelen > size) return 0;
+            memcpy(buffer + pos, f.value, f.valuelen);
+            pos += f.valuelen;
+        }
+
+        if (pos + 1 > size) return 0;
+        buffer[pos++] = '\n';
+    }
+    return pos;
+}
+
+static size_t write_binary(const msg_view& msg, char *buffer, size_t size)
+{
+    if (size < MSG_BINARY_HEADER) return 0;
+    memcpy(buffer, MSG_BINARY_MAGIC, MSG_BINARY_HEADER);
+    size_t pos = MSG_BINARY_HEADER;
+
+    for (int i = 0; i < msg.count; i++)
+    {
+        const msg_field& f = msg.fields[i];
+
+        int32_t number = f.number;
+        bool is_number = f.is_number || msg_parse_int(f.value, f.valuelen, number);
+        int index = key_index(f.key, f.keylen);
+
+        if (!index && (f.keylen == 0 || f.keylen > MSG_MAX_KEY)) return 0;
+        if (pos + 2 + (index ? 0 : f.keylen) > size) return 0;
+
+        buffer[pos++] = static_cast<char>(index | (is_number ? 0x80 : 0));
+        if (!index)
+        {
+            buffer[pos++] = static_cast<char>(f.keylen);
+            memcpy(buffer + pos, f.key, f.keylen);
+            pos += f.keylen;
+        }
+
+        if (is_number)
+        {
+            if (pos + 4 > size) return 0;
+            put32(buffer + pos, number);
+            pos += 4;
+        }
+        else
+        {
+            if (pos + 2 + f.valuelen > size) return 0;
+            put16(buffer + pos, f.valuelen);
+            memcpy(buffer + pos + 2, f.value, f.valuelen);
+            pos += 2 + f.valuelen;
+        }
+    }
+    return pos;
+}
+
+/**
+ * Write message in the given format into buffer. Returns the length of
+ * the message or 0 if it doesn't fit.
+ */
+size_t msg_write(const msg_view& msg, int format, char *buffer, size_t size)
+{
+    return format == MSG_FORMAT_BINARY ? write_binary(msg, buffer, size) : write_text(msg, buffer, size);
+}
@@ -0,0 +1,82 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Message codec
+ *
+ */
+
+/**
+ * Reader and writer for the messages between the master and the backends
+ * (and from the master to the syncd) in both wire formats:
+ *
+ * The text format (the default) has one "key=value" line per field, see
+ * Tirex::Message.
+ *
+ * The binary format (version 1) starts with the four bytes "\0TX\1"; a
+ * text message can never start with a NUL byte, so readers can tell the
+ * formats apart from the first byte. Then fields follow until the end of
+ * the datagram:
+ *
+ *   tag       1 byte   bit 7 set: the value is a 32 bit integer
+ *                      bits 0-6:  index into msg_keys, 0 for other keys
+ *   keylen    1 byte   only if the index is 0, followed by the key
+ *   value              integer: 4 bytes
+ *                      string:  2 bytes length, followed by the bytes
+ *
+ * All numbers are in network byte order. Writers use the integer
+ * encoding for every value that is a plain decimal number in the range of
+ * int32, so converting a message back to text gives exactly the same
+ * string. Keys may not contain '=', neither keys nor values may contain CR,
+ * LF or NUL, otherwise the message could not be converted to text.
+ *
+ * msg_keys must be kept in sync with @BINARY_KEYS in lib/Tirex/Message.pm.
+ * New keys may only be appended.
+ *
+ * The reader doesn't allocate or copy anything: the fields of a msg_view
+ * point into the buffer that was parsed, which must outlive the view.
+ */
+
+#ifndef message_included
+#define message_included
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MSG_FORMAT_TEXT      0
+#define MSG_FORMAT_BINARY    1
+
+#define MSG_BINARY_MAGIC     "\0TX\1"
+#define MSG_BINARY_HEADER    4
+#define MSG_MAX_FIELDS       64
+#define MSG_MAX_KEY          255
+#define MSG_MAX_VALUE        65535
+
+extern const char *const msg_keys[];
+extern const int msg_num_keys;
+
+struct msg_field {
+    const char *key;
+    const char *value;      // NULL for integers in binary messages
+    uint16_t keylen;
+    uint16_t valuelen;
+    int32_t number;
+    bool is_number;
+};
+
+struct msg_view {
+    int format;
+    int count;
+    msg_field fields[MSG_MAX_FIELDS];
+};
+
+int msg_format(const char *data, size_t len);
+bool msg_parse(const char *data, size_t len, msg_view& msg);
+bool msg_parse_int(const char *str, size_t len, int32_t& number);
+
+const msg_field *msg_find(const msg_view& msg, const char *key);
+bool msg_get_int(const msg_field& field, int& number);
+size_t msg_value(const msg_field& field, char *buffer, size_t size);
+
+size_t msg_write(const msg_view& msg, int format, char *buffer, size_t size);
+
+#endif
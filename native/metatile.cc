@@ -0,0 +1,113 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Metatile files
+ *
+ */
+
+#include "metatile.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+static bool isNumber(const char *str, size_t len)
+{
+    if (len == 0) return false;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (str[i] < '0' || str[i] > '9') return false;
+    }
+    return true;
+}
+
+std::string metatile_path(int depth, int z, uint32_t x, uint32_t y)
+{
+    std::string hashes;
+
+    for (int i = 0; i < depth; i++)
+    {
+        unsigned int hash = ((x & 0x0f) << 4) | (y & 0x0f);
+        x >>= 4;
+        y >>= 4;
+        hashes = "/" + std::to_string(hash) + hashes;
+    }
+
+    return "/" + std::to_string(z) + hashes + ".meta";
+}
+
+bool metatile_from_path(const std::string& path, int depth, int& z, uint32_t& x, uint32_t& y)
+{
+    std::vector<unsigned long> components;
+
+    size_t pos = path[0] == '/' ? 1 : 0;
+    size_t end = path.size();
+    if (end > 5 && path.compare(end - 5, 5, ".meta") == 0) end -= 5;
+
+    while (pos < end)
+    {
+        size_t next = path.find('/', pos);
+        if (next == std::string::npos || next > end) next = end;
+        if (!isNumber(path.c_str() + pos, next - pos) || next - pos > 9) return false;
+        components.push_back(strtoul(path.c_str() + pos, NULL, 10));
+        pos = next + 1;
+    }
+
+    if (components.size() != static_cast<size_t>(depth) + 1) return false;
+    if (components[0] > METATILE_MAX_ZOOM) return false;
+
+    z = components[0];
+    x = 0;
+    y = 0;
+    for (size_t i = 1; i < components.size(); i++)
+    {
+        if (components[i] > 255) return false;
+        x = (x << 4) | ((components[i] & 0xf0) >> 4);
+        y = (y << 4) |  (components[i] & 0x0f);
+    }
+
+    return true;
+}
+
+static int32_t readInt(const char *buffer, size_t offset)
+{
+    int32_t value;
+    memcpy(&value, buffer + offset, sizeof(value));
+    return value;
+}
+
+std::string metatile_check(int fd, uint64_t size, int z, uint32_t x, uint32_t y)
+{
+    char buffer[METATILE_INDEX_SIZE];
+
+    ssize_t len = pread(fd, buffer, sizeof(buffer), 0);
+    if (len < 0) return std::string("read error: ") + strerror(errno);
+    if (len < METATILE_HEADER_SIZE) return "truncated header";
+
+    if (memcmp(buffer, METATILE_MAGIC, 4)) return "bad magic";
+
+    int32_t count = readInt(buffer, 4);
+    if (count != METATILE_TILES) return "bad tile count " + std::to_string(count);
+
+    int32_t mx = readInt(buffer,  8);
+    int32_t my = readInt(buffer, 12);
+    int32_t mz = readInt(buffer, 16);
+    if (mz != z || static_cast<uint32_t>(mx) != x || static_cast<uint32_t>(my) != y)
+    {
+        return "header position x=" + std::to_string(mx) + " y=" + std::to_string(my) + " z=" + std::to_string(mz) + " doesn't match path";
+    }
+
+    if (len < METATILE_INDEX_SIZE) return "truncated index";
+
+    for (int i = 0; i < METATILE_TILES; i++)
+    {
+        int32_t offset = readInt(buffer, METATILE_HEADER_SIZE + i * 8);
+        int32_t length = readInt(buffer, METATILE_HEADER_SIZE + i * 8 + 4);
+        if (offset < METATILE_INDEX_SIZE || length < 0) return "bad index entry " + std::to_string(i);
+        if (static_cast<uint64_t>(offset) + static_cast<uint64_t>(length) > size) return "truncated tile data";
+    }
+
+    return "";
+}
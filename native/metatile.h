@@ -0,0 +1,49 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Metatile files
+ *
+ */
+
+/**
+ * Helpers for metatile files: the layout of the header written by the
+ * backends (see meta_layout in backend-mapnik/metatilewriter.h) and the
+ * hashed directory tree the files are kept in (see get_filename() in
+ * Tirex::Metatile and MetatileWriter::xyz_to_meta).
+ */
+
+#ifndef metatile_included
+#define metatile_included
+
+#include <stdint.h>
+#include <string>
+
+#define METATILE_MAX_ZOOM       30
+#define METATILE_COLUMNS        8
+#define METATILE_ROWS           8
+
+#define METATILE_MAGIC          "META"
+#define METATILE_TILES          (METATILE_COLUMNS * METATILE_ROWS)
+#define METATILE_HEADER_SIZE    20     // magic + count + x + y + z
+#define METATILE_INDEX_SIZE     (METATILE_HEADER_SIZE + METATILE_TILES * 8)
+
+/**
+ * Path of the metatile with the given (tile) coordinates relative to the
+ * tile directory of the map, for instance "/10/0/0/0/33/136.meta".
+ */
+std::string metatile_path(int depth, int z, uint32_t x, uint32_t y);
+
+/**
+ * Decode the path of a metatile relative to the tile directory into zoom
+ * and x and y of the metatile. Returns false if the path doesn't fit the
+ * tiledir depth.
+ */
+bool metatile_from_path(const std::string& path, int depth, int& z, uint32_t& x, uint32_t& y);
+
+/**
+ * Check the header and index of a metatile file. Returns an empty string
+ * if everything is fine or a description of the problem.
+ */
+std::string metatile_check(int fd, uint64_t size, int z, uint32_t x, uint32_t y);
+
+#endif
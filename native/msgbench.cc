@@ -0,0 +1,83 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Message codec
+ *
+ */
+
+/**
+ * msgbench
+ *
+ * Measures how many render requests per second can be parsed and how
+ * many responses per second can be written in the text and binary
+ * format. test/message_speed_test.pl does the same for Tirex::Message.
+ *
+ * Usage: msgbench [NUMMESSAGES]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "message.h"
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void bench(const char *name, int format, const msg_view& request, int num)
+{
+    char buffer[1024];
+    size_t len = msg_write(request, format, buffer, sizeof(buffer));
+
+    // the backend reads x, y, z and map of every request
+    double t0 = now();
+    long sum = 0;
+    for (int n = 0; n < num; n++)
+    {
+        msg_view msg;
+        msg_parse(buffer, len, msg);
+        int x = 0, y = 0, z = 0;
+        msg_get_int(*msg_find(msg, "x"), x);
+        msg_get_int(*msg_find(msg, "y"), y);
+        msg_get_int(*msg_find(msg, "z"), z);
+        sum += x + y + z + msg_find(msg, "map")->valuelen;
+    }
+    double parse = now() - t0;
+
+    // the response is the request plus a few fields
+    msg_view response = request;
+    msg_field extra[3] = {
+        { "result", "ok", 6, 2, 0, false },
+        { "render_time", NULL, 11, 0, 1234, true },
+        { "rss", NULL, 3, 0, 123456, true }
+    };
+    for (int i = 0; i < 3; i++) response.fields[response.count++] = extra[i];
+
+    t0 = now();
+    for (int n = 0; n < num; n++)
+    {
+        sum += msg_write(response, format, buffer, sizeof(buffer));
+    }
+    double build = now() - t0;
+
+    printf("%-6s %3zu bytes  parse: %10.0f msgs/s  write: %10.0f msgs/s  (%ld)\n", name, len, num / parse, num / build, sum % 10);
+}
+
+int main(int argc, char **argv)
+{
+    int num = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    const char *text = "id=1234567_0\nmap=default\nprio=3\ntype=metatile_render_request\nx=1024\ny=2048\nz=12\n";
+    msg_view request;
+    msg_parse(text, strlen(text), request);
+
+    bench("text", MSG_FORMAT_TEXT, request, num);
+    bench("binary", MSG_FORMAT_BINARY, request, num);
+
+    return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Message codec
+ *
+ */
+
+/**
+ * msgtest
+ *
+ * Tests for the message codec: round trips between the text and binary
+ * format and a fuzzer that feeds random and mutated messages to the
+ * parser. Every message the parser accepts must survive a round trip
+ * through both formats unchanged. Run it under valgrind or with
+ * -fsanitize=address to catch reads outside the buffer.
+ *
+ * Usage: msgtest [ITERATIONS [SEED]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "message.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static std::string value(const msg_view& msg, const char *key)
+{
+    const msg_field *f = msg_find(msg, key);
+    if (!f) return "<undef>";
+    char buffer[MSG_MAX_VALUE + 1];
+    size_t len = msg_value(*f, buffer, sizeof(buffer));
+    return std::string(buffer, len);
+}
+
+static bool sameFields(const msg_view& a, const msg_view& b)
+{
+    if (a.count != b.count) return false;
+    for (int i = 0; i < a.count; i++)
+    {
+        char va[MSG_MAX_VALUE + 1], vb[MSG_MAX_VALUE + 1];
+        const msg_field& fa = a.fields[i];
+        const msg_field& fb = b.fields[i];
+        if (fa.keylen != fb.keylen || memcmp(fa.key, fb.key, fa.keylen)) return false;
+        size_t la = msg_value(fa, va, sizeof(va));
+        size_t lb = msg_value(fb, vb, sizeof(vb));
+        if (la != lb || memcmp(va, vb, la)) return false;
+    }
+    return true;
+}
+
+/**
+ * A message the parser accepted must give the same fields after writing
+ * it in both formats and parsing it again.
+ */
+static void checkRoundTrip(const msg_view& msg, const char *what)
+{
+    static char text[MSG_MAX_FIELDS * (MSG_MAX_KEY + MSG_MAX_VALUE + 2)];
+    static char binary[MSG_MAX_FIELDS * (MSG_MAX_KEY + MSG_MAX_VALUE + 4) + MSG_BINARY_HEADER];
+
+    size_t tlen = msg_write(msg, MSG_FORMAT_TEXT, text, sizeof(text));
+    size_t blen = msg_write(msg, MSG_FORMAT_BINARY, binary, sizeof(binary));
+
+    // empty keys have no binary encoding
+    bool emptykey = false;
+    for (int i = 0; i < msg.count; i++) emptykey |= msg.fields[i].keylen == 0;
+
+    msg_view t, b;
+    check(msg_parse(text, tlen, t) && t.format == MSG_FORMAT_TEXT && sameFields(msg, t), what);
+    if (!emptykey)
+    {
+        check(blen > 0 && msg_parse(binary, blen, b) && b.format == MSG_FORMAT_BINARY && sameFields(msg, b), what);
+    }
+}
+
+static void testRoundTrip()
+{
+    const char *request = "id=1234567_0\nmap=default\nprio=3\ntype=metatile_render_request\nx=1024\ny=2048\nz=12\n";
+    msg_view msg;
+
+    check(msg_parse(request, strlen(request), msg), "parse text request");
+    check(msg.format == MSG_FORMAT_TEXT && msg.count == 7, "text format and field count");
+    check(value(msg, "map") == "default" && value(msg, "x") == "1024", "text values");
+    checkRoundTrip(msg, "round trip request");
+
+    char binary[512];
+    size_t blen = msg_write(msg, MSG_FORMAT_BINARY, binary, sizeof(binary));
+    check(blen > 0 && blen < strlen(request), "binary is shorter than text");
+
+    msg_view b;
+    check(msg_parse(binary, blen, b) && b.format == MSG_FORMAT_BINARY, "parse binary request");
+    const msg_field *fx = msg_find(b, "x");
+    int x = 0;
+    check(fx && fx->is_number && msg_get_int(*fx, x) && x == 1024, "integers are binary");
+    check(!msg_find(b, "id")->is_number, "ids with underscore are strings");
+
+    // values that would not give the same text stay strings
+    const char *odd = "type=t\na=007\nb=-0\nc=+5\nd=2147483648\ne=-2147483648\nf=\nlongkey_not_in_table=x=y\n";
+    check(msg_parse(odd, strlen(odd), msg), "parse odd values");
+    blen = msg_write(msg, MSG_FORMAT_BINARY, binary, sizeof(binary));
+    check(msg_parse(binary, blen, b), "parse odd values binary");
+    check(!msg_find(b, "a")->is_number && !msg_find(b, "b")->is_number && !msg_find(b, "c")->is_number && !msg_find(b, "d")->is_number, "non-canonical numbers are strings");
+    check(msg_find(b, "e")->is_number && value(b, "e") == "-2147483648", "int32 minimum");
+    check(value(b, "f") == "" && value(b, "longkey_not_in_table") == "x=y", "empty value and literal key");
+    checkRoundTrip(msg, "round trip odd values");
+
+    // CRLF, lines without '=', duplicates
+    const char *crlf = "type=a\r\nbogus\r\n\r\nx=1\r\nx=2\r\n";
+    check(msg_parse(crlf, strlen(crlf), msg) && msg.count == 3 && value(msg, "x") == "2", "CRLF and duplicates");
+
+    // atoi semantics for text integers
+    const char *lenient = "x= 12abc\ny=abc\n";
+    check(msg_parse(lenient, strlen(lenient), msg), "parse lenient");
+    int n = 0;
+    check(msg_get_int(*msg_find(msg, "x"), n) && n == 12, "atoi-like conversion");
+    check(!msg_get_int(*msg_find(msg, "y"), n), "no digits");
+
+    // malformed binary messages
+    const char truncated[] = "\0TX\1\x84\0\0";
+    check(!msg_parse(truncated, sizeof(truncated) - 1, msg), "truncated integer");
+    const char badkey[] = "\0TX\1\x7f\0\0";
+    check(!msg_parse(badkey, sizeof(badkey) - 1, msg), "unknown key index");
+    const char newline[] = "\0TX\1\x03\0\2a\n";
+    check(!msg_parse(newline, sizeof(newline) - 1, msg), "line break in value");
+    const char nul[] = "\0TX\1\x03\0\2a\0";
+    check(!msg_parse(nul, sizeof(nul) - 1, msg), "NUL in value");
+    const char eqkey[] = "\0TX\1\0\3a=b\0\0";
+    check(!msg_parse(eqkey, sizeof(eqkey) - 1, msg), "equal sign in key");
+    check(msg_parse(MSG_BINARY_MAGIC, MSG_BINARY_HEADER, msg) && msg.count == 0, "empty binary message");
+
+    // too many fields
+    std::string many;
+    for (int i = 0; i <= MSG_MAX_FIELDS; i++) many += "k" + std::to_string(i) + "=v\n";
+    check(!msg_parse(many.data(), many.size(), msg), "too many fields");
+
+    // buffer too small
+    check(msg_parse(request, strlen(request), msg) && msg_write(msg, MSG_FORMAT_TEXT, binary, 10) == 0, "text overflow");
+    check(msg_write(msg, MSG_FORMAT_BINARY, binary, 10) == 0, "binary overflow");
+}
+
+static void fuzz(int iterations)
+{
+    const char *seeds[] = {
+        "id=1\nmap=default\nprio=3\ntype=metatile_render_request\nx=1024\ny=2048\nz=12\n",
+        "id=1\nresult=error\nerrmsg=map style 'x' is not known\ntype=metatile_render_request\n",
+        "type=t\nfoo=bar\nrender_time=1234\nrss=-5\n"
+    };
+    const int numseeds = sizeof(seeds) / sizeof(seeds[0]);
+
+    char binary[numseeds][512];
+    size_t blen[numseeds];
+    for (int i = 0; i < numseeds; i++)
+    {
+        msg_view msg;
+        msg_parse(seeds[i], strlen(seeds[i]), msg);
+        blen[i] = msg_write(msg, MSG_FORMAT_BINARY, binary[i], sizeof(binary[i]));
+    }
+
+    char buffer[1024];
+    int accepted = 0;
+    for (int n = 0; n < iterations; n++)
+    {
+        size_t len;
+        int s = rand() % numseeds;
+
+        switch (rand() % 4)
+        {
+            case 0: // random bytes, sometimes with the binary magic
+                len = rand() % 128;
+                for (size_t i = 0; i < len; i++) buffer[i] = rand();
+                if (len >= MSG_BINARY_HEADER && rand() % 2) memcpy(buffer, MSG_BINARY_MAGIC, MSG_BINARY_HEADER);
+                break;
+            case 1: // flipped bytes in a text message
+                len = strlen(seeds[s]);
+                memcpy(buffer, seeds[s], len);
+                for (int i = rand() % 4; i >= 0; i--) buffer[rand() % len] = rand();
+                break;
+            default: // flipped bytes or truncation of a binary message
+                len = blen[s];
+                memcpy(buffer, binary[s], len);
+                if (rand() % 2)
+                {
+                    for (int i = rand() % 4; i >= 0; i--) buffer[MSG_BINARY_HEADER + rand() % (len - MSG_BINARY_HEADER)] = rand();
+                }
+                else
+                {
+                    len = MSG_BINARY_HEADER + rand() % (len - MSG_BINARY_HEADER);
+                }
+                break;
+        }
+
+        // copy to a buffer of exactly the right size, so that reads past
+        // the end are caught by sanitizers
+        char *data = static_cast<char *>(malloc(len ? len : 1));
+        memcpy(data, buffer, len);
+
+        msg_view msg;
+        if (msg_parse(data, len, msg))
+        {
+            accepted++;
+            checkRoundTrip(msg, "fuzz round trip");
+        }
+        free(data);
+
+        if (failures > 10) break;
+    }
+
+    printf("fuzz: %d iterations, %d messages accepted\n", iterations, accepted);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    srand(argc > 2 ? atoi(argv[2]) : 1);
+
+    testRoundTrip();
+    fuzz(iterations);
+
+    if (failures)
+    {
+        printf("%d tests FAILED\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Native job queue
+ *
+ * Perl binding for the JobQueue class (see ../jobqueue.h). The queue holds
+ * a reference to each Tirex::Job object it contains. The metatile, prio,
+ * request time and expire time are read directly from the job hashes, so
+ * no Perl methods are called except Tirex::Job::merge() when a job for an
+ * already queued metatile is added.
+ */
+
+#include <vector>
+
+#include "jobqueue.h"
+
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+
+typedef JobQueue *Tirex__Queue__Native;
+
+static IV hv_fetch_iv(pTHX_ HV *hv, const char *key, IV def)
+{
+    SV **svp = hv_fetch(hv, key, strlen(key), 0);
+    return (svp && SvOK(*svp)) ? SvIV(*svp) : def;
+}
+
+static HV *job_hv(pTHX_ SV *job)
+{
+    if (!SvROK(job) || SvTYPE(SvRV(job)) != SVt_PVHV || !sv_derived_from(job, "Tirex::Job"))
+    {
+        croak("Can only add objects of type Tirex::Job to queue!");
+    }
+    return (HV *) SvRV(job);
+}
+
+static void job_key(pTHX_ JobQueue *q, HV *job, queue_key *key)
+{
+    SV **mt = hv_fetch(job, "metatile", 8, 0);
+    if (!mt || !SvROK(*mt) || SvTYPE(SvRV(*mt)) != SVt_PVHV) croak("job without metatile");
+    HV *metatile = (HV *) SvRV(*mt);
+
+    SV **map = hv_fetch(metatile, "map", 3, 0);
+    if (!map) croak("metatile without map");
+    STRLEN len;
+    const char *name = SvPV(*map, len);
+
+    key->map = q->mapId(std::string(name, len));
+    key->x   = hv_fetch_iv(aTHX_ metatile, "x", 0);
+    key->y   = hv_fetch_iv(aTHX_ metatile, "y", 0);
+    key->z   = hv_fetch_iv(aTHX_ metatile, "z", 0);
+}
+
+static SV *call_merge(pTHX_ SV *oldjob, SV *newjob)
+{
+    dSP;
+    ENTER;
+    SAVETMPS;
+    PUSHMARK(SP);
+    XPUSHs(oldjob);
+    XPUSHs(newjob);
+    PUTBACK;
+    if (call_method("merge", G_SCALAR) != 1) croak("Tirex::Job::merge() didn't return a job");
+    SPAGAIN;
+    SV *merged = newSVsv(POPs);
+    PUTBACK;
+    FREETMPS;
+    LEAVE;
+    return merged;
+}
+
+static void release(pTHX_ std::vector<void *>& jobs)
+{
+    for (auto itr = jobs.begin(); itr != jobs.end(); itr++)
+    {
+        SvREFCNT_dec(static_cast<SV *>(*itr));
+    }
+}
+
+static SV *job_or_undef(pTHX_ void *job)
+{
+    return job ? sv_2mortal(static_cast<SV *>(job)) : &PL_sv_undef;
+}
+
+MODULE = Tirex::Queue::Native    PACKAGE = Tirex::Queue::Native
+
+PROTOTYPES: DISABLE
+
+Tirex::Queue::Native
+_new(char *klass)
+    CODE:
+        PERL_UNUSED_VAR(klass);
+        RETVAL = new JobQueue();
+    OUTPUT:
+        RETVAL
+
+void
+DESTROY(Tirex::Queue::Native self)
+    CODE:
+        std::vector<void *> jobs;
+        self->clear(jobs);
+        release(aTHX_ jobs);
+        delete self;
+
+void
+_reset(Tirex::Queue::Native self)
+    CODE:
+        std::vector<void *> jobs;
+        self->clear(jobs);
+        release(aTHX_ jobs);
+
+UV
+size(Tirex::Queue::Native self)
+    CODE:
+        RETVAL = self->size();
+    OUTPUT:
+        RETVAL
+
+UV
+size_of_prio(Tirex::Queue::Native self, unsigned int prio)
+    CODE:
+        RETVAL = self->prioSize(prio);
+    OUTPUT:
+        RETVAL
+
+bool
+empty(Tirex::Queue::Native self)
+    CODE:
+        RETVAL = self->empty();
+    OUTPUT:
+        RETVAL
+
+UV
+reset_maxsize(Tirex::Queue::Native self)
+    CODE:
+        RETVAL = self->resetMaxsize();
+    OUTPUT:
+        RETVAL
+
+void
+_add(Tirex::Queue::Native self, SV *job)
+    CODE:
+        HV *hv = job_hv(aTHX_ job);
+        queue_key key;
+        job_key(aTHX_ self, hv, &key);
+
+        SV *newjob;
+        JobQueue::handle h = self->find(key);
+        if (h != JobQueue::none)
+        {
+            newjob = call_merge(aTHX_ static_cast<SV *>(self->get(h).data), job);
+            hv = job_hv(aTHX_ newjob);
+        }
+        else
+        {
+            newjob = newSVsv(job);
+        }
+
+        void *replaced;
+        self->add(key, hv_fetch_iv(aTHX_ hv, "prio", 1), hv_fetch_iv(aTHX_ hv, "request_time", 0), hv_fetch_iv(aTHX_ hv, "expire", 0), newjob, &replaced);
+        if (replaced) SvREFCNT_dec(static_cast<SV *>(replaced));
+
+void
+remove(Tirex::Queue::Native self, SV *job)
+    PPCODE:
+        queue_key key;
+        job_key(aTHX_ self, job_hv(aTHX_ job), &key);
+        XPUSHs(job_or_undef(aTHX_ self->remove(key)));
+
+void
+in_queue(Tirex::Queue::Native self, SV *job)
+    PPCODE:
+        queue_key key;
+        job_key(aTHX_ self, job_hv(aTHX_ job), &key);
+        JobQueue::handle h = self->find(key);
+        XPUSHs(h == JobQueue::none ? &PL_sv_undef : static_cast<SV *>(self->get(h).data));
+
+void
+next(Tirex::Queue::Native self)
+    PPCODE:
+        XPUSHs(job_or_undef(aTHX_ self->next()));
+
+void
+peek(Tirex::Queue::Native self)
+    PPCODE:
+        JobQueue::handle h = self->peek();
+        XPUSHs(h == JobQueue::none ? &PL_sv_undef : static_cast<SV *>(self->get(h).data));
+
+void
+jobs(Tirex::Queue::Native self)
+    PPCODE:
+        std::vector<JobQueue::handle> handles;
+        self->handles(handles);
+        EXTEND(SP, handles.size());
+        for (auto itr = handles.begin(); itr != handles.end(); itr++)
+        {
+            PUSHs(sv_2mortal(newSVsv(static_cast<SV *>(self->get(*itr).data))));
+        }
+
+void
+map_names(Tirex::Queue::Native self)
+    PPCODE:
+        for (size_t i = 0; i < self->mapCount(); i++)
+        {
+            const std::string& name = self->mapName(i);
+            mXPUSHs(newSVpvn(name.data(), name.size()));
+        }
+
+UV
+remove_map(Tirex::Queue::Native self, SV *map)
+    CODE:
+        STRLEN len;
+        const char *name = SvPV(map, len);
+        std::vector<void *> jobs;
+        RETVAL = self->removeMap(self->mapId(std::string(name, len)), jobs);
+        release(aTHX_ jobs);
+    OUTPUT:
+        RETVAL
+
+SV *
+status(Tirex::Queue::Native self)
+    CODE:
+        std::vector<queue_prio_status> prios;
+        self->status(prios, time(NULL));
+
+        AV *pq = newAV();
+        for (auto itr = prios.begin(); itr != prios.end(); itr++)
+        {
+            HV *s = newHV();
+            hv_stores(s, "size",    newSVuv(itr->size));
+            hv_stores(s, "maxsize", newSVuv(itr->maxsize));
+            hv_stores(s, "prio",    newSVuv(itr->prio));
+            if (itr->size > 0)
+            {
+                hv_stores(s, "age_first", newSViv(itr->age_first));
+                hv_stores(s, "age_last",  newSViv(itr->age_last));
+            }
+            av_push(pq, newRV_noinc((SV *) s));
+        }
+
+        HV *status = newHV();
+        hv_stores(status, "size",       newSVuv(self->size()));
+        hv_stores(status, "maxsize",    newSVuv(self->maxsize()));
+        hv_stores(status, "prioqueues", newRV_noinc((SV *) pq));
+        RETVAL = newRV_noinc((SV *) status);
+    OUTPUT:
+        RETVAL
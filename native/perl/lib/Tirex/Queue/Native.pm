@@ -0,0 +1,148 @@
+#-----------------------------------------------------------------------------
+#
+#  Tirex/Queue/Native.pm
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Carp;
+use XSLoader;
+
+use Tirex::Job;
+use Tirex::Map;
+
+#-----------------------------------------------------------------------------
+
+package Tirex::Queue::Native;
+
+our $VERSION = '0.6.2';
+
+XSLoader::load('Tirex::Queue::Native', $VERSION);
+
+=head1 NAME
+
+Tirex::Queue::Native - Job queue for Tirex system implemented in C++
+
+=head1 SYNOPSIS
+
+ use Tirex::Queue::Native;
+
+ my $q = Tirex::Queue::Native->new();
+ $q->add( Tirex::Job->new(...) );
+
+ my $job = $q->next();
+
+=head1 DESCRIPTION
+
+Drop-in replacement for L<Tirex::Queue> with the same methods and semantics:
+jobs for the same metatile are merged (see L<Tirex::Job/merge>), jobs come
+out ordered by priority and first-in first-out within a priority, and
+status() returns the same structure.
+
+The queue itself is kept in C++ (see native/jobqueue.h in the Tirex
+sources), the Tirex::Job objects are only referenced from there. This is
+much faster than the Perl implementation when there are millions of jobs
+in the queue.
+
+tirex-master uses this queue if the config option B<master_queue_engine>
+is set to B<native>.
+
+=head1 METHODS
+
+=head2 Tirex::Queue::Native->new()
+
+Create new queue object.
+
+=cut
+
+sub new
+{
+    my $class = shift;
+    return $class->_new();
+}
+
+=head2 $queue->reset()
+
+Reset the queue. All jobs on the queue will be lost!
+
+Returns queue itself, so that calls can be chained.
+
+=cut
+
+sub reset
+{
+    my $self = shift;
+    $self->_reset();
+    return $self;
+}
+
+=head2 $queue->add($job1, $job2, ...)
+
+Adds one or more jobs to the queue. You can also call it with an array reference
+and all jobs inside the array will be added to the queue.
+
+Returns queue itself, so that calls can be chained.
+
+=cut
+
+sub add
+{
+    my $self = shift;
+
+    while (defined(my $job = shift))
+    {
+        if (ref($job) eq 'ARRAY')
+        {
+            foreach my $j (@$job)
+            {
+                Carp::croak('Can only add objects of type Tirex::Job to queue!') unless (ref($j) eq 'Tirex::Job');
+                $self->_add($j);
+            }
+        }
+        elsif (ref($job) eq 'Tirex::Job')
+        {
+            $self->_add($job);
+        }
+        else
+        {
+            Carp::croak('Can only add objects of type Tirex::Job to queue!');
+        }
+    }
+    return $self;
+}
+
+=head2 $queue->remove_jobs_for_unknown_maps()
+
+Remove all jobs where the map is undefined. This can happen after a reload of
+the config file, when a map was deleted from it.
+
+=cut
+
+sub remove_jobs_for_unknown_maps
+{
+    my $self = shift;
+
+    foreach my $map ($self->map_names())
+    {
+        $self->remove_map($map) unless (defined Tirex::Map->get($map));
+    }
+}
+
+=head2 Other methods
+
+size(), size_of_prio(), empty(), status(), remove($job), in_queue($job), next(),
+peek(), jobs() and reset_maxsize() are implemented in C++ and work exactly as in
+L<Tirex::Queue>.
+
+=head1 SEE ALSO
+
+L<Tirex::Queue>, L<Tirex::Job>
+
+=cut
+
+
+1;
+
+#-- THE END ------------------------------------------------------------------
@@ -0,0 +1,137 @@
+#-----------------------------------------------------------------------------
+#
+#  native/perl/t/queue_native.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use lib '../../lib';
+
+use Tirex;
+use Tirex::Queue;
+use Tirex::Queue::Native;
+
+#-----------------------------------------------------------------------------
+
+my $q = Tirex::Queue::Native->new();
+isa_ok($q, 'Tirex::Queue::Native', 'class');
+
+ok($q->empty(), 'empty queue');
+is($q->next(), undef, 'nothing in empty queue');
+is($q->peek(), undef, 'nothing to peek at in empty queue');
+
+my @jobs = (
+    Tirex::Job->new( metatile => Tirex::Metatile->new(map => 'test', x =>  7, y => 1, z => 9), prio => 8),
+    Tirex::Job->new( metatile => Tirex::Metatile->new(map => 'test', x =>  8, y => 1, z => 9), prio => 5),
+    Tirex::Job->new( metatile => Tirex::Metatile->new(map => 'test', x => 31, y => 1, z => 9), prio => 1),
+    Tirex::Job->new( metatile => Tirex::Metatile->new(map => 'test', x => 32, y => 1, z => 9), prio => 9),
+    Tirex::Job->new( metatile => Tirex::Metatile->new(map => 'test', x => 99, y => 1, z => 9), prio => 7),
+);
+
+$q->add(@jobs);
+is($q->size(), scalar(@jobs), 'all jobs in queue');
+is($q->in_queue($jobs[3]), $jobs[3], 'job in queue');
+is($q->peek(), $jobs[2], 'peek');
+
+is($q->next(), $jobs[2], 'jobs from queue 1');
+is($q->next(), $jobs[1], 'jobs from queue 2');
+is($q->next(), $jobs[4], 'jobs from queue 3');
+is($q->next(), $jobs[0], 'jobs from queue 4');
+is($q->next(), $jobs[3], 'jobs from queue 5');
+ok($q->empty(), 'queue empty again');
+is($q->in_queue($jobs[3]), undef, 'job not in queue any more');
+
+#-----------------------------------------------------------------------------
+# merging
+
+my $mt = Tirex::Metatile->new(map => 'test', x => 1, y => 1, z => 1);
+my $other = Tirex::Job->new( metatile => Tirex::Metatile->new(map => 'test', x => 8, y => 8, z => 4), prio => 3 );
+$q->add($other);
+foreach my $prio (5, 3, 10, 8, 1, 9) {
+    $q->add( Tirex::Job->new( metatile => $mt, prio => $prio, request_time => 100 + $prio, expire => time() + $prio ) );
+}
+
+is($q->size(), 2, 'only one job for the same metatile');
+my $j = $q->next();
+is($j->get_prio(), 1, 'merged job has lowest prio');
+is($j->{'request_time'}, 101, 'merged job has earliest request time');
+is($j->{'expire'} - time() >= 9, 1, 'merged job has latest expire time');
+is($q->next(), $other, 'other job is behind merged job');
+
+$q->add( Tirex::Job->new( metatile => $mt, prio => 2, expire => time() + 10 ) );
+$q->add( Tirex::Job->new( metatile => $mt, prio => 2 ) );
+is($q->next()->{'expire'}, undef, 'no expire time if one job has none');
+
+#-----------------------------------------------------------------------------
+# remove
+
+$q->add(@jobs);
+is($q->remove($jobs[1]), $jobs[1], 'remove returns job');
+is($q->remove($jobs[1]), undef, 'remove returns undef if job not in queue');
+is($q->size(), 4, 'one job less');
+
+#-----------------------------------------------------------------------------
+# status
+
+$q->reset();
+is($q->size(), 0, 'reset');
+$q->add(@jobs);
+$q->next();
+
+my $pq = Tirex::Queue->new();
+$pq->add(@jobs);
+$pq->next();
+
+is_deeply($q->status(), $pq->status(), 'same status as Tirex::Queue');
+is($q->size_of_prio($_), $pq->size_of_prio($_), "same size of prio $_ as Tirex::Queue") foreach (0 .. 10, 100);
+is_deeply([ map { $_->get_id() } $q->jobs() ], [ map { $_->get_id() } $pq->jobs() ], 'same jobs as Tirex::Queue');
+is($q->size(), 4, 'jobs stay in queue');
+
+$q->next() foreach (1..4);
+is_deeply($q->status(), { size => 0, maxsize => 5, prioqueues => [
+    { prio => 1, size => 0, maxsize => 1 },
+    { prio => 5, size => 0, maxsize => 1 },
+    { prio => 7, size => 0, maxsize => 1 },
+    { prio => 8, size => 0, maxsize => 1 },
+    { prio => 9, size => 0, maxsize => 1 },
+] }, 'status of empty queue');
+
+is($q->reset_maxsize(), 0, 'reset maxsize');
+
+#-----------------------------------------------------------------------------
+# many jobs, compare with Tirex::Queue
+
+$q->reset();
+$pq->reset();
+srand(42);
+foreach my $n (1 .. 20000)
+{
+    my $z = int(rand(10));
+    my $job = Tirex::Job->new( metatile => Tirex::Metatile->new(map => 'test', x => int(rand(2**$z)), y => int(rand(2**$z)), z => $z), prio => int(rand(5)) + 1, request_time => 1000 );
+    $q->add($job);
+    $pq->add($job);
+    if ($n % 7 == 0)
+    {
+        my $j1 = $q->next();
+        my $j2 = $pq->next();
+        $q->remove($j2) if ($j1 != $j2);
+    }
+}
+is($q->size(), $pq->size(), 'same size as Tirex::Queue');
+
+my $same = 1;
+until ($pq->empty())
+{
+    my $j1 = $q->next();
+    my $j2 = $pq->next();
+    $same = 0 unless ($j1->hash_key() eq $j2->hash_key() && $j1->get_prio() == $j2->get_prio());
+}
+ok($same, 'same order as Tirex::Queue');
+ok($q->empty(), 'both empty');
+
+
+#-- THE END ------------------------------------------------------------------
@@ -0,0 +1,341 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * CPU and NUMA placement benchmark
+ *
+ */
+
+/**
+ * placebench
+ *
+ * Runs a number of worker processes with each of the placement policies
+ * of the tirex-backend-manager (see Tirex::Placement) and reports how many
+ * metatiles per second they manage together. The workers don't render
+ * anything, they do what dominates the memory traffic of a rendering
+ * process: reading features from a large in-memory data set (much larger
+ * than the CPU caches) and painting them into a metatile sized RGBA image.
+ *
+ * Usage: placebench [-w WORKERS] [-t SECONDS] [-m MB] [POLICY...]
+ *
+ * WORKERS defaults to the number of online CPUs, SECONDS to 5 and MB (the
+ * size of the data set of each worker) to 64. POLICY is "none", "spread"
+ * or "core" (default: all three). On a machine with a single NUMA node
+ * "spread" is the same as "none" with all CPUs allowed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+static const char *SYSFS = "/sys/devices/system";
+
+// metatile of 8x8 tiles of 256x256 RGBA pixels
+static const size_t METATILE_BYTES = 8 * 256 * 8 * 256 * 4;
+
+struct cpuinfo {
+    int node;
+    std::string core;
+};
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static std::string read_line(const std::string &filename)
+{
+    char buffer[4096];
+    FILE *f = fopen(filename.c_str(), "r");
+    if (!f) return "";
+    std::string line;
+    if (fgets(buffer, sizeof(buffer), f)) line = buffer;
+    fclose(f);
+    while (!line.empty() && (line.back() == '\n' || line.back() == ' ')) line.pop_back();
+    return line;
+}
+
+// parse CPU list in kernel format ("0-3,8,10-11")
+static std::vector<int> parse_cpulist(const std::string &list)
+{
+    std::vector<int> cpus;
+    const char *p = list.c_str();
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) break;
+        long last = first;
+        if (*end == '-') last = strtol(end + 1, &end, 10);
+        for (long c = first; c <= last; c++) cpus.push_back(static_cast<int>(c));
+        p = *end == ',' ? end + 1 : end;
+        if (*end != ',') break;
+    }
+    return cpus;
+}
+
+static std::string format_cpulist(const std::vector<int> &cpus)
+{
+    std::string list;
+    for (size_t i = 0; i < cpus.size(); )
+    {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+        if (!list.empty()) list += ",";
+        list += std::to_string(cpus[i]);
+        if (j > i) list += "-" + std::to_string(cpus[j]);
+        i = j + 1;
+    }
+    return list;
+}
+
+static std::map<int, cpuinfo> read_topology()
+{
+    std::map<int, int> node;
+    for (int n = 0; n < 1024; n++)
+    {
+        std::string list = read_line(std::string(SYSFS) + "/node/node" + std::to_string(n) + "/cpulist");
+        if (list.empty()) continue;
+        for (int cpu : parse_cpulist(list)) node[cpu] = n;
+    }
+
+    std::map<int, cpuinfo> topology;
+    std::vector<int> online = parse_cpulist(read_line(std::string(SYSFS) + "/cpu/online"));
+    if (online.empty()) for (long c = 0; c < sysconf(_SC_NPROCESSORS_ONLN); c++) online.push_back(static_cast<int>(c));
+    for (int cpu : online)
+    {
+        std::string dir = std::string(SYSFS) + "/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        std::string package = read_line(dir + "physical_package_id");
+        std::string core = read_line(dir + "core_id");
+        topology[cpu] = cpuinfo{ node.count(cpu) ? node[cpu] : 0, (package.empty() ? "0" : package) + ":" + (core.empty() ? std::to_string(cpu) : core) };
+    }
+    return topology;
+}
+
+/**
+ * Same placement as Tirex::Placement::place(). Returns the node of the
+ * placement or -1 if the worker isn't bound to a node.
+ */
+static int place(const std::map<int, cpuinfo> &topology, const std::string &policy, int index, std::vector<int> &cpus)
+{
+    cpus.clear();
+    std::map<int, std::vector<int>> by_node;
+    for (auto &c : topology) by_node[c.second.node].push_back(c.first);
+
+    if (policy == "none")
+    {
+        for (auto &c : topology) cpus.push_back(c.first);
+        return -1;
+    }
+
+    std::vector<int> nodes;
+    for (auto &n : by_node) nodes.push_back(n.first);
+
+    if (policy == "spread")
+    {
+        int node = nodes[index % nodes.size()];
+        cpus = by_node[node];
+        return node;
+    }
+
+    // core: cores of each node ordered by first CPU, taken round-robin from the nodes
+    std::vector<std::vector<std::vector<int>>> cores_by_node;
+    for (int node : nodes)
+    {
+        std::map<std::string, std::vector<int>> cores;
+        for (int cpu : by_node[node]) cores[topology.at(cpu).core].push_back(cpu);
+        std::vector<std::vector<int>> list;
+        for (auto &c : cores) list.push_back(c.second);
+        std::sort(list.begin(), list.end());
+        cores_by_node.push_back(list);
+    }
+
+    std::vector<std::vector<int>> cores;
+    for (size_t i = 0; ; i++)
+    {
+        bool more = false;
+        for (auto &list : cores_by_node)
+        {
+            if (i < list.size()) { cores.push_back(list[i]); more = true; }
+        }
+        if (!more) break;
+    }
+
+    cpus = cores[index % cores.size()];
+    return topology.at(cpus[0]).node;
+}
+
+static bool apply(const std::vector<int> &cpus, int node)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) return false;
+
+#ifdef SYS_set_mempolicy
+    if (node >= 0)
+    {
+        unsigned long nodemask[16] = { 0 };
+        nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_set_mempolicy, 1 /* MPOL_PREFERRED */, nodemask, sizeof(nodemask) * 8 + 1)) return false;
+    }
+#else
+    (void) node;
+#endif
+    return true;
+}
+
+/**
+ * The work of one worker: allocate the data set (after the placement, so
+ * that it ends up on the right node) and paint metatiles from random parts
+ * of it until the time is up. Returns the number of metatiles.
+ */
+static long work(size_t datasize, double seconds)
+{
+    std::vector<uint32_t> data(datasize / sizeof(uint32_t));
+    for (size_t i = 0; i < data.size(); i++) data[i] = static_cast<uint32_t>(i * 2654435761u);
+    std::vector<uint32_t> image(METATILE_BYTES / sizeof(uint32_t));
+
+    uint32_t seed = static_cast<uint32_t>(getpid());
+    long metatiles = 0;
+    double end = now() + seconds;
+    while (now() < end)
+    {
+        // 64 "features", each a run of data read from a random place and
+        // blended into a random row span of the image
+        for (int f = 0; f < 64; f++)
+        {
+            seed = seed * 1103515245u + 12345u;
+            size_t src = seed % (data.size() - 16384);
+            size_t dst = (seed >> 8) % (image.size() - 16384);
+            for (size_t i = 0; i < 16384; i++)
+            {
+                image[dst + i] = (image[dst + i] >> 1) + (data[src + i] >> 1);
+            }
+        }
+        // encoding reads the whole image once
+        uint32_t sum = 0;
+        for (size_t i = 0; i < image.size(); i++) sum += image[i];
+        image[sum % image.size()]++;
+        metatiles++;
+    }
+    return metatiles;
+}
+
+static double run(const std::map<int, cpuinfo> &topology, const std::string &policy, int workers, size_t datasize, double seconds)
+{
+    std::vector<pid_t> pids;
+    std::vector<int> fds;
+
+    for (int i = 0; i < workers; i++)
+    {
+        std::vector<int> cpus;
+        int node = place(topology, policy, i, cpus);
+
+        int fd[2];
+        if (pipe(fd))
+        {
+            perror("pipe");
+            exit(1);
+        }
+
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("fork");
+            exit(1);
+        }
+        if (pid == 0)
+        {
+            close(fd[0]);
+            if (!apply(cpus, node)) fprintf(stderr, "cannot apply placement to worker %d: %s\n", i, strerror(errno));
+            long metatiles = work(datasize, seconds);
+            if (write(fd[1], &metatiles, sizeof(metatiles)) != sizeof(metatiles)) _exit(1);
+            _exit(0);
+        }
+
+        if (policy != "none") printf("    worker %2d: cpus %-12s node %d\n", i, format_cpulist(cpus).c_str(), node);
+        close(fd[1]);
+        pids.push_back(pid);
+        fds.push_back(fd[0]);
+    }
+
+    long total = 0;
+    for (size_t i = 0; i < pids.size(); i++)
+    {
+        long metatiles = 0;
+        if (read(fds[i], &metatiles, sizeof(metatiles)) == sizeof(metatiles)) total += metatiles;
+        close(fds[i]);
+        waitpid(pids[i], NULL, 0);
+    }
+
+    return total / seconds;
+}
+
+int main(int argc, char **argv)
+{
+    std::map<int, cpuinfo> topology = read_topology();
+    int workers = static_cast<int>(topology.size());
+    double seconds = 5;
+    long mb = 64;
+
+    int c;
+    while ((c = getopt(argc, argv, "w:t:m:")) != -1)
+    {
+        switch (c)
+        {
+            case 'w': workers = atoi(optarg); break;
+            case 't': seconds = atof(optarg); break;
+            case 'm': mb = atol(optarg); break;
+            default:
+                fprintf(stderr, "Usage: placebench [-w WORKERS] [-t SECONDS] [-m MB] [POLICY...]\n");
+                return 2;
+        }
+    }
+
+    if (workers < 1 || seconds <= 0 || mb < 1)
+    {
+        fprintf(stderr, "placebench: WORKERS, SECONDS and MB must be positive\n");
+        return 2;
+    }
+
+    std::vector<std::string> policies;
+    for (int i = optind; i < argc; i++)
+    {
+        if (strcmp(argv[i], "none") && strcmp(argv[i], "spread") && strcmp(argv[i], "core"))
+        {
+            fprintf(stderr, "placebench: unknown policy '%s'\n", argv[i]);
+            return 2;
+        }
+        policies.push_back(argv[i]);
+    }
+    if (policies.empty()) policies = { "none", "spread", "core" };
+
+    std::map<int, int> nodes;
+    std::map<std::string, int> cores;
+    for (auto &cpu : topology) { nodes[cpu.second.node]++; cores[cpu.second.core]++; }
+    printf("%zu cpus, %zu cores, %zu numa nodes; %d workers with %ld MB each for %g s\n",
+        topology.size(), cores.size(), nodes.size(), workers, mb, seconds);
+
+    for (auto &policy : policies)
+    {
+        printf("%s:\n", policy.c_str());
+        double rate = run(topology, policy, workers, static_cast<size_t>(mb) * 1024 * 1024, seconds);
+        printf("  %-6s %10.1f metatiles/s\n", policy.c_str(), rate);
+    }
+
+    return 0;
+}
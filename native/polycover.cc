@@ -0,0 +1,132 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Metatiles covered by a polygon
+ *
+ */
+
+/**
+ * polycover
+ *
+ * Native version of the 'polygon' range of tirex-batch, installed as
+ * tirex-polycover. Reads a polygon from a GeoJSON or WKT file (see
+ * Coverage) and prints one init string for every span of metatiles
+ * covered on each zoom level:
+ *
+ *   map=NAME z=Z x=XMIN-XMAX y=Y
+ *
+ * x and y are tile coordinates (as in all tirex-batch init strings), so
+ * the output can be piped into tirex-batch directly. The rows are
+ * written while they are found, so even countries on zoom level 18 only
+ * need the memory for one row of metatiles.
+ *
+ * Usage: polycover [OPTIONS] -m MAP -z MINZ [-Z MAXZ] FILE
+ *
+ *   -m, --map=NAME         map name(s) for the init strings (required,
+ *                          several maps can be separated by commas)
+ *   -z, --minz=N           first zoom level (required)
+ *   -Z, --maxz=N           last zoom level (default: same as minz)
+ *   -c, --count            only print the number of metatiles per zoom
+ *                          level
+ *
+ * Returns 0 on success, 1 if the polygon can't be read and 2 on errors in
+ * the command line.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "coverage.h"
+#include "metatile.h"
+
+static void usage()
+{
+    fprintf(stderr, "Usage: polycover -m MAP -z MINZ [-Z MAXZ] [-c] FILE\n");
+    exit(2);
+}
+
+static long intArg(const char *arg, long min, long max)
+{
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value < min || value > max) usage();
+    return value;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        { "map",   required_argument, 0, 'm' },
+        { "minz",  required_argument, 0, 'z' },
+        { "maxz",  required_argument, 0, 'Z' },
+        { "count", no_argument,       0, 'c' },
+        { "help",  no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    std::string map;
+    int minz = -1;
+    int maxz = -1;
+    bool count = false;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "m:z:Z:ch", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'm': map = optarg; break;
+            case 'z': minz = intArg(optarg, 0, METATILE_MAX_ZOOM); break;
+            case 'Z': maxz = intArg(optarg, 0, METATILE_MAX_ZOOM); break;
+            case 'c': count = true; break;
+            default: usage();
+        }
+    }
+
+    if (map.empty() || minz < 0 || optind != argc - 1) usage();
+    if (maxz < 0) maxz = minz;
+    if (maxz < minz) usage();
+
+    Coverage coverage;
+    std::string error;
+    if (!coverage.readFile(argv[optind], error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    uint64_t total = 0;
+    for (int z = minz; z <= maxz; z++)
+    {
+        if (count)
+        {
+            uint64_t n = coverage.count(z, METATILE_COLUMNS, METATILE_ROWS);
+            printf("z%d: %llu\n", z, static_cast<unsigned long long>(n));
+            total += n;
+            continue;
+        }
+
+        uint64_t limit = (static_cast<uint64_t>(1) << z) - 1;
+        coverage.rows(z, METATILE_COLUMNS, METATILE_ROWS, [&](uint32_t row, const std::vector<coverage_span>& spans) {
+            for (auto itr = spans.begin(); itr != spans.end(); ++itr)
+            {
+                uint64_t xmin = static_cast<uint64_t>(itr->xmin) * METATILE_COLUMNS;
+                uint64_t xmax = std::min(limit, static_cast<uint64_t>(itr->xmax) * METATILE_COLUMNS + METATILE_COLUMNS - 1);
+                printf("map=%s z=%d x=%llu-%llu y=%llu\n", map.c_str(), z,
+                       static_cast<unsigned long long>(xmin), static_cast<unsigned long long>(xmax),
+                       static_cast<unsigned long long>(row) * METATILE_ROWS);
+            }
+        });
+    }
+
+    if (count)
+    {
+        printf("total: %llu\n", static_cast<unsigned long long>(total));
+    }
+
+    return 0;
+}
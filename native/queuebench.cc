@@ -0,0 +1,70 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Native job queue
+ *
+ */
+
+/**
+ * queuebench
+ *
+ * Tests queue filling and emptying speed of the native job queue. This
+ * does the same as test/queue_speed_test.pl does for Tirex::Queue, so
+ * the numbers can be compared directly.
+ *
+ * Usage: queuebench [NUMJOBS [MAXZOOM [MAXPRIO]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "jobqueue.h"
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main(int argc, char **argv)
+{
+    // changes these variables as needed (or use the command line)
+    int numjobs = argc > 1 ? atoi(argv[1]) : 100000;
+    int maxzoom = argc > 2 ? atoi(argv[2]) : 14;
+    int maxprio = argc > 3 ? atoi(argv[3]) : 3;
+
+    JobQueue q;
+    uint16_t map = q.mapId("test");
+    void *replaced;
+
+    double t0 = now();
+
+    printf("filling queue...\n");
+
+    for (int n = 0; n < numjobs; n++)
+    {
+        queue_key key;
+        key.z = rand() % maxzoom;
+        uint32_t limit = 1u << key.z;
+        // metatiles are always aligned to 8x8 tiles, as in Tirex::Metatile
+        key.x = (rand() % limit) & ~7u;
+        key.y = (rand() % limit) & ~7u;
+        key.map = map;
+        q.add(key, rand() % maxprio + 1, time(NULL), 0, NULL, &replaced);
+    }
+
+    printf("queue filled with %lu jobs of %d added in %f seconds\n", static_cast<unsigned long>(q.size()), numjobs, now() - t0);
+
+    t0 = now();
+
+    while (!q.empty())
+    {
+        q.next();
+    }
+
+    printf("queue empty again after %f seconds\n", now() - t0);
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * SHA-256 and HMAC-SHA256
+ *
+ */
+
+/**
+ * Sha256, HmacSha256
+ *
+ * Plain implementation of SHA-256 (FIPS 180-4) and HMAC (RFC 2104), used
+ * to authenticate the frames of the tile sync protocol without linking
+ * against a crypto library. Data can be added piece by piece, digest()
+ * returns the 32 byte binary digest and may only be called once.
+ */
+
+#ifndef sha256_included
+#define sha256_included
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#define SHA256_SIZE 32
+
+class Sha256
+{
+    public:
+
+    Sha256();
+
+    void update(const void *data, size_t len);
+    std::string digest();
+
+    private:
+
+    void transform(const unsigned char *block);
+
+    uint32_t mState[8];
+    uint64_t mLength;
+    unsigned char mBuffer[64];
+    size_t mBufferLen;
+};
+
+class HmacSha256
+{
+    public:
+
+    HmacSha256(const std::string& key);
+
+    void update(const void *data, size_t len) { mInner.update(data, len); }
+    std::string digest();
+
+    private:
+
+    std::string mOuterPad;
+    Sha256 mInner;
+};
+
+std::string hmac_sha256(const std::string& key, const std::string& data);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Status segment
+ *
+ */
+
+/**
+ * statusjson
+ *
+ * Reads the binary status segment of the running tirex-master and prints
+ * it as JSON. This is the same JSON that "tirex-status --raw" prints, but
+ * without needing Perl.
+ *
+ * Usage: statusjson
+ */
+
+#include <stdio.h>
+
+#include "statussegment.h"
+
+int main()
+{
+    StatusSegment segment;
+
+    if (!segment.attach())
+    {
+        fprintf(stderr, "Can't connect to shared memory. Is the tirex-master running?\n");
+        return 1;
+    }
+
+    std::string json = segment.toJson();
+    if (json.empty())
+    {
+        fprintf(stderr, "Can't read from shared memory. Did the tirex-master die?\n");
+        return 1;
+    }
+
+    fputs(json.c_str(), stdout);
+    return 0;
+}
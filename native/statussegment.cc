@@ -0,0 +1,320 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Status segment
+ *
+ */
+
+#include "statussegment.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+StatusSegment::StatusSegment(key_t key) :
+    mKey(key),
+    mId(-1),
+    mpSegment(NULL)
+{
+}
+
+StatusSegment::~StatusSegment()
+{
+    detach();
+}
+
+void StatusSegment::detach()
+{
+    if (mpSegment) shmdt(mpSegment);
+    mpSegment = NULL;
+    mId = -1;
+}
+
+/**
+ * Attach to the status segment created by the master. Returns false if
+ * there is no segment or it doesn't have the expected layout.
+ */
+bool StatusSegment::attach()
+{
+    detach();
+
+    int id = shmget(mKey, 0, 0);
+    if (id < 0) return false;
+
+    void *addr = shmat(id, NULL, 0);
+    if (addr == reinterpret_cast<void *>(-1)) return false;
+
+    status_segment *segment = static_cast<status_segment *>(addr);
+    if (segment->header.magic != STATUS_MAGIC || segment->header.version != STATUS_VERSION || segment->header.size != sizeof(status_segment))
+    {
+        shmdt(addr);
+        return false;
+    }
+
+    mId = id;
+    mpSegment = segment;
+    return true;
+}
+
+/**
+ * The master creates a new segment whenever it is started. Re-attach if
+ * the segment we are attached to isn't the current one any more.
+ */
+bool StatusSegment::checkSegment()
+{
+    int id = shmget(mKey, 0, 0);
+    if (id >= 0 && id == mId) return true;
+    return attach();
+}
+
+template <typename T>
+static bool readSection(const T *src, T& dst)
+{
+    for (int tries = 0; tries < 1000; tries++)
+    {
+        uint32_t before = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+        if (before & 1)
+        {
+            sched_yield();
+            continue;
+        }
+        memcpy(&dst, src, sizeof(T));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&src->seq, __ATOMIC_RELAXED) == before) return true;
+    }
+    return false;
+}
+
+bool StatusSegment::readMaster(status_master& master) const
+{
+    return mpSegment && readSection(&mpSegment->master, master);
+}
+
+bool StatusSegment::readWorker(unsigned int slot, status_worker& worker) const
+{
+    return mpSegment && slot < STATUS_MAX_WORKERS && readSection(&mpSegment->workers[slot], worker);
+}
+
+bool StatusSegment::readBlob(std::string& config, std::string& profile) const
+{
+    if (!mpSegment) return false;
+
+    status_blob *blob = new status_blob;
+    bool ok = readSection(&mpSegment->blob, *blob);
+    if (ok)
+    {
+        uint32_t length = blob->length < STATUS_BLOB_SIZE ? blob->length : STATUS_BLOB_SIZE;
+        std::string data(blob->data, length);
+        size_t sep = data.find('\0');
+        config  = data.substr(0, sep);
+        profile = sep == std::string::npos ? "" : data.substr(sep + 1);
+    }
+    delete blob;
+    return ok;
+}
+
+/**
+ * Write a worker slot. The seq field of worker is ignored. Returns false
+ * if the master isn't running.
+ */
+bool StatusSegment::writeWorker(unsigned int slot, status_worker& worker)
+{
+    if (slot >= STATUS_MAX_WORKERS || !checkSegment()) return false;
+
+    status_worker *dst = &mpSegment->workers[slot];
+
+    // make sure we start from an even value, even if a previous writer
+    // of this slot died in the middle of an update
+    uint32_t seq = (__atomic_load_n(&dst->seq, __ATOMIC_RELAXED) + 1) & ~1u;
+    __atomic_store_n(&dst->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(reinterpret_cast<char *>(dst) + offsetof(status_worker, pid), reinterpret_cast<char *>(&worker) + offsetof(status_worker, pid), sizeof(status_worker) - offsetof(status_worker, pid));
+    __atomic_store_n(&dst->seq, seq + 2, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+static std::string jsonString(const char *str, size_t maxlen)
+{
+    std::string result = "\"";
+    for (size_t i = 0; i < maxlen && str[i]; i++)
+    {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\')
+        {
+            result += '\\';
+            result += c;
+        }
+        else if (c < 0x20)
+        {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            result += buffer;
+        }
+        else
+        {
+            result += c;
+        }
+    }
+    return result + "\"";
+}
+
+template <typename T>
+static std::string jsonArray(const T *values, unsigned int count)
+{
+    std::string result = "[";
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (i) result += ",";
+        result += std::to_string(values[i]);
+    }
+    return result + "]";
+}
+
+/**
+ * Status as JSON in the same structure that the master used to write
+ * into shared memory, so that existing tools can use it. Worker slots
+ * are added as "workers".
+ */
+std::string StatusSegment::toJson() const
+{
+    status_master *m = new status_master;
+    if (!readMaster(*m))
+    {
+        delete m;
+        return "";
+    }
+
+    std::string config, profile;
+    readBlob(config, profile);
+
+    std::string json = "{\"pid\":" + std::to_string(m->pid) +
+                       ",\"updated\":" + std::to_string(m->updated) +
+                       ",\"started\":" + std::to_string(m->started);
+
+    json += ",\"queue\":{\"size\":" + std::to_string(m->queue_size) + ",\"maxsize\":" + std::to_string(m->queue_maxsize) + ",\"prioqueues\":[";
+    for (unsigned int i = 0; i < m->num_prios && i < STATUS_MAX_PRIOS; i++)
+    {
+        const status_prio& p = m->prios[i];
+        if (i) json += ",";
+        json += "{\"prio\":" + std::to_string(p.prio) + ",\"size\":" + std::to_string(p.size) + ",\"maxsize\":" + std::to_string(p.maxsize);
+        if (p.has_age) json += ",\"age_first\":" + std::to_string(p.age_first) + ",\"age_last\":" + std::to_string(p.age_last);
+        json += "}";
+    }
+    json += "]}";
+
+    char load[32];
+    snprintf(load, sizeof(load), "%g", m->load);
+    json += ",\"rm\":{\"load\":" + std::string(load) + ",\"num_rendering\":" + std::to_string(m->num_rendering);
+
+    std::string count_rendered, sum_render_time, max_render_time;
+    for (unsigned int i = 0; i < m->num_maps && i < STATUS_MAX_MAPS; i++)
+    {
+        const status_map& map = m->maps[i];
+        unsigned int zooms = map.zooms < STATUS_MAX_ZOOMS ? map.zooms : STATUS_MAX_ZOOMS;
+        std::string name = jsonString(map.name, sizeof(map.name)) + ":";
+        if (i)
+        {
+            count_rendered += ",";
+            sum_render_time += ",";
+            max_render_time += ",";
+        }
+        count_rendered  += name + jsonArray(map.count_rendered, zooms);
+        sum_render_time += name + jsonArray(map.sum_render_time, zooms);
+        max_render_time += name + jsonArray(map.max_render_time, zooms);
+    }
+    json += ",\"stats\":{\"count_requested\":" + std::to_string(m->count_requested) +
+            ",\"count_expired\":" + std::to_string(m->count_expired) +
+            ",\"count_timeouted\":" + std::to_string(m->count_timeouted) +
+            ",\"count_error\":" + std::to_string(m->count_error) +
+            ",\"count_rendered\":{" + count_rendered + "}" +
+            ",\"sum_render_time\":{" + sum_render_time + "}" +
+            ",\"max_render_time\":{" + max_render_time + "}}";
+
+    json += ",\"layer_profile\":" + (profile.empty() ? std::string("{}") : profile);
+
+    if (m->has_psi)
+    {
+        char pressure[160];
+        snprintf(pressure, sizeof(pressure), ",\"pressure\":{\"cpu\":{\"10\":%g},\"memory\":{\"10\":%g},\"io\":{\"10\":%g}}",
+                 m->psi_cpu / 100.0, m->psi_memory / 100.0, m->psi_io / 100.0);
+        json += pressure;
+    }
+
+    static const char *limits[] = STATUS_BUCKET_LIMITS;
+    json += ",\"buckets\":[";
+    for (unsigned int i = 0; i < m->num_buckets && i < STATUS_MAX_BUCKETS; i++)
+    {
+        const status_bucket& b = m->buckets[i];
+        char maxload[32];
+        snprintf(maxload, sizeof(maxload), "%g", b.maxload);
+        if (i) json += ",";
+        json += "{\"name\":" + jsonString(b.name, sizeof(b.name)) +
+                ",\"minprio\":" + std::to_string(b.minprio) +
+                ",\"maxprio\":" + std::to_string(b.maxprio) +
+                ",\"numproc\":" + std::to_string(b.numproc) +
+                ",\"maxproc\":" + std::to_string(b.maxproc) +
+                ",\"maxload\":" + maxload +
+                ",\"active\":" + std::to_string(static_cast<unsigned int>(b.active)) +
+                ",\"can_render\":" + (b.can_render ? "true" : "false") +
+                ",\"limited_by\":\"" + (b.limited_by < sizeof(limits) / sizeof(limits[0]) ? limits[b.limited_by] : "") + "\"}";
+    }
+    json += "]";
+
+    json += ",\"rendering\":[";
+    for (unsigned int i = 0; i < m->num_rendering && i < STATUS_MAX_RENDERING; i++)
+    {
+        const status_rendering& r = m->rendering[i];
+        if (i) json += ",";
+        json += "{\"map\":" + jsonString(r.map, sizeof(r.map)) +
+                ",\"x\":" + std::to_string(r.x) +
+                ",\"y\":" + std::to_string(r.y) +
+                ",\"z\":" + std::to_string(r.z) +
+                ",\"prio\":" + std::to_string(r.prio) +
+                ",\"age\":" + std::to_string(r.age) + "}";
+    }
+    json += "]}";
+
+    json += ",\"workers\":[";
+    bool first = true;
+    for (unsigned int slot = 0; slot < STATUS_MAX_WORKERS; slot++)
+    {
+        status_worker w;
+        if (!readWorker(slot, w) || w.state == STATUS_WORKER_FREE) continue;
+        if (!first) json += ",";
+        first = false;
+        json += "{\"slot\":" + std::to_string(slot) +
+                ",\"pid\":" + std::to_string(w.pid) +
+                ",\"renderer\":" + jsonString(w.renderer, sizeof(w.renderer)) +
+                ",\"state\":\"" + (w.state == STATUS_WORKER_RENDERING ? "rendering" : "idle") + "\"" +
+                ",\"updated\":" + std::to_string(w.updated) +
+                ",\"rendered\":" + std::to_string(w.rendered) +
+                ",\"errors\":" + std::to_string(w.errors) +
+                ",\"rss\":" + std::to_string(w.rss);
+        if (w.state == STATUS_WORKER_RENDERING)
+        {
+            json += ",\"map\":" + jsonString(w.map, sizeof(w.map)) +
+                    ",\"x\":" + std::to_string(w.x) +
+                    ",\"y\":" + std::to_string(w.y) +
+                    ",\"z\":" + std::to_string(w.z) +
+                    ",\"job_started\":" + std::to_string(w.job_started);
+        }
+        json += "}";
+    }
+    json += "]";
+
+    // the config part of the blob is a JSON object with renderers, maps
+    // and sources, its members are added at the top level
+    size_t open = config.find('{');
+    size_t close = config.rfind('}');
+    if (open != std::string::npos && close != std::string::npos && close > open + 1)
+    {
+        json += "," + config.substr(open + 1, close - open - 1);
+    }
+
+    delete m;
+    return json + "}\n";
+}
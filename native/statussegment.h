@@ -0,0 +1,203 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Status segment
+ *
+ */
+
+/**
+ * StatusSegment
+ *
+ * The master keeps its status in a SysV shared memory segment with a fixed
+ * binary layout (see Tirex::Status for the writer in the master). Every
+ * backend worker gets a slot of its own in the same segment, which it
+ * updates whenever it starts or finishes a job.
+ *
+ * Each section (master, blob and every worker slot) has exactly one
+ * writer and is protected by its own sequence counter: the writer makes
+ * the counter odd, changes the data and makes it even again. Readers copy
+ * the section and retry if the counter was odd or changed while copying.
+ * Nobody ever waits for a lock.
+ *
+ * The blob section holds the parts of the status that don't fit into a
+ * fixed layout (renderer and map config, source counters, layer
+ * profiles) as two JSON strings separated by a NUL byte. The master only
+ * rewrites it if the content changed. If it doesn't fit, the master leaves
+ * out whole sections, so it is always valid JSON.
+ *
+ * The layout must be kept in sync with lib/Tirex/Status.pm. All numbers
+ * are in host byte order.
+ */
+
+#ifndef statussegment_included
+#define statussegment_included
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+
+#define STATUS_SHMKEY        0x00002468
+#define STATUS_MAGIC         0x54535854   // "TXST"
+#define STATUS_VERSION       2
+
+#define STATUS_MAX_PRIOS     32
+#define STATUS_MAX_BUCKETS   16
+#define STATUS_MAX_RENDERING 256
+#define STATUS_MAX_MAPS      32
+#define STATUS_MAX_ZOOMS     32
+#define STATUS_MAX_WORKERS   128
+#define STATUS_BLOB_SIZE     65536
+
+#define STATUS_WORKER_FREE      0
+#define STATUS_WORKER_IDLE      1
+#define STATUS_WORKER_RENDERING 2
+
+// why a bucket can't render (status_bucket.limited_by), see
+// Tirex::Manager::Bucket::limit()
+#define STATUS_BUCKET_LIMITS { "", "inactive", "maxproc", "load", "psi_cpu", "psi_memory", "psi_io", "memory", "cost" }
+
+struct status_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t max_prios;
+    uint32_t max_buckets;
+    uint32_t max_rendering;
+    uint32_t max_maps;
+    uint32_t max_workers;
+    uint32_t blob_size;
+    char pad[28];
+};
+
+struct status_prio {
+    uint32_t prio;
+    uint32_t size;
+    uint32_t maxsize;
+    uint32_t has_age;
+    int32_t age_first;
+    int32_t age_last;
+};
+
+struct status_bucket {
+    char name[32];
+    uint32_t minprio;
+    uint32_t maxprio;
+    uint32_t numproc;
+    uint32_t maxproc;
+    double maxload;
+    uint8_t active;
+    uint8_t can_render;
+    uint8_t limited_by;
+    char pad[5];
+};
+
+struct status_rendering {
+    char map[32];
+    uint32_t x;
+    uint32_t y;
+    uint32_t z;
+    uint32_t prio;
+    int64_t age;
+};
+
+struct status_map {
+    char name[32];
+    uint32_t zooms;
+    uint32_t pad;
+    uint32_t count_rendered[STATUS_MAX_ZOOMS];
+    uint32_t max_render_time[STATUS_MAX_ZOOMS];
+    uint64_t sum_render_time[STATUS_MAX_ZOOMS];
+};
+
+struct status_master {
+    uint32_t seq;
+    uint32_t pid;
+    int64_t updated;
+    int64_t started;
+    double load;
+    uint32_t queue_size;
+    uint32_t queue_maxsize;
+    uint32_t num_prios;
+    uint32_t num_buckets;
+    uint32_t num_rendering;
+    uint32_t num_maps;
+    uint64_t count_requested;
+    uint64_t count_expired;
+    uint64_t count_timeouted;
+    uint64_t count_error;
+    uint16_t psi_cpu;       // PSI "some" avg10 in hundredths of a percent
+    uint16_t psi_memory;
+    uint16_t psi_io;
+    uint16_t has_psi;
+    status_prio prios[STATUS_MAX_PRIOS];
+    status_bucket buckets[STATUS_MAX_BUCKETS];
+    status_rendering rendering[STATUS_MAX_RENDERING];
+    status_map maps[STATUS_MAX_MAPS];
+};
+
+struct status_blob {
+    uint32_t seq;
+    uint32_t length;
+    char data[STATUS_BLOB_SIZE];
+};
+
+struct status_worker {
+    uint32_t seq;
+    uint32_t pid;
+    char renderer[32];
+    char map[32];
+    uint32_t x;
+    uint32_t y;
+    uint32_t z;
+    uint32_t state;
+    int64_t job_started;  // milliseconds since the epoch
+    int64_t updated;      // seconds since the epoch
+    uint64_t rendered;
+    uint64_t errors;
+    uint64_t rss;         // kB
+};
+
+struct status_segment {
+    status_header header;
+    status_master master;
+    status_blob blob;
+    status_worker workers[STATUS_MAX_WORKERS];
+};
+
+static_assert(sizeof(status_header)    ==    64, "status_header layout");
+static_assert(sizeof(status_prio)      ==    24, "status_prio layout");
+static_assert(sizeof(status_bucket)    ==    64, "status_bucket layout");
+static_assert(sizeof(status_rendering) ==    56, "status_rendering layout");
+static_assert(sizeof(status_map)       ==   552, "status_map layout");
+static_assert(sizeof(status_master)    == 33888, "status_master layout");
+static_assert(sizeof(status_blob)      == 65544, "status_blob layout");
+static_assert(sizeof(status_worker)    ==   128, "status_worker layout");
+
+class StatusSegment
+{
+    public:
+
+    StatusSegment(key_t key = STATUS_SHMKEY);
+    ~StatusSegment();
+
+    bool attach();
+    bool attached() const { return mpSegment != NULL; }
+
+    bool readMaster(status_master& master) const;
+    bool readWorker(unsigned int slot, status_worker& worker) const;
+    bool readBlob(std::string& config, std::string& profile) const;
+    bool writeWorker(unsigned int slot, status_worker& worker);
+
+    std::string toJson() const;
+
+    private:
+
+    bool checkSegment();
+    void detach();
+
+    key_t mKey;
+    int mId;
+    status_segment *mpSegment;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#!/bin/bash
+#
+#  Tirex Tile Rendering System
+#
+#  synctest.sh - run tilesyncd and tilesyncrecv against each other on
+#                localhost and check that metatiles arrive
+#
+#  Usage: ./synctest.sh [NUMTILES]
+#
+
+set -e
+
+NUMTILES=${1:-200}
+UDP_PORT=$((20000 + RANDOM % 10000))
+TCP_PORT=$((UDP_PORT + 1))
+
+DIR=$(mktemp -d /tmp/tirex-synctest.XXXXXX)
+SRC=$DIR/src/demo
+DST=$DIR/dst
+
+cleanup() {
+    kill $SENDER $RECEIVER 2>/dev/null || true
+    rm -rf $DIR
+}
+trap cleanup EXIT
+
+mkdir -p $DIR/config/renderer/test $SRC $DST
+cat >$DIR/config/tirex.conf <<EOF
+sync_to_host=127.0.0.1:$TCP_PORT
+syncd_udp_port=$UDP_PORT
+syncd_aggregate_delay=1
+syncd_batch_size=50
+syncd_secret_file=$DIR/secret
+EOF
+head -c 32 /dev/urandom | od -An -tx1 | tr -d ' \n' >$DIR/secret
+echo "name=test" >$DIR/config/renderer/test.conf
+printf "name=demo\ntiledir=$SRC\ntiledir_depth=3\n" >$DIR/config/renderer/test/demo.conf
+
+./tilesyncrecv -c $DIR/config -p $TCP_PORT -r $DST -a 127.0.0.1 -d 2>$DIR/receiver.log &
+RECEIVER=$!
+./tilesyncd -c $DIR/config -d 2>$DIR/sender.log &
+SENDER=$!
+sleep 1
+
+# metatile x=8*i, y=0 on zoom 12, depth 3: z/hash2/hash1/hash0.meta
+path() {
+    local x=$1
+    echo "12/$(( ((x >> 8) & 0x0f) << 4 ))/$(( ((x >> 4) & 0x0f) << 4 ))/$(( (x & 0x0f) << 4 )).meta"
+}
+
+# the printf builtin writes every line separately, cat sends one datagram
+send() {
+    printf "id=1\nmap=demo\nresult=ok\ntype=metatile_render_request\nx=$1\ny=0\nz=12\n" | cat >/dev/udp/127.0.0.1/$UDP_PORT
+}
+
+for i in $(seq 0 $((NUMTILES - 1))); do
+    x=$((i * 8))
+    f=$SRC/$(path $x)
+    mkdir -p $(dirname $f)
+    head -c $((100 + i)) /dev/urandom >$f
+    touch -d "@$((1000000000 + i))" $f
+    send $x
+    send $x    # repeats are only sent once
+done
+
+# delete one metatile, the receiver should delete it, too
+rm $SRC/$(path 0)
+send 0
+
+for i in $(seq 1 30); do
+    n=$(find $DST -name '*.meta' | wc -l)
+    [ "$n" -ge $((NUMTILES - 1)) ] && [ ! -e $DST$SRC/$(path 0) ] && break
+    sleep 1
+done
+
+errors=0
+for i in $(seq 1 $((NUMTILES - 1))); do
+    f=$(path $((i * 8)))
+    if ! cmp -s $SRC/$f $DST$SRC/$f; then
+        echo "missing or different: $f"
+        errors=$((errors + 1))
+    elif [ "$(stat -c %Y $SRC/$f)" != "$(stat -c %Y $DST$SRC/$f)" ]; then
+        echo "wrong mtime: $f"
+        errors=$((errors + 1))
+    fi
+done
+if [ -e $DST$SRC/$(path 0) ]; then
+    echo "deleted metatile still there"
+    errors=$((errors + 1))
+fi
+if [ -n "$(find $DST -name '*.tmp')" ]; then
+    echo "tmp files left over"
+    errors=$((errors + 1))
+fi
+
+# a sender without the secret is rejected
+printf 'TXSY\x01\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00' >/dev/tcp/127.0.0.1/$TCP_PORT || true
+sleep 1
+if ! grep -q "sender doesn't authenticate" $DIR/receiver.log; then
+    echo "unauthenticated sender not rejected"
+    errors=$((errors + 1))
+fi
+
+if [ $errors -gt 0 ]; then
+    echo "sender log:"; cat $DIR/sender.log
+    echo "receiver log:"; cat $DIR/receiver.log
+    echo "FAILED ($errors errors)"
+    exit 1
+fi
+
+echo "OK ($NUMTILES metatiles)"
@@ -0,0 +1,449 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Tile directory scanner
+ *
+ */
+
+#include "tiledir.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+const int64_t tiledir_age_buckets[TILEDIR_AGE_BUCKETS - 1] = {
+    3600,           // hour
+    86400,          // day
+    7 * 86400,      // week
+    30 * 86400,     // month
+    365 * 86400     // year
+};
+
+tiledir_zoom_stats::tiledir_zoom_stats() :
+    count(0),
+    countempty(0),
+    minage(999999999),
+    maxage(0),
+    sumage(0),
+    minsize(999999999),
+    maxsize(0),
+    sumsize(0),
+    minblocks(999999999),
+    maxblocks(0),
+    sumblocks(0)
+{
+    memset(agehist, 0, sizeof(agehist));
+}
+
+void tiledir_zoom_stats::add(int64_t age, uint64_t size, uint64_t blocks)
+{
+    minage    = std::min(minage, age);
+    maxage    = std::max(maxage, age);
+    minsize   = std::min(minsize, size);
+    maxsize   = std::max(maxsize, size);
+    minblocks = std::min(minblocks, blocks);
+    maxblocks = std::max(maxblocks, blocks);
+    sumage    += age;
+    sumsize   += size;
+    sumblocks += blocks;
+    count++;
+    if (size == TILEDIR_EMPTY_TILE_SIZE) countempty++;
+
+    int bucket = 0;
+    while (bucket < TILEDIR_AGE_BUCKETS - 1 && age >= tiledir_age_buckets[bucket]) bucket++;
+    agehist[bucket]++;
+}
+
+void tiledir_zoom_stats::merge(const tiledir_zoom_stats& other)
+{
+    if (other.count == 0) return;
+
+    minage    = std::min(minage, other.minage);
+    maxage    = std::max(maxage, other.maxage);
+    minsize   = std::min(minsize, other.minsize);
+    maxsize   = std::max(maxsize, other.maxsize);
+    minblocks = std::min(minblocks, other.minblocks);
+    maxblocks = std::max(maxblocks, other.maxblocks);
+    sumage    += other.sumage;
+    sumsize   += other.sumsize;
+    sumblocks += other.sumblocks;
+    count     += other.count;
+    countempty += other.countempty;
+    for (int i = 0; i < TILEDIR_AGE_BUCKETS; i++) agehist[i] += other.agehist[i];
+}
+
+tiledir_options::tiledir_options() :
+    depth(5),
+    minz(0),
+    maxz(19),
+    threads(4),
+    list(NULL),
+    validate(false)
+{
+}
+
+static bool isNumber(const char *str, size_t len)
+{
+    if (len == 0) return false;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (str[i] < '0' || str[i] > '9') return false;
+    }
+    return true;
+}
+
+/**
+ * Directory stack shared by all threads. The scan is finished when the
+ * stack is empty and no thread is working on a directory (which could
+ * add more).
+ */
+struct TiledirScanner::work {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::pair<std::string, int> > dirs;
+    unsigned int active;
+
+    work() : active(0) { }
+};
+
+struct TiledirScanner::result {
+    std::vector<tiledir_zoom_stats> stats;
+    std::string list;       // lines not yet written to the list file
+    std::vector<std::string> corrupt;
+
+    result() : stats(TILEDIR_MAX_ZOOM + 1) { }
+};
+
+TiledirScanner::TiledirScanner(const tiledir_options& options) :
+    mOptions(options),
+    mNow(0),
+    mRootFd(-1),
+    mpWork(NULL),
+    mErrors(false),
+    mStats(TILEDIR_MAX_ZOOM + 1)
+{
+    while (mOptions.dir.size() > 1 && mOptions.dir[mOptions.dir.size() - 1] == '/') mOptions.dir.erase(mOptions.dir.size() - 1);
+    if (mOptions.minz < 0) mOptions.minz = 0;
+    if (mOptions.maxz > TILEDIR_MAX_ZOOM) mOptions.maxz = TILEDIR_MAX_ZOOM;
+    if (mOptions.threads < 1) mOptions.threads = 1;
+}
+
+void TiledirScanner::error(const std::string& message)
+{
+    // stdio locks the stream for every call, so messages are not mixed up
+    fprintf(stderr, "%s\n", message.c_str());
+    mErrors = true;
+}
+
+/**
+ * Scan the tile directory. Returns false if it can't be opened at all,
+ * problems found while scanning are written to STDERR and can be checked
+ * with errors() afterwards.
+ */
+bool TiledirScanner::scan()
+{
+    mRootFd = open(mOptions.dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (mRootFd < 0)
+    {
+        error("Can't open tile directory " + mOptions.dir + ": " + strerror(errno));
+        return false;
+    }
+
+    mNow = time(NULL);
+
+    std::vector<result> results(mOptions.threads);
+
+    // one zoom level after the other, so that the list is sorted by zoom
+    // level like the one written by the Perl version
+    for (int z = mOptions.minz; z <= mOptions.maxz; z++)
+    {
+        struct stat st;
+        std::string path = "/" + std::to_string(z);
+        if (fstatat(mRootFd, path.c_str() + 1, &st, 0) < 0 || !S_ISDIR(st.st_mode)) continue;
+
+        work w;
+        w.dirs.push_back(std::make_pair(path, 1));
+        mpWork = &w;
+
+        std::vector<std::thread> threads;
+        for (unsigned int i = 0; i < mOptions.threads; i++)
+        {
+            threads.push_back(std::thread(&TiledirScanner::worker, this, std::ref(results[i])));
+        }
+        for (unsigned int i = 0; i < threads.size(); i++)
+        {
+            threads[i].join();
+        }
+
+        mpWork = NULL;
+
+        for (unsigned int i = 0; i < results.size(); i++)
+        {
+            flushList(results[i]);
+        }
+    }
+
+    close(mRootFd);
+    mRootFd = -1;
+
+    for (unsigned int i = 0; i < results.size(); i++)
+    {
+        for (int z = 0; z <= TILEDIR_MAX_ZOOM; z++)
+        {
+            mStats[z].merge(results[i].stats[z]);
+        }
+        mCorrupt.insert(mCorrupt.end(), results[i].corrupt.begin(), results[i].corrupt.end());
+    }
+    std::sort(mCorrupt.begin(), mCorrupt.end());
+
+    return true;
+}
+
+/**
+ * Write the lines collected by a thread to the list file.
+ */
+void TiledirScanner::flushList(result& r)
+{
+    if (r.list.empty()) return;
+
+    std::lock_guard<std::mutex> lock(mListMutex);
+    if (fwrite(r.list.data(), 1, r.list.size(), mOptions.list) != r.list.size())
+    {
+        error(std::string("Can't write list: ") + strerror(errno));
+    }
+    r.list.clear();
+}
+
+void TiledirScanner::worker(result& r)
+{
+    std::unique_lock<std::mutex> lock(mpWork->mutex);
+
+    while (true)
+    {
+        while (mpWork->dirs.empty() && mpWork->active > 0)
+        {
+            mpWork->cond.wait(lock);
+        }
+        if (mpWork->dirs.empty()) break;
+
+        std::pair<std::string, int> dir = mpWork->dirs.back();
+        mpWork->dirs.pop_back();
+        mpWork->active++;
+
+        lock.unlock();
+        scanDir(dir.first, dir.second, r);
+        lock.lock();
+
+        mpWork->active--;
+        mpWork->cond.notify_all();
+    }
+}
+
+/**
+ * Find out what a directory entry is if the file system didn't tell us.
+ * Symlinks are followed like the Perl version did.
+ */
+static unsigned char entryType(int dirfd, const char *name)
+{
+    struct stat st;
+    if (fstatat(dirfd, name, &st, 0) < 0) return DT_UNKNOWN;
+    if (S_ISDIR(st.st_mode)) return DT_DIR;
+    if (S_ISREG(st.st_mode)) return DT_REG;
+    return DT_UNKNOWN;
+}
+
+void TiledirScanner::scanDir(const std::string& path, int level, result& r)
+{
+    int dirfd = openat(mRootFd, path.c_str() + 1, O_RDONLY | O_DIRECTORY);
+    if (dirfd < 0)
+    {
+        error("Can't open directory: " + path);
+        return;
+    }
+
+    std::vector<std::pair<std::string, unsigned char> > entries;
+
+#ifdef SYS_getdents64
+    struct linux_dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    char buffer[32768];
+    while (true)
+    {
+        long len = syscall(SYS_getdents64, dirfd, buffer, sizeof(buffer));
+        if (len < 0)
+        {
+            error("Can't read directory: " + path);
+            break;
+        }
+        if (len == 0) break;
+
+        for (long pos = 0; pos < len; )
+        {
+            const linux_dirent64 *d = reinterpret_cast<const linux_dirent64 *>(buffer + pos);
+            pos += d->d_reclen;
+            if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..")) continue;
+            entries.push_back(std::make_pair(std::string(d->d_name), d->d_type));
+        }
+    }
+#else
+    DIR *dir = fdopendir(dup(dirfd));
+    if (dir)
+    {
+        while (struct dirent *d = readdir(dir))
+        {
+            if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..")) continue;
+            entries.push_back(std::make_pair(std::string(d->d_name), d->d_type));
+        }
+        closedir(dir);
+    }
+#endif
+
+    std::vector<std::pair<std::string, int> > subdirs;
+
+    for (unsigned int i = 0; i < entries.size(); i++)
+    {
+        const char *name = entries[i].first.c_str();
+        unsigned char type = entries[i].second;
+        std::string entrypath = path + "/" + name;
+
+        if (type == DT_LNK || type == DT_UNKNOWN) type = entryType(dirfd, name);
+
+        if (type == DT_DIR)
+        {
+            if (level >= mOptions.depth || !isNumber(name, strlen(name)))
+            {
+                error("Unknown directory format: " + entrypath);
+                continue;
+            }
+            subdirs.push_back(std::make_pair(entrypath, level + 1));
+        }
+        else
+        {
+            processFile(dirfd, entrypath, name, r);
+        }
+    }
+
+    close(dirfd);
+
+    if (!subdirs.empty())
+    {
+        std::lock_guard<std::mutex> lock(mpWork->mutex);
+        mpWork->dirs.insert(mpWork->dirs.end(), subdirs.rbegin(), subdirs.rend());
+        mpWork->cond.notify_all();
+    }
+}
+
+struct file_stat {
+    int64_t mtime;
+    uint64_t size;
+    uint64_t blocks;
+};
+
+static bool statFile(int dirfd, const char *name, file_stat& fs)
+{
+#ifdef STATX_BASIC_STATS
+    struct statx sx;
+    if (statx(dirfd, name, AT_STATX_DONT_SYNC, STATX_MTIME | STATX_SIZE | STATX_BLOCKS, &sx) == 0)
+    {
+        fs.mtime  = sx.stx_mtime.tv_sec;
+        fs.size   = sx.stx_size;
+        fs.blocks = sx.stx_blocks;
+        return true;
+    }
+    if (errno != ENOSYS) return false;
+#endif
+    struct stat st;
+    if (fstatat(dirfd, name, &st, 0) < 0) return false;
+    fs.mtime  = st.st_mtime;
+    fs.size   = st.st_size;
+    fs.blocks = st.st_blocks;
+    return true;
+}
+
+void TiledirScanner::processFile(int dirfd, const std::string& path, const char *name, result& r)
+{
+    size_t namelen = strlen(name);
+    const char *dot = strchr(name, '.');
+
+    // tmp files written by the backends: name.meta.pid.tmp
+    if (dot && !strncmp(dot, ".meta.", 6) && namelen > 4 && !strcmp(name + namelen - 4, ".tmp") &&
+        isNumber(name, dot - name) && isNumber(dot + 6, name + namelen - 4 - (dot + 6)))
+    {
+        file_stat fs;
+        if (statFile(dirfd, name, fs) && fs.mtime < mNow - TILEDIR_TMP_MAX_AGE)
+        {
+            error("Old tmp file: " + path);
+        }
+        return;
+    }
+
+    int z;
+    uint32_t x, y;
+    if (!dot || strcmp(dot, ".meta") || !isNumber(name, dot - name) || !metatile_from_path(path, mOptions.depth, z, x, y))
+    {
+        error("Unknown file format: " + path);
+        return;
+    }
+
+    file_stat fs;
+    if (!statFile(dirfd, name, fs))
+    {
+        error("Can't stat file: " + path);
+        return;
+    }
+
+    int64_t age = mNow - fs.mtime;
+
+    if (mOptions.visit)
+    {
+        mOptions.visit(z, x, y, fs.mtime);
+    }
+
+    if (mOptions.list)
+    {
+        r.list += std::to_string(age) + "," + std::to_string(fs.size) + "," + std::to_string(fs.blocks) +
+                  ",map=" + mOptions.map + " z=" + std::to_string(z) + " x=" + std::to_string(x) + " y=" + std::to_string(y) + "\n";
+        if (r.list.size() >= TILEDIR_LIST_BUFFER) flushList(r);
+    }
+
+    r.stats[z].add(age, fs.size, fs.blocks);
+
+    if (mOptions.validate)
+    {
+        std::string problem;
+        int fd = openat(dirfd, name, O_RDONLY);
+        if (fd < 0)
+        {
+            problem = std::string("can't open: ") + strerror(errno);
+        }
+        else
+        {
+            problem = metatile_check(fd, fs.size, z, x, y);
+            close(fd);
+        }
+        if (!problem.empty())
+        {
+            r.corrupt.push_back(path + "," + problem);
+            error("Corrupt metatile: " + path + " (" + problem + ")");
+        }
+    }
+}
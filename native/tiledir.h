@@ -0,0 +1,123 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Tile directory scanner
+ *
+ */
+
+/**
+ * TiledirScanner
+ *
+ * Walks the metatile directory tree of one map (see get_filename() in
+ * Tirex::Metatile for the layout) with a pool of threads and collects the
+ * same information as the Perl version of tirex-tiledir-check: a list of
+ * all metatiles with age, size and blocks and statistics per zoom level.
+ *
+ * Every thread takes a directory from a shared stack, reads it with
+ * getdents64 and stats the files relative to the directory fd. Results are
+ * kept per thread and merged at the end, so the threads only share the
+ * directory stack. Only the list of metatiles is written out while
+ * scanning, through a small buffer per thread, as it can be huge. Zoom
+ * levels are scanned one after the other, so the list is sorted by zoom
+ * level.
+ *
+ * Optionally the header of every metatile is read and checked against the
+ * meta_layout format written by the backends and a histogram of tile ages
+ * is kept per zoom level.
+ */
+
+#ifndef tiledir_included
+#define tiledir_included
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "metatile.h"
+
+#define TILEDIR_MAX_ZOOM        METATILE_MAX_ZOOM
+#define TILEDIR_EMPTY_TILE_SIZE 7124
+#define TILEDIR_TMP_MAX_AGE     60
+#define TILEDIR_AGE_BUCKETS     6
+#define TILEDIR_LIST_BUFFER     65536
+
+/**
+ * Upper bounds (in seconds) for the buckets of the age histogram. The last
+ * bucket has everything older.
+ */
+extern const int64_t tiledir_age_buckets[TILEDIR_AGE_BUCKETS - 1];
+
+struct tiledir_zoom_stats {
+    uint64_t count;
+    uint64_t countempty;
+    int64_t minage;
+    int64_t maxage;
+    int64_t sumage;
+    uint64_t minsize;
+    uint64_t maxsize;
+    uint64_t sumsize;
+    uint64_t minblocks;
+    uint64_t maxblocks;
+    uint64_t sumblocks;
+    uint64_t agehist[TILEDIR_AGE_BUCKETS];
+
+    tiledir_zoom_stats();
+    void add(int64_t age, uint64_t size, uint64_t blocks);
+    void merge(const tiledir_zoom_stats& other);
+};
+
+struct tiledir_options {
+    std::string dir;        // tile directory of the map
+    std::string map;        // map name, only used for output
+    int depth;              // tiledir_depth of the map
+    int minz;
+    int maxz;
+    unsigned int threads;
+    FILE *list;             // write list of metatiles to this file
+    bool validate;          // read and check metatile headers
+    std::function<void(int, uint32_t, uint32_t, int64_t)> visit; // called with z, x, y and mtime of every
+                                                                 // metatile (from the scanner threads)
+
+    tiledir_options();
+};
+
+class TiledirScanner
+{
+    public:
+
+    TiledirScanner(const tiledir_options& options);
+
+    bool scan();
+
+    const std::vector<tiledir_zoom_stats>& stats() const { return mStats; }
+    const std::vector<std::string>& corrupt() const { return mCorrupt; }
+    bool errors() const { return mErrors.load(); }
+
+    private:
+
+    struct work;
+    struct result;
+
+    void worker(result& r);
+    void flushList(result& r);
+    void scanDir(const std::string& path, int level, result& r);
+    void processFile(int dirfd, const std::string& path, const char *name, result& r);
+    void error(const std::string& message);
+
+    tiledir_options mOptions;
+    time_t mNow;
+    int mRootFd;
+    work *mpWork;
+    std::atomic<bool> mErrors;
+
+    std::mutex mListMutex;
+    std::vector<tiledir_zoom_stats> mStats;
+    std::vector<std::string> mCorrupt;
+};
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Tile directory scanner
+ *
+ */
+
+/**
+ * tiledirscan
+ *
+ * Native version of the directory walk in tirex-tiledir-check. It is
+ * installed as tirex-tiledir-scan and called by tirex-tiledir-check if the
+ * --jobs option is given, which looks up the tile directory and depth of
+ * the map in the config. The list and stats files have the same format as
+ * those written by tirex-tiledir-check.
+ *
+ * Usage: tiledirscan [OPTIONS] TILEDIR
+ *
+ *   -m, --map=NAME        map name used in list and stats (default: basename of TILEDIR)
+ *   -d, --depth=N         tiledir_depth of the map (default: 5)
+ *   -z, --minz=N          start at zoom level N (default: 0)
+ *   -Z, --maxz=N          stop at zoom level N (default: 19)
+ *   -j, --threads=N       number of threads (default: number of CPUs)
+ *   -l, --list=FILE       write list of metatiles to FILE ('-' for STDOUT)
+ *   -s, --stats=FILE      write stats to FILE ('-' for STDOUT)
+ *   -a, --age-histogram   add histogram of tile ages to the stats
+ *   -C, --corrupt=FILE    check metatile headers and write list of corrupt
+ *                         or truncated metatiles to FILE ('-' for STDOUT)
+ *
+ * Returns 0 if no errors were found, 1 if there were errors and 2 on
+ * errors in the command line.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <thread>
+
+#include "tiledir.h"
+
+static void usage()
+{
+    fprintf(stderr, "Usage: tiledirscan [-m MAP] [-d DEPTH] [-z MINZ] [-Z MAXZ] [-j THREADS] [-l FILE] [-s FILE] [-a] [-C FILE] TILEDIR\n");
+    exit(2);
+}
+
+static int intArg(const char *arg)
+{
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value < 0 || value > 1000) usage();
+    return value;
+}
+
+/**
+ * Open output file. Files are opened for appending and only truncated
+ * when the result is written, so that a scan running for hours doesn't
+ * leave an empty stats file behind for that time. The list is written
+ * while scanning, so its file is truncated right away.
+ */
+static FILE *openOutput(const char *name, const char *what)
+{
+    if (!strcmp(name, "-")) return stdout;
+
+    FILE *file = fopen(name, "a");
+    if (!file)
+    {
+        fprintf(stderr, "Can't open %s file '%s': %s\n", what, name, strerror(errno));
+        exit(1);
+    }
+    return file;
+}
+
+static void rewindOutput(FILE *file)
+{
+    if (file == stdout) return;
+    fflush(file);
+    if (ftruncate(fileno(file), 0) == 0) rewind(file);
+}
+
+static std::string jsonString(const std::string& str)
+{
+    std::string result = "\"";
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\') result += '\\';
+        if (c < 0x20) continue;
+        result += c;
+    }
+    return result + "\"";
+}
+
+static void writeStats(FILE *file, const std::string& map, const TiledirScanner& scanner, bool histogram)
+{
+    const std::vector<tiledir_zoom_stats>& stats = scanner.stats();
+
+    int maxz = -1;
+    for (int z = 0; z <= TILEDIR_MAX_ZOOM; z++)
+    {
+        if (stats[z].count) maxz = z;
+    }
+
+    if (maxz < 0)
+    {
+        fputs("{}\n", file);
+        return;
+    }
+
+    fprintf(file, "{\n   %s : [\n", jsonString(map).c_str());
+    for (int z = 0; z <= maxz; z++)
+    {
+        const tiledir_zoom_stats& s = stats[z];
+        const char *sep = z < maxz ? "," : "";
+        if (!s.count)
+        {
+            fprintf(file, "      null%s\n", sep);
+            continue;
+        }
+        fprintf(file, "      {\n");
+        if (histogram)
+        {
+            fprintf(file, "         \"agehist\" : [");
+            for (int i = 0; i < TILEDIR_AGE_BUCKETS; i++)
+            {
+                fprintf(file, "%s%llu", i ? "," : "", static_cast<unsigned long long>(s.agehist[i]));
+            }
+            fprintf(file, "],\n");
+        }
+        fprintf(file, "         \"count\" : %llu,\n",      static_cast<unsigned long long>(s.count));
+        fprintf(file, "         \"countempty\" : %llu,\n", static_cast<unsigned long long>(s.countempty));
+        fprintf(file, "         \"maxage\" : %lld,\n",     static_cast<long long>(s.maxage));
+        fprintf(file, "         \"maxblocks\" : %llu,\n",  static_cast<unsigned long long>(s.maxblocks));
+        fprintf(file, "         \"maxsize\" : %llu,\n",    static_cast<unsigned long long>(s.maxsize));
+        fprintf(file, "         \"minage\" : %lld,\n",     static_cast<long long>(s.minage));
+        fprintf(file, "         \"minblocks\" : %llu,\n",  static_cast<unsigned long long>(s.minblocks));
+        fprintf(file, "         \"minsize\" : %llu,\n",    static_cast<unsigned long long>(s.minsize));
+        fprintf(file, "         \"sumage\" : %lld,\n",     static_cast<long long>(s.sumage));
+        fprintf(file, "         \"sumblocks\" : %llu,\n",  static_cast<unsigned long long>(s.sumblocks));
+        fprintf(file, "         \"sumsize\" : %llu\n",     static_cast<unsigned long long>(s.sumsize));
+        fprintf(file, "      }%s\n", sep);
+    }
+    fprintf(file, "   ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        { "map",           required_argument, 0, 'm' },
+        { "depth",         required_argument, 0, 'd' },
+        { "minz",          required_argument, 0, 'z' },
+        { "maxz",          required_argument, 0, 'Z' },
+        { "threads",       required_argument, 0, 'j' },
+        { "list",          required_argument, 0, 'l' },
+        { "stats",         required_argument, 0, 's' },
+        { "age-histogram", no_argument,       0, 'a' },
+        { "corrupt",       required_argument, 0, 'C' },
+        { "help",          no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    tiledir_options options;
+    options.threads = std::thread::hardware_concurrency();
+
+    const char *list = NULL;
+    const char *stats = NULL;
+    const char *corrupt = NULL;
+    bool histogram = false;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "m:d:z:Z:j:l:s:aC:h", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'm': options.map = optarg; break;
+            case 'd': options.depth = intArg(optarg); break;
+            case 'z': options.minz = intArg(optarg); break;
+            case 'Z': options.maxz = intArg(optarg); break;
+            case 'j': options.threads = intArg(optarg); break;
+            case 'l': list = optarg; break;
+            case 's': stats = optarg; break;
+            case 'a': histogram = true; break;
+            case 'C': corrupt = optarg; break;
+            default: usage();
+        }
+    }
+
+    if (optind != argc - 1) usage();
+    options.dir = argv[optind];
+
+    if (options.map.empty())
+    {
+        std::string dir = options.dir;
+        while (dir.size() > 1 && dir[dir.size() - 1] == '/') dir.erase(dir.size() - 1);
+        options.map = dir.substr(dir.rfind('/') + 1);
+    }
+
+    int stdout_users = (list && !strcmp(list, "-")) + (stats && !strcmp(stats, "-")) + (corrupt && !strcmp(corrupt, "-"));
+    if (stdout_users > 1)
+    {
+        fprintf(stderr, "Only one of --list, --stats and --corrupt can be -\n");
+        return 2;
+    }
+
+    FILE *fh_list    = list    ? openOutput(list,    "list")    : NULL;
+    FILE *fh_stats   = stats   ? openOutput(stats,   "stats")   : NULL;
+    FILE *fh_corrupt = corrupt ? openOutput(corrupt, "corrupt") : NULL;
+
+    if (fh_list) rewindOutput(fh_list);
+
+    options.list = fh_list;
+    options.validate = fh_corrupt != NULL;
+
+    TiledirScanner scanner(options);
+    if (!scanner.scan()) return 1;
+
+    if (fh_list && fh_list != stdout) fclose(fh_list);
+
+    if (fh_stats)
+    {
+        rewindOutput(fh_stats);
+        writeStats(fh_stats, options.map, scanner, histogram);
+        if (fh_stats != stdout) fclose(fh_stats);
+    }
+
+    if (fh_corrupt)
+    {
+        rewindOutput(fh_corrupt);
+        const std::vector<std::string>& lines = scanner.corrupt();
+        for (unsigned int i = 0; i < lines.size(); i++)
+        {
+            fprintf(fh_corrupt, "%s\n", lines[i].c_str());
+        }
+        if (fh_corrupt != stdout) fclose(fh_corrupt);
+    }
+
+    return scanner.errors() ? 1 : 0;
+}
@@ -0,0 +1,250 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Tile sync protocol
+ *
+ */
+
+#include "tilesync.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+
+#include "sha256.h"
+
+bool sync_read_full(int fd, void *buffer, size_t len)
+{
+    char *p = static_cast<char *>(buffer);
+    while (len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool sync_write_full(int fd, const void *buffer, size_t len)
+{
+    const char *p = static_cast<const char *>(buffer);
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void put64(char *buffer, int64_t value)
+{
+    uint32_t high = htonl(static_cast<uint64_t>(value) >> 32);
+    uint32_t low  = htonl(static_cast<uint64_t>(value) & 0xffffffff);
+    memcpy(buffer, &high, 4);
+    memcpy(buffer + 4, &low, 4);
+}
+
+static int64_t get64(const char *buffer)
+{
+    uint32_t high, low;
+    memcpy(&high, buffer, 4);
+    memcpy(&low, buffer + 4, 4);
+    return static_cast<int64_t>((static_cast<uint64_t>(ntohl(high)) << 32) | ntohl(low));
+}
+
+/**
+ * MAC of a frame: HMAC-SHA256 with the key of the direction over the frame
+ * counter, the header, the name and the data.
+ */
+static std::string frameMac(const std::string& key, uint64_t counter, const char *header, const std::string& name, const char *data, size_t datalen)
+{
+    char buffer[8];
+    put64(buffer, counter);
+
+    HmacSha256 hmac(key);
+    hmac.update(buffer, 8);
+    hmac.update(header, SYNC_HEADER_SIZE);
+    hmac.update(name.data(), name.size());
+    if (datalen) hmac.update(data, datalen);
+    return hmac.digest();
+}
+
+bool sync_write_frame(int fd, int type, const std::string& name, const char *data, size_t datalen, int64_t value, sync_auth *auth)
+{
+    if (name.size() > SYNC_MAX_NAME || datalen > SYNC_MAX_DATA) return false;
+
+    char header[SYNC_HEADER_SIZE];
+    uint16_t namelen = htons(name.size());
+    uint32_t len = htonl(datalen);
+
+    memcpy(header, SYNC_MAGIC, 4);
+    header[4] = SYNC_VERSION;
+    header[5] = type;
+    memcpy(header + 6, &namelen, 2);
+    memcpy(header + 8, &len, 4);
+    put64(header + 12, value);
+
+    std::string mac;
+    if (auth && !auth->sendkey.empty())
+    {
+        mac = frameMac(auth->sendkey, auth->sent++, header, name, data, datalen);
+    }
+
+    // header, name, data and MAC in one system call
+    struct iovec iov[4];
+    iov[0].iov_base = header;
+    iov[0].iov_len  = SYNC_HEADER_SIZE;
+    iov[1].iov_base = const_cast<char *>(name.data());
+    iov[1].iov_len  = name.size();
+    iov[2].iov_base = const_cast<char *>(data);
+    iov[2].iov_len  = datalen;
+    iov[3].iov_base = const_cast<char *>(mac.data());
+    iov[3].iov_len  = mac.size();
+
+    size_t total = SYNC_HEADER_SIZE + name.size() + datalen + mac.size();
+    ssize_t n;
+    do
+    {
+        n = writev(fd, iov, 4);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return false;
+    if (static_cast<size_t>(n) == total) return true;
+
+    // partial write, send the rest piece by piece
+    size_t done = n;
+    for (int i = 0; i < 4; i++)
+    {
+        if (done >= iov[i].iov_len)
+        {
+            done -= iov[i].iov_len;
+            continue;
+        }
+        if (!sync_write_full(fd, static_cast<char *>(iov[i].iov_base) + done, iov[i].iov_len - done)) return false;
+        done = 0;
+    }
+    return true;
+}
+
+/**
+ * Read a frame. Returns false on EOF, errors, frames that don't follow
+ * the protocol and frames with a wrong MAC (auth->failed is set then).
+ * The connection should be closed in that case.
+ */
+bool sync_read_frame(int fd, sync_frame& frame, sync_auth *auth)
+{
+    char header[SYNC_HEADER_SIZE];
+    if (!sync_read_full(fd, header, SYNC_HEADER_SIZE)) return false;
+
+    if (memcmp(header, SYNC_MAGIC, 4) || header[4] != SYNC_VERSION) return false;
+
+    uint16_t namelen;
+    uint32_t datalen;
+    memcpy(&namelen, header + 6, 2);
+    memcpy(&datalen, header + 8, 4);
+    namelen = ntohs(namelen);
+    datalen = ntohl(datalen);
+    if (namelen > SYNC_MAX_NAME || datalen > SYNC_MAX_DATA) return false;
+
+    frame.type  = static_cast<unsigned char>(header[5]);
+    frame.value = get64(header + 12);
+    frame.name.resize(namelen);
+    frame.data.resize(datalen);
+
+    if (namelen && !sync_read_full(fd, &frame.name[0], namelen)) return false;
+    if (datalen && !sync_read_full(fd, &frame.data[0], datalen)) return false;
+
+    if (auth && !auth->recvkey.empty())
+    {
+        char mac[SHA256_SIZE];
+        if (!sync_read_full(fd, mac, SHA256_SIZE)) return false;
+
+        std::string expected = frameMac(auth->recvkey, auth->received++, header, frame.name, frame.data.data(), datalen);
+        unsigned char diff = 0;
+        for (int i = 0; i < SHA256_SIZE; i++) diff |= mac[i] ^ expected[i];
+        if (diff)
+        {
+            auth->failed = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Read the shared secret from the first line of a file. Returns false if
+ * it can't be read or is empty.
+ */
+bool sync_read_secret(const std::string& filename, std::string& secret)
+{
+    FILE *file = fopen(filename.c_str(), "r");
+    if (!file) return false;
+
+    char buffer[1024] = "";
+    bool ok = fgets(buffer, sizeof(buffer), file) != NULL;
+    fclose(file);
+
+    secret = buffer;
+    while (!secret.empty() && isspace(static_cast<unsigned char>(secret[secret.size() - 1]))) secret.erase(secret.size() - 1);
+    return ok && !secret.empty();
+}
+
+std::string sync_nonce()
+{
+    std::string nonce(SYNC_NONCE_SIZE, '\0');
+    int fd = open("/dev/urandom", O_RDONLY);
+    bool ok = fd >= 0 && sync_read_full(fd, &nonce[0], SYNC_NONCE_SIZE);
+    if (fd >= 0) close(fd);
+
+    // never go on without a random nonce, that would allow replays
+    if (!ok) abort();
+    return nonce;
+}
+
+/**
+ * Derive the keys of a connection from the secret and the nonces of both
+ * HELLO frames.
+ */
+void sync_auth_init(sync_auth& auth, const std::string& secret, const std::string& sender_nonce, const std::string& receiver_nonce, bool sender)
+{
+    std::string tosender   = hmac_sha256(secret, "tirex-sync receiver" + sender_nonce + receiver_nonce);
+    std::string toreceiver = hmac_sha256(secret, "tirex-sync sender"   + sender_nonce + receiver_nonce);
+
+    auth.sendkey  = sender ? toreceiver : tosender;
+    auth.recvkey  = sender ? tosender : toreceiver;
+    auth.sent     = 0;
+    auth.received = 0;
+    auth.failed   = false;
+}
+
+/**
+ * Receivers only accept relative paths of metatiles without any ".."
+ * components, so that a sender can't write anywhere else.
+ */
+bool sync_valid_name(const std::string& name)
+{
+    if (name.empty() || name[0] == '/') return false;
+    if (name.size() < 5 || name.compare(name.size() - 5, 5, ".meta")) return false;
+    if (name.find('\0') != std::string::npos) return false;
+
+    size_t pos = 0;
+    while (pos <= name.size())
+    {
+        size_t next = name.find('/', pos);
+        if (next == std::string::npos) next = name.size();
+        std::string component = name.substr(pos, next - pos);
+        if (component.empty() || component == "." || component == "..") return false;
+        pos = next + 1;
+    }
+    return true;
+}
@@ -0,0 +1,100 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Tile sync protocol
+ *
+ */
+
+/**
+ * Protocol between tilesyncd (which runs next to the tirex-master and
+ * sends rendered metatiles) and tilesyncrecv (which runs on the hosts
+ * that keep a copy of the tiles).
+ *
+ * The sender keeps one TCP connection open to every receiver. Everything
+ * on the connection is a frame with a fixed 20 byte header followed by
+ * the name and the data:
+ *
+ *   magic     4 bytes  "TXSY"
+ *   version   1 byte   SYNC_VERSION
+ *   type      1 byte   SYNC_* below
+ *   namelen   2 bytes  length of the name
+ *   datalen   4 bytes  length of the data
+ *   value     8 bytes  mtime for files, sequence number for batches
+ *
+ * All numbers are in network byte order.
+ *
+ * The sender starts with a HELLO frame (name is its hostname), the
+ * receiver answers with HELLO. Then the sender streams FILE frames (name
+ * is the path of the file, data its content, value its mtime) and DELETE
+ * frames (for files that were gone when the sender wanted to read them)
+ * without waiting. Every batch ends with a BATCH frame carrying the
+ * sequence number of the batch and the receiver answers with an ACK frame
+ * with the same sequence number after all files of the batch are in
+ * place. The data of the ACK is the number of files that failed, as
+ * decimal string. Only acknowledged files are removed from the sender's
+ * queue.
+ *
+ * If a shared secret is configured (syncd_secret_file), both HELLO frames
+ * carry a random nonce as data. A key for each direction is derived from
+ * the secret and both nonces and every following frame is followed by a
+ * HMAC-SHA256 over a frame counter, the header, the name and the data.
+ * So frames can't be changed, injected or replayed from another
+ * connection. A receiver with a secret rejects senders without one and
+ * the other way round. The data is not encrypted.
+ */
+
+#ifndef tilesync_included
+#define tilesync_included
+
+#include <stdint.h>
+#include <string>
+
+#define SYNC_MAGIC        "TXSY"
+#define SYNC_VERSION      1
+#define SYNC_HEADER_SIZE  20
+#define SYNC_PORT         9324
+
+#define SYNC_MAX_NAME     4096
+#define SYNC_MAX_DATA     (64 * 1024 * 1024)
+#define SYNC_NONCE_SIZE   16
+
+#define SYNC_HELLO        1
+#define SYNC_FILE         2
+#define SYNC_DELETE       3
+#define SYNC_BATCH        4
+#define SYNC_ACK          5
+
+struct sync_frame {
+    int type;
+    int64_t value;
+    std::string name;
+    std::string data;
+};
+
+/**
+ * Authentication state of a connection. Without keys frames are sent and
+ * accepted without MAC.
+ */
+struct sync_auth {
+    std::string sendkey;
+    std::string recvkey;
+    uint64_t sent;
+    uint64_t received;
+    bool failed;            // a frame with a wrong MAC was received
+
+    sync_auth() : sent(0), received(0), failed(false) { }
+};
+
+bool sync_read_full(int fd, void *buffer, size_t len);
+bool sync_write_full(int fd, const void *buffer, size_t len);
+
+bool sync_write_frame(int fd, int type, const std::string& name, const char *data, size_t datalen, int64_t value, sync_auth *auth = NULL);
+bool sync_read_frame(int fd, sync_frame& frame, sync_auth *auth = NULL);
+
+bool sync_read_secret(const std::string& filename, std::string& secret);
+std::string sync_nonce();
+void sync_auth_init(sync_auth& auth, const std::string& secret, const std::string& sender_nonce, const std::string& receiver_nonce, bool sender);
+
+bool sync_valid_name(const std::string& name);
+
+#endif
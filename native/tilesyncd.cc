@@ -0,0 +1,625 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Tile sync daemon
+ *
+ */
+
+/**
+ * tilesyncd
+ *
+ * Native replacement for tirex-syncd, installed as tirex-tilesyncd. Like
+ * tirex-syncd it gets a message from the master on UDP for every metatile
+ * that was rendered and copies the metatile to the hosts in sync_to_host.
+ * But instead of running rsync for every host one after the other, it
+ * keeps a TCP connection open to tilesyncrecv on every host and streams
+ * the files to all hosts in parallel (see tilesync.h for the protocol).
+ *
+ * There is a queue for every host. A metatile that is already in the
+ * queue is not added again, so metatiles rendered several times within the
+ * aggregation window are only sent once. Metatiles are sent when they
+ * have been in the queue for syncd_aggregate_delay seconds or as soon as
+ * there are syncd_batch_size metatiles waiting, so the replication lag is
+ * bounded by the delay plus the time needed for the transfer even if the
+ * renderers produce a burst of tiles.
+ *
+ * Queues are bounded by syncd_max_pending. If a host is connected but
+ * can't keep up, the daemon stops reading messages from the master until
+ * there is space again (the master doesn't wait for the daemon, so messages
+ * might get lost in the UDP buffer then). If a host is not reachable, the
+ * oldest entries are dropped from its queue and the number of dropped
+ * metatiles is logged, so that the host can be resynced later.
+ *
+ * If syncd_secret_file is set, all frames are authenticated with the
+ * secret in that file (see tilesync.h), the receivers need the same.
+ *
+ * Usage: tilesyncd [-c CONFIGDIR] [-d]
+ *
+ *   -c, --config=DIR   config directory (default: /etc/tirex)
+ *   -d, --debug        stay in the foreground and log to STDERR as well
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "config.h"
+#include "message.h"
+#include "metatile.h"
+#include "tilesync.h"
+
+#define SYNCD_UDP_PORT            9323
+#define SYNCD_AGGREGATE_DELAY     5
+#define SYNCD_BATCH_SIZE          500
+#define SYNCD_MAX_PENDING         100000
+#define SYNCD_ACK_TIMEOUT         60      // seconds
+#define SYNCD_STATS_INTERVAL      60      // seconds
+#define SYNCD_PIDFILE             "/run/tirex/tirex-syncd.pid"
+
+struct syncd_options {
+    int delay;
+    size_t batch_size;
+    size_t max_pending;
+    std::string secret;
+};
+
+class SyncTarget
+{
+    public:
+
+    SyncTarget(const std::string& host, const std::string& port, const syncd_options& options);
+
+    void enqueue(const std::string& name, time_t now);
+    void run();
+
+    private:
+
+    struct entry {
+        std::string name;
+        time_t queued;
+    };
+
+    bool connectHost();
+    void disconnect();
+    bool sendBatch(const std::vector<entry>& batch);
+    void requeue(const std::vector<entry>& batch);
+    void logStats(time_t now);
+
+    std::string mHost;
+    std::string mPort;
+    syncd_options mOptions;
+    int mFd;
+    int64_t mSeq;
+    sync_auth mAuth;
+
+    std::mutex mMutex;
+    std::condition_variable mWork;
+    std::condition_variable mSpace;
+    std::deque<entry> mQueue;
+    std::unordered_set<std::string> mPending;
+    bool mConnected;
+
+    // statistics since the last log message
+    unsigned long mSent;
+    unsigned long mDeleted;
+    unsigned long mFailed;
+    unsigned long mDropped;
+    unsigned long mBatches;
+    time_t mMaxLag;
+    time_t mLastStats;
+};
+
+SyncTarget::SyncTarget(const std::string& host, const std::string& port, const syncd_options& options) :
+    mHost(host),
+    mPort(port),
+    mOptions(options),
+    mFd(-1),
+    mSeq(0),
+    mConnected(false),
+    mSent(0),
+    mDeleted(0),
+    mFailed(0),
+    mDropped(0),
+    mBatches(0),
+    mMaxLag(0),
+    mLastStats(time(NULL))
+{
+}
+
+/**
+ * Add file to the queue unless it is already there. Called from the main
+ * thread.
+ */
+void SyncTarget::enqueue(const std::string& name, time_t now)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    if (mPending.count(name)) return;
+
+    while (mQueue.size() >= mOptions.max_pending)
+    {
+        if (mConnected)
+        {
+            mSpace.wait(lock);
+            if (mPending.count(name)) return;
+        }
+        else
+        {
+            mPending.erase(mQueue.front().name);
+            mQueue.pop_front();
+            mDropped++;
+        }
+    }
+
+    entry e = { name, now };
+    mQueue.push_back(e);
+    mPending.insert(name);
+    mWork.notify_one();
+}
+
+bool SyncTarget::connectHost()
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *ai;
+    int rc = getaddrinfo(mHost.c_str(), mPort.c_str(), &hints, &ai);
+    if (rc)
+    {
+        syslog(LOG_ERR, "can't resolve %s: %s", mHost.c_str(), gai_strerror(rc));
+        return false;
+    }
+
+    for (struct addrinfo *p = ai; p && mFd < 0; p = p->ai_next)
+    {
+        mFd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (mFd >= 0 && connect(mFd, p->ai_addr, p->ai_addrlen) < 0)
+        {
+            close(mFd);
+            mFd = -1;
+        }
+    }
+    freeaddrinfo(ai);
+
+    if (mFd < 0)
+    {
+        syslog(LOG_ERR, "can't connect to %s port %s: %s", mHost.c_str(), mPort.c_str(), strerror(errno));
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(mFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    char hostname[256] = "";
+    gethostname(hostname, sizeof(hostname) - 1);
+
+    sync_frame frame;
+    std::string nonce = mOptions.secret.empty() ? "" : sync_nonce();
+    if (!sync_write_frame(mFd, SYNC_HELLO, hostname, nonce.data(), nonce.size(), 0) || !sync_read_frame(mFd, frame) || frame.type != SYNC_HELLO)
+    {
+        syslog(LOG_ERR, "handshake with %s failed", mHost.c_str());
+        disconnect();
+        return false;
+    }
+
+    mAuth = sync_auth();
+    if (!mOptions.secret.empty())
+    {
+        if (frame.data.size() != SYNC_NONCE_SIZE)
+        {
+            syslog(LOG_ERR, "handshake with %s failed: receiver doesn't authenticate", mHost.c_str());
+            disconnect();
+            return false;
+        }
+        sync_auth_init(mAuth, mOptions.secret, nonce, frame.data, true);
+    }
+
+    syslog(LOG_INFO, "connected to %s (%s)", mHost.c_str(), frame.name.c_str());
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mConnected = true;
+    return true;
+}
+
+void SyncTarget::disconnect()
+{
+    if (mFd >= 0) close(mFd);
+    mFd = -1;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mConnected = false;
+    mSpace.notify_all();
+}
+
+/**
+ * Stream all files of the batch without waiting, then wait for the ACK
+ * of the receiver.
+ */
+bool SyncTarget::sendBatch(const std::vector<entry>& batch)
+{
+    std::vector<char> buffer;
+    unsigned long sent = 0;
+    unsigned long deleted = 0;
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        std::string path = "/" + batch[i].name;
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+
+        if (fd < 0 && errno == ENOENT)
+        {
+            if (!sync_write_frame(mFd, SYNC_DELETE, batch[i].name, NULL, 0, 0, &mAuth)) return false;
+            deleted++;
+            continue;
+        }
+        if (fd < 0 || fstat(fd, &st) < 0 || st.st_size > SYNC_MAX_DATA)
+        {
+            syslog(LOG_ERR, "can't read %s: %s", path.c_str(), fd < 0 ? strerror(errno) : "file too large");
+            if (fd >= 0) close(fd);
+            continue;
+        }
+
+        buffer.resize(st.st_size);
+        bool ok = st.st_size == 0 || sync_read_full(fd, &buffer[0], st.st_size);
+        close(fd);
+        if (!ok)
+        {
+            syslog(LOG_ERR, "can't read %s: %s", path.c_str(), strerror(errno));
+            continue;
+        }
+
+        if (!sync_write_frame(mFd, SYNC_FILE, batch[i].name, buffer.empty() ? NULL : &buffer[0], buffer.size(), st.st_mtime, &mAuth)) return false;
+        sent++;
+    }
+
+    int64_t seq = ++mSeq;
+    if (!sync_write_frame(mFd, SYNC_BATCH, "", NULL, 0, seq, &mAuth)) return false;
+
+    struct pollfd pfd = { mFd, POLLIN, 0 };
+    if (poll(&pfd, 1, SYNCD_ACK_TIMEOUT * 1000) <= 0)
+    {
+        syslog(LOG_ERR, "no answer from %s", mHost.c_str());
+        return false;
+    }
+
+    sync_frame frame;
+    if (!sync_read_frame(mFd, frame, &mAuth) || frame.type != SYNC_ACK || frame.value != seq)
+    {
+        if (mAuth.failed) syslog(LOG_ERR, "wrong MAC in answer from %s", mHost.c_str());
+        return false;
+    }
+
+    unsigned long failed = strtoul(frame.data.c_str(), NULL, 10);
+    if (failed) syslog(LOG_WARNING, "%s: %lu files of batch %lld failed", mHost.c_str(), failed, static_cast<long long>(seq));
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSent += sent;
+    mDeleted += deleted;
+    mFailed += failed;
+    mBatches++;
+    return true;
+}
+
+/**
+ * Put the files of a batch that couldn't be sent back at the front of the
+ * queue, unless they have been queued again in the meantime.
+ */
+void SyncTarget::requeue(const std::vector<entry>& batch)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    for (size_t i = batch.size(); i > 0; i--)
+    {
+        const entry& e = batch[i - 1];
+        if (mPending.count(e.name)) continue;
+        mQueue.push_front(e);
+        mPending.insert(e.name);
+    }
+
+    while (mQueue.size() > mOptions.max_pending)
+    {
+        mPending.erase(mQueue.front().name);
+        mQueue.pop_front();
+        mDropped++;
+    }
+}
+
+void SyncTarget::logStats(time_t now)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (now - mLastStats < SYNCD_STATS_INTERVAL) return;
+
+    if (mSent || mDeleted || mDropped || mFailed || !mQueue.empty())
+    {
+        syslog(mDropped ? LOG_WARNING : LOG_INFO, "%s: sent %lu files, %lu deleted, %lu failed, %lu dropped in %lu batches, max lag %lds, %lu in queue",
+               mHost.c_str(), mSent, mDeleted, mFailed, mDropped, mBatches, static_cast<long>(mMaxLag), static_cast<unsigned long>(mQueue.size()));
+    }
+
+    mSent = mDeleted = mFailed = mDropped = mBatches = 0;
+    mMaxLag = 0;
+    mLastStats = now;
+}
+
+void SyncTarget::run()
+{
+    int backoff = 1;
+
+    while (true)
+    {
+        logStats(time(NULL));
+
+        if (mFd < 0 && !connectHost())
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(backoff));
+            backoff = std::min(backoff * 2, 30);
+            continue;
+        }
+        backoff = 1;
+
+        std::vector<entry> batch;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+
+            // wait until the oldest entry has been waiting long enough
+            // to collect repeats, or there is a full batch
+            while (mQueue.empty() || (mQueue.size() < mOptions.batch_size && mQueue.front().queued + mOptions.delay > time(NULL)))
+            {
+                std::chrono::system_clock::time_point until = std::chrono::system_clock::now() + std::chrono::seconds(SYNCD_STATS_INTERVAL);
+                if (!mQueue.empty()) until = std::chrono::system_clock::from_time_t(mQueue.front().queued + mOptions.delay);
+                if (mWork.wait_until(lock, until) == std::cv_status::timeout && mQueue.empty()) break;
+            }
+            if (mQueue.empty()) continue;
+
+            time_t now = time(NULL);
+            mMaxLag = std::max(mMaxLag, now - mQueue.front().queued);
+
+            while (!mQueue.empty() && batch.size() < mOptions.batch_size)
+            {
+                batch.push_back(mQueue.front());
+                mPending.erase(mQueue.front().name);
+                mQueue.pop_front();
+            }
+            mSpace.notify_all();
+        }
+
+        if (!sendBatch(batch))
+        {
+            syslog(LOG_ERR, "lost connection to %s", mHost.c_str());
+            disconnect();
+            requeue(batch);
+        }
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: tilesyncd [-c CONFIGDIR] [-d]\n");
+    exit(2);
+}
+
+static int intConfig(const config_map& config, const char *key, int def)
+{
+    int value = atoi(config_get(config, key, std::to_string(def)).c_str());
+    return value > 0 ? value : def;
+}
+
+/**
+ * Parse host with optional port: "host", "host:port" or "[v6addr]:port".
+ */
+static void splitHost(const std::string& spec, std::string& host, std::string& port)
+{
+    size_t colon = spec.rfind(':');
+    if (spec[0] == '[')
+    {
+        size_t close = spec.find(']');
+        host = spec.substr(1, close - 1);
+        if (close + 1 < spec.size() && spec[close + 1] == ':') port = spec.substr(close + 2);
+    }
+    else if (colon != std::string::npos && spec.find(':') == colon)
+    {
+        host = spec.substr(0, colon);
+        port = spec.substr(colon + 1);
+    }
+    else
+    {
+        host = spec;
+    }
+}
+
+/**
+ * Messages from the master are the replies of the backends (text or
+ * binary, see message.h), we only need map, x, y and z.
+ */
+static bool parseMessage(const char *buffer, size_t len, std::string& map, int& x, int& y, int& z)
+{
+    msg_view msg;
+    if (!msg_parse(buffer, len, msg)) return false;
+
+    const msg_field *fm = msg_find(msg, "map");
+    const msg_field *fx = msg_find(msg, "x");
+    const msg_field *fy = msg_find(msg, "y");
+    const msg_field *fz = msg_find(msg, "z");
+    if (!fm || !fx || !fy || !fz || fm->is_number) return false;
+
+    map.assign(fm->value, fm->valuelen);
+    return msg_get_int(*fx, x) && msg_get_int(*fy, y) && msg_get_int(*fz, z);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        { "config", required_argument, 0, 'c' },
+        { "debug",  no_argument,       0, 'd' },
+        { "help",   no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    std::string configdir = TIREX_CONFIGDIR;
+    bool debug = false;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "c:dh", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'c': configdir = optarg; break;
+            case 'd': debug = true; break;
+            default: usage();
+        }
+    }
+    if (optind != argc) usage();
+
+    config_map config;
+    if (!config_read(configdir + "/tirex.conf", config))
+    {
+        fprintf(stderr, "Can't read config file %s/tirex.conf\n", configdir.c_str());
+        return 1;
+    }
+
+    std::map<std::string, config_map> maps;
+    config_read_maps(configdir, maps);
+
+    syncd_options options;
+    options.delay       = atoi(config_get(config, "syncd_aggregate_delay", std::to_string(SYNCD_AGGREGATE_DELAY)).c_str());
+    options.batch_size  = intConfig(config, "syncd_batch_size", SYNCD_BATCH_SIZE);
+    options.max_pending = intConfig(config, "syncd_max_pending", SYNCD_MAX_PENDING);
+    if (options.max_pending < options.batch_size) options.max_pending = options.batch_size;
+
+    std::string secretfile = config_get(config, "syncd_secret_file", "");
+    if (!secretfile.empty() && !sync_read_secret(secretfile, options.secret))
+    {
+        fprintf(stderr, "Can't read secret from %s\n", secretfile.c_str());
+        return 1;
+    }
+
+    std::string hosts = config_get(config, "sync_to_host", "");
+    std::string default_port = config_get(config, "syncd_port", std::to_string(SYNC_PORT));
+
+    std::vector<SyncTarget *> targets;
+    size_t pos = 0;
+    while (pos < hosts.size())
+    {
+        size_t next = hosts.find_first_of(", ", pos);
+        if (next == std::string::npos) next = hosts.size();
+        if (next > pos)
+        {
+            std::string host, port = default_port;
+            splitHost(hosts.substr(pos, next - pos), host, port);
+            targets.push_back(new SyncTarget(host, port, options));
+        }
+        pos = next + 1;
+    }
+    if (targets.empty())
+    {
+        fprintf(stderr, "Please set 'sync_to_host' config option in %s/tirex.conf\n", configdir.c_str());
+        return 1;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(intConfig(config, "syncd_udp_port", SYNCD_UDP_PORT));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sock < 0 || bind(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0)
+    {
+        fprintf(stderr, "Can't open UDP socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    openlog("tirex-tilesyncd", LOG_PID | (debug ? LOG_PERROR : 0), LOG_DAEMON);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!debug)
+    {
+        if (daemon(0, 0) < 0)
+        {
+            fprintf(stderr, "Can't daemonize: %s\n", strerror(errno));
+            return 1;
+        }
+        std::string pidfile = config_get(config, "syncd_pidfile", SYNCD_PIDFILE);
+        FILE *pf = fopen(pidfile.c_str(), "w");
+        if (pf)
+        {
+            fprintf(pf, "%d\n", getpid());
+            fclose(pf);
+        }
+        else
+        {
+            syslog(LOG_ERR, "Can't open pidfile '%s' for writing: %s", pidfile.c_str(), strerror(errno));
+        }
+    }
+
+    for (size_t i = 0; i < targets.size(); i++)
+    {
+        std::thread(&SyncTarget::run, targets[i]).detach();
+    }
+
+    syslog(LOG_INFO, "started, syncing to %s", hosts.c_str());
+
+    char buffer[2048];
+    while (true)
+    {
+        ssize_t len = recv(sock, buffer, sizeof(buffer), 0);
+        if (len < 0)
+        {
+            if (errno != EINTR) syslog(LOG_ERR, "recv failed: %s", strerror(errno));
+            continue;
+        }
+
+        std::string mapname;
+        int x, y, z;
+        if (!parseMessage(buffer, len, mapname, x, y, z) || x < 0 || y < 0 || z < 0 || z > METATILE_MAX_ZOOM) continue;
+
+        std::map<std::string, config_map>::const_iterator map = maps.find(mapname);
+        if (map == maps.end())
+        {
+            syslog(LOG_WARNING, "unknown map '%s'", mapname.c_str());
+            continue;
+        }
+
+        std::string tiledir = config_get(map->second, "tiledir", "");
+        while (!tiledir.empty() && tiledir[0] == '/') tiledir.erase(0, 1);
+        while (!tiledir.empty() && tiledir[tiledir.size() - 1] == '/') tiledir.erase(tiledir.size() - 1);
+        int depth = atoi(config_get(map->second, "tiledir_depth", "5").c_str());
+
+        x -= x % METATILE_COLUMNS;
+        y -= y % METATILE_ROWS;
+
+        std::string name = tiledir + metatile_path(depth, z, x, y);
+        if (debug) syslog(LOG_DEBUG, "got %s", name.c_str());
+
+        time_t now = time(NULL);
+        for (size_t i = 0; i < targets.size(); i++)
+        {
+            targets[i]->enqueue(name, now);
+        }
+    }
+}
@@ -0,0 +1,381 @@
+/*
+ * Tirex Tile Rendering System
+ *
+ * Tile sync receiver
+ *
+ */
+
+/**
+ * tilesyncrecv
+ *
+ * Receiving end of tilesyncd, installed as tirex-tilesync-receiver. Runs
+ * on the hosts that keep a copy of the tiles, accepts connections from
+ * tilesyncd and writes the metatiles it gets. Every file is written to a
+ * temporary file next to its final place first and then renamed, so that
+ * the tile server never sees half-written metatiles. See tilesync.h for
+ * the protocol.
+ *
+ * Usage: tilesyncrecv [OPTIONS]
+ *
+ *   -c, --config=DIR     config directory (default: /etc/tirex)
+ *   -l, --listen=ADDR    address to listen on (default: syncd_receiver_listen
+ *                        from tirex.conf or all addresses)
+ *   -p, --port=PORT      TCP port (default: syncd_port from tirex.conf or 9324)
+ *   -r, --root=DIR       directory the paths from the sender are relative to
+ *                        (default: syncd_receiver_root from tirex.conf, there
+ *                        is no default, it must be set)
+ *   -a, --allow=ADDRS    comma separated list of addresses allowed to connect
+ *                        (default: syncd_receiver_allow from tirex.conf or
+ *                        127.0.0.1,::1)
+ *   -s, --secret=FILE    file with the shared secret (default:
+ *                        syncd_secret_file from tirex.conf)
+ *   -f, --fsync          fsync every file before renaming it
+ *   -d, --debug          log to STDERR as well
+ *
+ * The receiver stays in the foreground and logs to syslog.
+ *
+ * Any sender on the allow list can write metatiles anywhere below the
+ * root. Without a shared secret the connection is neither authenticated
+ * nor encrypted, so the receiver must only be reachable from a trusted
+ * network then. With a secret every frame is authenticated, but still not
+ * encrypted.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "config.h"
+#include "tilesync.h"
+
+struct receiver_options {
+    std::string root;
+    std::set<std::string> allow;
+    std::string secret;
+    bool fsync;
+};
+
+static std::atomic<unsigned long> tmpcounter(0);
+
+static void usage()
+{
+    fprintf(stderr, "Usage: tilesyncrecv [-c CONFIGDIR] [-l ADDR] [-p PORT] [-r ROOT] [-a ADDRS] [-s SECRETFILE] [-f] [-d]\n");
+    exit(2);
+}
+
+static bool mkdirs(const std::string& path)
+{
+    for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1))
+    {
+        if (mkdir(path.substr(0, pos).c_str(), 0755) < 0 && errno != EEXIST) return false;
+    }
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+/**
+ * Write a file atomically: to a tmp file in the same directory (with a
+ * name that tirex-tiledir-check recognizes), then rename.
+ */
+static bool writeFile(const receiver_options& options, const std::string& name, const std::string& data, int64_t mtime)
+{
+    std::string path = options.root + "/" + name;
+    std::string tmp = path + "." + std::to_string(getpid()) + std::to_string(tmpcounter++) + ".tmp";
+
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == ENOENT)
+    {
+        std::string dir = path.substr(0, path.rfind('/'));
+        if (!mkdirs(dir))
+        {
+            syslog(LOG_ERR, "can't create directory %s: %s", dir.c_str(), strerror(errno));
+            return false;
+        }
+        fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd < 0)
+    {
+        syslog(LOG_ERR, "can't open %s: %s", tmp.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct timespec times[2];
+    times[0].tv_sec  = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec  = mtime;
+    times[1].tv_nsec = 0;
+
+    bool ok = sync_write_full(fd, data.data(), data.size()) &&
+              (!options.fsync || fsync(fd) == 0) &&
+              futimens(fd, times) == 0;
+    int err = errno;
+    ok = close(fd) == 0 && ok;
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) < 0)
+    {
+        syslog(LOG_ERR, "can't write %s: %s", path.c_str(), strerror(ok ? errno : err));
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static void handleConnection(const receiver_options& options, int fd, std::string peer)
+{
+    sync_frame frame;
+    sync_auth auth;
+
+    char hostname[256] = "";
+    gethostname(hostname, sizeof(hostname) - 1);
+
+    if (!sync_read_frame(fd, frame) || frame.type != SYNC_HELLO)
+    {
+        syslog(LOG_WARNING, "protocol error in handshake with %s", peer.c_str());
+        close(fd);
+        return;
+    }
+
+    if (!options.secret.empty() && frame.data.size() != SYNC_NONCE_SIZE)
+    {
+        syslog(LOG_WARNING, "rejecting connection from %s: sender doesn't authenticate", peer.c_str());
+        close(fd);
+        return;
+    }
+
+    std::string nonce = options.secret.empty() ? "" : sync_nonce();
+    if (!sync_write_frame(fd, SYNC_HELLO, hostname, nonce.data(), nonce.size(), 0))
+    {
+        syslog(LOG_WARNING, "protocol error in handshake with %s", peer.c_str());
+        close(fd);
+        return;
+    }
+    if (!options.secret.empty()) sync_auth_init(auth, options.secret, frame.data, nonce, false);
+
+    syslog(LOG_INFO, "connection from %s (%s)", peer.c_str(), frame.name.c_str());
+
+    unsigned long files = 0;
+    unsigned long errors = 0;
+
+    while (sync_read_frame(fd, frame, &auth))
+    {
+        if (frame.type == SYNC_FILE || frame.type == SYNC_DELETE)
+        {
+            if (!sync_valid_name(frame.name))
+            {
+                syslog(LOG_WARNING, "rejecting invalid file name from %s: %s", peer.c_str(), frame.name.c_str());
+                errors++;
+            }
+            else if (frame.type == SYNC_FILE)
+            {
+                if (!writeFile(options, frame.name, frame.data, frame.value)) errors++;
+            }
+            else if (unlink((options.root + "/" + frame.name).c_str()) < 0 && errno != ENOENT)
+            {
+                syslog(LOG_ERR, "can't remove %s/%s: %s", options.root.c_str(), frame.name.c_str(), strerror(errno));
+                errors++;
+            }
+            files++;
+        }
+        else if (frame.type == SYNC_BATCH)
+        {
+            std::string result = std::to_string(errors);
+            if (!sync_write_frame(fd, SYNC_ACK, "", result.data(), result.size(), frame.value, &auth)) break;
+            errors = 0;
+        }
+        else
+        {
+            syslog(LOG_WARNING, "unexpected frame type %d from %s", frame.type, peer.c_str());
+            break;
+        }
+    }
+
+    if (auth.failed) syslog(LOG_WARNING, "wrong MAC in frame from %s", peer.c_str());
+    syslog(LOG_INFO, "connection from %s closed after %lu files", peer.c_str(), files);
+    close(fd);
+}
+
+static std::string peerAddress(const struct sockaddr_storage& addr)
+{
+    char buffer[INET6_ADDRSTRLEN] = "";
+
+    if (addr.ss_family == AF_INET)
+    {
+        inet_ntop(AF_INET, &reinterpret_cast<const struct sockaddr_in *>(&addr)->sin_addr, buffer, sizeof(buffer));
+    }
+    else if (addr.ss_family == AF_INET6)
+    {
+        inet_ntop(AF_INET6, &reinterpret_cast<const struct sockaddr_in6 *>(&addr)->sin6_addr, buffer, sizeof(buffer));
+    }
+
+    std::string result = buffer;
+    if (result.compare(0, 7, "::ffff:") == 0) result.erase(0, 7);
+    return result;
+}
+
+static std::set<std::string> splitList(const std::string& list)
+{
+    std::set<std::string> result;
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t next = list.find_first_of(", ", pos);
+        if (next == std::string::npos) next = list.size();
+        if (next > pos) result.insert(list.substr(pos, next - pos));
+        pos = next + 1;
+    }
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        { "config", required_argument, 0, 'c' },
+        { "listen", required_argument, 0, 'l' },
+        { "port",   required_argument, 0, 'p' },
+        { "root",   required_argument, 0, 'r' },
+        { "allow",  required_argument, 0, 'a' },
+        { "secret", required_argument, 0, 's' },
+        { "fsync",  no_argument,       0, 'f' },
+        { "debug",  no_argument,       0, 'd' },
+        { "help",   no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    std::string configdir = TIREX_CONFIGDIR;
+    const char *listen_arg = NULL;
+    const char *port_arg = NULL;
+    const char *root_arg = NULL;
+    const char *allow_arg = NULL;
+    const char *secret_arg = NULL;
+    bool debug = false;
+
+    receiver_options options;
+    options.fsync = false;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "c:l:p:r:a:s:fdh", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'c': configdir = optarg; break;
+            case 'l': listen_arg = optarg; break;
+            case 'p': port_arg = optarg; break;
+            case 'r': root_arg = optarg; break;
+            case 'a': allow_arg = optarg; break;
+            case 's': secret_arg = optarg; break;
+            case 'f': options.fsync = true; break;
+            case 'd': debug = true; break;
+            default: usage();
+        }
+    }
+    if (optind != argc) usage();
+
+    config_map config;
+    config_read(configdir + "/tirex.conf", config);
+
+    std::string listen_addr = listen_arg ? listen_arg : config_get(config, "syncd_receiver_listen", "");
+    std::string port = port_arg ? port_arg : config_get(config, "syncd_port", std::to_string(SYNC_PORT));
+    options.root = root_arg ? root_arg : config_get(config, "syncd_receiver_root", "");
+    options.allow = splitList(allow_arg ? allow_arg : config_get(config, "syncd_receiver_allow", "127.0.0.1,::1"));
+
+    // senders can write anywhere below the root, so there is no default
+    if (options.root.empty() || options.root[0] != '/')
+    {
+        fprintf(stderr, "Please set 'syncd_receiver_root' in %s/tirex.conf or use --root to an absolute path\n", configdir.c_str());
+        return 2;
+    }
+    while (options.root.size() > 1 && options.root[options.root.size() - 1] == '/') options.root.erase(options.root.size() - 1);
+    if (options.root == "/") options.root = "";
+
+    std::string secretfile = secret_arg ? secret_arg : config_get(config, "syncd_secret_file", "");
+    if (!secretfile.empty() && !sync_read_secret(secretfile, options.secret))
+    {
+        fprintf(stderr, "Can't read secret from %s\n", secretfile.c_str());
+        return 1;
+    }
+
+    openlog("tirex-tilesync-receiver", LOG_PID | (debug ? LOG_PERROR : 0), LOG_DAEMON);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    struct addrinfo *ai;
+    int rc = getaddrinfo(listen_addr.empty() ? NULL : listen_addr.c_str(), port.c_str(), &hints, &ai);
+    if (rc)
+    {
+        fprintf(stderr, "Can't resolve listen address: %s\n", gai_strerror(rc));
+        return 1;
+    }
+
+    // prefer IPv6, which also takes IPv4 connections on most systems
+    int lfd = -1;
+    int one = 1;
+    for (int pass = 0; pass < 2 && lfd < 0; pass++)
+    {
+        for (struct addrinfo *p = ai; p && lfd < 0; p = p->ai_next)
+        {
+            if ((p->ai_family == AF_INET6) != (pass == 0)) continue;
+            lfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+            if (lfd >= 0 &&
+                (setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+                 bind(lfd, p->ai_addr, p->ai_addrlen) < 0 ||
+                 listen(lfd, 16) < 0))
+            {
+                close(lfd);
+                lfd = -1;
+            }
+        }
+    }
+    if (lfd < 0)
+    {
+        fprintf(stderr, "Can't listen on port %s: %s\n", port.c_str(), strerror(errno));
+        return 1;
+    }
+    freeaddrinfo(ai);
+
+    syslog(LOG_INFO, "listening on port %s, writing to %s/%s", port.c_str(), options.root.c_str(), options.secret.empty() ? " (no authentication)" : "");
+
+    while (true)
+    {
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        int fd = accept(lfd, reinterpret_cast<struct sockaddr *>(&addr), &addrlen);
+        if (fd < 0)
+        {
+            if (errno != EINTR) syslog(LOG_ERR, "accept failed: %s", strerror(errno));
+            continue;
+        }
+
+        std::string peer = peerAddress(addr);
+        if (!options.allow.count(peer))
+        {
+            syslog(LOG_WARNING, "rejecting connection from %s", peer.c_str());
+            close(fd);
+            continue;
+        }
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        std::thread(handleConnection, std::cref(options), fd, peer).detach();
+    }
+}
@@ -63,6 +63,60 @@ is($b_backg->get_active(), 1, 'active');
 $b_backg->set_active(0);
 is($b_backg->get_active(), 0, 'not active');
 is($b_backg->can_render(4, 0), 0, 'can not render because not active');
+is($b_backg->limit(4, 0), 'inactive', 'limited because not active');
+$b_backg->set_active(1);
+
+#-----------------------------------------------------------------------------
+
+eval { Tirex::Manager::Bucket->new( name => 'name', minprio => 1, maxproc => 1, maxload => 1, maxpsi_cpu => 'x'); };
+like($@, qr{parameter 'maxpsi_cpu' for bucket must be a number}, 'maxpsi_cpu must be a number');
+
+eval { Tirex::Manager::Bucket->new( name => 'name', minprio => 1, maxproc => 1, maxload => 1, psi_window => 30); };
+like($@, qr{parameter 'psi_window' for bucket must be 10, 60, or 300}, 'psi_window');
+
+my $b_psi = Tirex::Manager::Bucket->new( name => 'psi', minprio => 50, maxproc => 5, maxload => 10, maxpsi_memory => 10, maxpsi_io => 40, psi_window => 60, minmem => 512);
+my $pressure = {
+    cpu    => { 10 => 90, 60 => 90, 300 => 90 },
+    memory => { 10 => 50, 60 =>  5, 300 =>  1 },
+    io     => { 10 =>  0, 60 => 10, 300 =>  0 },
+    memory_available => 1024,
+};
+
+is($b_backg->limit(4, 0, $pressure), '', 'no pressure limits configured');
+is($b_psi->limit(4, 0), '', 'no pressure information');
+is($b_psi->limit(4, 0, { cpu => { 10 => 100, 60 => 100, 300 => 100 } }), '', 'no limit for cpu pressure');
+is($b_psi->limit(4, 0, $pressure), '', 'below limits in psi_window');
+is($b_psi->limit(5, 20, $pressure), 'maxproc', 'maxproc before pressure');
+is($b_psi->limit(4, 20, $pressure), 'load', 'load before pressure');
+
+$pressure->{'io'}->{'60'} = 40;
+is($b_psi->limit(4, 0, $pressure), 'psi_io', 'io pressure');
+is($b_psi->can_render(4, 0, $pressure), undef, 'can not render: io pressure');
+$pressure->{'memory'}->{'60'} = 10.5;
+is($b_psi->limit(4, 0, $pressure), 'psi_memory', 'memory pressure');
+$pressure->{'memory'}->{'60'} = 0;
+$pressure->{'io'}->{'60'} = 0;
+
+$pressure->{'memory_available'} = 100;
+is($b_psi->limit(4, 0, $pressure), 'memory', 'not enough memory');
+is($b_psi->can_render(4, 0, $pressure), undef, 'can not render: not enough memory');
+delete $pressure->{'memory_available'};
+ok($b_psi->can_render(4, 0, $pressure), 'can render without memory information');
+
+my $st = $b_psi->status(4, 0, { io => { 60 => 50 } });
+is($st->{'limited_by'}, 'psi_io', 'status limited_by');
+is($st->{'maxpsi_io'}, 40, 'status maxpsi_io');
+is($st->{'psi_window'}, 60, 'status psi_window');
+ok(!exists $b_backg->status(4, 0)->{'psi_window'}, 'no psi_window in status without limits');
+
+#-----------------------------------------------------------------------------
+
+my $b_cost = Tirex::Manager::Bucket->new( name => 'cost', minprio => 50, maxproc => 5, maxload => 10, maxcost => 30);
+is($b_cost->limit(4, 0, {}, 29999), '', 'below maxcost');
+is($b_cost->limit(4, 0, {}, 30000), 'cost', 'maxcost reached');
+is($b_cost->can_render(4, 0, {}, 30000), undef, 'can not render: maxcost reached');
+is($b_backg->limit(4, 0, {}, 1000000), '', 'no maxcost configured');
+is($b_cost->status(4, 0, {}, 0)->{'maxcost'}, 30, 'maxcost in status');
 
 
 #-- THE END ------------------------------------------------------------------
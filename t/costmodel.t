@@ -0,0 +1,105 @@
+#-----------------------------------------------------------------------------
+#
+#  t/costmodel.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use File::Temp;
+
+use lib 'lib';
+
+use Tirex;
+use Tirex::Manager;
+use Tirex::Manager::CostModel;
+use Tirex::PrioQueue;
+use Tirex::Queue;
+
+#-----------------------------------------------------------------------------
+
+sub mt  { return Tirex::Metatile->new(map => $_[0], x => $_[1], y => $_[2], z => $_[3]); }
+sub job { return Tirex::Job->new(metatile => mt(@_[0..3]), prio => $_[4] || 1); }
+
+eval { Tirex::Manager::CostModel->new( halflife => 0 ); };
+like($@, qr{halflife for cost model must be a positive number}, 'halflife');
+
+my $model = Tirex::Manager::CostModel->new( cell_bits => 1, halflife => 100 );
+
+is($model->cell_key(mt('test', 8, 24, 10)), 'test 10 0 1', 'cell key');
+is($model->cell_key(mt('test', 16, 0, 10)), 'test 10 1 0', 'cell key of neighbouring cell');
+
+is($model->estimate(mt('test', 0, 0, 10)), undef, 'nothing known');
+
+my $now = time();
+$model->add(mt('test', 0, 0, 10), 1000, $now);
+$model->add(mt('test', 8, 8, 10), 3000, $now);
+is($model->estimate(mt('test', 0, 0, 10)), 2000, 'average in cell');
+is($model->estimate(mt('test', 64, 64, 10)), 2000, 'average of zoom level for unknown cell');
+is($model->estimate(mt('test', 0, 0, 11)), undef, 'other zoom level');
+is($model->estimate(mt('other', 0, 0, 10)), undef, 'other map');
+is($model->size(), 1, 'one cell');
+
+# older values count less
+$model = Tirex::Manager::CostModel->new( halflife => 100 );
+$model->add(mt('test', 0, 0, 10), 1000, $now - 100);
+$model->add(mt('test', 0, 0, 10), 4000, $now);
+is($model->estimate(mt('test', 0, 0, 10)), 3000, 'decayed average');
+
+# prune
+$model = Tirex::Manager::CostModel->new( cell_bits => 0, max_cells => 10 );
+$model->add(mt('test', 0, 0, 10), 100) foreach (1 .. 5);
+$model->add(mt('test', 8 * $_, 0, 10), 100) foreach (1 .. 10);
+is($model->size(), 9, 'pruned');
+is($model->estimate(mt('test', 0, 0, 10)), 100, 'cell with highest weight kept');
+
+#-----------------------------------------------------------------------------
+
+my $dir = File::Temp::tempdir( CLEANUP => 1 );
+
+$model = Tirex::Manager::CostModel->new( file => "$dir/costs" );
+ok(!$model->load(), 'no file to load');
+$model->add(mt('test', 0, 0, 10), 1500, $now);
+$model->add(mt('test', 512, 0, 10), 500, $now);
+ok($model->save(), 'save');
+ok(! -e "$dir/costs.tmp", 'temporary file renamed');
+
+my $loaded = Tirex::Manager::CostModel->new( file => "$dir/costs" );
+ok($loaded->load(), 'load');
+is_deeply($loaded->{'cells'}, $model->{'cells'}, 'cells loaded');
+is_deeply($loaded->{'zooms'}, $model->{'zooms'}, 'zoom levels loaded');
+
+#-----------------------------------------------------------------------------
+
+# shortest expected job first
+is(Tirex::PrioQueue->new(prio => 1, order => 'cost'), undef, 'cost order needs cost model');
+eval { Tirex::Queue->new(order => 'cost'); };
+like($@, qr{queue order 'cost' needs a cost model}, 'queue croaks without cost model');
+
+$model = Tirex::Manager::CostModel->new();
+$model->add(mt('test', 0,   0, 10), 5000);
+$model->add(mt('test', 512, 0, 10), 100);
+$model->add(mt('test', 0, 512, 10), 100);
+
+my $q = Tirex::Queue->new(order => 'cost', cost_model => $model);
+$q->add(job('test', 0, 0, 10), job('test', 512, 0, 10), job('test', 0, 512, 10), job('new', 0, 0, 10));
+is($q->next()->get_map(), 'new', 'unknown job first');
+is($q->next()->get_x(), 512, 'cheap job');
+is($q->next()->get_y(), 512, 'cheap job with same cost in fifo order');
+is($q->next()->get_x(), 0, 'expensive job last');
+ok($q->empty(), 'queue empty');
+
+# jobs don't time out before the backend manager gives up on their worker
+$Tirex::Config::confhash->{'master_cost_timeout_factor'} = 3;
+$Tirex::Config::confhash->{'backend_manager_alive_timeout'} = 5;
+my $rm = Tirex::Manager->new( queue => $q, cost_model => $model );
+is($rm->{'min_timeout'}, 300, 'minimum timeout raised to alive timeout');
+$Tirex::Config::confhash->{'master_cost_min_timeout'} = 600;
+$rm = Tirex::Manager->new( queue => $q, cost_model => $model );
+is($rm->{'min_timeout'}, 600, 'longer minimum timeout kept');
+
+
+#-- THE END ------------------------------------------------------------------
@@ -0,0 +1,130 @@
+#-----------------------------------------------------------------------------
+#
+#  t/freshindex.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use File::Temp;
+
+use lib 'lib';
+
+use Tirex;
+use Tirex::FreshnessIndex;
+use Tirex::Metatile;
+use Tirex::Renderer;
+use Tirex::Map;
+
+#-----------------------------------------------------------------------------
+
+# write index file for zoom level z like the backend would
+sub write_index
+{
+    my ($dir, $z, %times) = @_;
+
+    my $width = (2**$z + 7) >> 3;
+    my @data = (0) x ($width * $width);
+    while (my ($key, $time) = each %times)
+    {
+        my ($mx, $my) = split(/,/, $key);
+        $data[$my * $width + $mx] = $time;
+    }
+
+    open(my $fh, '>', "$dir/$z.fresh") or die;
+    binmode($fh);
+    print $fh pack('a8 L5 x36', 'TIREXFI1', $z, 8, 8, $width, $width), pack('L*', @data);
+    close($fh);
+}
+
+my $dir     = File::Temp::tempdir(CLEANUP => 1);
+my $tiledir = "$dir/tiles";
+my $index   = "$dir/fresh";
+mkdir($tiledir);
+mkdir($index);
+
+write_index($index, 10, '0,0' => 1000, '3,2' => 2000);
+
+eval { Tirex::FreshnessIndex->new(); };
+like($@, qr{need dir for freshness index}, 'dir missing');
+
+my $fi = Tirex::FreshnessIndex->new( dir => $index );
+is($fi->get(10, 0, 0), 1000, 'time of metatile');
+is($fi->get(10, 7, 7), 1000, 'any tile in metatile');
+is($fi->get(10, 24, 16), 2000, 'other metatile');
+is($fi->get(10, 8, 0), 0, 'never rendered');
+is($fi->get(10, 2000, 0), 0, 'outside of the world');
+is($fi->get(11, 0, 0), undef, 'no index for zoom level');
+is($fi->get(21, 0, 0), undef, 'no index above max zoom');
+
+write_index($index, 12);
+open(my $fh, '+<', "$index/12.fresh") or die;
+print $fh 'TIREXFI0';
+close($fh);
+is($fi->get(12, 0, 0), undef, 'broken index ignored');
+
+#-----------------------------------------------------------------------------
+# metatile methods use the index if the map has one
+#-----------------------------------------------------------------------------
+
+my $renderer = Tirex::Renderer->new( name => 'fresh', path => '/bin/true', port => 1260, procs => 1 );
+Tirex::Map->new( name => 'indexed', renderer => $renderer, tiledir => $tiledir, freshindex => $index );
+Tirex::Map->new( name => 'plain', renderer => $renderer, tiledir => $tiledir );
+
+is(Tirex::FreshnessIndex->for_map(Tirex::Map->get('plain')), undef, 'no index for map without freshindex');
+is(Tirex::FreshnessIndex->for_map(Tirex::Map->get('indexed')), Tirex::FreshnessIndex->for_map(Tirex::Map->get('indexed')), 'index is cached');
+
+my $mt = Tirex::Metatile->new( map => 'indexed', z => 10, x => 24, y => 16 );
+ok($mt->exists(), 'exists from index');
+is($mt->older(3000), 1, 'older from index');
+ok(!$mt->older(1000), 'not older from index');
+is($mt->newer(1000), 1, 'newer from index');
+
+$mt = Tirex::Metatile->new( map => 'indexed', z => 10, x => 8, y => 0 );
+ok(!$mt->exists(), 'missing from index');
+is($mt->older(3000), 2, 'older of missing metatile');
+
+# zoom level without index falls back to the metatile file
+my $file = Tirex::Metatile->new( map => 'plain', z => 11, x => 0, y => 0 );
+my $fn = "$tiledir/" . $file->get_filename();
+my $path = $tiledir;
+foreach my $d (split('/', $file->get_filename()))
+{
+    last if ($d =~ /\.meta$/);
+    $path .= "/$d";
+    mkdir($path);
+}
+open($fh, '>', $fn) or die;
+close($fh);
+utime(5000, 5000, $fn);
+
+$mt = Tirex::Metatile->new( map => 'indexed', z => 11, x => 0, y => 0 );
+ok($mt->exists(), 'exists from file');
+is($mt->older(6000), 1, 'older from file');
+ok(!$mt->newer(6000), 'not newer from file');
+
+# metatile that is not in the index (written before there was an index or
+# by another backend) falls back to the metatile file
+$file = Tirex::Metatile->new( map => 'plain', z => 10, x => 16, y => 0 );
+$fn = "$tiledir/" . $file->get_filename();
+$path = $tiledir;
+foreach my $d (split('/', $file->get_filename()))
+{
+    last if ($d =~ /\.meta$/);
+    $path .= "/$d";
+    mkdir($path);
+}
+open($fh, '>', $fn) or die;
+close($fh);
+utime(5000, 5000, $fn);
+
+$mt = Tirex::Metatile->new( map => 'indexed', z => 10, x => 16, y => 0 );
+ok($mt->exists(), 'exists from file if not in index');
+is($mt->older(6000), 1, 'older from file if not in index');
+ok(!$mt->older(4000), 'not older from file if not in index');
+
+
+#-- THE END ------------------------------------------------------------------
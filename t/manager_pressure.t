@@ -0,0 +1,66 @@
+#-----------------------------------------------------------------------------
+#
+#  t/manager_pressure.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use File::Temp;
+
+use lib 'lib';
+
+use Tirex;
+use Tirex::Queue;
+use Tirex::Manager;
+
+#-----------------------------------------------------------------------------
+
+sub write_file
+{
+    my ($file, $content) = @_;
+    open(my $fh, '>', $file) or die("can't write $file: $!");
+    print $fh $content;
+    close($fh);
+}
+
+my $dir = File::Temp::tempdir( CLEANUP => 1 );
+
+write_file("$dir/cpu",    "some avg10=12.50 avg60=3.00 avg300=1.00 total=123456\nfull avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+write_file("$dir/memory", "some avg10=0.00 avg60=20.25 avg300=5.00 total=1\nfull avg10=0.00 avg60=10.00 avg300=2.00 total=1\n");
+
+my $rm = Tirex::Manager->new( queue => Tirex::Queue->new(), pressure_dir => $dir );
+$rm->add_bucket( name => 'live', minprio => 1, maxproc => 4, maxload => 1000, maxpsi_memory => 10, psi_window => 60 );
+
+my $pressure = $rm->get_pressure();
+is_deeply($pressure, {
+    cpu    => { 10 => 12.5, 60 => 3,     300 => 1 },
+    memory => { 10 => 0,    60 => 20.25, 300 => 5 },
+}, 'pressure from files, io not available');
+
+my $job = Tirex::Job->new( metatile => Tirex::Metatile->new(map => 'test', x => 0, y => 0, z => 3), prio => 1 );
+$rm->{'queue'}->add($job);
+is($rm->run(), 0, 'no rendering because of memory pressure');
+is($rm->status()->{'buckets'}->[0]->{'limited_by'}, 'psi_memory', 'status shows limit');
+is_deeply($rm->status()->{'pressure'}, $pressure, 'status shows pressure');
+
+#-----------------------------------------------------------------------------
+
+# pressure and memory of a cgroup
+write_file("$dir/cpu.pressure",   "some avg10=1.00 avg60=2.00 avg300=3.00 total=1\n");
+write_file("$dir/memory.max",     "1073741824\n");
+write_file("$dir/memory.current", "805306368\n");
+
+$Tirex::Config::confhash->{'master_pressure_cgroup'} = $dir;
+$rm->{'last_pressure_check'} = 0;
+is_deeply($rm->get_pressure(), { cpu => { 10 => 1, 60 => 2, 300 => 3 }, memory_available => 256 }, 'pressure of cgroup');
+
+write_file("$dir/memory.max", "max\n");
+$rm->{'last_pressure_check'} = 0;
+ok(!exists $rm->get_pressure()->{'memory_available'}, 'no memory limit in cgroup');
+
+
+#-- THE END ------------------------------------------------------------------
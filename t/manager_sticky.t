@@ -0,0 +1,72 @@
+#-----------------------------------------------------------------------------
+#
+#  t/manager_sticky.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use lib 'lib';
+
+use Tirex;
+use Tirex::Queue;
+use Tirex::Manager;
+use Tirex::Renderer;
+
+#-----------------------------------------------------------------------------
+
+sub mt  { return Tirex::Metatile->new(map => $_[0], x => $_[1], y => $_[2], z => $_[3]); }
+sub job { return Tirex::Job->new(metatile => mt(@_), prio => 1); }
+
+# similarity of metatiles
+is(Tirex::Manager::similarity(undef, mt('a', 0, 0, 10)), 0, 'no previous metatile');
+is(Tirex::Manager::similarity(mt('a', 0, 0, 10), mt('b', 0, 0, 10)), 0, 'different map');
+is(Tirex::Manager::similarity(mt('a', 0, 0, 10), mt('a', 0, 0, 10)), 4, 'same metatile');
+is(Tirex::Manager::similarity(mt('a', 0, 0, 10), mt('a', 8, 8, 11)), 4, 'child in same zoom band');
+is(Tirex::Manager::similarity(mt('a', 0, 0, 10), mt('a', 0, 0, 12)), 2, 'other zoom band, same area');
+is(Tirex::Manager::similarity(mt('a', 0, 0, 10), mt('a', 512, 0, 10)), 3, 'same zoom band, other area');
+is(Tirex::Manager::similarity(mt('a', 0, 0, 10), mt('a', 512, 0, 12)), 1, 'only same map');
+
+# choice of workers
+my $renderer = Tirex::Renderer->new( name => 'sticky', path => '/bin/true', port => 1235, procs => 3, worker_port => 2000 );
+my $rm = Tirex::Manager->new( queue => Tirex::Queue->new() );
+
+my @jobs = (job('a', 0, 0, 10), job('b', 0, 0, 10), job('c', 0, 0, 10));
+foreach my $n (0 .. 2)
+{
+    $rm->{'rendering_jobs'}->add($jobs[$n]);
+    is($rm->choose_worker($renderer, $jobs[$n]), $n, "free worker $n");
+    is($jobs[$n]->{'worker'}, $n, 'worker stored in job');
+}
+
+$rm->{'rendering_jobs'}->remove($_) foreach (@jobs);
+
+my $j = job('b', 8, 0, 10);
+$rm->{'rendering_jobs'}->add($j);
+is($rm->choose_worker($renderer, $j), 1, 'worker that rendered same map');
+
+$j = job('c', 0, 0, 12);
+$rm->{'rendering_jobs'}->add($j);
+is($rm->choose_worker($renderer, $j), 2, 'worker that rendered same map in other zoom band');
+
+# worker 1 and 2 are busy now
+$j = job('b', 16, 0, 10);
+$rm->{'rendering_jobs'}->add($j);
+is($rm->choose_worker($renderer, $j), 0, 'busy workers are avoided');
+
+# all busy: least loaded, then most similar
+$j = job('c', 0, 0, 12);
+$rm->{'rendering_jobs'}->add($j);
+is($rm->choose_worker($renderer, $j), 2, 'all busy, most similar');
+
+$rm->{'rendering_jobs'}->remove($_) foreach (values %{$rm->{'rendering_jobs'}->{'requests_by_id'}});
+
+# equally good workers: the one idle for longest
+$j = job('d', 0, 0, 10);
+$rm->{'rendering_jobs'}->add($j);
+is($rm->choose_worker($renderer, $j), 1, 'least recently used');
+
+#-- THE END ------------------------------------------------------------------
@@ -0,0 +1,98 @@
+#-----------------------------------------------------------------------------
+#
+#  t/message_binary.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use lib 'lib';
+
+use Tirex;
+
+#-----------------------------------------------------------------------------
+
+my $msg = Tirex::Message->new( type => 'metatile_render_request', id => '1234567_0', map => 'default', prio => 3, x => 1024, y => 2048, z => 12 );
+my $b = $msg->serialize_binary();
+
+ok(Tirex::Message::is_binary($b), 'is_binary');
+ok(!Tirex::Message::is_binary($msg->serialize()), 'text is not binary');
+ok(length($b) < length($msg->serialize()), 'binary is shorter');
+
+# same bytes as native/message.cc writes
+is(unpack('H*', substr($b, 0, 7)), '00545801' . '02' . '0009', 'header and first field');
+
+my $bmsg = Tirex::Message->new_from_string($b);
+isa_ok($bmsg, 'Tirex::Message', 'create from binary');
+is_deeply($bmsg, $msg, 're-created from binary');
+
+is_deeply(Tirex::parse_msg($b), { %$msg }, 'parse_msg with binary message');
+
+#-----------------------------------------------------------------------------
+
+# values that are not plain int32 numbers stay strings
+$msg = Tirex::Message->new( type => 't', a => '007', b => '-0', c => '+5', d => '2147483648', e => '-2147483648', f => '', g => undef, longkey_not_in_table => 'x=y', errmsg => "map style 'x' is not known" );
+$bmsg = Tirex::Message->new_from_string($msg->serialize_binary());
+delete $msg->{'g'};
+is_deeply($bmsg, $msg, 'odd values');
+
+eval { Tirex::Message->new( type => 't', 'k' x 256 => 1 )->serialize_binary(); };
+like($@, qr/can't be sent in binary message/, 'long key');
+
+#-----------------------------------------------------------------------------
+
+# malformed messages
+is(Tirex::Message::decode_binary("\0TX\x01\x84\0\0"), undef, 'truncated integer');
+is(Tirex::Message::decode_binary("\0TX\x01\x7f\0\0"), undef, 'unknown key index');
+is(Tirex::Message::decode_binary("\0TX\x01\x03\0\x02a\n"), undef, 'line break in value');
+is(Tirex::Message::decode_binary("\0TX\x01\x03\0\x02a\0"), undef, 'NUL in value');
+is(Tirex::Message::decode_binary("\0TX\x01\0\x03a=b\0\0"), undef, 'equal sign in key');
+is_deeply(Tirex::Message::decode_binary("\0TX\x01"), {}, 'empty message');
+is_deeply(Tirex::parse_msg("\0TX\x01\x84"), {}, 'parse_msg with malformed message');
+
+eval { Tirex::Message->new_from_string("\0TX\x01\x84"); };
+like($@, qr/invalid binary message/, 'new_from_string croaks');
+
+#-----------------------------------------------------------------------------
+
+# fuzz: every message that decodes must survive a round trip unchanged
+srand(1);
+my @seeds = map { $_->serialize_binary() } (
+    Tirex::Message->new( type => 'metatile_render_request', id => 1, map => 'default', prio => 3, x => 1024, y => 2048, z => 12 ),
+    Tirex::Message->new( type => 'metatile_render_request', id => 1, result => 'error', errmsg => "map style 'x' is not known" ),
+    Tirex::Message->new( type => 't', foo => 'bar', render_time => 1234, rss => -5 ),
+);
+
+my $accepted = 0;
+my $failed = 0;
+for (1 .. 20000)
+{
+    my $data = $seeds[int(rand(@seeds))];
+    if (rand() < 0.5)
+    {
+        for (0 .. int(rand(4)))
+        {
+            substr($data, 4 + int(rand(length($data) - 4)), 1) = chr(int(rand(256)));
+        }
+    }
+    else
+    {
+        $data = substr($data, 0, 4 + int(rand(length($data) - 4)));
+    }
+
+    my $fields = eval { Tirex::Message::decode_binary($data) };
+    $failed++ if ($@);
+    next unless ($fields);
+    $accepted++;
+
+    my $m = bless { %$fields } => 'Tirex::Message';
+    my $again = Tirex::Message::decode_binary($m->serialize_binary());
+    $failed++ unless ($again && join("\n", map { "$_=$again->{$_}" } sort keys %$again) eq join("\n", map { "$_=$fields->{$_}" } sort keys %$fields));
+}
+is($failed, 0, "fuzz ($accepted of 20000 accepted)");
+
+
+#-- THE END ------------------------------------------------------------------
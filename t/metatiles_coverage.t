@@ -0,0 +1,143 @@
+#-----------------------------------------------------------------------------
+#
+#  t/metatiles_coverage.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use File::Temp;
+
+use lib 'lib';
+
+use Tirex;
+use Tirex::Metatiles::Coverage;
+
+#-----------------------------------------------------------------------------
+
+sub polygon_file
+{
+    my $content = shift;
+
+    my $fh = File::Temp->new();
+    print $fh $content;
+    close($fh);
+
+    return $fh;
+}
+
+sub all_metatiles
+{
+    my $range = shift;
+
+    my @list;
+    while (my $mt = $range->next())
+    {
+        push(@list, $mt->to_s());
+    }
+    return [ sort @list ];
+}
+
+#-----------------------------------------------------------------------------
+# parsing
+#-----------------------------------------------------------------------------
+
+is_deeply(Tirex::Metatiles::Coverage::parse_wkt('POLYGON((0 0, 10 0, 10 10, 0 0))'), [[[0, 0], [10, 0], [10, 10], [0, 0]]], 'wkt polygon');
+is_deeply(Tirex::Metatiles::Coverage::parse_wkt('SRID=4326;MULTIPOLYGON(((0 0,1 0,1 1)),((5 5,6 5,6 6),(5.1 5.1,5.2 5.1,5.2 5.2)))'),
+    [[[0, 0], [1, 0], [1, 1]], [[5, 5], [6, 5], [6, 6]], [['5.1', '5.1'], ['5.2', '5.1'], ['5.2', '5.2']]], 'wkt multipolygon with hole');
+eval { Tirex::Metatiles::Coverage::parse_wkt('LINESTRING(0 0, 1 1)'); };
+like($@, qr{only POLYGON and MULTIPOLYGON}, 'wkt linestring');
+eval { Tirex::Metatiles::Coverage::parse_wkt('POLYGON((0 0, x 1, 1 1))'); };
+like($@, qr{can't parse WKT point}, 'broken wkt');
+
+my $geojson = '{"type":"FeatureCollection","features":[
+    {"type":"Feature","properties":{},"geometry":{"type":"Polygon","coordinates":[[[0,0],[1,0],[1,1],[0,0]]]}},
+    {"type":"Feature","properties":{},"geometry":{"type":"MultiPolygon","coordinates":[[[[5,5],[6,5],[6,6],[5,5]]],[[[7,7],[8,7],[8,8],[7,7]]]]}},
+    {"type":"Feature","properties":{},"geometry":{"type":"Point","coordinates":[3,3]}}
+]}';
+is(scalar(@{Tirex::Metatiles::Coverage::parse_geojson($geojson)}), 3, 'geojson feature collection');
+eval { Tirex::Metatiles::Coverage::parse_geojson('{"type":'); };
+like($@, qr{can't parse GeoJSON}, 'broken geojson');
+
+eval { Tirex::Metatiles::Coverage->new( rings => [[[0, 0], [1, 1]]] ); };
+like($@, qr{no polygon with at least three points}, 'ring too short');
+
+eval { Tirex::Metatiles::Coverage->new_from_file(polygon_file('{"type":"Point","coordinates":[3,3]}')->filename()); };
+like($@, qr{no polygons in}, 'file without polygons');
+
+eval { Tirex::Metatiles::Coverage->new_from_file('/nonexistent/file.geojson'); };
+like($@, qr{can't open polygon file}, 'missing file');
+
+#-----------------------------------------------------------------------------
+# rows
+#-----------------------------------------------------------------------------
+
+# everything is in one metatile on low zoom levels
+my $world = Tirex::Metatiles::Coverage->new( rings => [[[-180, -85], [180, -85], [180, 85], [-180, 85]]] );
+is($world->count(0, 8, 8), 1, 'world on zoom 0');
+is($world->count(3, 8, 8), 1, 'world on zoom 3');
+is($world->count(4, 8, 8), 4, 'world on zoom 4');
+is($world->count(10, 8, 8), 128 * 128, 'world on zoom 10');
+
+# triangle: spans grow towards the south
+my $triangle = Tirex::Metatiles::Coverage->new( rings => [[[0, 0], [10, 0], [0, 10]]] );
+my $rows = $triangle->rows(10, 8, 8);
+my @rows;
+while (my ($y, $spans) = $rows->())
+{
+    push(@rows, [ $y, @$spans ]);
+}
+is_deeply(\@rows, [ [60, [64, 64]], [61, [64, 65]], [62, [64, 66]], [63, [64, 67]], [64, [64, 67]] ], 'triangle rows');
+
+# square with a hole: the row in the middle has two spans
+my $square = [[0, 0], [20, 0], [20, 20], [0, 20]];
+my $hole   = [[5, 5], [15, 5], [15, 15], [5, 15]];
+my $donut = Tirex::Metatiles::Coverage->new( rings => [ $square, $hole ] );
+my $full  = Tirex::Metatiles::Coverage->new( rings => [ $square ] );
+ok($donut->count(12, 8, 8) < $full->count(12, 8, 8), 'hole is left out');
+$rows = $donut->rows(12, 8, 8);
+my $max_spans = 0;
+while (my ($y, $spans) = $rows->())
+{
+    $max_spans = scalar(@$spans) if (@$spans > $max_spans);
+}
+is($max_spans, 2, 'rows through the hole have two spans');
+
+#-----------------------------------------------------------------------------
+# ranges
+#-----------------------------------------------------------------------------
+
+# a rectangle covers the same metatiles as the bbox
+my $rect = polygon_file('POLYGON((5.87 47.27, 15.04 47.27, 15.04 55.06, 5.87 55.06, 5.87 47.27))');
+my $r1 = Tirex::Metatiles::Range->new( map => 'test', z => '8-11', polygon => $rect->filename() );
+my $r2 = Tirex::Metatiles::Range->new( map => 'test', z => '8-11', bbox => '5.87,47.27,15.04,55.06' );
+is($r1->count(), $r2->count(), 'same count as bbox');
+is_deeply(all_metatiles($r1), all_metatiles($r2), 'same metatiles as bbox');
+is($r1->to_s(), 'maps=test z=8,11 polygon=' . $rect->filename(), 'to_s');
+
+# triangle from GeoJSON for two maps
+my $tri = polygon_file('{"type":"Feature","properties":{},"geometry":{"type":"Polygon","coordinates":[[[0,0],[10,0],[0,10],[0,0]]]}}');
+my $r3 = Tirex::Metatiles::Range->new( init => 'map=foo,bar z=10 polygon=' . $tri->filename() );
+my $list = all_metatiles($r3);
+is(scalar(@$list), 2 * 14, 'triangle metatiles for two maps');
+is($r3->count(), scalar(@$list), 'count matches iteration');
+is($r3->get_metatiles(), scalar(@$list), 'get_metatiles');
+ok((grep { $_ eq 'map=foo z=10 x=512 y=480' } @$list), 'metatile at the tip of the triangle');
+ok(!(grep { $_ eq 'map=foo z=10 x=536 y=480' } @$list), 'metatile outside of the triangle');
+
+$r3->reset();
+is(scalar(@{all_metatiles($r3)}), 2 * 14, 'same after reset');
+
+# on low zoom levels everything is in one metatile
+my $r4 = Tirex::Metatiles::Range->new( map => 'test', z => 2, polygon => $tri->filename() );
+is($r4->next()->to_s(), 'map=test z=2 x=0 y=0', 'low zoom');
+is($r4->next(), undef, 'only one metatile on low zoom');
+
+eval { Tirex::Metatiles::Range->new( map => 'test', z => 5, polygon => $tri->filename(), bbox => '0,0,1,1' ); };
+like($@, qr{you cannot have parameter 'polygon' and x/y/lon/lat/bbox parameters}, 'polygon and bbox');
+
+
+#-- THE END ------------------------------------------------------------------
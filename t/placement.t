@@ -0,0 +1,132 @@
+#-----------------------------------------------------------------------------
+#
+#  t/placement.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use File::Path qw( make_path );
+use File::Temp;
+
+use lib 'lib';
+
+use Tirex;
+use Tirex::Placement;
+use Tirex::Renderer;
+
+#-----------------------------------------------------------------------------
+
+is_deeply([Tirex::Placement::parse_cpulist('0-3,8,10-11')], [0, 1, 2, 3, 8, 10, 11], 'parse cpulist');
+is_deeply([Tirex::Placement::parse_cpulist('5,1,1-2')], [1, 2, 5], 'parse unsorted cpulist');
+is_deeply([Tirex::Placement::parse_cpulist('3-1')], [], 'parse broken range');
+is_deeply([Tirex::Placement::parse_cpulist('x')], [], 'parse broken cpulist');
+is(Tirex::Placement::format_cpulist(11, 0, 1, 2, 3, 8, 10), '0-3,8,10-11', 'format cpulist');
+is(Tirex::Placement::format_cpulist(), '', 'format empty cpulist');
+
+#-----------------------------------------------------------------------------
+# fake sysfs: two nodes with two cores each, every core has two hardware
+# threads (cpu n and n+4 are siblings like on real machines)
+#-----------------------------------------------------------------------------
+
+my $sysfs = File::Temp::tempdir(CLEANUP => 1);
+
+sub write_file
+{
+    my ($file, $content) = @_;
+    open(my $fh, '>', $file) or die("can't write $file: $!");
+    print $fh "$content\n";
+    close($fh);
+}
+
+make_path("$sysfs/node/node0", "$sysfs/node/node1", "$sysfs/cpu");
+write_file("$sysfs/node/node0/cpulist", '0-1,4-5');
+write_file("$sysfs/node/node1/cpulist", '2-3,6-7');
+write_file("$sysfs/cpu/online", '0-7');
+foreach my $cpu (0 .. 7)
+{
+    my $dir = "$sysfs/cpu/cpu$cpu/topology";
+    make_path($dir);
+    write_file("$dir/physical_package_id", $cpu % 4 < 2 ? 0 : 1);
+    write_file("$dir/core_id", $cpu % 2);
+}
+
+my $t = Tirex::Placement->new( sysfs => $sysfs );
+is_deeply([$t->get_cpus()], [0 .. 7], 'online cpus');
+
+is($t->place('none', 0), undef, 'none without cpuset');
+is_deeply($t->place('none', 1, '0-2'), { cpus => [0, 1, 2], node => undef }, 'none with cpuset');
+
+is_deeply($t->place('spread', 0), { cpus => [0, 1, 4, 5], node => 0 }, 'spread worker 0');
+is_deeply($t->place('spread', 1), { cpus => [2, 3, 6, 7], node => 1 }, 'spread worker 1');
+is_deeply($t->place('spread', 2), { cpus => [0, 1, 4, 5], node => 0 }, 'spread worker 2');
+is_deeply($t->place('spread', 1, '0-1,4-5'), { cpus => [0, 1, 4, 5], node => 0 }, 'spread within cpuset');
+
+is_deeply($t->place('core', 0), { cpus => [0, 4], node => 0 }, 'core worker 0');
+is_deeply($t->place('core', 1), { cpus => [2, 6], node => 1 }, 'core worker 1');
+is_deeply($t->place('core', 2), { cpus => [1, 5], node => 0 }, 'core worker 2');
+is_deeply($t->place('core', 3), { cpus => [3, 7], node => 1 }, 'core worker 3');
+is_deeply($t->place('core', 4), { cpus => [0, 4], node => 0 }, 'core worker 4 wraps around');
+is_deeply($t->place('core', 1, '0-3'), { cpus => [2], node => 1 }, 'core within cpuset');
+
+eval { $t->place('bogus', 0); };
+like($@, qr{unknown placement policy 'bogus'}, 'unknown policy');
+eval { $t->place('spread', 0, '12-15'); };
+like($@, qr{no online CPUs in cpuset}, 'cpuset without online cpus');
+
+eval { Tirex::Placement->new( sysfs => "$sysfs/nonexistent" ); };
+like($@, qr{can't find any CPUs}, 'missing sysfs');
+
+#-----------------------------------------------------------------------------
+# machine without NUMA information
+#-----------------------------------------------------------------------------
+
+my $flat = File::Temp::tempdir(CLEANUP => 1);
+make_path("$flat/cpu/cpu0", "$flat/cpu/cpu1");
+$t = Tirex::Placement->new( sysfs => $flat );
+is_deeply($t->place('spread', 1), { cpus => [0, 1], node => 0 }, 'spread without numa');
+is_deeply($t->place('core', 1), { cpus => [1], node => 0 }, 'core without topology');
+
+#-----------------------------------------------------------------------------
+# apply
+#-----------------------------------------------------------------------------
+
+ok(Tirex::Placement::apply(undef), 'apply nothing');
+
+SKIP: {
+    skip('no sysfs', 1) unless (-r '/sys/devices/system/cpu/online');
+    my $real = Tirex::Placement->new();
+    my $placement = $real->place('core', 0);
+    ok(Tirex::Placement::apply({ cpus => $placement->{'cpus'}, node => undef }), 'apply to current process');
+}
+
+#-----------------------------------------------------------------------------
+# renderer config
+#-----------------------------------------------------------------------------
+
+my $r = Tirex::Renderer->new( name => 'p1', path => '/bin/true', port => 1240, procs => 2 );
+is($r->get_placement(), 'none', 'default placement');
+is($r->get_numa_memory(), 'preferred', 'default numa_memory');
+ok(! $r->has_placement(), 'no placement');
+
+$r = Tirex::Renderer->new( name => 'p2', path => '/bin/true', port => 1241, procs => 2, placement => 'core', numa_memory => 'bind' );
+is($r->get_placement(), 'core', 'placement');
+is($r->get_numa_memory(), 'bind', 'numa_memory');
+ok($r->has_placement(), 'has placement');
+
+$r = Tirex::Renderer->new( name => 'p3', path => '/bin/true', port => 1242, procs => 2, cpuset => '0-3,8' );
+is($r->get_cpuset(), '0-3,8', 'cpuset');
+ok($r->has_placement(), 'cpuset is a placement');
+
+eval { Tirex::Renderer->new( name => 'p4', path => '/bin/true', port => 1243, procs => 2, placement => 'numa' ); };
+like($@, qr{placement must be}, 'unknown placement');
+eval { Tirex::Renderer->new( name => 'p5', path => '/bin/true', port => 1244, procs => 2, cpuset => 'all' ); };
+like($@, qr{cpuset must be}, 'broken cpuset');
+eval { Tirex::Renderer->new( name => 'p6', path => '/bin/true', port => 1245, procs => 2, numa_memory => 'local' ); };
+like($@, qr{numa_memory must be}, 'unknown numa_memory');
+
+
+#-- THE END ------------------------------------------------------------------
@@ -0,0 +1,127 @@
+#-----------------------------------------------------------------------------
+#
+#  t/prioqueue_order.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use lib 'lib';
+
+use Tirex;
+use Tirex::PrioQueue;
+use Tirex::Queue;
+
+#-----------------------------------------------------------------------------
+
+sub mt  { return Tirex::Metatile->new(map => 'test', x => $_[0], y => $_[1], z => $_[2]); }
+sub job { return Tirex::Job->new(metatile => mt(@_[0..2]), prio => $_[3] || 1, request_time => $_[4]); }
+sub xy  { my $job = shift; return defined $job ? $job->get_x() . ',' . $job->get_y() : 'undef'; }
+
+is(Tirex::PrioQueue->new(prio => 1, order => 'random'), undef, 'unknown order');
+eval { Tirex::Queue->new(order => 'random'); };
+like($@, qr{unknown queue order}, 'queue croaks on unknown order');
+
+# curve keys: the four quadrants on zoom level 4 (metatiles are 8x8 tiles)
+my @hilbert = map { Tirex::PrioQueue::hilbert_key(mt(@$_, 4)) } ([0, 0], [0, 8], [8, 8], [8, 0]);
+is_deeply([sort @hilbert], \@hilbert, 'hilbert order of quadrants');
+
+my @morton = map { Tirex::PrioQueue::morton_key(mt(@$_, 4)) } ([0, 0], [8, 0], [0, 8], [8, 8]);
+is_deeply([sort @morton], \@morton, 'morton order of quadrants');
+
+ok(Tirex::PrioQueue::hilbert_key(mt(0, 0, 3)) lt Tirex::PrioQueue::hilbert_key(mt(0, 0, 4)), 'zoom level makes key unique');
+ok(Tirex::PrioQueue::hilbert_key(mt(8, 8, 4)) lt Tirex::PrioQueue::hilbert_key(mt(16, 16, 5)) &&
+   Tirex::PrioQueue::hilbert_key(mt(16, 16, 5)) lt Tirex::PrioQueue::hilbert_key(mt(8, 0, 4)), 'lower zoom covering the same area is close');
+
+# consecutive tiles on the curve are neighbours
+my @keys = sort { $a->[0] cmp $b->[0] } map { my ($x, $y) = ($_ % 8 * 8, int($_ / 8) * 8); [Tirex::PrioQueue::hilbert_key(mt($x, $y, 6)), $x, $y] } (0 .. 63);
+my $neighbours = 1;
+for (my $i = 1; $i < @keys; $i++)
+{
+    $neighbours = 0 if (abs($keys[$i]->[1] - $keys[$i-1]->[1]) + abs($keys[$i]->[2] - $keys[$i-1]->[2]) != 8);
+}
+ok($neighbours, 'hilbert curve only has steps to neighbouring metatiles');
+
+# jobs are served along the curve, starting after the last one served
+my $pq = Tirex::PrioQueue->new(prio => 1, order => 'hilbert');
+my @jobs = map { job(@$_, 4) } ([8, 0], [0, 8], [0, 0], [8, 8]);
+$pq->add($_) foreach (@jobs);
+is($pq->size(), 4, 'size');
+
+is(xy($pq->peek()), '0,0', 'peek first on curve');
+is(xy($pq->next()), '0,0', 'next returns peeked job');
+is(xy($pq->next()), '0,8', 'second on curve');
+
+$pq->add(job(0, 0, 4));
+is(xy($pq->next()), '8,8', 'continues after last job');
+is(xy($pq->next()), '8,0', 'last on curve');
+is(xy($pq->next()), '0,0', 'wraps around');
+ok($pq->empty(), 'empty');
+is($pq->next(), undef, 'next on empty queue');
+
+# remove
+$pq->add($_) foreach (@jobs);
+is($pq->remove($jobs[2]), $jobs[2], 'remove job');
+is($pq->size(), 3, 'size after remove');
+is(join(' ', map { xy($pq->next()) } (1 .. 3)), '0,8 8,8 8,0', 'removed job is not served');
+ok($pq->empty(), 'empty after serving the rest');
+
+# the oldest job is served first when it is too old
+$pq->reset();
+$pq->{'max_age'} = 10;
+$pq->add(job(8, 0, 4, 1, time() - 5));
+$pq->add(job(0, 0, 4, 1));
+is(xy($pq->next()), '0,0', 'old job waits');
+$pq->add(job(0, 0, 4, 1));
+$pq->{'queue'}->[0]->{'request_time'} = time() - 20;
+is(xy($pq->next()), '8,0', 'too old job is served first');
+is($pq->age_first(), $pq->age_last(), 'age of remaining job');
+
+# large queue: jobs come in and are removed while the queue is served,
+# the jobs are still served along the curve
+$pq = Tirex::PrioQueue->new(prio => 1, order => 'hilbert');
+srand(42);
+my %queued;
+for (my $n = 0; $n < 20000; $n++)
+{
+    my $job = job(int(rand(1024)) * 8, int(rand(1024)) * 8, 13);
+    next if ($queued{xy($job)});
+    $pq->add($job);
+    $queued{xy($job)} = $job;
+}
+my @removed = grep { $_ % 3 == 0 } (0 .. scalar(keys %queued) - 1);
+my @all = sort keys %queued;
+$pq->remove($queued{$all[$_]}) foreach (@removed);
+is($pq->size(), scalar(@all) - scalar(@removed), 'size of large queue');
+
+my ($last, $wraps, $served) = ('', 0, 0);
+while (my $job = $pq->next())
+{
+    my $key = Tirex::PrioQueue::hilbert_key($job->get_metatile());
+    $wraps++ if ($key lt $last);
+    $last = $key;
+    $served++;
+
+    # new jobs behind the cursor are served after wrapping around
+    $pq->add(job(0, 0, 13)) if ($served == 1000);
+}
+is($served, scalar(@all) - scalar(@removed) + 1, 'all jobs in large queue served');
+is($wraps, 1, 'large queue served along the curve');
+cmp_ok($pq->{'stale'}, '<=', $pq->size() + 64, 'removed jobs are dropped from heaps');
+
+# queue keeps the priorities
+my $q = Tirex::Queue->new(order => 'morton', max_age => 60);
+$q->add(job(8, 8, 4, 2), job(0, 0, 4, 2), job(8, 0, 4, 1), job(0, 8, 4, 1));
+is(xy($q->next()), '8,0', 'lower prio first');
+is(xy($q->next()), '0,8', 'then rest of prio');
+is(xy($q->next()), '0,0', 'next prio');
+
+$q->add(job(8, 8, 4, 2));
+is($q->size(), 1, 'merged job in queue');
+is(xy($q->next()), '8,8', 'merged job');
+ok($q->empty(), 'queue empty');
+
+#-- THE END ------------------------------------------------------------------
@@ -46,6 +46,9 @@ $q->reset();
 );
 $q->add(\@jobs);
 is($q->size(), 3, 'added three jobs');
+is($q->size_of_prio(7), 1, 'one job with prio 7');
+is($q->size_of_prio(8), 0, 'no job with prio 8');
+is($q->size_of_prio(99), 0, 'no job with prio 99');
 $q->reset();
 
 
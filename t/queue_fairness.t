@@ -0,0 +1,150 @@
+#-----------------------------------------------------------------------------
+#
+#  t/queue_fairness.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use lib 'lib';
+
+use Tirex;
+use Tirex::Queue;
+use Tirex::Queue::Fairness;
+use Tirex::PrioQueue::Fair;
+
+#-----------------------------------------------------------------------------
+
+sub job { return Tirex::Job->new(metatile => Tirex::Metatile->new(map => 'test', x => $_[0] * 8, y => 0, z => 12), prio => $_[2] || 1, source => $_[1], request_time => $_[3] || time()); }
+
+# config
+eval { Tirex::Queue::Fairness->new( sources => [ { weight => 1 } ] ); };
+like($@, qr{source needs a name}, 'source without name');
+eval { Tirex::Queue::Fairness->new( sources => [ { name => 'Foo' } ] ); };
+like($@, qr{invalid source name}, 'invalid name');
+eval { Tirex::Queue::Fairness->new( sources => [ { name => 'foo', weight => 0 } ] ); };
+like($@, qr{invalid weight}, 'weight must be positive');
+eval { Tirex::Queue::Fairness->new( sources => [ { name => 'foo', rate => 'x' } ] ); };
+like($@, qr{invalid rate}, 'invalid rate');
+eval { Tirex::Queue::Fairness->new( sources => [ { name => 'foo', rate => 1, burst => 0 } ] ); };
+like($@, qr{invalid burst}, 'invalid burst');
+
+my $f = Tirex::Queue::Fairness->new( sources => [
+    { name => 'modtile', weight => 3 },
+    { name => 'batch',   weight => 1, rate => 2, burst => 4 },
+]);
+
+is($f->weight('modtile'), 3, 'weight');
+is($f->weight('batch'),   1, 'weight');
+is($f->weight('other'),   1, 'weight of unconfigured source is weight of default');
+
+is($f->key(job(0, 'batch')),  'batch',   'key');
+is($f->key(job(0, undef)),    'default', 'key of job without source');
+is($f->key(job(0, 'A B')),    'default', 'key of job with invalid source');
+is($f->key(job(0, 'other')),  'default', 'key of job with unconfigured source');
+
+# token bucket
+is($f->tokens('modtile', 100), undef, 'no tokens without rate limit');
+is($f->tokens('batch', 100),   4,     'bucket starts full');
+
+my $admitted = 0;
+foreach my $i (1 .. 6)
+{
+    $admitted++ if ($f->admit(job($i, 'batch'), 0, 100));
+}
+is($admitted, 4, 'burst is admitted at once');
+is($f->tokens('batch', 100), 0, 'no tokens left');
+
+ok($f->admit(job(1, 'batch'), 1, 100), 'merged job is always admitted');
+ok(! $f->admit(job(7, 'batch'), 0, 100.4), 'not enough time for a new token');
+ok($f->admit(job(7, 'batch'), 0, 100.5), 'new token after 1/rate seconds');
+is($f->tokens('batch', 200), 4, 'bucket is refilled up to burst');
+
+ok($f->admit(job($_, 'modtile'), 0, 100), 'no rate limit') foreach (1 .. 10);
+
+# unconfigured sources share the state of 'default'
+my $fd = Tirex::Queue::Fairness->new( sources => [ { name => 'default', rate => 1, burst => 2 } ] );
+$admitted = 0;
+foreach my $i (1 .. 6)
+{
+    $admitted++ if ($fd->admit(job($i, "x$i"), 0, 100));
+}
+is($admitted, 2, 'unconfigured sources share the bucket of default');
+is_deeply([map { $_->{'name'} } @{$fd->status()}], ['default'], 'and are counted as default');
+
+my %status = map { ($_->{'name'} => $_) } @{$f->status()};
+is_deeply([sort keys %status], ['batch', 'modtile'], 'status of sources that sent jobs');
+is($status{'batch'}->{'admitted'}, 5, 'admitted');
+is($status{'batch'}->{'merged'},   1, 'merged');
+is($status{'batch'}->{'rejected'}, 3, 'rejected');
+is($status{'batch'}->{'rate'},     2, 'rate');
+is($status{'batch'}->{'burst'},    4, 'burst');
+is($status{'modtile'}->{'admitted'}, 10, 'admitted');
+ok(! exists $status{'modtile'}->{'rate'}, 'no rate in status without rate limit');
+
+# weighted fair queuing
+my $pq = Tirex::PrioQueue::Fair->new(prio => 1, fairness => $f);
+is($pq->add(job(0, 'batch', 2)), undef, 'job with wrong prio is not added');
+
+$pq->add(job($_, 'batch'))         foreach (0 .. 19);
+$pq->add(job(100 + $_, 'modtile')) foreach (0 .. 19);
+is($pq->size(), 40, 'size');
+is_deeply($pq->status()->{'sources'}, { batch => 20, modtile => 20 }, 'jobs per source in status');
+
+my %served;
+foreach (1 .. 20)
+{
+    my $peek = $pq->peek();
+    my $job  = $pq->next();
+    is($job, $peek, 'peek returns next job') if ($_ == 1);
+    $served{$job->get_source()}++;
+}
+is($served{'modtile'}, 15, 'source with weight 3 gets three quarters of the jobs');
+is($served{'batch'},   5,  'source with weight 1 gets one quarter of the jobs');
+is($pq->size(), 20, 'size after next');
+
+my ($job) = grep { $_->get_source() eq 'batch' } $pq->jobs();
+is($pq->remove($job), $job, 'remove');
+is($pq->remove($job), undef, 'remove job not in queue');
+is($pq->size(), 19, 'size after remove');
+
+$pq->next() foreach (1 .. 14);
+is($pq->status()->{'sources'}->{'modtile'}, undef, 'modtile has no jobs left');
+is($pq->next()->get_source(), 'batch', 'other source gets all the jobs');
+
+# a source that was idle doesn't get to catch up
+$pq->reset();
+$pq->add(job($_, 'batch')) foreach (0 .. 9);
+$pq->next() foreach (1 .. 5);
+$pq->add(job(100 + $_, 'modtile')) foreach (0 .. 9);
+%served = ();
+$served{$pq->next()->get_source()}++ foreach (1 .. 5);
+is($served{'batch'},   1, 'idle source starts at current virtual time');
+is($served{'modtile'}, 4, 'and only gets its share from then on');
+
+# queue with fairness
+my $q = Tirex::Queue->new(fairness => $f);
+$q->add(job($_, 'batch', 5, 1000 + $_))         foreach (0 .. 3);
+$q->add(job(100 + $_, 'modtile', 5, 2000 + $_)) foreach (0 .. 3);
+$q->add(job(200, 'batch', 1));
+is($q->size(), 9, 'queue size');
+is($q->next()->get_x(), 200 * 8, 'lower prio first');
+is($q->next()->get_source(), 'batch', 'then by virtual start time, ties by name');
+is($q->next()->get_source(), 'modtile', 'modtile');
+
+# merging a job for the same metatile keeps the job in the queue
+my $merge = job(100 + 3, 'batch', 5);
+$q->add($merge);
+is($q->size(), 6, 'merged job');
+is($q->in_queue($merge)->get_source(), 'batch', 'merged job has source of the new job');
+
+my @sources;
+while (my $j = $q->next()) { push(@sources, $j->get_source()); }
+is(scalar(@sources), 6, 'all jobs come out of the queue');
+is($q->size(), 0, 'queue empty');
+
+
+#-- THE END ------------------------------------------------------------------
@@ -0,0 +1,188 @@
+#-----------------------------------------------------------------------------
+#
+#  t/queue_journal.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use File::Temp;
+
+use lib 'lib';
+
+use Tirex;
+use Tirex::Queue;
+use Tirex::Queue::Journal;
+use Tirex::Renderer;
+use Tirex::Map;
+
+#-----------------------------------------------------------------------------
+
+sub mt  { return Tirex::Metatile->new(map => $_[0], x => $_[1], y => $_[2], z => $_[3]); }
+sub job { return Tirex::Job->new(metatile => mt(@_[0..3]), prio => $_[4], request_time => $_[5], defined $_[6] ? (expire => $_[6]) : ()); }
+
+sub content
+{
+    my $queue = shift;
+    return [ map { join(' ', $_->get_map(), $_->get_z(), $_->get_x(), $_->get_y(), $_->get_prio(), $_->{'request_time'}, $_->{'expire'} || '-') } $queue->jobs() ];
+}
+
+my $renderer = Tirex::Renderer->new( name => 'journal', path => '/bin/true', port => 1250, procs => 1 );
+Tirex::Map->new( name => 'a', renderer => $renderer, tiledir => '/tmp' );
+Tirex::Map->new( name => 'b', renderer => $renderer, tiledir => '/tmp' );
+
+my $dir  = File::Temp::tempdir(CLEANUP => 1);
+my $file = "$dir/queue";
+my $now  = time();
+
+eval { Tirex::Queue::Journal->new( queue => Tirex::Queue->new() ); };
+like($@, qr{need file for queue journal}, 'file missing');
+
+#-----------------------------------------------------------------------------
+# nothing to restore on first start
+#-----------------------------------------------------------------------------
+
+my $j = Tirex::Queue::Journal->new( queue => Tirex::Queue->new(), file => $file );
+is_deeply([$j->restore()], [0, 0], 'nothing restored');
+is($j->get_generation(), 1, 'first snapshot written');
+ok(-f $file && -f "$file.journal", 'files written');
+
+#-----------------------------------------------------------------------------
+# snapshot and restore on clean shutdown
+#-----------------------------------------------------------------------------
+
+$j->add(job('a', 0, 0, 10, 5, $now - 100), job('b', 8, 8, 10, 2, $now - 50, $now + 3600), job('a', 16, 0, 10, 5, $now - 10));
+$j->add([ job('a', 0, 8, 12, 1, $now - 5) ]);
+is($j->size(), 4, 'jobs added through journal');
+is($j->get_records(), 4, 'records in journal');
+is($j->next()->get_map(), 'a', 'next job');
+is($j->get_records(), 5, 'next is recorded');
+my $expected = content($j);
+
+ok($j->snapshot(), 'snapshot');
+is($j->get_records(), 0, 'journal is empty after snapshot');
+is(-s "$file.journal", 12, 'only journal header');
+is(-s $file, 22 + 4 + 23 * 3, 'size of snapshot');
+
+my $j2 = Tirex::Queue::Journal->new( queue => Tirex::Queue->new(), file => $file );
+is_deeply([$j2->restore()], [3, 0], 'restored three jobs');
+is_deeply(content($j2), $expected, 'same jobs with same prio, request time and expire time');
+is($j2->get_generation(), 3, 'new snapshot after restore');
+
+#-----------------------------------------------------------------------------
+# crash: snapshot plus journal
+#-----------------------------------------------------------------------------
+
+$j2->add(job('b', 0, 0, 14, 3, $now - 1));
+$j2->add(job('a', 16, 0, 10, 9, $now - 1));   # merged with the job that is there
+$j2->remove(job('b', 8, 8, 10, 1));
+ok($j2->flush(), 'flush');
+$j2->add(job('a', 64, 64, 10, 1, $now));       # not flushed, lost in the crash
+$expected = [ grep { !/^a 10 64 64/ } @{content($j2)} ];
+
+my $j3 = Tirex::Queue::Journal->new( queue => Tirex::Queue->new(), file => $file );
+is_deeply([$j3->restore()], [3, 0], 'restored from snapshot and journal');
+is_deeply(content($j3), $expected, 'same jobs as before the crash except unflushed');
+
+#-----------------------------------------------------------------------------
+# incomplete record at the end of the journal and journal of an older
+# snapshot
+#-----------------------------------------------------------------------------
+
+$j3->add(job('b', 0, 8, 10, 4, $now));
+ok($j3->flush(), 'flush');
+$expected = content($j3);
+open(my $fh, '>>', "$file.journal") or die;
+print $fh pack('a C/a N', 'a', 'b', 4);
+close($fh);
+
+my $j4 = Tirex::Queue::Journal->new( queue => Tirex::Queue->new(), file => $file );
+is_deeply([$j4->restore()], [4, 0], 'incomplete record ignored');
+is_deeply(content($j4), $expected, 'same jobs');
+
+$j4->add(job('b', 0, 16, 10, 4, $now));
+ok($j4->flush(), 'flush');
+my $old_journal = do { open(my $in, '<', "$file.journal") or die; local $/; <$in> };
+ok($j4->snapshot(), 'snapshot');
+open($fh, '>', "$file.journal") or die;
+print $fh $old_journal;
+close($fh);
+
+my $j5 = Tirex::Queue::Journal->new( queue => Tirex::Queue->new(), file => $file );
+is_deeply([$j5->restore()], [5, 0], 'journal of older snapshot ignored');
+
+#-----------------------------------------------------------------------------
+# unknown maps and expired jobs are dropped, new jobs are merged
+#-----------------------------------------------------------------------------
+
+$j5->add(job('b', 0, 0, 11, 1, $now, $now - 1));
+Tirex::Map->new( name => 'c', renderer => $renderer, tiledir => '/tmp' );
+$j5->add(job('c', 0, 0, 11, 1, $now));
+ok($j5->snapshot(), 'snapshot');
+Tirex::Map->clear();
+Tirex::Map->new( name => 'a', renderer => $renderer, tiledir => '/tmp' );
+Tirex::Map->new( name => 'b', renderer => $renderer, tiledir => '/tmp' );
+
+my $q = Tirex::Queue->new();
+$q->add(job('a', 16, 0, 10, 1, $now));
+my $j6 = Tirex::Queue::Journal->new( queue => $q, file => $file );
+is_deeply([$j6->restore()], [5, 2], 'unknown map and expired job dropped');
+is($q->in_queue(job('a', 16, 0, 10, 1))->get_prio(), 1, 'merged with new job');
+is($q->in_queue(job('a', 16, 0, 10, 1))->{'request_time'}, $now - 10, 'merged job keeps oldest request time');
+
+#-----------------------------------------------------------------------------
+# jobs currently rendering are written to the snapshot on exit
+#-----------------------------------------------------------------------------
+
+my $rendering = $j6->next();
+ok($j6->snapshot($rendering, $j6->peek()), 'snapshot with rendering jobs');
+my $j8 = Tirex::Queue::Journal->new( queue => Tirex::Queue->new(), file => $file );
+is_deeply([$j8->restore()], [5, 0], 'rendering job restored, queued job only once');
+ok($j8->in_queue($rendering), 'rendering job in queue');
+
+#-----------------------------------------------------------------------------
+# broken files
+#-----------------------------------------------------------------------------
+
+open($fh, '>', $file) or die;
+print $fh "this is not a snapshot\n";
+close($fh);
+my $j7 = Tirex::Queue::Journal->new( queue => Tirex::Queue->new(), file => $file );
+is_deeply([$j7->restore()], [0, 0], 'broken snapshot');
+
+$j7->reset();
+is($j7->size(), 0, 'reset');
+
+#-----------------------------------------------------------------------------
+# journal is disabled if the files can't be written
+#-----------------------------------------------------------------------------
+
+my $j9 = Tirex::Queue::Journal->new( queue => Tirex::Queue->new(), file => "$dir/missing/queue" );
+is_deeply([$j9->restore()], [0, 0], 'nothing restored');
+ok($j9->is_disabled(), 'journal disabled after failed snapshot');
+$j9->add(job('a', 0, 0, 10, 5, $now));
+is($j9->size(), 1, 'queue works without journal');
+is($j9->next()->get_map(), 'a', 'next works without journal');
+is($j9->get_records(), 0, 'nothing recorded');
+is($j9->{'buffer'}, '', 'nothing buffered');
+ok(!$j9->flush(), 'flush fails');
+ok(!$j9->snapshot(), 'snapshot fails');
+
+ok($j7->flush(), 'flush');
+ok(-e $file && -e "$file.journal", 'files exist before disable');
+$j7->disable();
+ok(! -e $file && ! -e "$file.journal", 'files removed on disable');
+$j7->add(job('a', 0, 0, 10, 5, $now));
+is($j7->get_records(), 0, 'nothing recorded after disable');
+
+# the snapshot on exit is still written
+ok($j7->snapshot(), 'snapshot after disable');
+ok(!$j7->is_disabled(), 'journal enabled again');
+my $j10 = Tirex::Queue::Journal->new( queue => Tirex::Queue->new(), file => $file );
+is_deeply([$j10->restore()], [1, 0], 'queue restored from snapshot after disable');
+
+
+#-- THE END ------------------------------------------------------------------
@@ -94,5 +94,25 @@ is($r3->num_workers(), 2, 'num workers 2');
 $r3->remove_worker(123);
 is($r3->num_workers(), 1, 'num workers 1');
 
+ok(!$r3->is_sticky(), 'not sticky');
+is_deeply([$r3->get_ports()], [1234], 'one port for all workers');
+
+eval { Tirex::Renderer->new( name => 'sticky', path => '/bin/true', port => 1235, procs => 3, worker_port => 'x' ); };
+($@ =~ qr{worker_port must be a port number}) ? pass() : fail();
+
+my $r4 = Tirex::Renderer->new( name => 'sticky', path => '/bin/true', port => 1235, procs => 3, worker_port => 2000 );
+ok($r4->is_sticky(), 'sticky');
+is($r4->get_worker_port(2), 2002, 'worker port');
+is_deeply([$r4->get_ports()], [2000, 2001, 2002], 'one port per worker');
+
+is($r4->free_worker_index(), 0, 'first free worker index');
+$r4->add_worker(10, 0);
+$r4->add_worker(11, 1);
+is($r4->free_worker_index(), 2, 'next free worker index');
+$r4->add_worker(12, 2);
+is($r4->free_worker_index(), undef, 'no free worker index');
+$r4->remove_worker(11);
+is($r4->free_worker_index(), 1, 'index of removed worker is free again');
+
 
 #-- THE END ------------------------------------------------------------------
@@ -90,12 +90,13 @@ ok(!$bucket3->can_render(0, 30), 'bucket 3 can 0, 30');
 
 my $expected_status = {
     buckets => [
-        { name => 'live',   minprio =>  1, maxprio =>  9, maxproc => 3, maxload => 30, numproc => 0, active => 1, can_render => JSON::true },
-        { name => 'middle', minprio => 10, maxprio => 19, maxproc => 2, maxload => 20, numproc => 0, active => 1, can_render => JSON::true },
-        { name => 'backg',  minprio => 20, maxprio =>  0, maxproc => 1, maxload => 10, numproc => 0, active => 1, can_render => JSON::true },
+        { name => 'live',   minprio =>  1, maxprio =>  9, maxproc => 3, maxload => 30, numproc => 0, active => 1, can_render => JSON::true, limited_by => '' },
+        { name => 'middle', minprio => 10, maxprio => 19, maxproc => 2, maxload => 20, numproc => 0, active => 1, can_render => JSON::true, limited_by => '' },
+        { name => 'backg',  minprio => 20, maxprio =>  0, maxproc => 1, maxload => 10, numproc => 0, active => 1, can_render => JSON::true, limited_by => '' },
     ],
     num_rendering => 0,
     rendering     => [],
+    layer_profile => {},
     stats         => {
         count_requested => 0,
         count_expired   => 0,
@@ -108,7 +109,21 @@ my $expected_status = {
 };
 my $is_status = $rm->status();
 delete($is_status->{'load'}); # remove load because we don't know what it is
+delete($is_status->{'pressure'}); # same for pressure
 is_deeply($is_status, $expected_status, 'status');
 
+#-----------------------------------------------------------------------------
+
+my $job = Tirex::Job->new( metatile => Tirex::Metatile->new( map => 'test', x => 0, y => 0, z => 3 ), prio => 1 );
+$rm->add_layer_profile($job, 'land,10,20,300;roads,5,40,1000');
+$rm->add_layer_profile($job, 'land,30,20,100;broken');
+$rm->add_layer_profile($job, 'roads,x,1,1;land,1,2,3,4;roads,5,4');
+is_deeply($rm->status()->{'layer_profile'}, {
+    test => { 3 => {
+        land  => { count => 2, sum_query_time => 40, sum_render_time => 40, sum_features =>  400 },
+        roads => { count => 1, sum_query_time =>  5, sum_render_time => 40, sum_features => 1000 },
+    } },
+}, 'layer profile');
+
 
 #-- THE END ------------------------------------------------------------------
@@ -73,6 +73,22 @@ is_deeply($rjstatus, $status, 'status');
     sleep(2);
     is($rj->check_timeout(), 1, 'check_timeout');
     is($rj->count(), 0, 'count 0');
+
+    # jobs with their own timeout and expected cost
+    my $rj2 = Tirex::Manager::RenderingJobs->new( timeout => 100 );
+    my $short = Tirex::Job->new( metatile => Tirex::Metatile->new(map => 'test', x => 0, y => 0, z => 3), prio => 1 );
+    my $long  = Tirex::Job->new( metatile => Tirex::Metatile->new(map => 'test', x => 8, y => 0, z => 4), prio => 1 );
+    $short->{'timeout'} = 1;
+    $short->{'expected_cost'} = 500;
+    $long->{'expected_cost'} = 2500;
+    $rj2->add($short);
+    $rj2->add($long);
+    is($rj2->expected_cost(), 3000, 'expected cost');
+    is((grep { $_->{'x'} == 0 } @{$rj2->status()})[0]->{'expected_cost'}, 500, 'expected cost in status');
+    sleep(2);
+    is($rj2->check_timeout(), 1, 'only job with short timeout removed');
+    is($rj2->find_by_id($long->get_id()), $long, 'other job still there');
+    is($rj2->expected_cost(), 2500, 'expected cost after timeout');
 }
 
 
@@ -0,0 +1,138 @@
+#-----------------------------------------------------------------------------
+#
+#  t/status.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use lib 'lib';
+
+use JSON;
+
+use Tirex;
+use Tirex::Status;
+
+#-----------------------------------------------------------------------------
+
+# use a different key so we don't interfere with a running master
+$Tirex::Status::SHMKEY = 0x00002400 + ($$ % 0x100);
+
+my $status = eval { Tirex::Status->new( master => 1 ) };
+SKIP: {
+    skip("no SysV shared memory available: $@", 1) unless ($status);
+
+    my %data = (
+        started => 1000,
+        queue   => {
+            size       => 3,
+            maxsize    => 10,
+            prioqueues => [
+                { prio => 1,  size => 2, maxsize => 5, age_first => 10, age_last => 3 },
+                { prio => 10, size => 1, maxsize => 5, age_first => 0,  age_last => 0 },
+                { prio => 20, size => 0, maxsize => 1 },
+            ],
+        },
+        rm => {
+            load          => 1.5,
+            num_rendering => 1,
+            stats         => {
+                count_requested => 100,
+                count_expired   => 3,
+                count_timeouted => 1,
+                count_error     => 2,
+                count_rendered  => { test => [0, 1, 2, 3] },
+                sum_render_time => { test => [0, 10, 20, 30] },
+                max_render_time => { test => [0, 10, 15, 20] },
+            },
+            pressure      => { cpu => { 10 => 1.25 }, memory => { 10 => 0 }, io => { 10 => 40.5 } },
+            layer_profile => { test => { 3 => { land => { count => 1, query_ms => 2, render_ms => 3, features => 4 } } } },
+            buckets       => [
+                { name => 'live', minprio => 1, maxprio => 9, numproc => 1, maxproc => 4, maxload => 20, active => 1, can_render => JSON::true, limited_by => '' },
+                { name => 'bulk', minprio => 10, maxprio => 0, numproc => 0, maxproc => 2, maxload => 2.5, active => 0, can_render => JSON::false, limited_by => 'inactive' },
+            ],
+            rendering     => [
+                { map => 'test', x => 8, y => 16, z => 5, prio => 1, age => 2 },
+            ],
+        },
+        renderers => [ { name => 'mapnik', port => 9331 } ],
+        maps      => [ { name => 'test', renderer => 'mapnik' } ],
+        sources   => [ { name => 'batch', weight => 1, admitted => 10, merged => 2, rejected => 3, rate => 100, burst => 1000, tokens => 990 } ],
+    );
+
+    $status->update(%data);
+
+    my $reader = Tirex::Status->new();
+    my $s = $reader->read_status();
+
+    is($s->{'pid'}, $$, 'pid');
+    ok(time() - $s->{'updated'} < 10, 'updated');
+    is($s->{'started'}, 1000, 'started');
+    is_deeply($s->{'queue'}, $data{'queue'}, 'queue');
+    is_deeply($s->{'renderers'}, $data{'renderers'}, 'renderers');
+    is_deeply($s->{'maps'}, $data{'maps'}, 'maps');
+    is_deeply($s->{'sources'}, $data{'sources'}, 'sources');
+    is_deeply($s->{'rm'}, $data{'rm'}, 'rendering manager');
+    is_deeply($s->{'workers'}, [], 'no workers');
+
+    my $json = JSON::from_json($reader->read());
+    is($json->{'queue'}->{'size'}, 3, 'read() returns JSON');
+
+    #-------------------------------------------------------------------------
+
+    ok($reader->update_worker(5, renderer => 'mapnik', state => 'rendering', map => 'test', x => 8, y => 16, z => 5, job_started => 123456, rendered => 7, errors => 1, rss => 1024), 'update worker');
+    ok($reader->update_worker(6, renderer => 'mapnik', state => 'idle', rendered => 3), 'update other worker');
+    ok($reader->update_worker(7, renderer => 'mapnik', state => 'idle'), 'update third worker');
+    ok($reader->update_worker(7, state => 'free'), 'free worker slot');
+
+    my $workers = $status->read_workers();
+    is(scalar(@$workers), 2, 'two workers');
+    my $u = $workers->[0]->{'updated'};
+    is_deeply($workers, [
+        { slot => 5, pid => $$, renderer => 'mapnik', state => 'rendering', map => 'test', x => 8, y => 16, z => 5, job_started => 123456, updated => $u, rendered => 7, errors => 1, rss => 1024 },
+        { slot => 6, pid => $$, renderer => 'mapnik', state => 'idle', updated => $workers->[1]->{'updated'}, rendered => 3, errors => 0, rss => 0 },
+    ], 'worker status');
+
+    #-------------------------------------------------------------------------
+
+    # parts that don't fit are left out, but the JSON stays valid
+    {
+        my @warnings;
+        local *main::syslog = sub { push(@warnings, sprintf($_[1], @_[2..$#_])); };
+
+        my %big = %data;
+        $big{'rm'} = { %{$data{'rm'}}, layer_profile => { map { ("layer$_" => 'x' x 100) } 1 .. 1000 }, rendering => [ map { { map => 'test', x => $_, y => 0, z => 10, prio => 1, age => 0 } } 1 .. 300 ] };
+        $status->update(%big);
+        $status->update(%big);
+        my $s = $status->read_status();
+        is_deeply($s->{'rm'}->{'layer_profile'}, {}, 'layer profile left out');
+        is_deeply($s->{'maps'}, $data{'maps'}, 'maps still there');
+        is(scalar(@{$s->{'rm'}->{'rendering'}}), $Tirex::Status::MAX_RENDERING, 'rendering list cut');
+        is_deeply([ sort @warnings ], [
+            'status in shared memory is incomplete: 256 of 300 rendering jobs',
+            'status in shared memory is incomplete: left out layer_profile',
+        ], 'truncation logged once');
+
+        $status->update(%data);
+        is_deeply($status->read_status()->{'rm'}, $data{'rm'}, 'complete again');
+    }
+
+    #-------------------------------------------------------------------------
+
+    # worker re-attaches after master restart
+    undef $status;
+    $status = Tirex::Status->new( master => 1 );
+    $status->update(%data);
+    is(scalar(@{$status->read_workers()}), 0, 'no workers after restart');
+    ok($reader->update_worker(1, renderer => 'mapnik', state => 'idle'), 'update worker after restart');
+    is(scalar(@{$status->read_workers()}), 1, 'worker re-attached');
+
+    $status->destroy();
+    ok(!defined(eval { Tirex::Status->new() }), 'shared memory removed');
+}
+
+
+#-- THE END ------------------------------------------------------------------
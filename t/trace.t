@@ -0,0 +1,62 @@
+#-----------------------------------------------------------------------------
+#
+#  t/trace.t
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use Test::More qw( no_plan );
+
+use File::Temp;
+use JSON::PP;
+
+use lib 'lib';
+
+use Tirex;
+use Tirex::Trace;
+
+#-----------------------------------------------------------------------------
+
+ok(!Tirex::Trace->enabled(), 'tracing off by default');
+
+my $job = Tirex::Job->new( metatile => Tirex::Metatile->new( map => 'test', x => 8, y => 16, z => 5 ), prio => 3 );
+ok(!defined $job->{'trace_queued'}, 'no trace timestamps if tracing is off');
+
+my $dir = File::Temp::tempdir( CLEANUP => 1 );
+my $file = "$dir/trace.json";
+
+Tirex::Trace->open($file);
+ok(Tirex::Trace->enabled(), 'tracing on');
+
+$job = Tirex::Job->new( metatile => Tirex::Metatile->new( map => 'test', x => 8, y => 16, z => 5 ), prio => 3 );
+ok(defined $job->{'trace_queued'}, 'job has queued timestamp');
+
+Tirex::Trace->span('queued', $job, 100.5, 101.75);
+Tirex::Trace->close();
+
+# re-opening an existing file must not add another bracket
+Tirex::Trace->open($file);
+Tirex::Trace->span('notified', $job, 102, 102.25);
+Tirex::Trace->close();
+ok(!Tirex::Trace->enabled(), 'tracing off after close');
+
+open(my $fh, '<', $file) or die;
+my @lines = <$fh>;
+close($fh);
+
+is(scalar(@lines), 3, 'bracket and two events');
+is($lines[0], "[\n", 'opening bracket');
+
+my $events = JSON::PP::decode_json(join('', @lines[0..2]) =~ s/,\n\z/]/r);
+is($events->[0]->{'name'}, 'queued', 'name');
+is($events->[0]->{'ph'}, 'X', 'complete event');
+is($events->[0]->{'ts'}, 100500000, 'start in microseconds');
+is($events->[0]->{'dur'}, 1250000, 'duration in microseconds');
+is($events->[0]->{'args'}->{'id'}, $job->get_id(), 'job id');
+is($events->[0]->{'args'}->{'z'}, 5, 'zoom');
+is($events->[1]->{'name'}, 'notified', 'second event');
+
+
+#-- THE END ------------------------------------------------------------------
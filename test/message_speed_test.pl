@@ -0,0 +1,80 @@
+#!/usr/bin/perl
+#-----------------------------------------------------------------------------
+#
+#  Tirex Tile Rendering System
+#
+#  message_speed_test.pl
+#
+#-----------------------------------------------------------------------------
+#
+#  Tests how fast messages in the text and the binary format can be
+#  written and parsed. This is what the master does for every job: it
+#  writes a request and parses the response. native/msgbench does the
+#  same for the C++ codec used by the mapnik backend.
+#
+#-----------------------------------------------------------------------------
+#
+#  Copyright (C) 2010  Frederik Ramm <frederik.ramm@geofabrik.de> and
+#                      Jochen Topf <jochen.topf@geofabrik.de>
+#  
+#  This program is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU General Public License
+#  as published by the Free Software Foundation; either version 2
+#  of the License, or (at your option) any later version.
+#  
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#  
+#  You should have received a copy of the GNU General Public License
+#  along with this program; If not, see <http://www.gnu.org/licenses/>.
+#
+#-----------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use lib 'lib';
+
+use Tirex;
+
+use Time::HiRes;
+
+#-----------------------------------------------------------------------------
+
+# changes these variables as needed
+
+my $NUMMESSAGES = 200000;
+
+#-----------------------------------------------------------------------------
+
+my $request = Tirex::Message->new( type => 'metatile_render_request', id => '1234567_0', map => 'default', prio => 3, x => 1024, y => 2048, z => 12 );
+my $response = $request->reply();
+$response->{'render_time'} = 1234;
+$response->{'rss'} = 123456;
+
+foreach my $format (qw( text binary ))
+{
+    my $binary = $format eq 'binary';
+
+    my $t0 = [ Time::HiRes::gettimeofday() ];
+    foreach my $n (1 .. $NUMMESSAGES)
+    {
+        my $s = $binary ? $request->serialize_binary() : $request->serialize();
+    }
+    my $write = Time::HiRes::tv_interval($t0);
+
+    my $s = $binary ? $response->serialize_binary() : $response->serialize();
+    $t0 = [ Time::HiRes::gettimeofday() ];
+    foreach my $n (1 .. $NUMMESSAGES)
+    {
+        my $msg = Tirex::parse_msg($s);
+    }
+    my $parse = Time::HiRes::tv_interval($t0);
+
+    printf("%-6s %3d bytes  write: %8.0f msgs/s  parse: %8.0f msgs/s\n", $format, length($s), $NUMMESSAGES / $write, $NUMMESSAGES / $parse);
+}
+
+
+#-- THE END ------------------------------------------------------------------
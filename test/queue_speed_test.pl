@@ -9,6 +9,12 @@
 #
 #  Tests queue filling and emptying speed
 #
+#  Call with argument 'native' to test Tirex::Queue::Native instead of
+#  Tirex::Queue (build it with 'make' in the native directory first).
+#  native/queuebench does the same for the C++ queue without Perl.
+#  Call with argument 'hilbert' or 'morton' to test Tirex::Queue with that
+#  order within priorities.
+#
 #-----------------------------------------------------------------------------
 #
 #  Copyright (C) 2010  Frederik Ramm <frederik.ramm@geofabrik.de> and
@@ -49,7 +55,21 @@ my $MAXPRIO = 3;
 
 #-----------------------------------------------------------------------------
 
-my $q = Tirex::Queue->new();
+my $q;
+if (defined($ARGV[0]) && $ARGV[0] eq 'native')
+{
+    use lib 'native/perl/blib/lib', 'native/perl/blib/arch';
+    require Tirex::Queue::Native;
+    $q = Tirex::Queue::Native->new();
+}
+elsif (defined($ARGV[0]) && $ARGV[0] =~ /^(hilbert|morton)$/)
+{
+    $q = Tirex::Queue->new(order => $ARGV[0]);
+}
+else
+{
+    $q = Tirex::Queue->new();
+}
 
 my $t0 = [ Time::HiRes::gettimeofday() ];
 
@@ -5,6 +5,11 @@
 # 
 # if you are interested in e.g. expiring zoom 12-19 then use the -e9-16
 # flag with osm2pgsql and load the resulting file into this program.
+#
+# for large expire lists use tirex-expire from the native directory, which
+# is much faster and can also delete or enqueue metatiles. It takes the
+# tiles at their real zoom level, so use osm2pgsql -e12-19 instead of
+# -e9-16 with it.
 
 use strict;
 use Tirex::Metatile;